@@ -41,8 +41,12 @@
 #define	API_H
 
 #define API __attribute__((visibility("default")))
-#define IPFIXCOL_API_VERSION_NUMBER 1
+#define IPFIXCOL_API_VERSION_NUMBER 2
 #define IPFIXCOL_API_VERSION unsigned int ipfixcol_api_version API __attribute__((used)) = IPFIXCOL_API_VERSION_NUMBER;
+/* Plugin accepts message views (see message_is_view()), others get materialized messages */
+#define IPFIXCOL_MESSAGE_VIEWS int ipfixcol_message_views API __attribute__((used)) = 1;
+/* Storage plugin can run in more instances (<workers>), they do not share any output (files, sockets...) */
+#define IPFIXCOL_STORAGE_WORKERS int ipfixcol_storage_workers API __attribute__((used)) = 1;
 
 #endif	/* API_H */
 
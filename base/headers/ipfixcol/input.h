@@ -165,6 +165,17 @@ struct __attribute__((__packed__)) input_info_file {
 	char *name;                 /**< name of the input file */
 };
 
+/**
+ * \struct input_packet
+ * \brief One packet passed to the ipfixcol core by get_packet_batch().
+ */
+struct input_packet {
+	struct input_info *info;    /**< information structure of the source */
+	char *packet;               /**< IPFIX packet, NULL when source closed */
+	int length;                 /**< length of the packet or INPUT_CLOSED */
+	int source_status;          /**< status of the source (enum SOURCE_STATUS) */
+};
+
 /**
  * \brief Input plugin initialization function.
  *
@@ -178,6 +189,22 @@ struct __attribute__((__packed__)) input_info_file {
  */
 API int input_init(char *params, void **config);
 
+/**
+ * \brief Input plugin initialization function for parallel receiving.
+ *
+ * This function is optional. When the collector runs more input threads, it
+ * calls this function instead of input_init() once in each input thread and
+ * each thread then calls get_packet() with its own configuration. All instances
+ * receive data on the same local address and port (e.g. using SO_REUSEPORT
+ * sockets) and the plugin MUST ensure that the data of one source (exporter
+ * address, port and ODID) are always passed by the same instance.
+ *
+ * \param[in]  params  String with specific parameters for the input plugin.
+ * \param[out] config  Plugin-specific configuration structure of the instance.
+ * \return 0 on success, nonzero else.
+ */
+API int input_init_parallel(char *params, void **config);
+
 /**
  * \brief Pass input data from the input plugin into the ipfixcol core.
  *
@@ -202,6 +229,23 @@ API int input_init(char *params, void **config);
  */
 API int get_packet(void *config, struct input_info** info, char **packet, int *source_status);
 
+/**
+ * \brief Pass more packets from the input plugin into the ipfixcol core.
+ *
+ * This function is optional. When present, ipfixcol core uses it instead of
+ * get_packet() to receive more packets by one call. Each item of the batch
+ * is the same as the output of the get_packet() function. Memory of the
+ * packets is freed by ipfixcol core.
+ *
+ * \param[in] config  Plugin-specific configuration data prepared by init
+ * function.
+ * \param[out] batch  Array of received packets.
+ * \param[in] max     Size of the batch array.
+ * \return number of packets in the batch (at least 1) on success, INPUT_INTR
+ *  when interrupted by a signal, INPUT_ERROR on error.
+ */
+API int get_packet_batch(void *config, struct input_packet *batch, int max);
+
 /**
  * \brief Input plugin "destructor".
  *
@@ -48,6 +48,14 @@
  * each message will pass all plugins one by one, unless some plugin discards
  * it.
  *
+ * Plugins that read data records only through the message metadata can
+ * declare IPFIXCOL_MESSAGE_VIEWS next to IPFIXCOL_API_VERSION. They may get
+ * message views (see message_create_view()) without sets, other plugins
+ * always get contiguous packets. Records of a view belong to the shared
+ * source packet, so plugins accepting views must never write record bytes
+ * (plugins that modify records must not declare IPFIXCOL_MESSAGE_VIEWS or
+ * have to call message_materialize() first).
+ *
  * @{
  */
 #ifndef IPFIXCOL_INTERMEDIATE_H_
@@ -95,15 +103,43 @@ API int intermediate_close(void *config);
  */
 API int intermediate_process_message(void *config, void *message);
 
+/**
+ * \brief Process more IPFIX messages
+ *
+ * This function is optional. When present, ipfixcol core uses it instead of
+ * intermediate_process_message() to process more messages by one call.
+ * Each message of the batch has to be passed (see "pass_message" and
+ * "pass_messages") or dropped before the function returns.
+ *
+ * \param[in] config
+ * \param[in] messages array of IPFIX messages
+ * \param[in] count number of messages
+ * \return 0 on success, nonzero else.
+ */
+API int intermediate_process_batch(void *config, void **messages, int count);
+
 /**
 * \brief Pass processed IPFIX message to the output queue.
 *
+* Passed messages are written into the output queue when the processing of
+* current message (or batch) is finished.
+*
 * \param[in] config configuration structure
 * \param[in] message IPFIX message
 * \return 0 on success, negative value otherwise
 */
 API int pass_message(void *config, struct ipfix_message *message);
 
+/**
+* \brief Pass more processed IPFIX messages to the output queue.
+*
+* \param[in] config configuration structure
+* \param[in] messages array of IPFIX messages
+* \param[in] count number of messages
+* \return 0 on success, negative value otherwise
+*/
+API int pass_messages(void *config, struct ipfix_message **messages, int count);
+
 /**
 * \brief Drop IPFIX message.
 *
@@ -132,6 +132,39 @@ API uint16_t get_next_data_record_offset(uint8_t *data_record, struct ipfix_temp
  */
 API int message_free(struct ipfix_message *msg);
 
+/**
+ * \brief Allocate memory from the message pool
+ *
+ * The pool recycles memory of IPFIX messages, packets and metadata arrays
+ * in fixed-size slabs with per-thread caches. Input plugins should use it
+ * for packets passed to the collector, the collector releases them by
+ * message_pool_free(). Allocations bigger than the largest size class
+ * (64 KiB) are served by malloc().
+ *
+ * \param[in] size Size of the memory
+ * \return pointer to memory (not initialized), NULL on error
+ */
+API void *message_pool_alloc(size_t size);
+
+/**
+ * \brief Change size of memory allocated from the message pool
+ *
+ * \param[in] ptr Memory from message_pool_alloc(), malloc() or NULL
+ * \param[in] size New size of the memory
+ * \return pointer to memory, NULL on error (the original memory is kept)
+ */
+API void *message_pool_realloc(void *ptr, size_t size);
+
+/**
+ * \brief Release memory to the message pool
+ *
+ * Memory that does not belong to the pool (e.g. packets allocated by
+ * malloc() in input plugins) is passed to free().
+ *
+ * \param[in] ptr Memory to release (can be NULL)
+ */
+API void message_pool_free(void *ptr);
+
 /**
  * \brief Get data from record
  *
@@ -225,6 +258,34 @@ API int data_record_field_next_offset(uint8_t *data_record, struct ipfix_templat
  */
 API int data_record_field_offset(uint8_t *data_record, struct ipfix_template *templ, uint32_t enterprise, uint16_t id, int *data_length);
 
+/**
+ * \brief Get offset of field in data record by its index in template
+ *
+ * The index is obtained by template_get_field_index(), typically once per
+ * template. For fields with a fixed offset (not preceded by a variable-length
+ * field) the offset is resolved in constant time, otherwise by one pass over
+ * the variable-length part of the record. For variable-length fields, the
+ * returned offset does not include the field's length indicators.
+ *
+ * \param[in] data_record Data record
+ * \param[in] templ Data record's template
+ * \param[in] field Field index in template
+ * \param[out] data_length Field length
+ * \return Field offset, negative value when the index is out of range
+ */
+API int data_record_field_offset_at(uint8_t *data_record, struct ipfix_template *templ, int field, int *data_length);
+
+/**
+ * \brief Get data from record by field index in template
+ *
+ * \param[in] record Pointer to data record
+ * \param[in] templ Data record's template
+ * \param[in] field Field index in template (see template_get_field_index())
+ * \param[out] data_length Length of returned data
+ * \return Pointer to field, NULL when the index is out of range
+ */
+API uint8_t *data_record_get_field_at(uint8_t *record, struct ipfix_template *templ, int field, int *data_length);
+
 /**
  * \brief Compute data record's length
  *
@@ -299,6 +360,46 @@ API void message_free_metadata(struct ipfix_message *msg);
  */
 API struct metadata *message_copy_metadata(struct ipfix_message *src);
 
+/**
+ * \brief Create view of IPFIX message
+ *
+ * The view shares the packet of the source message instead of copying it.
+ * It gets its own copy of the packet header (so ODID and sequence number can
+ * be changed) and no sets. The caller fills the metadata with the selected
+ * records (pointing into the source packet) and data_records_count.
+ * The source message is freed after the last view is freed.
+ *
+ * Views are passed only to plugins declaring IPFIXCOL_MESSAGE_VIEWS, others
+ * get the view materialized by message_materialize(). Record bytes of a view
+ * are shared with the source message and all its other views (possibly read
+ * by other threads at the same time), so they must never be written.
+ *
+ * \param[in] src Source IPFIX message
+ * \return new view, NULL on error
+ */
+API struct ipfix_message *message_create_view(struct ipfix_message *src);
+
+/**
+ * \brief Check whether the message is a view without its own packet
+ *
+ * \param[in] msg IPFIX message
+ * \return nonzero for views not materialized yet
+ */
+API int message_is_view(const struct ipfix_message *msg);
+
+/**
+ * \brief Build contiguous packet of a view
+ *
+ * Header, (options) template sets of the source message and the data sets
+ * with the selected records are copied into a new packet and the message
+ * (sets, metadata and template references) is updated to point into it.
+ * Messages that are not views are not changed.
+ *
+ * \param[in,out] msg IPFIX message
+ * \return 0 on success, 1 on error
+ */
+API int message_materialize(struct ipfix_message *msg);
+
 #endif /* IPFIX_MESSAGE_H_ */
 
 /**@}*/
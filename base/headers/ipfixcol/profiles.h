@@ -145,9 +145,12 @@ API void *profile_get_channel(void *profile, uint16_t index);
 /**
  * \brief Match profile with data record
  *
- * Data record is recursively matched with each channel sub-profile
- * Each matching channel is stored into an array
- * Profiles are NOT stored (they're accessible by calling
+ * Data record is matched with all channels of the profile and its
+ * subprofiles. The tree is compiled on the first call: channels are ordered
+ * so that sources precede their listeners and channels with the same filter
+ * expression share one evaluation per record.
+ * Each matching channel is stored into an array (once, parent profiles
+ * first). Profiles are NOT stored (they're accessible by calling
  * channel_get_profile on matched channel)
  *
  * \param[in] profile
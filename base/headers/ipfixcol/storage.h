@@ -134,6 +134,12 @@ struct __attribute__((__packed__)) ipfix_message {
 	void *live_profile;
 	/** List of metadata structures */
 	struct metadata *metadata;
+	/** Number of storage plugins still using the message (internal, aligned for atomic access) */
+	uint32_t references __attribute__((aligned(4)));
+	/** Number of views sharing the packet of the message (internal, aligned for atomic access) */
+	int32_t shares __attribute__((aligned(4)));
+	/** Message whose packet is shared by this view, NULL for ordinary messages */
+	struct ipfix_message *view_source;
 };
 
 /**
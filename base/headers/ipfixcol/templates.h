@@ -103,6 +103,44 @@ struct ipfix_offsets {
 	int bytes;          /**< Size of field */
 };
 
+/**
+ * \def TEMPLATE_FIELD_NONE
+ * \brief Empty slot/end of list marker in the template field index
+ */
+#define TEMPLATE_FIELD_NONE 0xFFFF
+
+/**
+ * \struct ipfix_template_field
+ * \brief Precompiled information about one field of a template
+ */
+struct ipfix_template_field {
+	uint32_t enterprise;    /**< Enterprise number (0 for IANA elements) */
+	uint16_t id;            /**< Information Element ID (without enterprise bit) */
+	uint16_t length;        /**< Length from the template (VAR_IE_LENGTH for variable) */
+	uint16_t row;           /**< Position of the field in template's fields array */
+	uint16_t next;          /**< Index of the next field with the same ID or TEMPLATE_FIELD_NONE */
+	int32_t offset;         /**< Offset in data record, -1 when it follows a variable-length field */
+};
+
+/**
+ * \struct ipfix_template_index
+ * \brief Field index compiled by the template manager when a template is created
+ *
+ * Maps (enterprise, id) to index of the first field with this ID in constant
+ * time. Fields that are not preceded by a variable-length field have a fixed
+ * offset in data records, offsets of the others are computed by one pass
+ * starting at the first variable-length field.
+ */
+struct ipfix_template_index {
+	uint16_t count;         /**< Number of fields */
+	uint16_t first_var;     /**< Index of the first variable-length field (count if none) */
+	uint16_t hash_mask;     /**< Number of hash table slots - 1 */
+	uint32_t serial;        /**< Unique number of the compiled template, a template
+	                         * allocated at the address of a withdrawn one gets a new one */
+	uint16_t *hash;         /**< Hash table of first occurrences of field IDs */
+	struct ipfix_template_field fields[]; /**< Fields in template order */
+};
+
 /**
  * \struct ipfix_template
  * \brief Structure for storing Template Record/Options Template Record
@@ -134,7 +172,10 @@ struct ipfix_template {
 	                              * length of the Data Record has to be
 	                              * calculated somehow else. For more information,
 	                              * see section 7 in RFC 5101. */
-	struct ipfix_offsets offsets[OF_COUNT]; /** Offsets of common elements    */
+	struct ipfix_offsets offsets[OF_COUNT]; /** Offsets of common elements (use the field index instead) */
+	struct ipfix_template_index *index;     /** Field index, NULL when the template was not
+	                                         * created by the template manager. Allocated
+	                                         * together with the template. */
 	template_ie fields[1];       /** Template fields */
 };
 
@@ -143,9 +184,19 @@ struct ipfix_template {
  * \brief Template Manager structure.
  */
 struct ipfix_template_mgr {
-	struct ipfix_template_mgr_record *first; /** list of template manager's record for each source */
-	struct ipfix_template_mgr_record *last;  /** last member of list */
-	pthread_mutex_t tmr_lock;
+	struct ipfix_template_mgr_table *table;   /** open addressing hash table of template manager's
+	                                           * records for each source, read without locking */
+	struct ipfix_template_mgr_table *retired_tables;  /** replaced tables, freed when no reader can use them */
+	struct ipfix_template_mgr_record *retired_records; /** removed records, freed when no reader can use them */
+	uint32_t records;                         /** number of records in the table */
+	uint32_t used;                            /** number of used slots (records and deleted slots) */
+	pthread_mutex_t tmr_lock;                 /** serializes changes of the table */
+
+	uint64_t id;                              /** identifier of the instance */
+	uint64_t epoch;                           /** current epoch, increased by each retirement */
+	struct ipfix_template_mgr_reader *readers; /** epochs of threads reading the table */
+	uint32_t reader_cnt;                      /** number of claimed reader slots */
+	uint32_t shared_readers;                  /** readers without a slot inside of critical section */
 };
 
 /**
@@ -168,8 +219,9 @@ struct ipfix_template_mgr_record {
 	uint16_t counter;       /**< number of templates in array */
 	uint64_t key;           /**< unique identifier (combination of odid and crc from ipfix_template_key) */
 	uint16_t registrations; /**< Number of reservations (from sources) */
+	uint64_t retired;       /**< epoch of removal from the template manager */
 
-	struct ipfix_template_mgr_record *next; /** pointer to next record in template manager's list */
+	struct ipfix_template_mgr_record *next; /** pointer to next retired record */
 };
 
 /**
@@ -260,6 +312,10 @@ API struct ipfix_template *tm_update_template(struct ipfix_template_mgr *tm,
 /**
  * \brief Function for specific Template lookup.
  *
+ * Lock-free, the record of the source is found inside of a reader's critical
+ * section. Records and tables removed meanwhile by other threads are freed
+ * only after all readers that entered before the removal have left.
+ *
  * \param[in]  tm Template Manager
  * \param[in]  key Unique identifier of template in Template Manager
  * \return pointer on the Temaplate on success, NULL if there is no such
@@ -299,6 +355,21 @@ API void tm_remove_all_odid_templates(struct ipfix_template_mgr *tm, uint32_t od
  */
 API struct ipfix_template_mgr *tm_create();
 
+/**
+ * \brief Get index of the first field with given ID in template
+ *
+ * Constant time for templates created by the template manager (using the
+ * precompiled field index), otherwise the template fields are walked. The
+ * index can be used with data_record_get_field_at() and
+ * data_record_field_offset_at().
+ *
+ * \param[in] templ Template
+ * \param[in] enterprise Enterprise number (0 for IANA elements)
+ * \param[in] id Field ID (without enterprise bit)
+ * \return Index of the field, -1 when the template does not contain it
+ */
+API int template_get_field_index(struct ipfix_template *templ, uint32_t enterprise, uint16_t id);
+
 /**
  * \brief Determines whether specific template contains given field and returns
  * the field's offset.
@@ -47,6 +47,7 @@
 
 #include <ipfixcol.h>
 #include "config.h"
+#include "data_manager.h"
 
 #define DEFAULT_STORAGE_PLUGIN "ipfix"
 
@@ -192,7 +193,7 @@ struct plugin_xml_conf_list* get_storage_plugins(xmlNodePtr collector_node, xmlD
 	xmlXPathObjectPtr xpath_obj_expprocnames = NULL, xpath_obj_expproc = NULL,
 			xpath_obj_destinations = NULL, xpath_obj_plugin_desc = NULL;
 	xmlChar *file_format = (xmlChar *) "", *file_format_inter, *plugin_file,
-			*odid, *thread_name, *single_mgr_txt;
+			*odid, *thread_name, *single_mgr_txt, *workers;
 	struct plugin_xml_conf_list* plugins = NULL, *aux_plugin = NULL;
 	char *odidptr;
 	bool single_mgr;
@@ -344,6 +345,20 @@ struct plugin_xml_conf_list* get_storage_plugins(xmlNodePtr collector_node, xmlD
 										}
 									}
 
+									/* number of plugin instances processing the data in parallel */
+									aux_plugin->config.workers = 1;
+									workers = get_children_content(xpath_obj_destinations->nodesetval->nodeTab[k], BAD_CAST "workers");
+									if (workers != NULL) {
+										long workers_cnt = strtol((char*) workers, &odidptr, 10);
+										if (*odidptr != '\0' || workers_cnt < 1 || workers_cnt > DM_MAX_PLUGINS) {
+											MSG_ERROR(msg_module, "workers element '%s' not valid (1-%d); skipping destination...", (char*) workers, DM_MAX_PLUGINS);
+											free(aux_plugin->config.observation_domain_id);
+											free(aux_plugin);
+											break;
+										}
+										aux_plugin->config.workers = workers_cnt;
+									}
+
 									aux_plugin->config.file = (char *) malloc (sizeof(char) *(xmlStrlen (plugin_file) + 1));
 									strncpy_safe(aux_plugin->config.file, (char *) plugin_file, xmlStrlen (plugin_file) + 1);
 
@@ -581,7 +596,7 @@ struct plugin_xml_conf_list* get_intermediate_plugins(xmlDocPtr config, char *in
 	struct plugin_xml_conf_list *last_plugin = NULL;
 	xmlNodePtr node;
 	xmlNodePtr plugin_config_internal;
-	xmlChar *plugin_file = NULL, *thread_name = NULL;
+	xmlChar *plugin_file = NULL, *thread_name = NULL, *fused = NULL;
 	xmlDocPtr xmldata = NULL;
 	uint8_t hit = 0;
 
@@ -696,6 +711,13 @@ struct plugin_xml_conf_list* get_intermediate_plugins(xmlDocPtr config, char *in
 
 		aux_plugin->config.xmldata = xmldata;
 
+		/* check whether plugin should run in the thread of the previous one */
+		fused = xmlGetProp(node, BAD_CAST "fused");
+		if (fused) {
+			aux_plugin->config.fused = !xmlStrcmp(fused, BAD_CAST "yes");
+			xmlFree(fused);
+		}
+
 		if (plugins) {
 			last_plugin->next = aux_plugin;
 		} else {
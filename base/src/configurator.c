@@ -45,6 +45,7 @@
 #include "preprocessor.h"
 #include "intermediate_process.h"
 #include "output_manager.h"
+#include "telemetry.h"
 #include "utils/elements/collection.h"
 
 #include <sys/types.h>
@@ -179,6 +180,7 @@ void config_free_plugin(struct plugin_config *plugin)
 	case PLUGIN_INTER:
 		if (plugin->inter) {
 			if (plugin->inter->in_queue) {
+				telemetry_queue_remove(plugin->inter->in_queue);
 				rbuffer_free(plugin->inter->in_queue);
 			}
 			if (plugin->inter->dll_handler) {
@@ -257,6 +259,13 @@ int config_remove_inter(configurator *config, int index)
 	
 	/* Remove it from startup config */
 	config->startup->inter[index] = NULL;
+
+	if (plugin->inter->fused_head) {
+		/* Plugin runs in the thread of other plugin and has no queues */
+		ip_unfuse(plugin->inter);
+		config_free_plugin(plugin);
+		return 0;
+	}
 	
 	/* Stop plugin */
 	ip_stop(plugin->inter);
@@ -277,6 +286,7 @@ int config_remove_inter(configurator *config, int index)
 	}
 	
 	/* Free plugin and it's queue */
+	telemetry_queue_remove(out_queue);
 	rbuffer_free(out_queue);
 	config_free_plugin(plugin);
 	
@@ -349,12 +359,22 @@ int config_add_input(configurator *config, struct plugin_config *plugin, int ind
 		goto err;
 	}
 	
+	/* Optional, only plugins able to receive in more threads provide it */
+	config->input.init_parallel = dlsym(config->input.dll_handler, "input_init_parallel");
+	if (config->input_threads > 1 && config->input.init_parallel == NULL) {
+		MSG_WARNING(msg_module, "[%d] Input plugin '%s' does not support parallel receiving; using single input thread",
+				config->proc_id, plugin->conf.name);
+	}
+
 	config->input.get = dlsym(config->input.dll_handler, "get_packet");
 	if (!config->input.get) {
 		MSG_ERROR(msg_module, "[%d] Unable to load input xml_conf (%s)", config->proc_id, dlerror());
 		goto err;
 	}
 	
+	/* Optional batch receiving */
+	config->input.get_batch = dlsym(config->input.dll_handler, "get_packet_batch");
+
 	config->input.close = dlsym(config->input.dll_handler, "input_close");
 	if (config->input.close == NULL) {
 		MSG_ERROR(msg_module, "[%d] Unable to load input xml_conf (%s)", config->proc_id, dlerror());
@@ -370,7 +390,12 @@ int config_add_input(configurator *config, struct plugin_config *plugin, int ind
 	/* initialize plugin */
 	xmlChar *plugin_params;
 	xmlDocDumpMemory(plugin->conf.xmldata, &plugin_params, NULL);
-	int retval = config->input.init((char *) plugin_params, &(config->input.config));
+	int retval;
+	if (config->input_threads > 1 && config->input.init_parallel) {
+		retval = config->input.init_parallel((char *) plugin_params, &(config->input.config));
+	} else {
+		retval = config->input.init((char *) plugin_params, &(config->input.config));
+	}
 	xmlFree(plugin_params);
 	
 	if (retval != 0) {
@@ -438,6 +463,13 @@ int config_add_inter(configurator *config, struct plugin_config *plugin, int ind
 		goto err;
 	}
 	
+	/* Optional batch processing function */
+	im_plugin->intermediate_process_batch = dlsym(im_plugin->dll_handler, "intermediate_process_batch");
+
+	/* Optional support of message views */
+	int *views = (int *) dlsym(im_plugin->dll_handler, "ipfixcol_message_views");
+	im_plugin->views = views && *views;
+
 	im_plugin->intermediate_init = dlsym(im_plugin->dll_handler, "intermediate_init");
 	if (im_plugin->intermediate_init == NULL) {
 		MSG_ERROR(msg_module, "Unable to load intermediate xml_conf (%s)", dlerror());
@@ -450,44 +482,59 @@ int config_add_inter(configurator *config, struct plugin_config *plugin, int ind
 		goto err;
 	}
 
-	/* Create new output buffer for plugin */
-	im_plugin->out_queue = rbuffer_init(ring_buffer_size);
-	
-	/* Set input queue */
 	/* Find previous plugin */
+	struct intermediate *prev = NULL;
 	for (int i = index - 1; i >= 0; --i) {
 		/* Found some previous plugin */
 		if (config->startup->inter[i]) {
-			im_plugin->in_queue = config->startup->inter[i]->inter->out_queue;
+			prev = config->startup->inter[i]->inter;
 			break;
 		}
 	}
-	
-	/* No plugin before this one, input == preprocessor's output */
-	if (!im_plugin->in_queue) {
-		im_plugin->in_queue = get_preprocessor_output_queue();
-	}
-	
-	struct ring_buffer *backup_queue;
-	
-	/* Set input queue of next plugin */
-	if (config->startup->inter[index + 1]) {
-		backup_queue = config->startup->inter[index + 1]->inter->in_queue;
-		ip_change_in_queue(config->startup->inter[index + 1]->inter, im_plugin->out_queue);
+
+	if (plugin->conf.fused && prev) {
+		/* Run plugin in the thread of the previous plugin, no queues needed */
+		if (ip_fuse(prev, im_plugin, config->ip_id) != 0) {
+			goto err;
+		}
 	} else {
-		backup_queue = output_manager_get_in_queue();
-		output_manager_set_in_queue(im_plugin->out_queue);
-	}
-	
-	/* Start plugin */
-	if (ip_init(im_plugin, config->ip_id) != 0) {
-		/* Restore queues */
+		if (plugin->conf.fused) {
+			MSG_WARNING(msg_module, "[%d] No previous intermediate plugin to fuse '%s' with", config->proc_id, plugin->conf.name);
+		}
+
+		/* Create new output buffer for plugin */
+		im_plugin->out_queue = rbuffer_init(ring_buffer_size);
+		telemetry_queue_add(im_plugin->thread_name, im_plugin->out_queue);
+		
+		/* Set input queue */
+		if (prev) {
+			im_plugin->in_queue = prev->out_queue;
+		} else {
+			/* No plugin before this one, input == preprocessor's output */
+			im_plugin->in_queue = get_preprocessor_output_queue();
+		}
+		
+		struct ring_buffer *backup_queue;
+		
+		/* Set input queue of next plugin */
 		if (config->startup->inter[index + 1]) {
-			ip_change_in_queue(config->startup->inter[index + 1]->inter, backup_queue);
+			backup_queue = config->startup->inter[index + 1]->inter->in_queue;
+			ip_change_in_queue(config->startup->inter[index + 1]->inter, im_plugin->out_queue);
 		} else {
-			output_manager_set_in_queue(backup_queue);
+			backup_queue = output_manager_get_in_queue();
+			output_manager_set_in_queue(im_plugin->out_queue);
+		}
+		
+		/* Start plugin */
+		if (ip_init(im_plugin, config->ip_id) != 0) {
+			/* Restore queues */
+			if (config->startup->inter[index + 1]) {
+				ip_change_in_queue(config->startup->inter[index + 1]->inter, backup_queue);
+			} else {
+				output_manager_set_in_queue(backup_queue);
+			}
+			goto err;
 		}
-		goto err;
 	}
 	
 	config->ip_id++;
@@ -573,6 +620,19 @@ int config_add_storage(configurator *config, struct plugin_config *plugin, int i
 		MSG_ERROR(msg_module, "[%d] Unable to load storage xml_conf (%s)", config->proc_id, dlerror());
 		goto err;
 	}
+
+	/* Optional support of message views */
+	int *views = (int *) dlsym(st_plugin->dll_handler, "ipfixcol_message_views");
+	st_plugin->views = views && *views;
+
+	/* Instances of most plugins would write the same files, workers must be supported explicitly */
+	int *workers = (int *) dlsym(st_plugin->dll_handler, "ipfixcol_storage_workers");
+	st_plugin->workers = plugin->conf.workers;
+	if (st_plugin->workers > 1 && !(workers && *workers)) {
+		MSG_WARNING(msg_module, "[%d] Storage plugin '%s' does not support workers; starting one instance...",
+				config->proc_id, plugin->conf.name);
+		st_plugin->workers = 1;
+	}
 	
 	/* Set plugin id */
 	st_plugin->id = config->sp_id;
@@ -613,9 +673,10 @@ err:
  */
 int config_compare_xml(struct plugin_xml_conf *first, struct plugin_xml_conf *second)
 {
-	/* Compare plugin name, file path and ODID */
+	/* Compare plugin name, file path and number of workers */
 	if (   strcmp(first->file, second->file)
-		|| strcmp(first->name, second->name)) {
+		|| strcmp(first->name, second->name)
+		|| first->workers != second->workers) {
 		return 1;
 	}
 	
@@ -729,6 +790,81 @@ int config_add(configurator *config, struct plugin_config *plugin, int index, in
 	return 0;
 }
 
+/**
+ * \brief Check whether old or new intermediate plugins run fused
+ *
+ * \param[in] old_plugins array of actually used plugins
+ * \param[in] new_plugins array of new configurations
+ * \return true when some plugin shares thread with other one
+ */
+static bool config_inter_fused(struct plugin_config *old_plugins[], struct plugin_config *new_plugins[])
+{
+	int i;
+
+	for (i = 0; old_plugins[i]; ++i) {
+		if (old_plugins[i]->inter->fused_head || old_plugins[i]->inter->fused_next) {
+			return true;
+		}
+	}
+
+	for (i = 0; new_plugins[i]; ++i) {
+		if (new_plugins[i]->conf.fused) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * \brief Process changes in fused intermediate plugins
+ *
+ * Plugins sharing a thread cannot be moved one by one, so any change restarts
+ * all intermediate plugins. They are removed from the last one, thus fused
+ * plugins are always removed before the plugin owning the thread.
+ *
+ * \param[in] config configurator
+ * \param[in] old_plugins array of actually used plugins
+ * \param[in] new_plugins array of new configurations
+ * \return 0 on success
+ */
+static int config_process_fused_changes(configurator *config, struct plugin_config *old_plugins[], struct plugin_config *new_plugins[])
+{
+	int plugs = 0, old_plugs = 0, i, j;
+
+	while (old_plugins[old_plugs]) old_plugs++;
+	while (new_plugins[plugs]) plugs++;
+
+	/* Check whether anything changed */
+	for (i = 0; i < old_plugs && i < plugs; ++i) {
+		if (strcmp(old_plugins[i]->conf.name, new_plugins[i]->conf.name)
+				|| old_plugins[i]->conf.fused != new_plugins[i]->conf.fused
+				|| config_compare_xml(&(old_plugins[i]->conf), &(new_plugins[i]->conf)) != 0) {
+			break;
+		}
+	}
+
+	if (i == old_plugs && i == plugs) {
+		return 0;
+	}
+
+	MSG_INFO(msg_module, "[%d] Restarting fused intermediate plugins", config->proc_id);
+
+	for (i = old_plugs - 1; i >= 0; --i) {
+		config_remove(config, i, PLUGIN_INTER);
+	}
+
+	for (j = 0; j < plugs; ++j) {
+		if (config_add(config, new_plugins[j], j, PLUGIN_INTER) != 0) {
+			return 1;
+		}
+
+		new_plugins[j] = NULL;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Process changes in plugins
  * 
@@ -741,6 +877,10 @@ int config_add(configurator *config, struct plugin_config *plugin, int index, in
 int config_process_changes(configurator *config, struct plugin_config *old_plugins[], struct plugin_config *new_plugins[], int type)
 {
 	int plugs = 0, old_plugs = 0, found, i, j;
+
+	if (type == PLUGIN_INTER && config_inter_fused(old_plugins, new_plugins)) {
+		return config_process_fused_changes(config, old_plugins, new_plugins);
+	}
 	
 	/* Get number of plugins in configurations */
 	while (old_plugins[old_plugs]) old_plugs++;
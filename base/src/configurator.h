@@ -95,6 +95,7 @@ typedef struct ipfix_config {
 	time_t profiles_file_tstamp;	/**< Timestamp of the profiles file */
 	int current_profiles;			/**< Current profiles configuration */
 	struct input input;             /**< Input plugin */
+	int input_threads;              /**< Number of input threads */
 	startup_config *startup;        /**< parser startup file */
 	char process_name[16];          /**< process name */
 	int proc_id;                    /**< process ID */
@@ -47,6 +47,7 @@
 #include <ipfixcol/storage.h>
 #include "configurator.h"
 #include "data_manager.h"
+#include "telemetry.h"
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "data manager";
@@ -54,6 +55,29 @@ static char *msg_module = "data manager";
 /** Ring buffer size */
 extern int ring_buffer_size;
 
+/**
+ * \brief Close storage plugin instance and free its structures
+ *
+ * @param plugin Storage plugin instance
+ */
+static void data_manager_free_plugin(struct storage *plugin)
+{
+	if (plugin->dll_handler) {
+		plugin->close(&(plugin->config));
+	}
+
+	if (plugin->thread_config) {
+		if (plugin->thread_config->queue) {
+			telemetry_queue_remove(plugin->thread_config->queue);
+			rbuffer_free(plugin->thread_config->queue);
+		}
+
+		free(plugin->thread_config);
+	}
+
+	free(plugin);
+}
+
 /**
  * \brief Deallocate Data manager's configuration structure.
  *
@@ -65,24 +89,9 @@ static inline void data_manager_free (struct data_manager_config* config)
 	
 	if (config) {
 		for (i = 0; i < config->plugins_count; ++i) {
-			if (config->storage_plugins[i]) {
-				/* Close & free plugin */
-				if (config->storage_plugins[i]->dll_handler) {
-					config->storage_plugins[i]->close(&(config->storage_plugins[i]->config));
-				}
-				
-				if (config->storage_plugins[i]->thread_config) {
-					free(config->storage_plugins[i]->thread_config);
-				}
-				
-				free(config->storage_plugins[i]);
-				config->storage_plugins[i] = NULL;
-			}
-		}
-		
-		/* Free store queue */
-		if (config->store_queue) {
-			rbuffer_free(config->store_queue);
+			/* Close & free plugin */
+			data_manager_free_plugin(config->storage_plugins[i]);
+			config->storage_plugins[i] = NULL;
 		}
 		
 		/* Free DM config */
@@ -90,144 +99,223 @@ static inline void data_manager_free (struct data_manager_config* config)
 	}
 }
 
+/**
+ * \brief Release message processed by storage plugin
+ *
+ * Message is shared by all storage plugins of the Data Manager, the last one
+ * frees it.
+ *
+ * @param msg IPFIX message
+ */
+static inline void data_manager_release_message(struct ipfix_message *msg)
+{
+	if (__atomic_sub_fetch(&(msg->references), 1, __ATOMIC_ACQ_REL) == 0) {
+		rbuffer_free_message(msg);
+	}
+}
+
+/**
+ * \brief Release messages left in the queue of a terminated storage plugin
+ *
+ * Messages written after the NULL message are not processed by the plugin.
+ *
+ * @param queue Queue of the storage plugin instance
+ */
+static void data_manager_drain_queue(struct ring_buffer *queue)
+{
+	struct ipfix_message *msg;
+	unsigned int index;
+
+	while (rbuffer_count(queue) > 0) {
+		index = -1;
+		msg = rbuffer_read(queue, &index);
+		rbuffer_remove_reference(queue, index, 0);
+		if (msg) {
+			data_manager_release_message(msg);
+		}
+	}
+}
+
 /**
  * \brief Thread for storage plugin
  */
 static void* storage_plugin_thread(void *cfg)
 {
-    struct storage *config = (struct storage*) cfg; 
-	struct ipfix_message *msg, *starting_msg = NULL;
-	int can_read = 0, stop = 0;
-	unsigned int index = config->thread_config->queue->read_offset;
+	struct storage *config = (struct storage*) cfg; 
+	struct ring_buffer *queue = config->thread_config->queue;
+	struct ipfix_message *msg;
+	struct telemetry_stage *stage;
+	unsigned int index;
+	uint64_t start = 0;
 
 	/* set the thread name to reflect the configuration */
 	prctl(PR_SET_NAME, config->thread_name, 0, 0, 0);
+	stage = telemetry_stage_create(config->thread_name);
 
-    /* loop will break upon receiving NULL from buffer */
-	while (!stop) {
+	/* loop will break upon receiving NULL from buffer */
+	while (1) {
 		/* get next data */
-		msg = rbuffer_read(config->thread_config->queue, &index);
+		index = -1;
+		msg = rbuffer_read(queue, &index);
 		if (msg == NULL) {
+			rbuffer_remove_reference(queue, index, 0);
 			MSG_INFO("storage plugin thread", "[%u] No more data from Data Manager", config->odid);
-            break;
-		}
-		
-		/* Decode message type */
-		switch (msg->plugin_status) {
-		case PLUGIN_STOP: /* Stop working */
-			if (msg->plugin_id == config->id) {
-				stop = 1;
-			}
-			rbuffer_remove_reference(config->thread_config->queue, index, 1);
-			break;
-		case PLUGIN_START: /* Start reading */
-			if (msg->plugin_id == config->id) {
-				can_read = 1;
-				if (starting_msg) {
-					free(starting_msg);
-				}
-
-				starting_msg = msg;
-				rbuffer_remove_reference(config->thread_config->queue, index, 0);
-			}
-			break;
-		default: /* DATA */
-			if (can_read) {
-				config->store(config->config, msg, config->thread_config->template_mgr);
-				rbuffer_remove_reference(config->thread_config->queue, index, 1);
-			}
 			break;
 		}
 
-		/* move the index */
-		index = (index + 1) % config->thread_config->queue->size;
-	}
+		if (stage) {
+			start = telemetry_now();
+		}
 
-	if (starting_msg) {
-		free(starting_msg);
+		config->store(config->config, msg, config->thread_config->template_mgr);
+		telemetry_stage_add(stage, start, 1, msg->data_records_count);
+
+		rbuffer_remove_reference(queue, index, 0);
+		data_manager_release_message(msg);
 	}
 
 	MSG_INFO("storage plugin thread", "[%u] Closing storage plugin thread", config->odid);
+	telemetry_stage_release(stage);
 	return (NULL);
 }
 
 /**
- * \brief Add storage plugin instance
+ * \brief Start one instance (worker) of the storage plugin
+ *
+ * The instance is not added to the Data Manager, see data_manager_add_plugin().
+ *
+ * @param config Data Manager's config
+ * @param plugin Plugin's configuration
+ * @param worker Index of the worker in the pool
+ * @return Instance or NULL on error
  */
-int data_manager_add_plugin(struct data_manager_config *config, struct storage *plugin)
+static struct storage *data_manager_start_plugin(struct data_manager_config *config, struct storage *plugin, int worker)
 {
-	int retval = 0, name_len;
+	int retval, name_len;
 	xmlChar *plugin_params;
-	
-	/* Check ODID */
-	if ((plugin->xml_conf->observation_domain_id != NULL && /* OID set and does not match */
-		atol(plugin->xml_conf->observation_domain_id) != config->observation_domain_id) ||
-		(plugin->xml_conf->observation_domain_id == NULL && /* OID not set, but specific plugin(s) found*/
-		config->oid_specific_plugins > 0)) {
-			
-		/* skip storage plugin */
-		return 0;
-	}
+	struct storage *instance;
+	struct storage_thread_conf *plugin_cfg;
 
-	/* Allocate space */
-	if (!config->storage_plugins[config->plugins_count]) {
-		config->storage_plugins[config->plugins_count] = calloc(1, sizeof(struct storage));
-		if (!config->storage_plugins[config->plugins_count]) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			return 1;
-		}
-	}
-	
 	/* Copy plugin data */
-	memcpy(config->storage_plugins[config->plugins_count], plugin, sizeof(struct storage));
-	plugin = config->storage_plugins[config->plugins_count];
-	
+	instance = calloc(1, sizeof(struct storage));
+	if (!instance) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	memcpy(instance, plugin, sizeof(struct storage));
+	instance->config = NULL;
+	instance->thread_config = NULL;
+	instance->worker = worker;
+
 	/* Initiate storage plugin */
-	xmlDocDumpMemory(plugin->xml_conf->xmldata, &plugin_params, NULL);
-	retval = plugin->init((char*) plugin_params, &(plugin->config));
+	xmlDocDumpMemory(instance->xml_conf->xmldata, &plugin_params, NULL);
+	retval = instance->init((char*) plugin_params, &(instance->config));
 	xmlFree(plugin_params);
 	
 	if (retval != 0) {
 		MSG_WARNING(msg_module, "[%u] Storage plugin initialization failed", config->observation_domain_id);
-		free(config->storage_plugins[config->plugins_count]);
-		return 0;
+		free(instance);
+		return NULL;
 	}
 	
-	/* Create storage plugin thread */
-	struct storage_thread_conf *plugin_cfg = calloc(1, sizeof(struct storage_thread_conf));
+	/* Create storage plugin thread with its own input queue */
+	plugin_cfg = calloc(1, sizeof(struct storage_thread_conf));
 	if (!plugin_cfg) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		plugin->close (&(plugin->config));
-		return 0;
+		instance->close(&(instance->config));
+		free(instance);
+		return NULL;
 	}
-	
-	/* Set plugin's input queue */
-	plugin_cfg->queue = config->store_queue;
-	plugin->thread_config = plugin_cfg;
-	plugin->odid = config->observation_domain_id;
+
+	instance->thread_config = plugin_cfg;
+	plugin_cfg->queue = rbuffer_init(ring_buffer_size);
+	if (!plugin_cfg->queue) {
+		MSG_ERROR(msg_module, "Unable to initiate queue for communication with storage plugin");
+		data_manager_free_plugin(instance);
+		return NULL;
+	}
+
+	instance->odid = config->observation_domain_id;
 	
 	/* Set thread name */
-	name_len = strlen(plugin->thread_name);
-	snprintf(plugin->thread_name + name_len, 16 - name_len, " %d", config->observation_domain_id);
+	name_len = strlen(instance->thread_name);
+	if (plugin->workers > 1) {
+		snprintf(instance->thread_name + name_len, 16 - name_len, " %d.%d", config->observation_domain_id, worker);
+	} else {
+		snprintf(instance->thread_name + name_len, 16 - name_len, " %d", config->observation_domain_id);
+	}
 	
+	telemetry_queue_add(instance->thread_name, plugin_cfg->queue);
+
 	/* Create thread */
-	if (pthread_create(&(plugin_cfg->thread_id), NULL, &storage_plugin_thread, (void*) plugin) != 0) {
+	if (pthread_create(&(plugin_cfg->thread_id), NULL, &storage_plugin_thread, (void*) instance) != 0) {
 		MSG_ERROR(msg_module, "Unable to create storage plugin thread");
-		plugin->close(&(plugin->config));
-		free(plugin_cfg);
-		plugin->thread_config = NULL;
+		data_manager_free_plugin(instance);
+		return NULL;
+	}
+
+	return instance;
+}
+
+/**
+ * \brief Stop storage plugin instance
+ *
+ * All messages in its queue are processed first.
+ *
+ * @param plugin Storage plugin instance
+ */
+static void data_manager_stop_plugin(struct storage *plugin)
+{
+	rbuffer_write(plugin->thread_config->queue, NULL, 1);
+	pthread_join(plugin->thread_config->thread_id, NULL);
+	data_manager_drain_queue(plugin->thread_config->queue);
+}
+
+/**
+ * \brief Add storage plugin instance
+ */
+int data_manager_add_plugin(struct data_manager_config *config, struct storage *plugin)
+{
+	int i, workers;
+	struct storage *pool[DM_MAX_PLUGINS];
+
+	/* Check ODID */
+	if ((plugin->xml_conf->observation_domain_id != NULL && /* OID set and does not match */
+		atol(plugin->xml_conf->observation_domain_id) != config->observation_domain_id) ||
+		(plugin->xml_conf->observation_domain_id == NULL && /* OID not set, but specific plugin(s) found*/
+		config->oid_specific_plugins > 0)) {
+			
+		/* skip storage plugin */
 		return 0;
 	}
-	
-	/* Create START message */
-	struct ipfix_message *msg = calloc(1, sizeof(struct ipfix_message));
-	msg->plugin_status = PLUGIN_START;
-	msg->plugin_id = plugin->id;
-
-	/* Start plugin */
-	config->plugins_count++;
-	rbuffer_write(config->store_queue, msg, 1);
-	
+
+	/* Start pool of plugin instances */
+	workers = plugin->workers > 1 ? plugin->workers : 1;
+	if (workers > DM_MAX_PLUGINS - (int) config->plugins_count) {
+		MSG_ERROR(msg_module, "[%u] Too many storage plugin instances", config->observation_domain_id);
+		workers = DM_MAX_PLUGINS - config->plugins_count;
+	}
+
+	for (i = 0; i < workers; ++i) {
+		if ((pool[i] = data_manager_start_plugin(config, plugin, i)) == NULL) {
+			break;
+		}
+	}
+
+	/* Messages are distributed by the number of running workers */
+	if (i > 0 && i < workers) {
+		MSG_WARNING(msg_module, "[%u] Only %d of %d storage plugin workers started", config->observation_domain_id, i, workers);
+	}
+
+	/* Publish the pool once the number of its workers is known */
+	workers = i;
+	for (i = 0; i < workers; ++i) {
+		pool[i]->workers = workers;
+		config->storage_plugins[config->plugins_count + i] = pool[i];
+	}
+	config->plugins_count += workers;
+
 	return 0;
 }
 
@@ -236,34 +324,99 @@ int data_manager_add_plugin(struct data_manager_config *config, struct storage *
  */
 int data_manager_remove_plugin(struct data_manager_config* config, int id)
 {
-	unsigned int i;
+	unsigned int i, count = 0;
 	struct storage *plugin = NULL;
 	
-	/* Find plugin */
+	/* Stop all instances of the plugin, keep the rest of the array packed */
 	for (i = 0; i < config->plugins_count; ++i) {
-		if (config->storage_plugins[i] && config->storage_plugins[i]->id == id) {
-			/* Remove from array */
-			plugin = config->storage_plugins[i];
-			config->storage_plugins[i] = NULL;
-			break;
+		plugin = config->storage_plugins[i];
+		if (plugin->id != id) {
+			config->storage_plugins[count++] = plugin;
+			continue;
 		}
-	}
-	
-	if (plugin) {
-		/* Create STOP message */
-		struct ipfix_message *msg = calloc(1, sizeof(struct ipfix_message));
-		msg->plugin_status = PLUGIN_STOP;
-		msg->plugin_id = plugin->id;
-		
+
 		/* Wait for plugin termination */
-		rbuffer_write(config->store_queue, msg, config->plugins_count);
-		pthread_join(plugin->thread_config->thread_id, NULL);
-		config->plugins_count--;
+		data_manager_stop_plugin(plugin);
+		data_manager_free_plugin(plugin);
 	}
+
+	for (i = count; i < config->plugins_count; ++i) {
+		config->storage_plugins[i] = NULL;
+	}
+	config->plugins_count = count;
 	
 	return 0;
 }
 
+/**
+ * \brief Pass message to storage plugins
+ */
+int data_manager_store(struct data_manager_config *config, struct ipfix_message *msg)
+{
+	unsigned int i, targets = 0;
+	struct storage *plugin;
+	struct storage *target[DM_MAX_PLUGINS];
+	uint32_t hash;
+
+	/* Messages of one source are always stored by the same worker */
+	hash = (uint32_t) (((uintptr_t) msg->input_info >> 4) * 2654435761U);
+
+	for (i = 0; i < config->plugins_count; ++i) {
+		plugin = config->storage_plugins[i];
+		if (plugin->workers > 1 && (hash >> 16) % plugin->workers != (unsigned int) plugin->worker) {
+			continue;
+		}
+
+		target[targets++] = plugin;
+	}
+
+	if (targets == 0) {
+		rbuffer_free_message(msg);
+		return 0;
+	}
+
+	/* Views are shared by plugins, materialize them before the first one gets it */
+	if (message_is_view(msg)) {
+		for (i = 0; i < targets; ++i) {
+			if (!target[i]->views) {
+				message_materialize(msg);
+				break;
+			}
+		}
+	}
+
+	/* Set all references before first plugin can release the message */
+	msg->references = targets;
+
+	for (i = 0; i < targets; ++i) {
+		if (rbuffer_write(target[i]->thread_config->queue, msg, 1) != 0) {
+			MSG_WARNING(msg_module, "[%u] Unable to write into storage plugin queue", config->observation_domain_id);
+			data_manager_release_message(msg);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Get utilization of the fullest queue of storage plugins
+ */
+void data_manager_queue_usage(struct data_manager_config *config, unsigned int *count, unsigned int *size)
+{
+	unsigned int i, aux;
+
+	*count = 0;
+	*size = 0;
+
+	for (i = 0; i < config->plugins_count; ++i) {
+		aux = rbuffer_count(config->storage_plugins[i]->thread_config->queue);
+		if (aux >= *count) {
+			*count = aux;
+			*size = config->storage_plugins[i]->thread_config->queue->size;
+		}
+	}
+}
+
 /**
  * \brief Close Data manager specified by its configuration
  *
@@ -274,16 +427,18 @@ void data_manager_close (struct data_manager_config **config)
 	unsigned int i;
 
 	/* close all storage plugins */
-	rbuffer_write ((*config)->store_queue, NULL, (*config)->plugins_count);
 	for (i = 0; i < (*config)->plugins_count; ++i) {
-		if ((*config)->storage_plugins[i]) {
-			pthread_join((*config)->storage_plugins[i]->thread_config->thread_id, NULL);
-		}
+		rbuffer_write((*config)->storage_plugins[i]->thread_config->queue, NULL, 1);
+	}
+
+	for (i = 0; i < (*config)->plugins_count; ++i) {
+		pthread_join((*config)->storage_plugins[i]->thread_config->thread_id, NULL);
+		data_manager_drain_queue((*config)->storage_plugins[i]->thread_config->queue);
 	}
 
 	/* deallocate config structure */
-    data_manager_free(*config);
-    *config = NULL;
+	data_manager_free(*config);
+	*config = NULL;
 }
 
 /**
@@ -301,13 +456,6 @@ struct data_manager_config *data_manager_create(uint32_t observation_domain_id,
 		return (NULL);
 	}
 
-	/* initiate queue to communicate with storage plugins' threads */
-	config->store_queue = rbuffer_init(ring_buffer_size);
-	if (config->store_queue == NULL) {
-		MSG_ERROR(msg_module, "Unable to initiate queue for communication with storage plugins");
-		goto err;
-	}
-
 	config->observation_domain_id = observation_domain_id;
 
 	/* check whether there is OID specific plugin for this OID */
@@ -49,20 +49,27 @@
 #include "queues.h"
 #include "preprocessor.h"
 
+/** Maximal number of storage plugin instances (workers) in one data manager */
+#define DM_MAX_PLUGINS 64
+
 /**
  * \brief Data manager configuration
  *
  * Contains all configuration of data manager. Works as list of configurations.
  * List of data manager configurations is mantained by preprocessor which
  * decides what data manager should get the message.
+ *
+ * Each storage plugin instance has its own input queue, so a slow plugin
+ * does not block the others until its queue is full. Messages are shared
+ * by all instances and freed by the last one.
  */
 struct data_manager_config {
 	uint32_t observation_domain_id;     /**< DM accepts messages from this ODID */
 	uint32_t references;                /**< Number of data sources working with this DM */
-	unsigned int plugins_count;         /**< Number of running storage plugins */
-	struct ring_buffer *store_queue;    /**< Input queue for storage plugins */
-	struct storage *storage_plugins[8]; /**< Storage plugins */
+	unsigned int plugins_count;         /**< Number of running storage plugin instances */
+	struct storage *storage_plugins[DM_MAX_PLUGINS]; /**< Storage plugin instances */
 	struct data_manager_config *next;   /**< Next DM */
+	struct data_manager_config *hash_next; /**< Next DM in the same bucket of ODID map */
 	int oid_specific_plugins;           /**< Number of ODID specific plugins */
 };
 
@@ -86,6 +93,8 @@ void data_manager_close (struct data_manager_config **config);
 /**
  * \brief Add new storage plugin
  * 
+ * Messages must not be stored into the Data Manager meanwhile.
+ * 
  * @param config Data Manager's config
  * @param plugin Plugin's configuration
  * @return 0 on success
@@ -95,10 +104,34 @@ int data_manager_add_plugin(struct data_manager_config *config, struct storage *
 /**
  * \brief Remove storage plugin
  * 
+ * Messages must not be stored into the Data Manager meanwhile.
+ * 
  * @param config Data Manager's config
  * @param id Plugin's id
  * @return 0 on success
  */
 int data_manager_remove_plugin(struct data_manager_config *config, int id);
 
+/**
+ * \brief Pass message to storage plugins
+ *
+ * Message is written into the queue of each storage plugin (or one worker
+ * of the plugin's pool selected by message source). Memory is freed when
+ * all of them are done with the message.
+ *
+ * @param config Data Manager's config
+ * @param msg IPFIX message
+ * @return 0 on success
+ */
+int data_manager_store(struct data_manager_config *config, struct ipfix_message *msg);
+
+/**
+ * \brief Get utilization of the fullest queue of storage plugins
+ *
+ * @param[in] config Data Manager's config
+ * @param[out] count Number of messages in the queue
+ * @param[out] size Size of the queue
+ */
+void data_manager_queue_usage(struct data_manager_config *config, unsigned int *count, unsigned int *size);
+
 #endif /* DATA_MANAGER_H_ */
@@ -62,6 +62,8 @@
 #include <libxml/tree.h>
 #include <time.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 
 #include <ipfixcol.h>
 #include "convert.h"
@@ -74,20 +76,19 @@
 #	define DEFAULT_SERVER_CERT_FILE "/etc/ssl/certs/collector.crt"
 #	define DEFAULT_SERVER_PKEY_FILE "/etc/ssl/private/collector.key"
 #	define DEFAULT_CA_FILE          "/etc/ssl/private/ca.crt"
-#	define DEFAULT_SIZE_SSL_LIST 100
 #endif
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
 
-/* input buffer length */
+/* initial length of the reassembly buffer of a connection */
 #define BUFF_LEN 10000
 /* default port for tcp collector */
 #define DEFAULT_PORT "4739"
 /* backlog for tcp connections */
 #define BACKLOG SOMAXCONN
-/* initial size of array of socket addresses */
-#define ADDR_ARRAY_INITIAL_SIZE 50
+/* maximal number of events returned by one epoll_wait call */
+#define MAX_EPOLL_EVENTS 64
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "TCP input";
@@ -101,15 +102,15 @@ static char *msg_module = "TCP input";
  * structure is filled during init and used to initialize new input info
  * structures for new connections.
  *
- * When connection is accepted, new input_info_list
- * is created and added to global list. This input info does not have ODID filled yet.
- * After data is received for this input info (based on source address and port),
- * ODID is filled in. Any other ODID from this source will create new input info as
- * a copy of the existing one with new ODID and zeroed counters.
+ * When connection is accepted, new input_info_list is created and added to
+ * the list of the connection. This input info does not have ODID filled yet.
+ * After data is received on the connection, ODID is filled in. Any other ODID
+ * from this connection will create new input info as a copy of the existing
+ * one with new ODID and zeroed counters.
  *
- * When input is closed, one of the input infos is selected and returned together
- * with INPUT_CLOSED code. Others for the same source have their status changed to CLOSED
- * and are returned in subsequent calls to get_packet.
+ * When connection is closed, all its input infos are moved to the list of
+ * closed infos and they are returned one by one together with INPUT_CLOSED code
+ * in subsequent calls to get_packet.
  *
  * When input is closed without any data being received, it is not reported to
  * the rest of the collector, but it is silently discarded.
@@ -124,197 +125,104 @@ struct input_info_list {
 #endif
 };
 
+/**
+ * \struct tcp_connection
+ * \brief  Connection of one exporter
+ *
+ * Data are read from the (non-blocking) socket into the reassembly buffer as
+ * long as they are available. Complete IPFIX messages are then copied out of
+ * the buffer and passed to the collector.
+ */
+struct tcp_connection {
+	int socket;                      /**< connection socket */
+	struct sockaddr_in6 address;     /**< address of the exporter */
+	struct input_info_list *infos;   /**< input infos of the connection (one per ODID) */
+	char *buffer;                    /**< reassembly buffer */
+	uint32_t buffer_size;            /**< size of the reassembly buffer */
+	uint32_t start;                  /**< start of unprocessed data in the buffer */
+	uint32_t end;                    /**< end of received data in the buffer */
+	bool ready;                      /**< connection is in the ready queue */
+	struct tcp_connection *ready_next; /**< next connection in the ready queue */
+	struct tcp_connection *prev;     /**< previous connection in the list of connections */
+	struct tcp_connection *next;     /**< next connection in the list of connections */
+#ifdef TLS_SUPPORT
+	SSL *ssl;                        /**< TLS connection */
+#endif
+};
+
 /**
  * \struct plugin_conf
  * \brief  Plugin configuration structure passed by the collector
  */
 struct plugin_conf {
 	int socket; /**< listening socket */
+	int epollfd; /**< epoll instance with all connections (edge triggered) */
 	struct input_info_network info; /**< basic information structure */
-	fd_set master; /**< set of all active sockets */
-	int fd_max; /**< max file descriptor number */
-	struct sockaddr_in6 **sock_addresses; /*< array of addresses indexed by sockets */
-	uint16_t sock_addresses_max;
-	struct input_info_list *info_list; /**< list of information structures
-										* passed to collector */
+	pthread_t listen_thread; /**< thread accepting new connections */
+	pthread_mutex_t mutex; /**< protects the list of connections */
+	struct tcp_connection *connections; /**< all open connections */
+	struct tcp_connection *ready_head; /**< connections that may have data to read */
+	struct tcp_connection *ready_tail; /**< last connection in the ready queue */
+	struct input_info_list *closed_list; /**< infos of closed connections to be reported */
 	struct input_info_list *used_info_list; /**< list of old input infos to be deleted */
-	int info_to_remove; /**< Number of closed input info structures */
 #ifdef TLS_SUPPORT
 	uint8_t tls;                  /**< TLS enabled? 0 = no, 1 = yes */
 	SSL_CTX *ctx;                 /**< CTX structure */
-	SSL **ssl_list;               /**< list of all SSL structures */
-	uint16_t ssl_list_size;       /**< number of SSL structures in the list */
 	char *ca_cert_file;           /**< CA certificate in PEM format */
 	char *server_cert_file;       /**< server's certifikate in PEM format */
 	char *server_pkey_file;       /**< server's private key */
 #endif
 };
 
-#ifdef TLS_SUPPORT
-/* auxiliary structure for error handling */
-struct cleanup {
-	struct sockaddr_in6 *address;
-	SSL *ssl;
-	X509 *peer_cert;
-} maid;
-#endif
-
-pthread_mutex_t mutex;
-pthread_t listen_thread;
-
 /**
- * \brief Free address variable on input_listen exit
+ * \brief Convert address of the exporter to string
  *
- * \param[in] address Address to free on exit
- * \return void
+ * \param[in] address Address of the exporter
+ * \param[out] buff Output buffer (at least INET6_ADDRSTRLEN bytes)
+ * \return buff
  */
-void input_listen_cleanup(void *address)
+static char *tcp_address_str(struct sockaddr_in6 *address, char *buff)
 {
-	if (address != NULL) {
-		free(address);
+	if (address->sin6_family == AF_INET) {
+		inet_ntop(AF_INET, &((struct sockaddr_in*) address)->sin_addr, buff, INET6_ADDRSTRLEN);
+	} else {
+		inet_ntop(AF_INET6, &address->sin6_addr, buff, INET6_ADDRSTRLEN);
 	}
+
+	return buff;
 }
 
-#ifdef TLS_SUPPORT
 /**
- * \brief Free TLS related things when TLS connection fails from some reason
+ * \brief Free input info structure
  *
- * \param[in] config  plugin configuration structure
- * \param[in] maid  structure containing all pointers to free
- * \return  nothing
+ * \param info Input info list structure
  */
-void input_listen_tls_cleanup(void *config, struct cleanup *maid)
+static void free_input_info(struct input_info_list *info)
 {
-	struct plugin_conf *conf;
-	int fd;
-	int ret;
-
-	conf = (struct plugin_conf *) config;
-
-	/* TLS enabled? */
-	if (conf->tls) {
-		if (maid->address != NULL) {
-			free(maid->address);
-		}
-
-		if (maid->ssl != NULL) {
-			fd = SSL_get_fd(maid->ssl);
-			if (fd >=0) {
-				/* TLS shutdown */
-				ret = SSL_shutdown(maid->ssl);
-				if (ret == -1) {
-					MSG_WARNING(msg_module, "Error during TLS connection teardown");
-				}
-			}
-			SSL_free(maid->ssl);
-		}
-
-		if (maid->peer_cert != NULL) {
-			X509_free(maid->peer_cert);
-		}
+#ifdef TLS_SUPPORT
+	if (info->exporter_cert != NULL) {
+		X509_free(info->exporter_cert);
 	}
-}
 #endif
-
-/**
- * \brief Resizes socket addresses storage
- * \param conf plugin configuration
- * \return true on success
- */
-bool enlarge_sock_addresses(struct plugin_conf *conf)
-{
-	uint16_t old_max = conf->sock_addresses_max;
-	conf->sock_addresses_max += ADDR_ARRAY_INITIAL_SIZE;
-
-	struct sockaddr_in6 **new_addresses = realloc(conf->sock_addresses, conf->sock_addresses_max * sizeof(void*));
-	if (new_addresses == NULL) {
-		MSG_ERROR(msg_module, "Cannot allocate memory: %s", strerror(errno));
-		conf->sock_addresses_max = old_max;
-		return false;
-	}
-
-	// Initializes newly allocated memory
-	conf->sock_addresses = new_addresses;
-	memset(&(conf->sock_addresses[old_max]), 0, ADDR_ARRAY_INITIAL_SIZE * sizeof(void*));
-
-	return true;
-}
-
-/**
- * \brief Stores socket address and resizes array if needed
- * \param conf plugin configuration
- * \param address socket address
- * \param position socket address position (socket file descriptor)
- * \return true on success
- */
-bool add_sock_address(struct plugin_conf *conf, struct sockaddr_in6 *address, uint16_t position)
-{
-	if (position >= conf->sock_addresses_max) {
-		if (!enlarge_sock_addresses(conf)) {
-			return false;
-		}
-	}
-
-	conf->sock_addresses[position] = address;
-	return true;
-}
-
-/**
- * \brief Removes socket address and frees memory
- * \param conf plugin configuration
- * \param position address position (socket file descriptor)
- */
-void remove_sock_address(struct plugin_conf *conf, uint16_t position)
-{
-	if (conf->sock_addresses[position] != NULL) {
-		free(conf->sock_addresses[position]);
-		conf->sock_addresses[position] = NULL;
-	}
-}
-
-/**
- * \brief Removes all addresses and destroys storage
- * \param conf plugin configuration
- */
-void destroy_sock_addresses(struct plugin_conf *conf)
-{
-	if (conf->sock_addresses == NULL) {
-		return;
-	}
-
-	for (int i = 0; i < conf->sock_addresses_max; ++i) {
-		if (conf->sock_addresses[i] != NULL) {
-			free(conf->sock_addresses[i]);
-		}
-	}
-
-	free(conf->sock_addresses);
-	conf->sock_addresses = NULL;
+	free(info);
 }
 
 /**
  * \brief Creates input info list strucutre based on an existing input_info
  *
- * Adds new input_info_list to the list held in plugin configuration
- * Address or src_info argument should be used to set source address
+ * Adds new input_info_list to the list held by the connection.
+ * Source address is taken from the connection or from src_info.
  *
  * \param conf Plugin configuration
+ * \param conn Connection of the exporter
  * \param src_info Input info to use as source for the new one. Use info from conf if NULL
- * \param address Address structure to use for input_info. Can be NULL
  * \return New input_info_list structure
  */
-struct input_info_list *create_input_info(struct plugin_conf *conf,
-	struct input_info_list *src_info, struct sockaddr_in6 *address)
+static struct input_info_list *create_input_info(struct plugin_conf *conf,
+	struct tcp_connection *conn, struct input_info_list *src_info)
 {
 	struct input_info_list *input_info = NULL;
-	struct input_info_network *src_info_net = NULL;
-
-	/* Use default info (new connection) or given info to create new one */
-	if (src_info == NULL) {
-		src_info_net = &conf->info;
-	} else {
-		src_info_net = &src_info->info;
-	}
+	struct sockaddr_in6 *address = &conn->address;
 
 	/* Create new input_info for this connection */
 	input_info = calloc(1, sizeof(struct input_info_list));
@@ -323,7 +231,8 @@ struct input_info_list *create_input_info(struct plugin_conf *conf,
 		return NULL;
 	}
 
-	memcpy(&input_info->info, src_info_net, sizeof(struct input_info_network));
+	/* Use default info (new connection) or given info to create new one */
+	memcpy(&input_info->info, src_info ? &src_info->info : &conf->info, sizeof(struct input_info_network));
 
 	/* Set status to new connection */
 	input_info->info.status = SOURCE_STATUS_NEW;
@@ -334,11 +243,11 @@ struct input_info_list *create_input_info(struct plugin_conf *conf,
 	input_info->info.data_records = 0;
 
 	/* Add to list */
-	input_info->next = conf->info_list;
-	conf->info_list = input_info;
+	input_info->next = conn->infos;
+	conn->infos = input_info;
 
-	/* When no address is given, do not setup address and ports */
-	if (address == NULL) {
+	/* Address and port are already set in the source info */
+	if (src_info != NULL) {
 		return input_info;
 	}
 
@@ -351,10 +260,7 @@ struct input_info_list *create_input_info(struct plugin_conf *conf,
 		input_info->info.src_port = ntohs(((struct sockaddr_in*)  address)->sin_port);
 	} else {
 		/* Copy src IPv6 address */
-		int i;
-		for (i = 0; i < 4; i++) {
-			input_info->info.src_addr.ipv6.s6_addr32[i] = address->sin6_addr.s6_addr32[i];
-		}
+		input_info->info.src_addr.ipv6 = address->sin6_addr;
 
 		/* Copy port */
 		input_info->info.src_port = ntohs(address->sin6_port);
@@ -364,43 +270,111 @@ struct input_info_list *create_input_info(struct plugin_conf *conf,
 }
 
 /**
- * \brief Removes given input info from global list
+ * \brief Free connection structure
  *
- * \param conf Plugin configuration
- * \param info Input info list structure to be removed
- * \param delete Add to list of infos to be deleted later (inform collector)
+ * Socket must be already closed and the connection removed from all lists.
+ *
+ * \param conn Connection
  */
-void remove_input_info(struct plugin_conf *conf, struct input_info_list *info, int delete)
+static void free_connection(struct tcp_connection *conn)
 {
-	struct input_info_list *info_list = NULL, *info_list_prev = NULL;
+	struct input_info_list *info;
 
-	for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-		if (info_list == info) {
-			if (info_list_prev) {
-				/* Removing ith element from list, i>1 */
-				info_list_prev->next = info->next;
-			} else {
-				/* Removing the first element from list */
-				conf->info_list = info->next;
-			}
+#ifdef TLS_SUPPORT
+	if (conn->ssl != NULL) {
+		SSL_free(conn->ssl);
+	}
+#endif
 
-			/* Add to list of input_infos to be deleted */
-			if (delete) {
-				info->next = conf->used_info_list;
-				conf->used_info_list = info;
-			}
-			break;
-		}
+	while (conn->infos) {
+		info = conn->infos->next;
+		free_input_info(conn->infos);
+		conn->infos = info;
+	}
+
+	free(conn->buffer);
+	free(conn);
+}
+
+/**
+ * \brief Free connection on listen thread cancellation
+ *
+ * \param[in] conn Connection to free, may be NULL
+ */
+static void input_listen_cleanup(void *conn)
+{
+	struct tcp_connection *connection = *((struct tcp_connection **) conn);
+
+	if (connection != NULL) {
+		close(connection->socket);
+		free_connection(connection);
+	}
+}
+
+#ifdef TLS_SUPPORT
+/**
+ * \brief Establish TLS connection with the exporter
+ *
+ * \param[in] conf  plugin configuration structure
+ * \param[in] conn  new connection (socket is still blocking)
+ * \return 0 on success, 1 when the connection must be closed
+ */
+static int input_listen_tls(struct plugin_conf *conf, struct tcp_connection *conn)
+{
+	X509 *peer_cert = NULL;    /* peer's certificate */
+
+	/* create a new SSL structure for the connection */
+	conn->ssl = SSL_new(conf->ctx);
+	if (!conn->ssl) {
+		MSG_ERROR(msg_module, "Unable to create SSL structure");
+		ERR_print_errors_fp(stderr);
+		return 1;
+	}
+
+	/* connect the SSL object with the socket */
+	if (SSL_set_fd(conn->ssl, conn->socket) != 1) {
+		MSG_ERROR(msg_module, "Unable to connect the SSL object with the socket");
+		ERR_print_errors_fp(stderr);
+		return 1;
+	}
+
+	/* TLS handshake */
+	if (SSL_accept(conn->ssl) != 1) {
+		/* handshake wasn't successful */
+		MSG_ERROR(msg_module, "TLS handshake was not successful");
+		ERR_print_errors_fp(stderr);
+		return 1;
+	}
+
+	/* obtain peer's certificate */
+	peer_cert = SSL_get_peer_certificate(conn->ssl);
+	if (!peer_cert) {
+		MSG_ERROR(msg_module, "No certificate was presented by the peer");
+		SSL_shutdown(conn->ssl);
+		return 1;
+	}
 
-		/* Remember previous element */
-		info_list_prev = info_list;
+	/* verify peer's certificate */
+	if (SSL_get_verify_result(conn->ssl) != X509_V_OK) {
+		MSG_ERROR(msg_module, "Client sent bad certificate; verification failed");
+		X509_free(peer_cert);
+		SSL_shutdown(conn->ssl);
+		return 1;
 	}
+
+	/* fill in certificates */
+	conn->infos->collector_cert = conf->server_cert_file;
+	conn->infos->exporter_cert = peer_cert;
+
+	return 0;
 }
+#endif
 
 /**
  * \brief Function that listens for new connections
  *
- * Runs in a thread and adds new connections to plugin_conf->master set
+ * Runs in a thread and adds new connections to the epoll instance. The
+ * connection belongs to the get_packet() function from that moment.
  *
  * \param[in, out] config Plugin configuration structure
  * \return NULL always
@@ -408,153 +382,99 @@ void remove_input_info(struct plugin_conf *conf, struct input_info_list *info, i
 void *input_listen(void *config)
 {
 	struct plugin_conf *conf = (struct plugin_conf *) config;
-	int new_sock;
-	/* use IPv6 sockaddr structure to store address information (IPv4 fits easily) */
-	struct sockaddr_in6 *address = NULL;
+	struct tcp_connection *conn = NULL;
+	struct epoll_event ev;
 	socklen_t addr_length;
 	char src_addr[INET6_ADDRSTRLEN];
-	struct input_info_list *input_info;
-#ifdef TLS_SUPPORT
-	int ret;
-	int i;
-	SSL *ssl = NULL;           /* structure for TLS connection */
-	X509 *peer_cert = NULL;    /* peer's certificate */
-	struct cleanup maid;       /* auxiliary struct for TLS error handling */
-#endif
+	int flags;
+
+	/* ensure that connection will be freed when thread is canceled */
+	pthread_cleanup_push(input_listen_cleanup, (void *) &conn);
 
 	/* loop ends when thread is cancelled by pthread_cancel() function */
 	while (1) {
-		/* allocate space for the address */
-		addr_length = sizeof(struct sockaddr_in6);
-		address = malloc(addr_length);
-		if (!address) {
+		conn = calloc(1, sizeof(struct tcp_connection));
+		if (!conn) {
 			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 			break;
 		}
+		conn->socket = -1;
 
-		/* ensure that address will be freed when thread is canceled */
-		pthread_cleanup_push(input_listen_cleanup, (void *) address);
-
-		if ((new_sock = accept(conf->socket, (struct sockaddr*) address, &addr_length)) == -1) {
+		/* use IPv6 sockaddr structure to store address information (IPv4 fits easily) */
+		addr_length = sizeof(struct sockaddr_in6);
+		if ((conn->socket = accept(conf->socket, (struct sockaddr*) &conn->address, &addr_length)) == -1) {
 			MSG_ERROR(msg_module, "Cannot accept new socket: %s", strerror(errno));
 			/* exit and call cleanup */
-			pthread_exit(0);
+			free(conn);
+			conn = NULL;
+			break;
 		}
-#ifdef TLS_SUPPORT
-		/* preparation for TLS error handling */
-		maid.address = address;
-		maid.ssl = NULL;
-		maid.peer_cert = NULL;
-
-		if (conf->tls) {
-			/* create a new SSL structure for the connection */
-			ssl = SSL_new(conf->ctx);
-			if (!ssl) {
-				MSG_ERROR(msg_module, "Unable to create SSL structure");
-				ERR_print_errors_fp(stderr);
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-			maid.ssl = ssl;
-
-			/* connect the SSL object with the socket */
-			ret = SSL_set_fd(ssl, new_sock);
-			if (ret != 1) {
-				MSG_ERROR(msg_module, "Unable to connect the SSL object with the socket");
-				ERR_print_errors_fp(stderr);
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-
-			/* TLS handshake */
-			ret = SSL_accept(ssl);
-			if (ret != 1) {
-				/* handshake wasn't successful */
-				MSG_ERROR(msg_module, "TLS handshake was not successful");
-				ERR_print_errors_fp(stderr);
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-
-			/* obtain peer's certificate */
-			peer_cert = SSL_get_peer_certificate(ssl);
-			if (!peer_cert) {
-				MSG_ERROR(msg_module, "No certificate was presented by the peer");
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-			maid.peer_cert = peer_cert;
-
-			/* verify peer's certificate */
-			if (SSL_get_verify_result(ssl) != X509_V_OK) {
-				MSG_ERROR(msg_module, "Client sent bad certificate; verification failed");
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
-
-			/* put new SSL structure into the conf->ssl_list */
-			for (i = 0; i < conf->ssl_list_size; i++) {
-				if (conf->ssl_list[i] == NULL) {
-					conf->ssl_list[i] = ssl;
-					break;
-				}
-			}
 
-			if (i == conf->ssl_list_size) {
-				/* limit reached. no space for new SSL structure */
-				MSG_WARNING(msg_module, "Reached limit on the number of TLS connections; tearing down this connection...");
-				/* cleanup */
-				input_listen_tls_cleanup(conf, &maid);
-				continue;
-			}
+		/* Create new input_info for this connection */
+		if (!create_input_info(conf, conn, NULL)) {
+			close(conn->socket);
+			free_connection(conn);
+			conn = NULL;
+			continue;
 		}
-#endif
-		pthread_mutex_lock(&mutex);
-		FD_SET(new_sock, &conf->master);
 
-		if (conf->fd_max < new_sock) {
-			conf->fd_max = new_sock;
+#ifdef TLS_SUPPORT
+		if (conf->tls && input_listen_tls(conf, conn) != 0) {
+			close(conn->socket);
+			free_connection(conn);
+			conn = NULL;
+			continue;
 		}
+#endif
 
-		/* copy socket address to config structure */
-		if (!add_sock_address(conf, address, new_sock)) {
-			MSG_ERROR(msg_module, "Cannot store another socket address");
-			break;
+		/* all reads are done in the event loop (edge triggered, read until EAGAIN) */
+		flags = fcntl(conn->socket, F_GETFL, 0);
+		if (flags == -1 || fcntl(conn->socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+			MSG_ERROR(msg_module, "Cannot set socket to non-blocking mode: %s", strerror(errno));
+			close(conn->socket);
+			free_connection(conn);
+			conn = NULL;
+			continue;
 		}
 
-		/* print info */
-		if (conf->info.l3_proto == 4) {
-			inet_ntop(AF_INET, (void *)&((struct sockaddr_in*) address)->sin_addr, src_addr, INET6_ADDRSTRLEN);
-		} else {
-			inet_ntop(AF_INET6, &address->sin6_addr, src_addr, INET6_ADDRSTRLEN);
-		}
-		MSG_INFO(msg_module, "Exporter connected from address %s", src_addr);
+		MSG_INFO(msg_module, "Exporter connected from address %s", tcp_address_str(&conn->address, src_addr));
 
-		pthread_mutex_unlock(&mutex);
+		/* connection must not be freed by the cleanup handler once it is registered */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-		/* Create new input_info for this connection */
-		input_info = create_input_info(conf, NULL, address);
-		if (!input_info) {
-			/* Failed to create input info, listen for new connection */
-			break;
+		pthread_mutex_lock(&conf->mutex);
+		conn->next = conf->connections;
+		if (conf->connections) {
+			conf->connections->prev = conn;
+		}
+		conf->connections = conn;
+		pthread_mutex_unlock(&conf->mutex);
+
+		/* from now on the connection is handled by get_packet() */
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = conn;
+		if (epoll_ctl(conf->epollfd, EPOLL_CTL_ADD, conn->socket, &ev) == -1) {
+			MSG_ERROR(msg_module, "Cannot add connection to epoll: %s", strerror(errno));
+			pthread_mutex_lock(&conf->mutex);
+			if (conn->prev) {
+				conn->prev->next = conn->next;
+			} else {
+				conf->connections = conn->next;
+			}
+			if (conn->next) {
+				conn->next->prev = conn->prev;
+			}
+			pthread_mutex_unlock(&conf->mutex);
+			close(conn->socket);
+			free_connection(conn);
 		}
 
-#ifdef TLS_SUPPORT
-		/* fill in certificates */
-		input_info->collector_cert = conf->server_cert_file;
-		input_info->exporter_cert = peer_cert;
-#endif
-
-		/* unset the address so that we do not free it incidentally */
-		address = NULL;
-
-		pthread_cleanup_pop(0);
+		conn = NULL;
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
+
+	pthread_cleanup_pop(0);
 	return NULL;
 }
 
@@ -578,7 +498,6 @@ int input_init(char *params, void **config)
 	int def_port = 0;
 #ifdef TLS_SUPPORT
 	SSL_CTX *ctx = NULL;       /* SSL context structure */
-	SSL **ssl_list = NULL;     /* list of SSL connection structures */
 	xmlNode *cur_node_parent;
 #endif
 
@@ -595,15 +514,17 @@ int input_init(char *params, void **config)
 		goto out;
 	}
 
-	if (!enlarge_sock_addresses(conf)) {
-		MSG_ERROR(msg_module, "Cannot initialize array for socket address");
+	conf->socket = -1;
+	pthread_mutex_init(&conf->mutex, NULL);
+
+	/* all connections are watched by one epoll instance */
+	conf->epollfd = epoll_create1(0);
+	if (conf->epollfd == -1) {
+		MSG_ERROR(msg_module, "Cannot create epoll instance: %s", strerror(errno));
 		retval = 1;
 		goto out;
 	}
 
-	/* empty the master set */
-	FD_ZERO(&conf->master);
-
 	/* parse xml string */
 	doc = xmlParseDoc(BAD_CAST params);
 	if (doc == NULL) {
@@ -843,22 +764,11 @@ int input_init(char *params, void **config)
 		/* set peer certificate verification parameters */
 		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, NULL);
 
-		ssl_list = (SSL **) malloc(sizeof(SSL *) * DEFAULT_SIZE_SSL_LIST);
-		if (ssl_list == NULL) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			retval = 1;
-			goto out;
-		}
-		memset(ssl_list, 0, DEFAULT_SIZE_SSL_LIST * sizeof(SSL *));
-
-		conf->ssl_list_size = DEFAULT_SIZE_SSL_LIST;
 		conf->ctx = ctx;
-		conf->ssl_list = ssl_list;
 	}
 #endif  /* TLS */
 
 	/* fill in general information */
-	conf->info_to_remove = 0;
 	conf->info.type = SOURCE_TYPE_TCP;
 	conf->info.dst_port = atoi(port);
 	if (addrinfo->ai_family == AF_INET) { /* IPv4 */
@@ -893,7 +803,7 @@ int input_init(char *params, void **config)
 	MSG_INFO(msg_module, "Input plugin listening on %s, port %s", dst_addr, port);
 
 	/* start listening thread */
-	if (pthread_create(&listen_thread, NULL, &input_listen, (void *) conf) != 0) {
+	if (pthread_create(&conf->listen_thread, NULL, &input_listen, (void *) conf) != 0) {
 		MSG_ERROR(msg_module, "Failed to create listening thread");
 		retval = 1;
 		goto out;
@@ -940,6 +850,13 @@ out:
 		if (conf->info.options_template_life_packet != NULL) {
 			free (conf->info.options_template_life_packet);
 		}
+		if (conf->socket != -1) {
+			close(conf->socket);
+		}
+		if (conf->epollfd != -1) {
+			close(conf->epollfd);
+		}
+		pthread_mutex_destroy(&conf->mutex);
 		free(conf);
 
 	}
@@ -947,10 +864,6 @@ out:
 #ifdef TLS_SUPPORT
 	/* error occurs, clean up */
 	if ((retval != 0) && (conf != NULL)) {
-		if (ssl_list) {
-			free(ssl_list);
-		}
-
 		if (ctx) {
 			SSL_CTX_free(ctx);
 		}
@@ -960,396 +873,436 @@ out:
 	return retval;
 }
 
+#ifdef TLS_SUPPORT
 /**
- * \brief Checks whether input_info matches the given address
- *
- * Compares L3 protocol, IP addresses and source port. ODID is not checked.
+ * \brief Wrapper function for SSL_read() function
  *
- * \param[in] info_list structure to compare
- * \param[in] address structure to compare
- * \return 0 if input_info matches the address, 1 otherwise
+ * The wrapper function prints error messages. Sockets are non-blocking, so
+ * SSL_ERROR_WANT_READ/WANT_WRITE means that no more data are available now.
+ * \param[in]  ssl TLS/SSL connection
+ * \param[in]  buf Buffer where to store loaded data
+ * \param[in]  num Number of bytes to read
+ * \param[out] err Error code from SSL_get_error (if NULL, no value is set)
+ * \return Same as SSL_read()
  */
-int compare_input_info(struct input_info_list *info_list, struct sockaddr_in6 *address)
+int wrapper_SSL_read(SSL *ssl, void *buf, int num, int *err)
 {
-	/* ports must match */
-	if (info_list->info.src_port == ntohs(((struct sockaddr_in*) address)->sin_port)) {
-		/* Compare addresses, dependent on IP protocol version*/
-		if (info_list->info.l3_proto == 4) {
-			if (info_list->info.src_addr.ipv4.s_addr == ((struct sockaddr_in*) address)->sin_addr.s_addr) {
-				return 0;
-			}
-		} else {
-			if (info_list->info.src_addr.ipv6.s6_addr32[0] == address->sin6_addr.s6_addr32[0] &&
-					info_list->info.src_addr.ipv6.s6_addr32[1] == address->sin6_addr.s6_addr32[1] &&
-					info_list->info.src_addr.ipv6.s6_addr32[2] == address->sin6_addr.s6_addr32[2] &&
-					info_list->info.src_addr.ipv6.s6_addr32[3] == address->sin6_addr.s6_addr32[3]) {
-				return 0;
-			}
+	// First, clear all current thread's errors, or SSL_get_error() will not work reliably
+	ERR_clear_error();
+	// Try to read the message
+	const int res = SSL_read(ssl, buf, num);
+	if (res > 0) {
+		// Success
+		if (err != NULL) {
+			*err = SSL_ERROR_NONE;
 		}
+		return res;
 	}
 
-	return 1;
+	// Something bad happened
+	int ssl_err = SSL_get_error(ssl, res);
+	int errno_backup = errno; // Preserve errno!
+
+	switch (ssl_err) {
+	case SSL_ERROR_WANT_READ:
+	case SSL_ERROR_WANT_WRITE:
+		// No data available at the moment
+		break;
+	case SSL_ERROR_ZERO_RETURN:
+		MSG_WARNING(msg_module, "SSL_read() failed: TLS/SSL connection closed!", '\0');
+		break;
+	case SSL_ERROR_SYSCALL:
+		MSG_WARNING(msg_module, "SSL_read() failed: non-recoverable I/O error", '\0');
+		break;
+	case SSL_ERROR_SSL:
+		MSG_WARNING(msg_module, "SSL_read() failed: SSL library failure", '\0');
+		break;
+	default:
+		MSG_WARNING(msg_module, "SSL_read() failed: unexpected return code '%d'", ssl_err);
+		break;
+	}
+
+	// Failed!
+	if (err != NULL) {
+		*err = ssl_err;
+	}
+
+	errno = errno_backup;
+	return res;
 }
+#endif
 
-#ifdef TLS_SUPPORT
 /**
- * \brief Wrapper function for SSL_read() function
+ * \brief Read available data of the connection into its reassembly buffer
  *
- * The wrapper function prints error messages and handles operation repeat in suitable situations.
- * \param[in]  ssl TLS/SSL connection
- * \param[in]  buf Buffer where to store loaded data
- * \param[in]  num Number of bytes to read
- * \param[out] err Error code from SSL_get_error (if NULL, no value is set)
- * \return Same as SSL_read()
+ * \param[in] conf Plugin configuration
+ * \param[in,out] conn Connection
+ * \param[in] need Number of bytes of unprocessed data needed in the buffer
+ * \return number of read bytes, 0 when no data are available at the moment
+ *  and -1 when the connection was closed or failed.
  */
-int wrapper_SSL_read(SSL *ssl, void *buf, int num, int *err)
+static int tcp_conn_read(struct plugin_conf *conf, struct tcp_connection *conn, uint32_t need)
 {
-	while (true) {
-		// First, clear all current thread's errors, or SSL_get_error() will not work reliably
-		ERR_clear_error();
-		// Try to read the message
-		const int res = SSL_read(ssl, buf, num);
-		if (res > 0) {
-			// Success
-			if (err != NULL) {
-				*err = SSL_ERROR_NONE;
-			}
-			return res;
+	ssize_t len;
+	char *new_buffer;
+
+	/* make room for the rest of the message */
+	if (conn->start > 0 && (conn->buffer_size - conn->start < need || conn->end == conn->buffer_size)) {
+		memmove(conn->buffer, conn->buffer + conn->start, conn->end - conn->start);
+		conn->end -= conn->start;
+		conn->start = 0;
+	}
+
+	if (conn->buffer_size < need) {
+		if (need < BUFF_LEN) {
+			need = BUFF_LEN;
 		}
 
-		// Something bad happened
-		int ssl_err = SSL_get_error(ssl, res);
-		int errno_backup = errno; // Preserve errno!
-
-		switch (ssl_err) {
-		case SSL_ERROR_WANT_READ:
-		case SSL_ERROR_WANT_WRITE:
-			MSG_DEBUG(msg_module, "SSL_read() failed: WANT_READ/WANT_WRITE", '\0');
-			continue; // Try again...
-		case SSL_ERROR_ZERO_RETURN:
-			MSG_WARNING(msg_module, "SSL_read() failed: TLS/SSL connection closed!", '\0');
-			break;
-		case SSL_ERROR_SYSCALL:
-			MSG_WARNING(msg_module, "SSL_read() failed: non-recoverable I/O error", '\0');
-			break;
-		case SSL_ERROR_SSL:
-			MSG_WARNING(msg_module, "SSL_read() failed: SSL library failure", '\0');
-			break;
-		default:
-			MSG_WARNING(msg_module, "SSL_read() failed: unexpected return code '%d'", ssl_err);
-			break;
+		new_buffer = realloc(conn->buffer, need);
+		if (new_buffer == NULL) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return -1;
 		}
 
-		// Failed!
-		if (err != NULL) {
-			*err = ssl_err;
+		conn->buffer = new_buffer;
+		conn->buffer_size = need;
+	}
+
+#ifdef TLS_SUPPORT
+	if (conf->tls) {
+		int ssl_err;
+		len = wrapper_SSL_read(conn->ssl, conn->buffer + conn->end, conn->buffer_size - conn->end, &ssl_err);
+		if (len <= 0) {
+			if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE) {
+				return 0;
+			}
+
+			return -1;
 		}
 
-		errno = errno_backup;
-		return res;
+		conn->end += len;
+		return len;
 	}
-}
+#else
+	(void) conf;
 #endif
 
+	while ((len = recv(conn->socket, conn->buffer + conn->end, conn->buffer_size - conn->end, 0)) == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		} else if (errno != EINTR) {
+			MSG_WARNING(msg_module, "Failed to receive IPFIX data: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (len == 0) {
+		/* connection closed */
+		return -1;
+	}
 
+	conn->end += len;
+	return len;
+}
 
 /**
- * \brief Pass input data from the input plugin into the ipfixcol core.
+ * \brief Get next complete IPFIX message of the connection
  *
- * IP addresses are passed as returned by recvfrom and getsockname,
- * ports are in host byte order
+ * Reads data from the socket until a complete message is in the reassembly
+ * buffer or no more data are available.
  *
- * \param[in] config  plugin_conf structure
- * \param[out] info   Information structure describing the source of the data.
- * \param[out] packet Flow information data in the form of IPFIX packet.
- * \param[out] source_status Status of source (new, opened, closed)
- * \return the length of packet on success, INPUT_CLOSE when some connection
- *  closed, INPUT_ERROR on error or INPUT_SIGINT when interrupted.
+ * \param[in] conf Plugin configuration
+ * \param[in,out] conn Connection
+ * \param[in,out] packet Memory for the message (reallocated to its length)
+ * \return length of the message, 0 when no complete message is available at
+ *  the moment and -1 when the connection must be closed.
  */
-int get_packet(void *config, struct input_info **info, char **packet, int *source_status)
+static int tcp_conn_message(struct plugin_conf *conf, struct tcp_connection *conn, char **packet)
 {
-	/* temporary socket set */
-	fd_set tmp_set;
-	ssize_t len = 0;
-	uint16_t max_msg_len = BUFF_LEN * sizeof(char);
-	uint16_t packet_len;
-	struct timeval tv;
-	char src_addr[INET6_ADDRSTRLEN];
-	struct sockaddr_in6 *address;
-	struct plugin_conf *conf = config;
-	int retval = 0, sock;
-	struct input_info_list *info_list, *tmp_list = NULL;
-#ifdef TLS_SUPPORT
-	int i;
-	SSL *ssl = NULL;        /* SSL structure for active socket */
-#endif
+	struct ipfix_header *header;
+	uint32_t avail, need;
+	char *new_packet;
+	int ret;
 
-	/* Handle closed connections first */
-	if (conf->info_to_remove > 0) {
-		/* Find first info to be removed and remove it */
-		for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-			if (info_list->info.status == SOURCE_STATUS_CLOSED) {
-				*info = (struct input_info*) &info_list->info;
-				*source_status = SOURCE_STATUS_CLOSED;
-				remove_input_info(conf, info_list, 1);
-				return INPUT_CLOSED;
+	while (1) {
+		avail = conn->end - conn->start;
+		need = IPFIX_HEADER_LENGTH;
+
+		if (avail >= IPFIX_HEADER_LENGTH) {
+			header = (struct ipfix_header *) (conn->buffer + conn->start);
+			if (ntohs(header->version) != IPFIX_VERSION) {
+				MSG_WARNING(msg_module, "Received invalid message: IPFIX version doesn't match; closing connection...");
+				return -1;
 			}
-		}
 
-		/* One less info to be removed */
-		conf->info_to_remove--;
-	}
+			need = ntohs(header->length);
+			if (need < IPFIX_HEADER_LENGTH) {
+				MSG_WARNING(msg_module, "Received invalid message: IPFIX message length is too short; closing connection...");
+				return -1;
+			}
 
-	/* allocate memory for packet, if needed */
-	if (*packet == NULL) {
-		*packet = malloc(max_msg_len);
-		if (*packet == NULL) {
-			MSG_ERROR(msg_module, "Cannot allocate memory for the packet, malloc failed: %s", strerror(errno));
-			return INPUT_ERROR;
-		}
-	}
+			if (avail >= need) {
+				/* complete message, pass a copy of it */
+				new_packet = realloc(*packet, need);
+				if (new_packet == NULL) {
+					MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+					return -1;
+				}
 
-	/* wait until some socket is ready */
-	while (retval <= 0) {
-		/* copy all sockets from master to tmp_set */
-		FD_ZERO(&tmp_set);
-		pthread_mutex_lock(&mutex);
-		tmp_set = conf->master;
-		pthread_mutex_unlock(&mutex);
+				*packet = new_packet;
+				memcpy(*packet, header, need);
 
-		/* wait at most one second - give time to check for new sockets */
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+				conn->start += need;
+				if (conn->start == conn->end) {
+					conn->start = conn->end = 0;
+				}
 
-		/* select active connections */
-		retval = select(conf->fd_max + 1, &tmp_set, NULL, NULL, &tv);
-		if (retval == -1) {
-			if (errno == EINTR) {
-				return INPUT_INTR;
+				return need;
 			}
-			MSG_WARNING(msg_module, "Failed to select active connection: %s", strerror(errno));
-			return INPUT_ERROR;
 		}
-	}
 
-	/* find first socket that is ready */
-	for (sock=0; sock <= conf->fd_max; sock++) {
-		/* fetch first active connection */
-		if (FD_ISSET(sock, &tmp_set)) {
-			break;
+		ret = tcp_conn_read(conf, conn, need);
+		if (ret <= 0) {
+			if (ret < 0 && conn->end != conn->start) {
+				MSG_WARNING(msg_module, "Packet is incomplete; closing connection...");
+			}
+
+			return ret;
 		}
 	}
+}
 
-	/* receive ipfix packet header */
-#ifdef TLS_SUPPORT
-	if (conf->tls) {
-		/* TLS enabled */
-		/* TODO - ugly piece of code... use epoll() instead of select()
-		 * find corresponding SSL structure for socket */
-		for (i = 0; ; i++) {
-			if (conf->ssl_list[i] && (SSL_get_fd(conf->ssl_list[i]) == sock)) {
-				ssl = conf->ssl_list[i];
-				break;
-			}
-		}
+/**
+ * \brief Add connection to the end of the ready queue
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] conn Connection
+ */
+static void tcp_ready_push(struct plugin_conf *conf, struct tcp_connection *conn)
+{
+	conn->ready = true;
+	conn->ready_next = NULL;
 
-		int ssl_err;
-		len = wrapper_SSL_read(ssl, *packet, IPFIX_HEADER_LENGTH, &ssl_err);
-		if (len <= 0) {
-			/* read operation was not successful */
-			if (ssl_err == SSL_ERROR_SYSCALL) {
-				if (errno == EINTR) {
-					return INPUT_INTR;
-				}
+	if (conf->ready_tail) {
+		conf->ready_tail->ready_next = conn;
+	} else {
+		conf->ready_head = conn;
+	}
 
-				MSG_ERROR(msg_module, "Failed to receive IPFIX packet header: %s", strerror(errno));
-				return INPUT_ERROR;
-			}
+	conf->ready_tail = conn;
+}
 
-			// This will close the connection
-			len = 0;
-		}
-	} else {
-#endif
-		/* receive without TLS */
-		len = recv(sock, *packet, IPFIX_HEADER_LENGTH, MSG_WAITALL);
-		if (len == -1) {
-			if (errno == EINTR) {
-				return INPUT_INTR;
-			}
+/**
+ * \brief Remove the first connection from the ready queue
+ *
+ * \param[in] conf Plugin configuration
+ * \return connection or NULL when the queue is empty
+ */
+static struct tcp_connection *tcp_ready_pop(struct plugin_conf *conf)
+{
+	struct tcp_connection *conn = conf->ready_head;
 
-			MSG_ERROR(msg_module, "Failed to receive IPFIX packet header: %s", strerror(errno));
-			return INPUT_ERROR;
+	if (conn) {
+		conf->ready_head = conn->ready_next;
+		if (conf->ready_head == NULL) {
+			conf->ready_tail = NULL;
 		}
-#ifdef TLS_SUPPORT
+
+		conn->ready = false;
+		conn->ready_next = NULL;
 	}
-#endif
 
-	if (len >= IPFIX_HEADER_LENGTH) { /* header received */
-		if (ntohs(((struct ipfix_header *) *packet)->version) != IPFIX_VERSION) {
-			// Unexpected version
-			MSG_WARNING(msg_module, "Received invalid message: IPFIX version doesn't match.", '\0');
-			return INPUT_ERROR;
-		}
+	return conn;
+}
 
-		/* get packet total length and check whether buffer is big enough */
-		packet_len = ntohs(((struct ipfix_header *) *packet)->length);
-		if (packet_len > BUFF_LEN) {
-			*packet = realloc(*packet, packet_len);
-			if (*packet == NULL) {
-				MSG_ERROR(msg_module, "Packet too big and realloc failed: %s", strerror(errno));
-				return INPUT_ERROR;
-			}
-		}
+/**
+ * \brief Close connection of the exporter
+ *
+ * Input infos with received data are moved to the list of closed infos to be
+ * reported to the collector, the others are freed.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] conn Connection (not in the ready queue)
+ */
+static void tcp_conn_close(struct plugin_conf *conf, struct tcp_connection *conn)
+{
+	char src_addr[INET6_ADDRSTRLEN];
+	struct input_info_list *info, *next;
 
-		char *body_ptr = (*packet) + IPFIX_HEADER_LENGTH;
-		int body_size = packet_len - IPFIX_HEADER_LENGTH;
-#ifdef TLS_SUPPORT
-		if (conf->tls) {
-			int ssl_err;
-			len = wrapper_SSL_read(ssl, body_ptr, body_size, &ssl_err);
-			if (len <= 0) {
-				if (ssl_err == SSL_ERROR_SYSCALL && errno == EINTR) {
-					return INPUT_INTR;
-				}
-				return INPUT_ERROR;
-			}
-		} else {
-#endif
-			len = recv(sock, (*packet) + IPFIX_HEADER_LENGTH, packet_len - IPFIX_HEADER_LENGTH,
-				MSG_WAITALL);
-			if (len == -1) {
-				if (errno == EINTR) {
-					return INPUT_INTR;
-				}
-				MSG_WARNING(msg_module, "Failed to receive IPFIX packet: %s", strerror(errno));
-				return INPUT_ERROR;
-			}
 #ifdef TLS_SUPPORT
+	if (conf->tls) {
+		if (SSL_get_shutdown(conn->ssl) != SSL_RECEIVED_SHUTDOWN) {
+			MSG_WARNING(msg_module, "SSL shutdown is incomplete");
 		}
-#endif
-		if (len < body_size) {
-			MSG_WARNING(msg_module, "Read IPFIX data is too short (%i): %s", len, strerror(errno));
+
+		/* Send "close notify" shutdown alert back to the peer */
+		if (SSL_shutdown(conn->ssl) == -1) {
+			MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
 		}
+	}
+#endif
 
-		len += IPFIX_HEADER_LENGTH;
+	MSG_INFO(msg_module, "Exporter on address %s closed connection", tcp_address_str(&conn->address, src_addr));
 
-		/* Check if lengths are the same */
-		if (len < htons(((struct ipfix_header *) *packet)->length)) {
-			return INPUT_INTR;
-		} else if (len > htons(((struct ipfix_header *) *packet)->length)) {
-			len = htons(((struct ipfix_header*) *packet)->length);
+	epoll_ctl(conf->epollfd, EPOLL_CTL_DEL, conn->socket, NULL);
+	close(conn->socket);
+
+	/* Do not send input_info for closing sources with no data. ODID is not filled in that case */
+	for (info = conn->infos; info != NULL; info = next) {
+		next = info->next;
+
+		if (info->info.status == SOURCE_STATUS_NEW) {
+			free_input_info(info);
+		} else {
+			info->next = conf->closed_list;
+			conf->closed_list = info;
 		}
-	} else if (len != 0) {
-		MSG_WARNING(msg_module, "Packet header is incomplete; closing connection...");
+	}
+	conn->infos = NULL;
 
-		/* this will close the connection */
-		len = 0;
+	pthread_mutex_lock(&conf->mutex);
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		conf->connections = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
 	}
+	pthread_mutex_unlock(&conf->mutex);
 
-	/* get peer address from configuration */
-	address = conf->sock_addresses[sock];
+	free_connection(conn);
+}
 
-	/* go through input_info_list */
-	for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-		if (compare_input_info(info_list, address) == 0) {
-			if (info_list->info.status == SOURCE_STATUS_NEW) {
-				/* First ODID for this connection, no ODID yet. Use it */
-				break;
-			} else {
-				/* Remember the match and use it for new ODID */
-				tmp_list = info_list;
+/**
+ * \brief Find input info of the connection for given ODID
+ *
+ * The first message of the connection fills ODID of its initial input info.
+ * New input info is created for each other ODID.
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in] conn Connection
+ * \param[in] odid Observation Domain ID of the message
+ * \return input info, NULL on memory allocation error
+ */
+static struct input_info_list *tcp_conn_info(struct plugin_conf *conf, struct tcp_connection *conn, uint32_t odid)
+{
+	struct input_info_list *info_list;
 
-				/* ODIDs must match or connection must be closing*/
-				if (len == 0 ||
-					(len > 0 && info_list->info.odid == ntohl(((struct ipfix_header *) *packet)->observation_domain_id))) {
-					break;
-				}
-			}
+	for (info_list = conn->infos; info_list != NULL; info_list = info_list->next) {
+		if (info_list->info.status == SOURCE_STATUS_NEW) {
+			/* First ODID for this connection, no ODID yet. Use it */
+			info_list->info.odid = odid;
+			return info_list;
+		}
+
+		if (info_list->info.odid == odid) {
+			return info_list;
 		}
 	}
 
 	/* Handle new ODIDs for existing source */
-	if (info_list == NULL && tmp_list != NULL) {
-		info_list = create_input_info(conf, tmp_list, NULL);
+	info_list = create_input_info(conf, conn, conn->infos);
+	if (info_list != NULL) {
+		info_list->info.odid = odid;
 	}
 
-	/* Check whether we have the input_info */
-	if (info_list == NULL) {
-		MSG_WARNING(msg_module, "input_info not found, passing packet with NULL input info");
-	} else {
-		/* Set source status */
-		*source_status = info_list->info.status;
-		/* Get ODID for opened connection */
-		if (len > 0 && info_list->info.status == SOURCE_STATUS_NEW) {
-			info_list->info.status = SOURCE_STATUS_OPENED;
-			info_list->info.odid = ntohl(((struct ipfix_header *) *packet)->observation_domain_id);
+	return info_list;
+}
+
+/**
+ * \brief Pass input data from the input plugin into the ipfixcol core.
+ *
+ * Connections are watched by an edge triggered epoll. Connections with
+ * events are put into the ready queue and each of them is read until no more
+ * data are available. One IPFIX message is returned per call, connections in
+ * the ready queue take turns.
+ *
+ * IP addresses are passed as returned by recvfrom and getsockname,
+ * ports are in host byte order
+ *
+ * \param[in] config  plugin_conf structure
+ * \param[out] info   Information structure describing the source of the data.
+ * \param[out] packet Flow information data in the form of IPFIX packet.
+ * \param[out] source_status Status of source (new, opened, closed)
+ * \return the length of packet on success, INPUT_CLOSE when some connection
+ *  closed, INPUT_ERROR on error or INPUT_SIGINT when interrupted.
+ */
+int get_packet(void *config, struct input_info **info, char **packet, int *source_status)
+{
+	struct plugin_conf *conf = config;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	struct tcp_connection *conn;
+	struct input_info_list *info_list;
+	int i, nfds, len;
+
+	while (1) {
+		/* Report closed sources first */
+		if (conf->closed_list != NULL) {
+			info_list = conf->closed_list;
+			conf->closed_list = info_list->next;
+
+			/* Messages may still point to the input_info, free it later */
+			info_list->next = conf->used_info_list;
+			conf->used_info_list = info_list;
+
+			info_list->info.status = SOURCE_STATUS_CLOSED;
+			*source_status = SOURCE_STATUS_CLOSED;
+			*info = (struct input_info*) &info_list->info;
+			return INPUT_CLOSED;
 		}
-	}
 
-	/* Pass info to the collector */
-	*info = (struct input_info*) &info_list->info;
+		/* wait for events when there is nothing to read */
+		if (conf->ready_head == NULL) {
+			nfds = epoll_wait(conf->epollfd, events, MAX_EPOLL_EVENTS, -1);
+			if (nfds == -1) {
+				if (errno == EINTR) {
+					return INPUT_INTR;
+				}
 
-	/* Check whether socket closed */
-	if (len == 0) {
-#ifdef TLS_SUPPORT
-		if (conf->tls) {
-			if (SSL_get_shutdown(ssl) != SSL_RECEIVED_SHUTDOWN) {
-				MSG_WARNING(msg_module, "SSL shutdown is incomplete");
+				MSG_WARNING(msg_module, "Failed to wait for active connections: %s", strerror(errno));
+				return INPUT_ERROR;
 			}
 
-			/* Send "close notify" shutdown alert back to the peer */
-			retval = SSL_shutdown(ssl);
-			if (retval == -1) {
-				MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
+			for (i = 0; i < nfds; i++) {
+				conn = (struct tcp_connection *) events[i].data.ptr;
+				if (!conn->ready) {
+					tcp_ready_push(conf, conn);
+				}
 			}
+
+			continue;
 		}
-#endif
-		/* Print info */
-		if (conf->info.l3_proto == 4) {
-			inet_ntop(AF_INET, (void *)&((struct sockaddr_in*) conf->sock_addresses[sock])->sin_addr, src_addr, INET6_ADDRSTRLEN);
-		} else {
-			inet_ntop(AF_INET6, &conf->sock_addresses[sock]->sin6_addr, src_addr, INET6_ADDRSTRLEN);
-		}
-		MSG_INFO(msg_module, "Exporter on address %s closed connection", src_addr);
 
-		/* Set source status */
-		*source_status = SOURCE_STATUS_CLOSED;
+		conn = tcp_ready_pop(conf);
+		len = tcp_conn_message(conf, conn, packet);
+		if (len == 0) {
+			/* No more data, wait for the next event of the connection */
+			continue;
+		} else if (len < 0) {
+			tcp_conn_close(conf, conn);
+			continue;
+		}
 
-		/* Remove current input_info from list */
-		remove_input_info(conf, info_list, (*info)->status != SOURCE_STATUS_NEW);
+		/* The connection may have more data */
+		tcp_ready_push(conf, conn);
 
-		/* Set status of all other input_infos from this source
-		 * The current one is not affected, it is removed from the list */
-		for (tmp_list = conf->info_list; tmp_list != NULL; tmp_list = tmp_list->next) {
-			if (compare_input_info(tmp_list, address) == 0) {
-				tmp_list->info.status = SOURCE_STATUS_CLOSED;
-				conf->info_to_remove++;
-			}
+		info_list = tcp_conn_info(conf, conn, ntohl(((struct ipfix_header *) *packet)->observation_domain_id));
+		if (info_list == NULL) {
+			return INPUT_INTR;
 		}
 
-		/* Use mutex so that listening thread does not reuse the socket too quickly */
-		pthread_mutex_lock(&mutex);
-		close(sock);
-		FD_CLR(sock, &conf->master);
-		remove_sock_address(conf, sock);
-		pthread_mutex_unlock(&mutex);
-
-		/* Do not send input_info for closing sources with no data. ODID is not filled in that case */
-		if ((*info)->status == SOURCE_STATUS_NEW) {
-			/* No messages point to this input_info, free here */
-			free(info_list);
-			*info = NULL;
-			return INPUT_INTR;
+		/* Set source status */
+		*source_status = info_list->info.status;
+		if (info_list->info.status == SOURCE_STATUS_NEW) {
+			info_list->info.status = SOURCE_STATUS_OPENED;
 		}
 
-		/* Set current input_info status to closed */
-		(*info)->status = SOURCE_STATUS_CLOSED;
+		/* Pass info to the collector */
+		*info = (struct input_info*) &info_list->info;
 
-		return INPUT_CLOSED;
+		return len;
 	}
-
-	return len;
 }
 
 /**
@@ -1360,69 +1313,76 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
  */
 int input_close(void **config)
 {
-	int ret, error = 0, sock=0;
+	int ret, error = 0;
 	struct plugin_conf *conf = (struct plugin_conf*) *config;
 	struct input_info_list *info_list;
+	struct tcp_connection *conn;
 
 	/* kill the listening thread */
-	if(pthread_cancel(listen_thread) != 0) {
+	if(pthread_cancel(conf->listen_thread) != 0) {
 		MSG_WARNING(msg_module, "Cannot cancel listening thread");
 	} else {
-		pthread_join(listen_thread, NULL);
+		pthread_join(conf->listen_thread, NULL);
 	}
 
-#ifdef TLS_SUPPORT
-	if (conf->tls) {
-		/* close TLS connection, if any */
-		for (sock = 0; sock < conf->ssl_list_size; sock++) {
-			if (conf->ssl_list[sock] == NULL) {
-				continue;
-			}
-			ret = SSL_get_fd(conf->ssl_list[sock]);
-			if (ret >= 0) {
-				/* send close notify */
-				ret = SSL_shutdown(conf->ssl_list[sock]);
-				if (ret == -1) {
-					MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
-				}
-			}
-
-			SSL_free(conf->ssl_list[sock]);
-		}
-
-		/* we are done here */
-		SSL_CTX_free(conf->ctx);
-	}
-#endif
-
 	/* close listening socket */
 	if ((ret = close(conf->socket)) == -1) {
 		error++;
 		MSG_ERROR(msg_module, "Cannot close listening socket: %s", strerror(errno));
 	}
 
-	/* close open sockets */
-	for (sock = 0; sock <= conf->fd_max; sock++) {
-		if (FD_ISSET(sock, &conf->master)) {
-			if ((ret = close(sock)) == -1) {
-				error++;
-				MSG_ERROR(msg_module, "Cannot close socket: %s", strerror(errno));
+	/* close open connections */
+	while (conf->connections) {
+		conn = conf->connections;
+		conf->connections = conn->next;
+
+#ifdef TLS_SUPPORT
+		if (conf->tls) {
+			/* send close notify */
+			if (SSL_shutdown(conn->ssl) == -1) {
+				MSG_ERROR(msg_module, "Fatal error occured during TLS close notify");
 			}
 		}
+#endif
+
+		if ((ret = close(conn->socket)) == -1) {
+			error++;
+			MSG_ERROR(msg_module, "Cannot close socket: %s", strerror(errno));
+		}
+
+		/* move input infos to the list of old infos */
+		while (conn->infos) {
+			info_list = conn->infos->next;
+			conn->infos->next = conf->used_info_list;
+			conf->used_info_list = conn->infos;
+			conn->infos = info_list;
+		}
+
+		free_connection(conn);
 	}
 
-	destroy_sock_addresses(conf);
+	close(conf->epollfd);
 
 	/* free used input_info list */
+	while (conf->closed_list) {
+		info_list = conf->closed_list->next;
+		free_input_info(conf->closed_list);
+		conf->closed_list = info_list;
+	}
+
 	while (conf->used_info_list) {
 		info_list = conf->used_info_list->next;
-#ifdef TLS_SUPPORT
-		X509_free(conf->used_info_list->exporter_cert);
-#endif
-		free(conf->used_info_list);
+		free_input_info(conf->used_info_list);
 		conf->used_info_list = info_list;
 	}
 
+#ifdef TLS_SUPPORT
+	if (conf->tls) {
+		/* we are done here */
+		SSL_CTX_free(conf->ctx);
+	}
+#endif
+
 	/* free configuration strings */
 	if (conf->info.template_life_time != NULL) {
 		free(conf->info.template_life_time);
@@ -1450,7 +1410,7 @@ int input_close(void **config)
 #endif
 
 	/* free allocated structures */
-	FD_ZERO(&conf->master);
+	pthread_mutex_destroy(&conf->mutex);
 	free(*config);
 	convert_close();
 	*config = NULL;
@@ -47,6 +47,8 @@
  * @{
  */
 
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -69,6 +71,12 @@ IPFIXCOL_API_VERSION;
 /* input buffer length */
 #define BUFF_LEN 10000
 
+/* maximal number of datagrams received by one recvmmsg call */
+#define RECV_BATCH 32
+
+/* initial size of the input info hash table (power of two) */
+#define INFO_HASH_SIZE 64
+
 /* default port for udp collector */
 #define DEFAULT_PORT "4739"
 
@@ -87,6 +95,8 @@ struct input_info_list {
 	struct input_info_list *next;
 	uint32_t last_sent;
 	uint16_t packets_sent;
+	/* the fields above are shared with the conversion library */
+	struct input_info_list *hash_next; /**< next item in the hash table bucket */
 };
 
 /**
@@ -97,16 +107,24 @@ struct plugin_conf {
 	int socket; /**< listening socket */
 	struct input_info_network info; /**< infromation structure passed to collector */
 	struct input_info_list *info_list; /**< list of infromation structures passed to collector */
+	struct input_info_list **info_hash; /**< hash table of info_list (address, port, ODID) */
+	uint32_t info_hash_size; /**< number of buckets in info_hash */
+	uint32_t info_count; /**< number of items in info_list */
+	char *recv_buffers; /**< RECV_BATCH receive buffers reused by all recvmmsg calls */
+	struct mmsghdr recv_msgs[RECV_BATCH]; /**< recvmmsg headers */
+	struct iovec recv_iov[RECV_BATCH]; /**< recvmmsg buffers */
+	struct sockaddr_in6 recv_addr[RECV_BATCH]; /**< recvmmsg source addresses */
 };
 
 /**
- * \brief Input plugin initializtion function
+ * \brief Initialize one instance of the plugin
  *
  * \param[in]  params XML with input parameters
  * \param[out] config  Sets source and destination IP, destination port.
+ * \param[in]  reuse_port Share the local port with other instances (SO_REUSEPORT)
  * \return 0 on success, nonzero else.
  */
-int input_init(char *params, void **config)
+static int udp_init(char *params, void **config, int reuse_port)
 {
 	/* necessary structures */
 	struct addrinfo *addrinfo = NULL, hints;
@@ -114,7 +132,7 @@ int input_init(char *params, void **config)
 	char *port = NULL, *address = NULL;
 	int ai_family = AF_INET6; /* IPv6 is default */
 	char dst_addr[INET6_ADDRSTRLEN];
-	int ret, ipv6_only = 0, retval = 0;
+	int ret, ipv6_only = 0, retval = 0, yes = 1;
 
 	/* 1 when using default port - don't free memory */
 	int default_port = 0;
@@ -253,6 +271,13 @@ int input_init(char *params, void **config)
 		MSG_WARNING(msg_module, "Cannot turn off socket option IPV6_V6ONLY; plugin may not accept IPv4 connections...");
 	}
 
+	/* allow other instances to bind the same address; the kernel then keeps each exporter on one socket */
+	if (reuse_port && setsockopt(conf->socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+		MSG_ERROR(msg_module, "Cannot set socket option SO_REUSEPORT: %s", strerror(errno));
+		retval = 1;
+		goto out;
+	}
+
 	/* bind socket to address */
 	if (bind(conf->socket, addrinfo->ai_addr, addrinfo->ai_addrlen) != 0) {
 		MSG_ERROR(msg_module, "Cannot bind socket: %s", strerror(errno));
@@ -284,6 +309,24 @@ int input_init(char *params, void **config)
 		inet_ntop(AF_INET6, &conf->info.dst_addr.ipv6, dst_addr, INET6_ADDRSTRLEN);
 	}
 
+	/* prepare input info hash table and buffers for batched receiving */
+	conf->info_hash_size = INFO_HASH_SIZE;
+	conf->info_hash = calloc(conf->info_hash_size, sizeof(struct input_info_list *));
+	conf->recv_buffers = calloc(RECV_BATCH, BUFF_LEN);
+	if (conf->info_hash == NULL || conf->recv_buffers == NULL) {
+		MSG_ERROR(msg_module, "Cannot allocate memory: %s", strerror(errno));
+		retval = 1;
+		goto out;
+	}
+
+	int i;
+	for (i = 0; i < RECV_BATCH; i++) {
+		conf->recv_iov[i].iov_base = conf->recv_buffers + i * BUFF_LEN;
+		conf->recv_iov[i].iov_len = BUFF_LEN;
+		conf->recv_msgs[i].msg_hdr.msg_iov = &conf->recv_iov[i];
+		conf->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
 	if (convert_init(UDP_PLUGIN, BUFF_LEN) != 0) {
 		MSG_ERROR(msg_module, "Failed to initialize templates");
 		retval = 1;
@@ -334,12 +377,231 @@ out:
 		if (conf->info.options_template_life_packet != NULL) {
 			free (conf->info.options_template_life_packet);
 		}
+		free(conf->info_hash);
+		free(conf->recv_buffers);
 		free(conf);
 	}
 
 	return retval;
 }
 
+/**
+ * \brief Input plugin initializtion function
+ *
+ * \param[in]  params XML with input parameters
+ * \param[out] config  Sets source and destination IP, destination port.
+ * \return 0 on success, nonzero else.
+ */
+int input_init(char *params, void **config)
+{
+	return udp_init(params, config, 0);
+}
+
+/**
+ * \brief Input plugin initializtion function for parallel receiving
+ *
+ * Every instance has its own socket bound with SO_REUSEPORT. The kernel
+ * distributes datagrams among the sockets by hashing the source address and
+ * port, so one exporter is always received by the same instance.
+ *
+ * \param[in]  params XML with input parameters
+ * \param[out] config  Sets source and destination IP, destination port.
+ * \return 0 on success, nonzero else.
+ */
+int input_init_parallel(char *params, void **config)
+{
+	return udp_init(params, config, 1);
+}
+
+/**
+ * \brief Fill source address of the datagram in the form used by input_info
+ *
+ * \param[in]  address Source address returned by recvfrom/recvmmsg
+ * \param[out] src_addr Source address
+ * \return source port in host byte order
+ */
+static inline uint16_t udp_source_addr(struct sockaddr_in6 *address, struct in6_addr *src_addr)
+{
+	memset(src_addr, 0, sizeof(struct in6_addr));
+
+	if (address->sin6_family == AF_INET) {
+		/* IPv4 address is stored in the first four bytes */
+		src_addr->s6_addr32[0] = ((struct sockaddr_in *) address)->sin_addr.s_addr;
+		return ntohs(((struct sockaddr_in *) address)->sin_port);
+	}
+
+	*src_addr = address->sin6_addr;
+	return ntohs(address->sin6_port);
+}
+
+/**
+ * \brief Compute hash of the (address, port, ODID) triplet (FNV-1a)
+ *
+ * \param[in] src_addr Source address
+ * \param[in] port Source port
+ * \param[in] odid Observation Domain ID
+ * \return hash
+ */
+static inline uint32_t udp_info_hash(const struct in6_addr *src_addr, uint16_t port, uint32_t odid)
+{
+	const uint8_t *ptr = (const uint8_t *) src_addr;
+	uint32_t hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		hash = (hash ^ ptr[i]) * 16777619U;
+	}
+
+	hash = (hash ^ port) * 16777619U;
+	hash = (hash ^ odid) * 16777619U;
+
+	return hash;
+}
+
+/**
+ * \brief Double the size of the input info hash table
+ *
+ * The table keeps working with the old size when the allocation fails.
+ *
+ * \param[in,out] conf Plugin configuration
+ */
+static void udp_info_hash_resize(struct plugin_conf *conf)
+{
+	uint32_t new_size = conf->info_hash_size * 2, i, idx;
+	struct input_info_list **new_hash, *item, *next;
+	struct in6_addr src_addr;
+
+	new_hash = calloc(new_size, sizeof(struct input_info_list *));
+	if (new_hash == NULL) {
+		MSG_WARNING(msg_module, "Cannot enlarge hash table of exporters: %s", strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < conf->info_hash_size; i++) {
+		for (item = conf->info_hash[i]; item != NULL; item = next) {
+			next = item->hash_next;
+			/* input_info_network is packed, do not use a pointer to the member */
+			memcpy(&src_addr, &item->info.src_addr.ipv6, sizeof(src_addr));
+			idx = udp_info_hash(&src_addr, item->info.src_port, item->info.odid) & (new_size - 1);
+			item->hash_next = new_hash[idx];
+			new_hash[idx] = item;
+		}
+	}
+
+	free(conf->info_hash);
+	conf->info_hash = new_hash;
+	conf->info_hash_size = new_size;
+}
+
+/**
+ * \brief Find input info of the exporter or create a new one
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in] address Source address of the datagram
+ * \param[in] odid Observation Domain ID from the packet header
+ * \return input info, NULL on memory allocation error
+ */
+static struct input_info_list *udp_info_get(struct plugin_conf *conf, struct sockaddr_in6 *address, uint32_t odid)
+{
+	struct in6_addr src_addr;
+	struct input_info_list *info_list;
+	uint16_t port = udp_source_addr(address, &src_addr);
+	uint32_t hash = udp_info_hash(&src_addr, port, odid);
+
+	for (info_list = conf->info_hash[hash & (conf->info_hash_size - 1)]; info_list != NULL; info_list = info_list->hash_next) {
+		if (info_list->info.src_port == port && info_list->info.odid == odid
+				&& memcmp(&info_list->info.src_addr.ipv6, &src_addr, sizeof(src_addr)) == 0) {
+			info_list->info.status = SOURCE_STATUS_OPENED;
+			return info_list;
+		}
+	}
+
+	MSG_INFO(msg_module, "New UDP exporter connected (unique adress, port, ODID)");
+
+	/* create new input_info */
+	info_list = calloc(1, sizeof(struct input_info_list));
+	if (info_list == NULL) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	memcpy(&info_list->info, &conf->info, sizeof(struct input_info_network));
+
+	info_list->info.status = SOURCE_STATUS_NEW;
+	info_list->info.odid = odid;
+	info_list->info.src_addr.ipv6 = src_addr;
+	info_list->info.src_port = port;
+
+	/* add to list */
+	info_list->next = conf->info_list;
+	info_list->packets_sent = 1;
+	conf->info_list = info_list;
+
+	/* add to hash table */
+	if (++conf->info_count > conf->info_hash_size) {
+		udp_info_hash_resize(conf);
+	}
+
+	info_list->hash_next = conf->info_hash[hash & (conf->info_hash_size - 1)];
+	conf->info_hash[hash & (conf->info_hash_size - 1)] = info_list;
+
+	return info_list;
+}
+
+/**
+ * \brief Check and convert received datagram and find its input info
+ *
+ * \param[in,out] conf Plugin configuration
+ * \param[in,out] packet Received datagram, at least BUFF_LEN long when it is not IPFIX
+ * \param[in] len Length of the datagram
+ * \param[in] address Source address of the datagram
+ * \param[out] info Input info of the exporter
+ * \param[out] source_status Status of the source
+ * \return the length of packet on success, INPUT_INTR when the datagram should be skipped
+ */
+static int udp_process_datagram(struct plugin_conf *conf, char **packet, ssize_t len,
+		struct sockaddr_in6 *address, struct input_info **info, int *source_status)
+{
+	struct input_info_list *info_list;
+
+	if (len < IPFIX_HEADER_LENGTH) {
+		MSG_WARNING(msg_module, "Packet header is incomplete; skipping message...");
+		return INPUT_INTR;
+	}
+
+	/* Try to convert packet from Netflow v5/v9/sflow to IPFIX */
+	if (htons(((struct ipfix_header *) (*packet))->version) != IPFIX_VERSION) {
+		if (convert_packet(packet, &len, BUFF_LEN, (char *) conf->info_list) != 0) {
+			MSG_WARNING(msg_module, "Message conversion error; skipping message...");
+			return INPUT_INTR;
+		}
+	}
+
+	/* Check if lengths are the same */
+	if (len < htons(((struct ipfix_header *) *packet)->length)) {
+		return INPUT_INTR;
+	} else if (len > htons(((struct ipfix_header *) *packet)->length)) {
+		len = htons(((struct ipfix_header *) *packet)->length);
+	}
+
+	info_list = udp_info_get(conf, address, ntohl(((struct ipfix_header *) *packet)->observation_domain_id));
+	if (info_list == NULL) {
+		return INPUT_INTR;
+	}
+
+	if (info_list->info.status == SOURCE_STATUS_NEW) {
+		info_list->last_sent = ((struct ipfix_header *)(*packet))->export_time;
+	}
+
+	/* Set source status */
+	*source_status = info_list->info.status;
+
+	/* pass info to the collector */
+	*info = (struct input_info*) info_list;
+
+	return len;
+}
+
 /**
  * \brief Pass input data from the input plugin into the ipfixcol core.
  *
@@ -362,11 +624,10 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 	socklen_t addr_len = sizeof(struct sockaddr_in6);
 	struct sockaddr_in6 address;
 	struct plugin_conf *conf = config;
-	struct input_info_list *info_list;
 
 	/* allocate memory for packet, if needed */
 	if (!*packet) {
-		*packet = malloc(max_msg_len);
+		*packet = message_pool_alloc(max_msg_len);
 		if (!*packet) {
 			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 			return INPUT_ERROR;
@@ -384,95 +645,80 @@ int get_packet(void *config, struct input_info **info, char **packet, int *sourc
 		return INPUT_ERROR;
 	}
 
-	if (len < IPFIX_HEADER_LENGTH) {
-		MSG_WARNING(msg_module, "Packet header is incomplete; skipping message...");
-		return INPUT_INTR;
-	}
+	return udp_process_datagram(conf, packet, len, &address, info, source_status);
+}
 
-	/* Try to convert packet from Netflow v5/v9/sflow to IPFIX */
-	if (htons(((struct ipfix_header *) (*packet))->version) != IPFIX_VERSION) {
-		if (convert_packet(packet, &len, max_msg_len, (char *) conf->info_list) != 0) {
-			MSG_WARNING(msg_module, "Message conversion error; skipping message...");
-			return INPUT_INTR;
-		}
-	}
+/**
+ * \brief Pass more packets from the input plugin into the ipfixcol core.
+ *
+ * Datagrams are received by one recvmmsg call into the receive buffers of the
+ * plugin, which are reused by every call. Each datagram is then copied into
+ * memory from the collector's message pool - IPFIX packets get a buffer of
+ * the exact size, other packets a buffer of BUFF_LEN bytes for the conversion.
+ *
+ * \param[in] config  plugin_conf structure
+ * \param[out] batch  Received packets
+ * \param[in] max     Size of the batch array
+ * \return number of packets in the batch, INPUT_INTR when nothing was received
+ *  or INPUT_ERROR on error.
+ */
+int get_packet_batch(void *config, struct input_packet *batch, int max)
+{
+	struct plugin_conf *conf = config;
+	int received, i, count = 0;
+	ssize_t len;
+	char *packet;
 
-	/* Check if lengths are the same */
-	if (len < htons(((struct ipfix_header *) *packet)->length)) {
-		return INPUT_INTR;
-	} else if (len > htons(((struct ipfix_header *) *packet)->length)) {
-		len = htons(((struct ipfix_header *) *packet)->length);
+	if (max > RECV_BATCH) {
+		max = RECV_BATCH;
 	}
 
-	/* Loop over input_info_list */
-	for (info_list = conf->info_list; info_list != NULL; info_list = info_list->next) {
-		/* Ports must match */
-		if (info_list->info.src_port == ntohs(((struct sockaddr_in*) &address)->sin_port)) {
-			/* ODIDs must match */
-			if (info_list->info.odid == ntohl(((struct ipfix_header *) *packet)->observation_domain_id)) {
-				/* Compare addresses, dependent on IP protocol version*/
-				if (info_list->info.l3_proto == 4) {
-					if (info_list->info.src_addr.ipv4.s_addr == ((struct sockaddr_in*) &address)->sin_addr.s_addr) {
-						break;
-					}
-				} else {
-					if (info_list->info.src_addr.ipv6.s6_addr32[0] == address.sin6_addr.s6_addr32[0]
-							&& info_list->info.src_addr.ipv6.s6_addr32[1] == address.sin6_addr.s6_addr32[1]
-							&& info_list->info.src_addr.ipv6.s6_addr32[2] == address.sin6_addr.s6_addr32[2]
-							&& info_list->info.src_addr.ipv6.s6_addr32[3] == address.sin6_addr.s6_addr32[3]) {
-						break;
-					}
-				}
-			}
-		}
+	for (i = 0; i < max; i++) {
+		conf->recv_msgs[i].msg_hdr.msg_name = &conf->recv_addr[i];
+		conf->recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
 	}
 
-	/* check whether we found the input_info */
-	if (info_list == NULL) {
-		MSG_INFO(msg_module, "New UDP exporter connected (unique adress, port, ODID)");
-
-		/* create new input_info */
-		info_list = calloc(1, sizeof(struct input_info_list));
-		memcpy(&info_list->info, &conf->info, sizeof(struct input_info_network));
+	/* wait for the first datagram, then take all that are already queued */
+	received = recvmmsg(conf->socket, conf->recv_msgs, max, MSG_WAITFORONE, NULL);
+	if (received == -1) {
+		if (errno == EINTR) {
+			return INPUT_INTR;
+		}
 
-		info_list->info.status = SOURCE_STATUS_NEW;
-		info_list->info.odid = ntohl(((struct ipfix_header *) *packet)->observation_domain_id);
+		MSG_ERROR(msg_module, "Failed to receive packets: %s", strerror(errno));
+		return INPUT_ERROR;
+	}
 
-		/* copy address and port */
-		if (address.sin6_family == AF_INET) {
-			/* copy src IPv4 address */
-			info_list->info.src_addr.ipv4.s_addr =
-					((struct sockaddr_in*) &address)->sin_addr.s_addr;
+	for (i = 0; i < received; i++) {
+		len = conf->recv_msgs[i].msg_len;
 
-			/* copy port */
-			info_list->info.src_port = ntohs(((struct sockaddr_in*)  &address)->sin_port);
+		/* Conversion to IPFIX needs space for additional sets */
+		if (len >= IPFIX_HEADER_LENGTH
+				&& htons(((struct ipfix_header *) conf->recv_iov[i].iov_base)->version) == IPFIX_VERSION) {
+			packet = message_pool_alloc(len);
 		} else {
-			/* copy src IPv6 address */
-			int i;
-			for (i = 0; i < 4; i++) {
-				info_list->info.src_addr.ipv6.s6_addr32[i] = address.sin6_addr.s6_addr32[i];
-			}
+			packet = message_pool_alloc(BUFF_LEN);
+		}
 
-			/* copy port */
-			info_list->info.src_port = ntohs(address.sin6_port);
+		if (packet == NULL) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			break;
 		}
 
-		/* add to list */
-		info_list->next = conf->info_list;
-		info_list->last_sent = ((struct ipfix_header *)(*packet))->export_time;
-		info_list->packets_sent = 1;
-		conf->info_list = info_list;
-	} else {
-		info_list->info.status = SOURCE_STATUS_OPENED;
-	}
+		memcpy(packet, conf->recv_iov[i].iov_base, len);
 
-	/* Set source status */
-	*source_status = info_list->info.status;
+		batch[count].length = udp_process_datagram(conf, &packet, len, &conf->recv_addr[i],
+				&batch[count].info, &batch[count].source_status);
+		if (batch[count].length < 0) {
+			message_pool_free(packet);
+			continue;
+		}
 
-	/* pass info to the collector */
-	*info = (struct input_info*) info_list;
+		batch[count].packet = packet;
+		count++;
+	}
 
-	return len;
+	return (count > 0) ? count : INPUT_INTR;
 }
 
 /**
@@ -499,6 +745,8 @@ int input_close(void **config)
 		free(conf->info_list);
 		conf->info_list = info_list;
 	}
+	free(conf->info_hash);
+	free(conf->recv_buffers);
 
 	/* free configuration strings */
 	if (conf->info.template_life_time != NULL) {
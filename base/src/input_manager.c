@@ -0,0 +1,288 @@
+/**
+ * \file input_manager.c
+ * \brief Parallel input threads
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <libxml/tree.h>
+#include <ipfixcol.h>
+
+#include "configurator.h"
+#include "preprocessor.h"
+#include "input_manager.h"
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "input manager";
+
+/** Signal used to interrupt blocking get_packet() of the input threads */
+#define INPUT_WAKEUP_SIGNAL SIGUSR2
+
+/** Delay between repeated wakeup signals when stopping a thread (ns) */
+#define INPUT_STOP_DELAY 10000000
+
+/* Input thread */
+struct input_thread {
+	pthread_t thread;           /**< Thread handle */
+	unsigned int id;            /**< Thread number (main loop is 0) */
+	struct input *input;        /**< Input plugin routines */
+	char *params;               /**< Plugin parameters */
+	void *config;               /**< Configuration of the plugin instance */
+	sem_t ready;                /**< Posted when the instance is initialized */
+	int init_retval;            /**< Result of the initialization */
+	volatile int stop;          /**< Stop request */
+	volatile int done;          /**< Thread left the receive loop */
+	char thread_name[16];       /**< Thread name */
+};
+
+/* Running input threads */
+static struct input_thread **threads = NULL;
+static int threads_cnt = 0;
+
+/**
+ * \brief Wakeup signal handler
+ *
+ * Does nothing, the signal only interrupts blocking calls of the input plugin.
+ */
+static void input_wakeup_handler(int sig)
+{
+	(void) sig;
+}
+
+/**
+ * \brief Input thread
+ *
+ * Initializes its own instance of the input plugin and passes received data
+ * to the preprocessor in the same way as the main loop.
+ *
+ * \param[in] arg input_thread structure
+ * \return NULL
+ */
+static void *input_thread(void *arg)
+{
+	struct input_thread *conf = (struct input_thread *) arg;
+	struct input_packet batch[INPUT_BATCH_SIZE];
+	int i, count;
+	sigset_t set;
+
+	prctl(PR_SET_NAME, conf->thread_name, 0, 0, 0);
+
+	/* Only the wakeup signal is delivered to this thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	sigemptyset(&set);
+	sigaddset(&set, INPUT_WAKEUP_SIGNAL);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+	/* Conversion state of the plugin is per thread, initialize the instance here */
+	conf->init_retval = conf->input->init_parallel(conf->params, &(conf->config));
+	sem_post(&conf->ready);
+	if (conf->init_retval != 0) {
+		return NULL;
+	}
+
+	while (!conf->stop && !terminating) {
+		count = input_manager_receive(conf->input, conf->config, batch, INPUT_BATCH_SIZE);
+
+		for (i = 0; i < count; ++i) {
+			preprocessor_parse_msg(batch[i].packet, batch[i].length, batch[i].info, batch[i].source_status);
+		}
+	}
+
+	conf->done = 1;
+
+	/* Free the preprocessing shard of this thread */
+	preprocessor_close();
+
+	return NULL;
+}
+
+/**
+ * \brief Receive packets from an instance of the input plugin
+ */
+int input_manager_receive(struct input *input, void *config, struct input_packet *batch, int max)
+{
+	int retval;
+
+	if (input->get_batch) {
+		return input->get_batch(config, batch, max);
+	}
+
+	batch[0].info = NULL;
+	batch[0].packet = NULL;
+	batch[0].source_status = SOURCE_STATUS_OPENED;
+
+	retval = input->get(config, &(batch[0].info), &(batch[0].packet), &(batch[0].source_status));
+	if (retval < 0 || retval == INPUT_CLOSED) {
+		/* No data received (probably interrupted by a signal) or closed connection */
+		if (batch[0].packet) {
+			message_pool_free(batch[0].packet);
+			batch[0].packet = NULL;
+		}
+
+		if (retval < 0) {
+			return retval;
+		}
+	}
+
+	batch[0].length = retval;
+	return 1;
+}
+
+/**
+ * \brief Stop input thread and free its resources
+ *
+ * \param[in] conf input thread
+ */
+static void input_thread_destroy(struct input_thread *conf)
+{
+	struct timespec delay = {0, INPUT_STOP_DELAY};
+
+	if (conf->init_retval == 0) {
+		conf->stop = 1;
+
+		/* Signal may come before the thread blocks in get_packet(), repeat it */
+		while (!conf->done) {
+			pthread_kill(conf->thread, INPUT_WAKEUP_SIGNAL);
+			nanosleep(&delay, NULL);
+		}
+	}
+
+	pthread_join(conf->thread, NULL);
+
+	if (conf->config) {
+		conf->input->close(&(conf->config));
+	}
+
+	sem_destroy(&conf->ready);
+	free(conf->params);
+	free(conf);
+}
+
+/**
+ * \brief Start additional input threads
+ */
+int input_manager_start(configurator *config)
+{
+	struct sigaction action;
+	xmlChar *plugin_params;
+	int i, size;
+
+	if (config->input_threads <= 1 || config->input.init_parallel == NULL) {
+		return 0;
+	}
+
+	/* Install wakeup signal handler (without SA_RESTART) */
+	memset(&action, 0, sizeof(action));
+	sigemptyset(&action.sa_mask);
+	action.sa_handler = input_wakeup_handler;
+	sigaction(INPUT_WAKEUP_SIGNAL, &action, NULL);
+
+	threads = calloc(config->input_threads - 1, sizeof(struct input_thread *));
+	if (!threads) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	/* Plugins are initialized one by one, plugin init is not expected to be reentrant */
+	for (i = 1; i < config->input_threads; ++i) {
+		struct input_thread *conf = calloc(1, sizeof(struct input_thread));
+		if (!conf) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			goto err;
+		}
+
+		xmlDocDumpMemory(config->input.xml_conf->xmldata, &plugin_params, &size);
+		conf->params = strdup((char *) plugin_params);
+		xmlFree(plugin_params);
+
+		conf->id = i;
+		conf->input = &(config->input);
+		snprintf(conf->thread_name, sizeof(conf->thread_name), "in:%u", conf->id);
+		sem_init(&conf->ready, 0, 0);
+
+		if (!conf->params || pthread_create(&conf->thread, NULL, input_thread, conf) != 0) {
+			MSG_ERROR(msg_module, "Unable to create input thread %u", conf->id);
+			sem_destroy(&conf->ready);
+			free(conf->params);
+			free(conf);
+			goto err;
+		}
+
+		threads[threads_cnt++] = conf;
+
+		/* Wait for the initialization of the plugin instance */
+		while (sem_wait(&conf->ready) == -1 && errno == EINTR);
+
+		if (conf->init_retval != 0) {
+			MSG_ERROR(msg_module, "Input plugin initialization failed in thread %u", conf->id);
+			goto err;
+		}
+	}
+
+	MSG_INFO(msg_module, "Receiving data in %d input threads", config->input_threads);
+	return 0;
+
+err:
+	input_manager_stop();
+	return 1;
+}
+
+/**
+ * \brief Stop all additional input threads
+ */
+void input_manager_stop(void)
+{
+	int i;
+
+	if (!threads) {
+		return;
+	}
+
+	for (i = 0; i < threads_cnt; ++i) {
+		input_thread_destroy(threads[i]);
+	}
+
+	free(threads);
+	threads = NULL;
+	threads_cnt = 0;
+}
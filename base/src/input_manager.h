@@ -0,0 +1,92 @@
+/**
+ * \file input_manager.h
+ * \brief Parallel input threads
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef INPUT_MANAGER_H_
+#define INPUT_MANAGER_H_
+
+#include "configurator.h"
+
+/** Maximal number of packets received from the input plugin by one call */
+#define INPUT_BATCH_SIZE 32
+
+/**
+ * \addtogroup internalAPIs
+ *
+ * Additional input threads. Each thread runs its own instance of the input
+ * plugin (see input_init_parallel()) and its own preprocessing shard and
+ * writes into the common preprocessor output queue. The first instance is
+ * still handled by the main loop.
+ *
+ * @{
+ */
+
+/**
+ * \brief Receive packets from an instance of the input plugin
+ *
+ * Uses get_packet_batch() when the plugin provides it and get_packet()
+ * otherwise. Packet of a closed source is always NULL.
+ *
+ * \param[in] input Input plugin routines
+ * \param[in] config Configuration of the plugin instance
+ * \param[out] batch Received packets
+ * \param[in] max Size of the batch array
+ * \return number of received packets, negative value when nothing was received
+ */
+int input_manager_receive(struct input *input, void *config, struct input_packet *batch, int max);
+
+/**
+ * \brief Start additional input threads
+ *
+ * Nothing is started when the input plugin does not support parallel
+ * receiving or only one input thread is configured.
+ *
+ * \param[in] config configurator
+ * \return 0 on success
+ */
+int input_manager_start(configurator *config);
+
+/**
+ * \brief Stop all additional input threads and close their plugin instances
+ *
+ * Must be called before the input plugin is closed or reconfigured.
+ */
+void input_manager_stop(void);
+
+/**@}*/
+
+#endif /* INPUT_MANAGER_H_ */
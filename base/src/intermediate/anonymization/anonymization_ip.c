@@ -57,8 +57,7 @@
 
 #include <ipfixcol.h>
 
-#include "Crypto-PAn/panonymizer.h"
-#include <ipfixcol.h>
+#include "cryptopan.h"
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
@@ -114,9 +113,20 @@ struct anonymization_ip_config {
 	uint8_t type;         /* anonymization type */
 	uint32_t ip_id;       /* Intermediate plugin source ID into template manager */
 	char *key;            /* Anonymization key */
+	uint32_t cache_size;  /* Number of cached Crypto-PAn prefixes */
+	struct cryptopan cryptopan; /* Crypto-PAn anonymizer */
 	struct ipfix_template_mgr *tm;
 };
 
+/** anonymized fields of a data set, resolved once per data set */
+struct anonymization_set {
+	struct anonymization_ip_config *conf;
+	uint32_t odid;
+	int count;                                  /* number of fields */
+	int fields[entities_array_length];          /* field indexes in template */
+	struct ipfix_entity *entities[entities_array_length];
+};
+
 /**
  * \brief Truncate IPv4 address
  *
@@ -166,6 +176,8 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 		return -1;
 	}
 
+	conf->cache_size = CRYPTOPAN_CACHE_DEFAULT;
+
 	/* parse params */
 	xmlDoc *doc = NULL;
 	xmlNode *root_element = NULL;
@@ -219,6 +231,18 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 			} else if (xmlStrEqual(cur_node->name, BAD_CAST "key")) { /* anonymization key */
 				/* tmp_val must not be freed here since value must remain in conf->key */
 				conf->key = tmp_val;
+			} else if (xmlStrEqual(cur_node->name, BAD_CAST "cacheSize")) { /* number of cached prefixes */
+				char *end;
+				long cache_size = strtol(tmp_val, &end, 10);
+				if (*end != '\0' || cache_size < 0) {
+					MSG_ERROR(msg_module, "Invalid cache size (%s)", tmp_val);
+					free(tmp_val);
+					retval = 1;
+					goto out;
+				}
+
+				conf->cache_size = cache_size;
+				free(tmp_val);
 			} else {
 				MSG_WARNING(msg_module, "Unknown plugin configuration key ('%s')", cur_node->name);
 				free(tmp_val);
@@ -242,11 +266,20 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 			}
 			fclose(fr);
 
-			PAnonymizer_Init(rnd_key);
+			if (cryptopan_init(&conf->cryptopan, rnd_key, conf->cache_size, 1)) {
+				MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+				retval = 1;
+				goto out;
+			}
 		} else {
 			/* Check key length */
 			if (strlen(conf->key) == 32) {
-				PAnonymizer_Init((uint8_t *) conf->key);
+				if (cryptopan_init(&conf->cryptopan, (uint8_t *) conf->key, conf->cache_size, 1)) {
+					MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+					retval = 1;
+					free(conf->key);
+					goto out;
+				}
 			} else {
 				MSG_ERROR(msg_module, "Key with invalid length provided (%s); must be 32 bytes", conf->key);
 				retval = 1;
@@ -255,7 +288,8 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 			}
 		}
 		
-		MSG_DEBUG(msg_module, "Crypto-PAn library initialized");
+		MSG_DEBUG(msg_module, "Crypto-PAn library initialized (%s, %u cached prefixes)",
+				conf->cryptopan.aesni ? "AES-NI" : "software AES", conf->cryptopan.cache_mask ? conf->cryptopan.cache_mask + 1 : 0);
 	}
 
 	conf->params = params;
@@ -281,9 +315,82 @@ out:
 	return retval;
 }
 
+/**
+ * \brief Anonymize one address in place
+ *
+ * \param[in] conf Plugin configuration
+ * \param[in,out] data Address in network byte order
+ * \param[in] ip_version IP version of the address
+ */
+static inline void anonymize_address(struct anonymization_ip_config *conf, uint8_t *data, uint8_t ip_version)
+{
+	uint32_t addr;
+
+	if (ip_version == 4) {
+		if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
+			memcpy(&addr, data, 4);
+			addr = htonl(cryptopan_anonymize_v4(&conf->cryptopan, ntohl(addr)));
+			memcpy(data, &addr, 4);
+		} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
+			truncate_IPv4Address(data);
+		}
+	} else {
+		if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
+			cryptopan_anonymize_v6(&conf->cryptopan, data, data);
+		} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
+			truncate_IPv6Address(data);
+		}
+	}
+}
+
+/**
+ * \brief Anonymize addresses of one data record
+ *
+ * Callback for data_set_process_records(), fields are modified in place.
+ *
+ * \param[in] rec Data record
+ * \param[in] rec_len Data record's length
+ * \param[in] templ Data record's template
+ * \param[in] data Anonymized fields (struct anonymization_set)
+ */
+static void anonymize_record(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+{
+	struct anonymization_set *set = (struct anonymization_set *) data;
+	char ip_orig[INET6_ADDRSTRLEN];
+	char ip_anon[INET6_ADDRSTRLEN];
+	int i, offset, length, family;
+
+	for (i = 0; i < set->count; i++) {
+		offset = data_record_field_offset_at(rec, templ, set->fields[i], &length);
+		if (offset < 0 || offset + length > rec_len) {
+			continue;
+		}
+
+		if (length != (set->entities[i]->ip_version == 4 ? 4 : 16)) {
+			/* Reduced size encoding or wrong length, not an address */
+			continue;
+		}
+
+		if (verbose < ICMSG_DEBUG) {
+			anonymize_address(set->conf, rec + offset, set->entities[i]->ip_version);
+			continue;
+		}
+
+		family = (set->entities[i]->ip_version == 4) ? AF_INET : AF_INET6;
+		inet_ntop(family, rec + offset, ip_orig, INET6_ADDRSTRLEN);
+		anonymize_address(set->conf, rec + offset, set->entities[i]->ip_version);
+		inet_ntop(family, rec + offset, ip_anon, INET6_ADDRSTRLEN);
+
+		MSG_DEBUG(msg_module, "[%u] %s: %s -> %s", set->odid, set->entities[i]->entity_name, ip_orig, ip_anon);
+	}
+}
+
 /**
  * \brief Anonymization Intermediate Process
  *
+ * Fields with addresses are looked up once per data set, then the records
+ * are modified in place.
+ *
  * \param[in] config configuration structure
  * \param[in] message IPFIX message
  * \return 0 on success, negative value otherwise
@@ -293,16 +400,9 @@ int intermediate_process_message(void *config, void *message)
 	struct ipfix_message *msg;
 	struct ipfix_data_set *data_set;
 	struct ipfix_template *templ;
-	int index;
-	int ret;
-	uint8_t *p;
-	uint32_t *data;
-	uint8_t **data_records;
-	uint16_t data_records_index;
-	char ip_orig[INET6_ADDRSTRLEN];
-	char ip_anon[INET6_ADDRSTRLEN];
+	struct anonymization_set set;
+	int index, entities_index, field;
 	struct anonymization_ip_config *conf;
-	uint32_t odid;
 
 	conf = (struct anonymization_ip_config *) config;
 	msg = (struct ipfix_message *) message;
@@ -319,7 +419,9 @@ int intermediate_process_message(void *config, void *message)
 		return 0;
 	}
 
-	odid = ntohl(msg->pkt_header->observation_domain_id);
+	set.conf = conf;
+	set.odid = ntohl(msg->pkt_header->observation_domain_id);
+
 	index = 0;
 	while ((data_set = msg->data_couple[index].data_set) != NULL) {
 		templ = msg->data_couple[index].data_template;
@@ -329,113 +431,19 @@ int intermediate_process_message(void *config, void *message)
 			continue;
 		}
 
-		int entities_index = 0;
-		while (entities_index < entities_array_length) {
-			ret = template_contains_field(templ, entities_to_anonymize[entities_index].element_id);
-			if (ret >= 0) {
-				switch (entities_to_anonymize[entities_index].ip_version) {
-					case 4: {
-						/* iterate over data records and modify IP address fields */
-						data_records = get_data_records(data_set, templ);
-
-						data_records_index = 0;
-						while (data_records[data_records_index]) {
-							p = data_records[data_records_index];
-							message_get_data((uint8_t **) &data, p + ret, 4); /* IPv4 address is 4 octet integer */
-							inet_ntop(AF_INET, data, ip_orig, INET6_ADDRSTRLEN);
-
-							if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
-								/* anonymization type: cryptopan */
-								uint32_t new_addr;
-								uint32_t old_addr = (uint32_t) *data;
-
-								old_addr = ntohl(old_addr);
-
-								/* anonymize given IPv4 address using CryptoPAn */
-								new_addr = anonymize(old_addr);
-								new_addr = htonl(new_addr);
-
-								message_set_data(p + ret, (uint8_t *) &new_addr, 4);
-								inet_ntop(AF_INET, &new_addr, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s %s -> %s", odid, entities_to_anonymize[entities_index].entity_name,
-										ip_orig, ip_anon);
-
-								++data_records_index;
-								free(data);
-								continue;
-							} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
-								/* anonymization type: truncation */
-								truncate_IPv4Address((uint8_t *) data);
-								message_set_data(p + ret, (uint8_t *) data, 4);
-								inet_ntop(AF_INET, data, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s %s -> %s", odid, entities_to_anonymize[entities_index].entity_name,
-										ip_orig, ip_anon);
-
-								++data_records_index;
-								free(data);
-								continue;
-							} else {
-								/* Do nothing */
-							}
-						}
-
-						free(data_records);
-					}
-					break;
-					case 6: {
-						/* iterate over data records and modify fields with IP addresses */
-						data_records = get_data_records(data_set, templ);
-
-						data_records_index = 0;
-						while (data_records[data_records_index]) {
-							p = data_records[data_records_index];
-							message_get_data((uint8_t **) &data, p + ret, 16); /* IPv6 address is 16 octet integer */
-							inet_ntop(AF_INET6, data, ip_orig, INET6_ADDRSTRLEN);
-
-							if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
-								uint64_t *old_addr = (uint64_t *) data;
-								uint64_t new_addr[2];
-								anonymize_v6(old_addr, new_addr);
-
-								message_set_data(p + ret, (uint8_t *) new_addr, 16);
-								inet_ntop(AF_INET6, new_addr, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s: %s -> %s", odid,
-										entities_to_anonymize[entities_index].entity_name, ip_orig, ip_anon);
-
-								++data_records_index;
-								free(data);
-								continue;
-							} else if (conf->type == ANONYMIZATION_TYPE_TRUNCATION) {
-								/* anonymization type: truncation */
-								truncate_IPv6Address((uint8_t *) data);
-								message_set_data(p + ret, (uint8_t *) data, 16);
-								inet_ntop(AF_INET6, data, ip_anon, INET6_ADDRSTRLEN);
-
-								MSG_DEBUG(msg_module, "[%u] %s: %s -> %s", odid,
-										entities_to_anonymize[entities_index].entity_name, ip_orig, ip_anon);
-
-								free(data);
-								++data_records_index;
-								continue;
-							} else {
-								/* Do nothing */
-							}
-						}
-
-						free(data_records);
-					}
-					break;
-					default:
-						MSG_ERROR(msg_module, "[%u] Invalid address family", odid);
-						break;
-				} /* switch */
-			} /* if */
-
-			++entities_index;
-		} /* while */
+		set.count = 0;
+		for (entities_index = 0; entities_index < entities_array_length; entities_index++) {
+			field = template_get_field_index(templ, 0, entities_to_anonymize[entities_index].element_id);
+			if (field >= 0) {
+				set.fields[set.count] = field;
+				set.entities[set.count] = &entities_to_anonymize[entities_index];
+				set.count++;
+			}
+		}
+
+		if (set.count > 0) {
+			data_set_process_records(data_set, templ, anonymize_record, &set);
+		}
 
 		++index;
 	}
@@ -459,6 +467,12 @@ int intermediate_close(void *config)
 		free(conf->key);
 	}
 
+	if (conf->type == ANONYMIZATION_TYPE_CRYPTOPAN) {
+		MSG_DEBUG(msg_module, "Crypto-PAn prefix cache: %lu hits, %lu misses",
+				(unsigned long) conf->cryptopan.hits, (unsigned long) conf->cryptopan.misses);
+	}
+
+	cryptopan_free(&conf->cryptopan);
 	free(conf);
 	return 0;
 }
@@ -0,0 +1,339 @@
+/**
+ * \file cryptopan.c
+ * \brief Crypto-PAn with a prefix cache and batched AES-NI encryption
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptopan.h"
+#include "Crypto-PAn/panonymizer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRYPTOPAN_AESNI
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/** Number of blocks encrypted together by AES-NI */
+#define CRYPTOPAN_BATCH 8
+
+/** Maximal number of cached prefixes */
+#define CRYPTOPAN_CACHE_MAX (1 << 24)
+
+/**
+ * \brief Hash of cached prefix (finalizer of MurmurHash3)
+ */
+static inline uint32_t cryptopan_hash(uint64_t prefix)
+{
+	prefix ^= prefix >> 33;
+	prefix *= 0xFF51AFD7ED558CCDULL;
+	prefix ^= prefix >> 33;
+	prefix *= 0xC4CEB9FE1A85EC53ULL;
+	prefix ^= prefix >> 33;
+	return (uint32_t) prefix;
+}
+
+#ifdef CRYPTOPAN_AESNI
+/**
+ * \brief One step of AES-128 key expansion
+ */
+__attribute__((target("aes,sse2")))
+static inline __m128i cryptopan_expand_step(__m128i key, __m128i assist)
+{
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+#define CRYPTOPAN_EXPAND(key, rcon) \
+	cryptopan_expand_step((key), _mm_aeskeygenassist_si128((key), (rcon)))
+
+/**
+ * \brief Expand AES-128 key into round keys
+ *
+ * \param[out] cp Anonymizer
+ * \param[in] key First 16 bytes of the Crypto-PAn key
+ */
+__attribute__((target("aes,sse2")))
+static void cryptopan_aesni_init(struct cryptopan *cp, const uint8_t *key)
+{
+	__m128i *rk = (__m128i *) cp->round_keys;
+
+	rk[0] = _mm_loadu_si128((const __m128i *) key);
+	rk[1] = CRYPTOPAN_EXPAND(rk[0], 0x01);
+	rk[2] = CRYPTOPAN_EXPAND(rk[1], 0x02);
+	rk[3] = CRYPTOPAN_EXPAND(rk[2], 0x04);
+	rk[4] = CRYPTOPAN_EXPAND(rk[3], 0x08);
+	rk[5] = CRYPTOPAN_EXPAND(rk[4], 0x10);
+	rk[6] = CRYPTOPAN_EXPAND(rk[5], 0x20);
+	rk[7] = CRYPTOPAN_EXPAND(rk[6], 0x40);
+	rk[8] = CRYPTOPAN_EXPAND(rk[7], 0x80);
+	rk[9] = CRYPTOPAN_EXPAND(rk[8], 0x1b);
+	rk[10] = CRYPTOPAN_EXPAND(rk[9], 0x36);
+}
+
+/**
+ * \brief Evaluate the pseudorandom function with AES-NI
+ *
+ * Blocks are encrypted in groups of CRYPTOPAN_BATCH so that the rounds of
+ * independent blocks overlap in the pipeline.
+ *
+ * \param[in] cp Anonymizer
+ * \param[in] in Input blocks
+ * \param[in] count Number of blocks
+ * \param[out] bits The most significant bit of each encrypted block
+ */
+__attribute__((target("aes,sse2")))
+static void cryptopan_aesni_prf(const struct cryptopan *cp, uint8_t (*in)[16], int count, uint8_t *bits)
+{
+	const __m128i *rk = (const __m128i *) cp->round_keys;
+	__m128i blocks[CRYPTOPAN_BATCH];
+	int i, j, round, n;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < CRYPTOPAN_BATCH ? count - i : CRYPTOPAN_BATCH;
+
+		for (j = 0; j < n; j++) {
+			blocks[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in[i + j]), rk[0]);
+		}
+
+		for (round = 1; round < 10; round++) {
+			for (j = 0; j < n; j++) {
+				blocks[j] = _mm_aesenc_si128(blocks[j], rk[round]);
+			}
+		}
+
+		for (j = 0; j < n; j++) {
+			blocks[j] = _mm_aesenclast_si128(blocks[j], rk[10]);
+			bits[i + j] = _mm_movemask_epi8(blocks[j]) & 1;
+		}
+	}
+}
+#endif
+
+/**
+ * \brief Evaluate the pseudorandom function (AES-128) on a batch of blocks
+ *
+ * \param[in] cp Anonymizer
+ * \param[in] in Input blocks
+ * \param[in] count Number of blocks
+ * \param[out] bits The most significant bit of each encrypted block
+ */
+static void cryptopan_prf(const struct cryptopan *cp, uint8_t (*in)[16], int count, uint8_t *bits)
+{
+	uint8_t out[16];
+	int i;
+
+#ifdef CRYPTOPAN_AESNI
+	if (cp->aesni) {
+		cryptopan_aesni_prf(cp, in, count, bits);
+		return;
+	}
+#endif
+
+	for (i = 0; i < count; i++) {
+		Rijndael_blockEncrypt(in[i], 128, out);
+		bits[i] = out[0] >> 7;
+	}
+}
+
+/**
+ * \brief Initialize anonymizer
+ */
+int cryptopan_init(struct cryptopan *cp, const uint8_t *key, uint32_t cache_size, int aesni)
+{
+	uint32_t entries = 1;
+
+	memset(cp, 0, sizeof(*cp));
+
+	PAnonymizer_Init((uint8_t *) key);
+	Rijndael_blockEncrypt(key + 16, 128, cp->pad);
+
+#ifdef CRYPTOPAN_AESNI
+	if (aesni && __builtin_cpu_supports("aes")) {
+		cryptopan_aesni_init(cp, key);
+		cp->aesni = 1;
+	}
+#else
+	(void) aesni;
+#endif
+
+	if (cache_size == 0) {
+		return 0;
+	}
+
+	if (cache_size > CRYPTOPAN_CACHE_MAX) {
+		cache_size = CRYPTOPAN_CACHE_MAX;
+	}
+
+	while (entries < cache_size) {
+		entries <<= 1;
+	}
+
+	cp->v4_cache = calloc(entries, sizeof(struct cryptopan_v4_entry));
+	cp->v6_cache = calloc(entries, sizeof(struct cryptopan_v6_entry));
+	if (!cp->v4_cache || !cp->v6_cache) {
+		cryptopan_free(cp);
+		return 1;
+	}
+
+	cp->cache_mask = entries - 1;
+	return 0;
+}
+
+/**
+ * \brief Free anonymizer's caches
+ */
+void cryptopan_free(struct cryptopan *cp)
+{
+	free(cp->v4_cache);
+	free(cp->v6_cache);
+	cp->v4_cache = NULL;
+	cp->v6_cache = NULL;
+}
+
+/**
+ * \brief Anonymize IPv4 address
+ *
+ * Same algorithm as anonymize(): bit (31 - pos) of the one-time pad is the
+ * first bit of the encrypted block made of the upper pos bits of the address
+ * and the rest of the secret pad.
+ */
+uint32_t cryptopan_anonymize_v4(struct cryptopan *cp, uint32_t addr)
+{
+	uint8_t in[32][16], bits[32];
+	uint32_t pad4, input, result = 0, prefix = addr >> 8;
+	struct cryptopan_v4_entry *entry = NULL;
+	int pos, from = 0;
+
+	if (cp->v4_cache) {
+		entry = &cp->v4_cache[cryptopan_hash(prefix) & cp->cache_mask];
+		if (entry->prefix == prefix + 1) {
+			result = entry->pad;
+			from = 24;
+			cp->hits++;
+		} else {
+			cp->misses++;
+		}
+	}
+
+	pad4 = ((uint32_t) cp->pad[0] << 24) | ((uint32_t) cp->pad[1] << 16) |
+		((uint32_t) cp->pad[2] << 8) | (uint32_t) cp->pad[3];
+
+	for (pos = from; pos < 32; pos++) {
+		if (pos == 0) {
+			input = pad4;
+		} else {
+			input = ((addr >> (32 - pos)) << (32 - pos)) | ((pad4 << pos) >> pos);
+		}
+
+		memcpy(in[pos - from], cp->pad, 16);
+		in[pos - from][0] = (uint8_t) (input >> 24);
+		in[pos - from][1] = (uint8_t) (input >> 16);
+		in[pos - from][2] = (uint8_t) (input >> 8);
+		in[pos - from][3] = (uint8_t) input;
+	}
+
+	cryptopan_prf(cp, in, 32 - from, bits);
+
+	for (pos = from; pos < 32; pos++) {
+		result |= (uint32_t) bits[pos - from] << (31 - pos);
+	}
+
+	if (entry && from == 0) {
+		entry->prefix = prefix + 1;
+		entry->pad = result & 0xFFFFFF00;
+	}
+
+	return result ^ addr;
+}
+
+/**
+ * \brief Anonymize IPv6 address
+ *
+ * Same algorithm (including the bit order of the one-time pad) as
+ * anonymize_v6(). Bits of the first 8 bytes of the pad depend only on the
+ * first 8 bytes of the address.
+ */
+void cryptopan_anonymize_v6(struct cryptopan *cp, const uint8_t *addr, uint8_t *anon)
+{
+	uint8_t in[128][16], bits[128], result[16];
+	uint64_t prefix;
+	struct cryptopan_v6_entry *entry = NULL;
+	int pos, from = 0, left_byte, bit_num, i;
+
+	memset(result, 0, sizeof(result));
+	memcpy(&prefix, addr, sizeof(prefix));
+
+	if (cp->v6_cache) {
+		entry = &cp->v6_cache[cryptopan_hash(prefix) & cp->cache_mask];
+		if (entry->valid && entry->prefix == prefix) {
+			memcpy(result, &entry->pad, 8);
+			from = 64;
+			cp->hits++;
+		} else {
+			cp->misses++;
+		}
+	}
+
+	for (pos = from; pos < 128; pos++) {
+		bit_num = pos & 0x7;
+		left_byte = pos >> 3;
+
+		memcpy(in[pos - from], addr, left_byte);
+		in[pos - from][left_byte] = (uint8_t) ((addr[left_byte] >> (7 - bit_num) << (7 - bit_num)) | cp->pad[left_byte]);
+		memcpy(in[pos - from] + left_byte + 1, cp->pad + left_byte + 1, 15 - left_byte);
+	}
+
+	cryptopan_prf(cp, in, 128 - from, bits);
+
+	for (pos = from; pos < 128; pos++) {
+		result[pos >> 3] |= bits[pos - from] << (pos & 0x7);
+	}
+
+	if (entry && from == 0) {
+		memcpy(&entry->pad, result, 8);
+		entry->prefix = prefix;
+		entry->valid = 1;
+	}
+
+	for (i = 0; i < 16; i++) {
+		anon[i] = result[i] ^ addr[i];
+	}
+}
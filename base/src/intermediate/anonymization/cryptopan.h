@@ -0,0 +1,120 @@
+/**
+ * \file cryptopan.h
+ * \brief Crypto-PAn with a prefix cache and batched AES-NI encryption
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef CRYPTOPAN_H_
+#define CRYPTOPAN_H_
+
+#include <stdint.h>
+
+/** Default number of cached prefixes of each address family */
+#define CRYPTOPAN_CACHE_DEFAULT 16384
+
+/** Cached one-time pad of an IPv4 /24 prefix */
+struct cryptopan_v4_entry {
+	uint32_t prefix;        /**< Upper 24 bits of the address + 1, 0 for empty entry */
+	uint32_t pad;           /**< Upper 24 bits of the one-time pad */
+};
+
+/** Cached one-time pad of an IPv6 /64 prefix */
+struct cryptopan_v6_entry {
+	uint64_t prefix;        /**< First 8 bytes of the address */
+	uint64_t pad;           /**< First 8 bytes of the one-time pad */
+	uint8_t valid;          /**< Entry is used */
+};
+
+/**
+ * \brief Crypto-PAn anonymizer
+ *
+ * Produces the same addresses as anonymize() and anonymize_v6() from the
+ * Crypto-PAn library. Bits of the one-time pad of an address depend only on
+ * its prefix, so the pads of the upper 24 bits (IPv4) and 64 bits (IPv6) are
+ * kept in direct mapped caches and only the rest is computed for addresses
+ * from a cached prefix. The pseudorandom function is evaluated in batches,
+ * with AES-NI when the CPU supports it.
+ */
+struct cryptopan {
+	uint8_t round_keys[11 * 16] __attribute__((aligned(16))); /**< AES-128 round keys */
+	uint8_t pad[16];        /**< Secret pad */
+	int aesni;              /**< Use AES-NI */
+	uint32_t cache_mask;    /**< Number of cache entries - 1 */
+	struct cryptopan_v4_entry *v4_cache;
+	struct cryptopan_v6_entry *v6_cache;
+	uint64_t hits;          /**< Number of cache hits */
+	uint64_t misses;        /**< Number of cache misses */
+};
+
+/**
+ * \brief Initialize anonymizer
+ *
+ * Also initializes the Crypto-PAn library (PAnonymizer_Init()) with the
+ * same key, which is used when AES-NI is not available.
+ *
+ * \param[out] cp Anonymizer
+ * \param[in] key 32 bytes long key
+ * \param[in] cache_size Number of cached prefixes (rounded up to a power of two), 0 disables the cache
+ * \param[in] aesni Use AES-NI when the CPU supports it
+ * \return 0 on success, 1 otherwise
+ */
+int cryptopan_init(struct cryptopan *cp, const uint8_t *key, uint32_t cache_size, int aesni);
+
+/**
+ * \brief Free anonymizer's caches
+ *
+ * \param[in] cp Anonymizer
+ */
+void cryptopan_free(struct cryptopan *cp);
+
+/**
+ * \brief Anonymize IPv4 address
+ *
+ * \param[in] cp Anonymizer
+ * \param[in] addr Address in host byte order
+ * \return Anonymized address in host byte order
+ */
+uint32_t cryptopan_anonymize_v4(struct cryptopan *cp, uint32_t addr);
+
+/**
+ * \brief Anonymize IPv6 address
+ *
+ * \param[in] cp Anonymizer
+ * \param[in] addr Address in network byte order
+ * \param[out] anon Anonymized address in network byte order (may be the same as addr)
+ */
+void cryptopan_anonymize_v6(struct cryptopan *cp, const uint8_t *addr, uint8_t *anon);
+
+#endif /* CRYPTOPAN_H_ */
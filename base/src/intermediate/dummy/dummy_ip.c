@@ -107,6 +107,21 @@ int intermediate_process_message(void *config, void *message)
 	return 0;
 }
 
+/**
+ * \brief Do nothing, just pass all messages of the batch to the output queue
+ */
+int intermediate_process_batch(void *config, void **messages, int count)
+{
+	struct dummy_ip_config *conf;
+
+	conf = (struct dummy_ip_config *) config;
+
+	MSG_DEBUG(msg_module, "Received batch of %d IPFIX messages", count);
+
+	pass_messages(conf->ip_config, (struct ipfix_message **) messages, count);
+
+	return 0;
+}
 
 int intermediate_close(void *config)
 {
@@ -227,6 +227,16 @@ int intermediate_init(char *params, void *ip_config, uint32_t ip_id, struct ipfi
 			continue;
 		}
 
+		/* <zeroCopy> option */
+		if (!xmlStrcmp(profile->name, (const xmlChar *) "zeroCopy")) {
+			aux_char = xmlNodeListGetString(doc, profile->children, 1);
+			if (!xmlStrcasecmp(aux_char, (const xmlChar *) "true")) {
+				conf->zero_copy = true;
+			}
+			xmlFree(aux_char);
+			continue;
+		}
+
 		/* <removeOriginal>  option */
 		if (!xmlStrcmp(profile->name, (const xmlChar *) "removeOriginal")) {
 			aux_char = xmlNodeListGetString(doc, profile->children, 1);
@@ -796,6 +806,83 @@ struct ipfix_message *filter_apply_profile(struct ipfix_message *msg, struct fil
 	return new_msg;
 }
 
+/**
+ * \brief Apply profile filter on message and pass matching records as a view
+ *
+ * Records are selected by their metadata, the view shares the packet of the
+ * original message and it is copied only when a plugin needs a contiguous
+ * packet (see message_materialize()).
+ *
+ * \param[in] msg IPFIX message
+ * \param[in] profile Filter profile
+ * \return pointer to new ipfix message (view)
+ */
+struct ipfix_message *filter_apply_profile_view(struct ipfix_message *msg, struct filter_profile *profile)
+{
+	struct ipfix_message *view = NULL;
+	struct metadata *metadata = NULL;
+	struct ipfix_record *rec;
+	int i, records = 0;
+	uint16_t channels;
+
+	if (msg->source_status == SOURCE_STATUS_CLOSED || !msg->metadata || msg->data_records_count == 0) {
+		return filter_apply_profile(msg, profile);
+	}
+
+	metadata = message_pool_alloc(msg->data_records_count * sizeof(struct metadata));
+	if (!metadata) {
+		MSG_ERROR(msg_module, "Not enough memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	/* Select matching records */
+	for (i = 0; i < msg->data_records_count; ++i) {
+		rec = &(msg->metadata[i].record);
+		if (!rec->templ || !filter_fits_node(profile->root, rec->record, rec->templ)) {
+			continue;
+		}
+
+		metadata[records] = msg->metadata[i];
+		if (msg->metadata[i].channels) {
+			for (channels = 0; msg->metadata[i].channels[channels]; ++channels);
+
+			metadata[records].channels = calloc(channels + 1, sizeof(void *));
+			if (metadata[records].channels) {
+				memcpy(metadata[records].channels, msg->metadata[i].channels, channels * sizeof(void *));
+			}
+		}
+		records++;
+	}
+
+	if (records == 0) {
+		message_pool_free(metadata);
+
+		/* Template sets are still passed (as a copy) */
+		return msg->templ_set[0] || msg->opt_templ_set[0] ? filter_apply_profile(msg, profile) : NULL;
+	}
+
+	view = message_create_view(msg);
+	if (!view) {
+		for (i = 0; i < records; ++i) {
+			free(metadata[i].channels);
+		}
+		message_pool_free(metadata);
+		return NULL;
+	}
+
+	view->metadata = metadata;
+	view->data_records_count = records;
+
+	/* Modify header */
+	view->pkt_header->sequence_number = htonl(filter_profile_update_input_info(profile, msg->input_info, records));
+	view->pkt_header->observation_domain_id = htonl(profile->new_odid);
+	view->input_info = profile->input_info;
+
+	filter_copy_metainfo(msg, view);
+
+	return view;
+}
+
 int intermediate_process_message(void *config, void *message)
 {
 	struct ipfix_message *msg = (struct ipfix_message *) message, *new_msg;
@@ -821,7 +908,8 @@ int intermediate_process_message(void *config, void *message)
 
 		profiles++;
 
-		new_msg = filter_apply_profile(msg, aux_profile);
+		new_msg = conf->zero_copy ? filter_apply_profile_view(msg, aux_profile)
+				: filter_apply_profile(msg, aux_profile);
 		if (new_msg) {
 			pass_message(conf->ip_config, (void *) new_msg);
 		}
@@ -831,7 +919,8 @@ int intermediate_process_message(void *config, void *message)
 	if (!profiles) {
 		if (conf->default_profile) {
 			/* Use default profile */
-			new_msg = filter_apply_profile(msg, conf->default_profile);
+			new_msg = conf->zero_copy ? filter_apply_profile_view(msg, conf->default_profile)
+					: filter_apply_profile(msg, conf->default_profile);
 			if (new_msg) {
 				pass_message(conf->ip_config, (void *) new_msg);
 			}
@@ -96,6 +96,7 @@ struct filter_source {
  */
 struct filter_config {
 	bool remove_original;   /**< keep only filtered records */
+	bool zero_copy;         /**< pass filtered records as views of the original message */
 	void *ip_config;        /**< plugin configuration for IPFIXcol */
 	struct filter_profile *profiles;        /**< list of filter profiles */
 	struct filter_profile *default_profile; /**< default profile */
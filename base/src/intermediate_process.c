@@ -46,15 +46,101 @@
 #include <string.h>
 #include "queues.h"
 #include "intermediate_process.h"
+#include "telemetry.h"
 #include "config.h"
 #include <ipfixcol/intermediate.h>
 
 static char *msg_module = "intermediate_process";
 
+/**
+ * \brief Write all pending passed messages into the output queue.
+ *
+ * \param[in] conf configuration structure
+ * \return 0 on success
+ */
+static int ip_flush(struct intermediate *conf)
+{
+	int ret = 0;
+
+	if (conf->pending_count > 0) {
+		ret = rbuffer_write_batch(conf->out_queue, conf->pending, conf->pending_count, 1);
+		conf->pending_count = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Process batch of messages read from the input queue.
+ *
+ * Messages that are not dropped by the plugin are removed from the input
+ * queue without freeing them (it must be done later in output manager).
+ *
+ * \param[in] conf configuration structure
+ * \param[in] msgs messages
+ * \param[in] first index of the first message in the input queue
+ * \param[in] count number of messages
+ */
+static void ip_process_batch(struct intermediate *conf, struct ipfix_message **msgs, unsigned int first, int count)
+{
+	uint16_t size = conf->in_queue->size;
+	int i;
+
+	if (count <= 0) {
+		return;
+	}
+
+	if (!conf->views) {
+		/* Plugin needs contiguous packets */
+		for (i = 0; i < count; ++i) {
+			if (message_is_view(msgs[i])) {
+				message_materialize(msgs[i]);
+			}
+		}
+	}
+
+	if (conf->intermediate_process_batch) {
+		memcpy(conf->batch, msgs, count * sizeof(struct ipfix_message *));
+		memset(conf->batch_dropped, 0, count * sizeof(bool));
+		conf->batch_count = count;
+		conf->batch_next = 0;
+		conf->index = first;
+
+		conf->intermediate_process_batch(conf->plugin_config, (void **) conf->batch, count);
+		conf->batch_count = 0;
+
+		for (i = 0; i < count; ++i) {
+			if (!conf->batch_dropped[i]) {
+				rbuffer_remove_reference(conf->in_queue, (first + i) % size, 0);
+			}
+		}
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		/* batch of one message */
+		conf->batch[0] = msgs[i];
+		conf->batch_dropped[0] = false;
+		conf->batch_count = 1;
+		conf->batch_next = 0;
+		conf->index = (first + i) % size;
+
+		/* process message */
+		conf->intermediate_process_message(conf->plugin_config, msgs[i]);
+		conf->batch_count = 0;
+
+		if (!conf->batch_dropped[0]) {
+			rbuffer_remove_reference(conf->in_queue, conf->index, 0);
+		}
+	}
+}
+
 /**
  * \brief Wait for data from input queue in loop.
  *
  * This function runs in separated thread.
+ * Messages are read and processed in batches, messages passed by the plugin
+ * are written into the output queue after each batch.
  *
  * \param[in] config configuration structure
  * \return NULL
@@ -62,44 +148,53 @@ static char *msg_module = "intermediate_process";
 void *ip_loop(void *config)
 {
 	struct intermediate *conf = (struct intermediate *) config;
-	struct ipfix_message *msg;
-	unsigned int index;
+	struct ipfix_message *msgs[INTERMEDIATE_BATCH_SIZE];
+	struct telemetry_stage *stage;
+	unsigned int index, count, i, messages;
+	uint64_t start = 0, records;
 
 	prctl(PR_SET_NAME, conf->thread_name, 0, 0, 0);
+	stage = telemetry_stage_create(conf->thread_name);
 
 	/* wait for messages and process them */
 	while (1) {
 		index = -1;
 
-		/* get message from input buffer */
-		msg = rbuffer_read(conf->in_queue, &index);
-		
-		if (!msg) {
-			rbuffer_remove_reference(conf->in_queue, index, 1);
-			if (conf->new_in) {
-				/* Set new input queue */
-				conf->in_queue = conf->new_in;
-				conf->new_in = NULL;
-				pthread_cond_signal(&conf->in_q_cond);
-				continue;
+		/* get messages from input buffer (NULL message ends the batch) */
+		count = rbuffer_read_batch(conf->in_queue, &index, msgs, INTERMEDIATE_BATCH_SIZE);
+		messages = msgs[count - 1] ? count : count - 1;
+
+		records = 0;
+		if (stage) {
+			for (i = 0; i < messages; ++i) {
+				records += msgs[i]->data_records_count;
 			}
+			start = telemetry_now();
+		}
+
+		ip_process_batch(conf, msgs, index, messages);
+		telemetry_stage_add(stage, start, messages, records);
+		ip_flush(conf);
 
-			/* terminating mediator */
-			MSG_DEBUG(msg_module, "NULL message; terminating intermediate process %s...", conf->thread_name);
-			break;
+		if (messages == count) {
+			continue;
 		}
-		conf->index = index;
-		conf->dropped = false;
-		
-		/* process message */
-		conf->intermediate_process_message(conf->plugin_config, msg);
 
-		if (!conf->dropped) {
-			/* remove message from input queue, but do not free memory (it must be done later in output manager) */
-			rbuffer_remove_reference(conf->in_queue, index, 0);
+		rbuffer_remove_reference(conf->in_queue, (index + count - 1) % conf->in_queue->size, 1);
+		if (conf->new_in) {
+			/* Set new input queue */
+			conf->in_queue = conf->new_in;
+			conf->new_in = NULL;
+			pthread_cond_signal(&conf->in_q_cond);
+			continue;
 		}
+
+		/* terminating mediator */
+		MSG_DEBUG(msg_module, "NULL message; terminating intermediate process %s...", conf->thread_name);
+		break;
 	}
-	
+
+	telemetry_stage_release(stage);
 	return NULL;
 }
 
@@ -123,13 +218,14 @@ int ip_change_in_queue(struct intermediate* conf, struct ring_buffer* in_queue)
 }
 
 /**
- * \brief Initialize Intermediate Process.
+ * \brief Initialize intermediate plugin
+ *
+ * \param[in] conf intermediate plugin structure
+ * \param[in] ip_id source ID for creating templates
+ * \return 0 on success
  */
-int ip_init(struct intermediate *conf, uint32_t ip_id)
+static int ip_plugin_init(struct intermediate *conf, uint32_t ip_id)
 {
-	int ret;
-
-	/* Initialize plugin */
 	xmlChar *ip_params = NULL;
 	xmlDocDumpMemory(conf->xml_conf->xmldata, &ip_params, NULL);
 	
@@ -140,8 +236,19 @@ int ip_init(struct intermediate *conf, uint32_t ip_id)
 	}
 
 	free(ip_params);
-	
-	/* start main thread */
+	return 0;
+}
+
+/**
+ * \brief Start thread of the intermediate process
+ *
+ * \param[in] conf intermediate plugin structure
+ * \return 0 on success
+ */
+static int ip_start(struct intermediate *conf)
+{
+	int ret;
+
 	ret = pthread_create(&(conf->thread_id), NULL, ip_loop, (void *)conf);
 	if (ret != 0) {
 		MSG_ERROR(msg_module, "Unable to create thread for intermediate process");
@@ -151,13 +258,84 @@ int ip_init(struct intermediate *conf, uint32_t ip_id)
 	return 0;
 }
 
+/**
+ * \brief Initialize Intermediate Process.
+ */
+int ip_init(struct intermediate *conf, uint32_t ip_id)
+{
+	/* Initialize plugin */
+	if (ip_plugin_init(conf, ip_id) != 0) {
+		return -1;
+	}
+	
+	/* start main thread */
+	return ip_start(conf);
+}
+
+/**
+ * \brief Initialize Intermediate Process running in the thread of other one.
+ */
+int ip_fuse(struct intermediate *prev, struct intermediate *conf, uint32_t ip_id)
+{
+	struct intermediate *head = prev->fused_head ? prev->fused_head : prev;
+
+	if (ip_plugin_init(conf, ip_id) != 0) {
+		return -1;
+	}
+
+	/* Plugins can be linked only when the thread is not running */
+	ip_stop(head);
+
+	conf->fused_head = head;
+	conf->fused_next = prev->fused_next;
+	prev->fused_next = conf;
+
+	/* Time of the thread's stage includes fused plugins, they get own stages */
+	conf->stage = telemetry_stage_create(conf->thread_name);
+
+	/* Messages passed by the last plugin go to the output queue of the thread */
+	conf->in_queue = NULL;
+	conf->out_queue = head->out_queue;
+
+	MSG_INFO(msg_module, "Intermediate plugin '%s' runs in the thread '%s'", conf->xml_conf->name, head->thread_name);
+
+	return ip_start(head);
+}
+
+/**
+ * \brief Remove Intermediate Process from the thread of other one.
+ */
+int ip_unfuse(struct intermediate *conf)
+{
+	struct intermediate *head = conf->fused_head, *prev;
+
+	if (!head) {
+		return -1;
+	}
+
+	ip_stop(head);
+
+	for (prev = head; prev->fused_next != conf; prev = prev->fused_next) {}
+	prev->fused_next = conf->fused_next;
+
+	conf->fused_head = NULL;
+	conf->fused_next = NULL;
+	conf->out_queue = NULL;
+
+	telemetry_stage_release(conf->stage);
+	conf->stage = NULL;
+
+	return ip_start(head);
+}
+
 /**
  * \brief Pass processed IPFIX message to the output queue.
  */
 int pass_message(void *config, struct ipfix_message *msg)
 {
-	struct intermediate *conf;
-	int ret;
+	struct intermediate *conf, *head, *next;
+	uint64_t start = 0, records = 0;
+	int ret = 0;
 
 	conf = (struct intermediate *) config;
 
@@ -165,7 +343,46 @@ int pass_message(void *config, struct ipfix_message *msg)
 		MSG_WARNING(msg_module, "NULL message from intermediate plugin; skipping...");
 		return 0;
 	}
-	ret = rbuffer_write(conf->out_queue, msg, 1);
+
+	next = conf->fused_next;
+	if (next) {
+		/* Next plugin runs in the same thread, process the message directly */
+		if (!next->views && message_is_view(msg)) {
+			message_materialize(msg);
+		}
+
+		/* The message may be dropped by the plugin, count records first */
+		if (next->stage) {
+			records = msg->data_records_count;
+			start = telemetry_now();
+		}
+
+		ret = next->intermediate_process_message(next->plugin_config, msg);
+		telemetry_stage_add(next->stage, start, 1, records);
+		return ret;
+	}
+
+	head = conf->fused_head ? conf->fused_head : conf;
+	if (head->pending_count == INTERMEDIATE_BATCH_SIZE) {
+		ret = ip_flush(head);
+	}
+	head->pending[head->pending_count++] = msg;
+
+	return ret;
+}
+
+/**
+ * \brief Pass more processed IPFIX messages to the output queue.
+ */
+int pass_messages(void *config, struct ipfix_message **msgs, int count)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (pass_message(config, msgs[i]) != 0) {
+			ret = -1;
+		}
+	}
 
 	return ret;
 }
@@ -176,11 +393,29 @@ int pass_message(void *config, struct ipfix_message *msg)
 int drop_message(void *config, struct ipfix_message *msg)
 {
 	struct intermediate *conf = (struct intermediate *) config;
-	(void) msg;
+	int i, pos;
+
+	/* Messages from the input queue are processed by the head of fused plugins */
+	if (conf->fused_head) {
+		conf = conf->fused_head;
+	}
+
+	/* Messages are usually dropped in order, start where the last one was found */
+	for (i = 0; i < conf->batch_count; ++i) {
+		pos = (conf->batch_next + i) % conf->batch_count;
+		if (conf->batch[pos] == msg && !conf->batch_dropped[pos]) {
+			rbuffer_remove_reference(conf->in_queue, (conf->index + pos) % conf->in_queue->size, 1);
+			conf->batch_dropped[pos] = true;
+			conf->batch_next = pos + 1;
+			return 0;
+		}
+	}
+
+	/* Message created by some (fused) plugin, it is not stored in any queue */
+	if (msg) {
+		rbuffer_free_message(msg);
+	}
 
-	rbuffer_remove_reference(conf->in_queue, conf->index, 1);
-	conf->dropped = true;
-	
 	return 0;
 }
 
@@ -194,10 +429,12 @@ int ip_destroy(struct intermediate *conf)
 	}
 
 	/* free input queue (output queue will be freed by next intermediate process) */
+	telemetry_queue_remove(conf->in_queue);
 	rbuffer_free(conf->in_queue);
 
 	/* Close plugin */
 	conf->intermediate_close(conf->plugin_config);
+	telemetry_stage_release(conf->stage);
 
 	free(conf);
 
@@ -216,6 +453,11 @@ int ip_stop(struct intermediate *conf)
 		return -1;
 	}
 
+	if (conf->fused_head) {
+		/* Plugin is stopped together with its thread */
+		return 0;
+	}
+
 	/* wait for thread to terminate */
 	rbuffer_write(conf->in_queue, NULL, 1);
 	ret = pthread_join(conf->thread_id, &retval);
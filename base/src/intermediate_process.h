@@ -60,6 +60,30 @@
  */
 int ip_init(struct intermediate *conf, uint32_t ip_id);
 
+/**
+ * \brief Initialize Intermediate Process running in the thread of other one.
+ *
+ * The plugin does not get own thread nor input and output queues, messages
+ * passed by \p prev are processed directly by this plugin. The thread is
+ * restarted to link the plugins.
+ *
+ * \param[in] prev running intermediate process (or plugin fused with it)
+ * \param[in] conf intermediate plugin structure
+ * \param[in] ip_id source ID for creating templates
+ * \return 0 on success, negative value otherwise
+ */
+int ip_fuse(struct intermediate *prev, struct intermediate *conf, uint32_t ip_id);
+
+/**
+ * \brief Remove Intermediate Process from the thread of other one.
+ *
+ * The thread is restarted without the plugin. Plugin is not closed.
+ *
+ * \param[in] conf intermediate plugin structure
+ * \return 0 on success, negative value otherwise
+ */
+int ip_unfuse(struct intermediate *conf);
+
 /**
  * \brief Set new input queue
  * 
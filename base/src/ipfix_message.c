@@ -47,27 +47,6 @@
 /** Identifier to MSG_* macros */
 static char *msg_module = "ipfix_message";
 
-/* Field offsets */
-struct offset_field {
-	uint16_t offset_index;
-	uint16_t id;
-	uint16_t length;
-};
-
-/* IPFIX ID <-> OFFSET ID mapping */
-static struct offset_field offsets[] = {
-	/* OFFSET ID, IPFIX_ID, LENGTH */
-	{ OF_OCTETS,	1,	8  },
-	{ OF_PACKETS,	2,	8  },
-	{ OF_PROTOCOL,	4,	1  },
-	{ OF_SRCPORT,	7,	2  },
-	{ OF_DSTPORT,	11,	2  },
-	{ OF_SRCIPV4,	8,	4  },
-	{ OF_DSTIPV4,	12,	4  },
-	{ OF_SRCIPV6,	27,	16 },
-	{ OF_DSTIPV6,	28,	16 }
-};
-
 /* some auxiliary functions for extracting data of exact length */
 #define read8(ptr) (*((uint8_t *) (ptr)))
 #define read16(ptr) (*((uint16_t *) (ptr)))
@@ -89,11 +68,12 @@ struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_i
 	uint32_t odid;
 	uint16_t pktlen;
 
-	message = (struct ipfix_message*) calloc (1, sizeof(struct ipfix_message));
+	message = (struct ipfix_message*) message_pool_alloc(sizeof(struct ipfix_message));
 	if (!message) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
+	memset(message, 0, sizeof(struct ipfix_message));
 
 	message->pkt_header = (struct ipfix_header*) msg;
 	message->input_info = input_info;
@@ -106,7 +86,7 @@ struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_i
 	if (message->pkt_header->version != htons(IPFIX_VERSION)) {
 		MSG_WARNING(msg_module, "[%u] Unexpected IPFIX version detected (%X); skipping message...", odid,
 				message->pkt_header->version);
-		free(message);
+		message_pool_free(message);
 		return NULL;
 	}
 
@@ -115,7 +95,7 @@ struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_i
 	/* check whether message is not shorter than header says */
 	if ((uint16_t) len < pktlen) {
 		MSG_WARNING(msg_module, "[%u] Malformed IPFIX message detected (bad length); skipping message...", odid);
-		free (message);
+		message_pool_free(message);
 		return NULL;
 	}
 
@@ -129,7 +109,7 @@ struct ipfix_message *message_create_from_mem(void *msg, int len, struct input_i
 		set_header = (struct ipfix_set_header*) p;
 		if ((uint8_t *) p + ntohs(set_header->length) > (uint8_t *) msg + pktlen) {
 			MSG_WARNING(msg_module, "[%u] Malformed IPFIX message detected (bad length); skipping message...", odid);
-			free(message);
+			message_pool_free(message);
 			return NULL;
 		}
 		switch (ntohs(set_header->flowset_id)) {
@@ -329,16 +309,17 @@ struct ipfix_message *message_create_empty()
 	struct ipfix_message *message;
 	struct ipfix_header *header;
 
-	message = (struct ipfix_message *) calloc(1, sizeof(*message));
+	message = (struct ipfix_message *) message_pool_alloc(sizeof(*message));
 	if (!message) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
+	memset(message, 0, sizeof(*message));
 
 	header = (struct ipfix_header *) calloc(1, sizeof(*header));
 	if (!header) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		free(message);
+		message_pool_free(message);
 		return NULL;
 	}
 
@@ -360,8 +341,8 @@ int message_free(struct ipfix_message *msg)
 		return -1;
 	}
 
-	free(msg->pkt_header);
-	free(msg);
+	message_pool_free(msg->pkt_header);
+	message_pool_free(msg);
 
 	/* note we do not want to free input_info structure, it is input plugin's job */
 
@@ -471,9 +452,122 @@ struct ipfix_template_row *template_record_get_field(struct ipfix_template_recor
  */
 struct ipfix_template_row *template_get_field(struct ipfix_template *templ, uint32_t enterprise, uint16_t id, int *data_offset)
 {
+	if (templ->index && (data_offset == NULL || !(templ->data_length & 0x80000000))) {
+		int field = template_get_field_index(templ, enterprise, id);
+		if (field < 0) {
+			return NULL;
+		}
+
+		if (data_offset) {
+			*data_offset = templ->index->fields[field].offset;
+		}
+
+		return (struct ipfix_template_row *) &templ->fields[templ->index->fields[field].row];
+	}
+
 	return fields_get_field((uint8_t *) templ->fields, templ->field_count, enterprise, id, data_offset, 0);
 }
 
+/**
+ * \brief Read length of variable-length field and skip its length indicator
+ *
+ * \param[in] data_record Data record
+ * \param[in,out] offset Offset of the field, moved to the field's data
+ * \return Field length
+ */
+static inline int data_record_var_length(uint8_t *data_record, int *offset)
+{
+	int length = *((uint8_t *) (data_record + *offset));
+	*offset += 1;
+
+	if (length == 255) {
+		length = ntohs(*((uint16_t *) (data_record + *offset)));
+		*offset += 2;
+	}
+
+	return length;
+}
+
+/**
+ * \brief Get offset of field in data record by its index in template
+ */
+int data_record_field_offset_at(uint8_t *data_record, struct ipfix_template *templ, int field, int *data_length)
+{
+	int offset = 0, length, i, row = 0;
+
+	if (field < 0 || field >= templ->field_count) {
+		return -1;
+	}
+
+	struct ipfix_template_index *index = templ->index;
+	if (index) {
+		struct ipfix_template_field *fields = index->fields;
+
+		/* Fixed offset */
+		if (fields[field].offset >= 0 && fields[field].length != VAR_IE_LENGTH) {
+			if (data_length) {
+				*data_length = fields[field].length;
+			}
+			return fields[field].offset;
+		}
+
+		/* One pass from the first variable-length field */
+		offset = fields[index->first_var].offset;
+		for (i = index->first_var; ; i++) {
+			length = fields[i].length;
+			if (length == VAR_IE_LENGTH) {
+				length = data_record_var_length(data_record, &offset);
+			}
+
+			if (i == field) {
+				break;
+			}
+			offset += length;
+		}
+
+		if (data_length) {
+			*data_length = length;
+		}
+		return offset;
+	}
+
+	/* Template without index, one pass from the first field */
+	for (i = 0; ; i++, row++) {
+		length = templ->fields[row].ie.length;
+		if (templ->fields[row].ie.id >> 15) {
+			/* Enterprise Number */
+			++row;
+		}
+
+		if (length == VAR_IE_LENGTH) {
+			length = data_record_var_length(data_record, &offset);
+		}
+
+		if (i == field) {
+			break;
+		}
+		offset += length;
+	}
+
+	if (data_length) {
+		*data_length = length;
+	}
+	return offset;
+}
+
+/**
+ * \brief Get data from record by field index in template
+ */
+uint8_t *data_record_get_field_at(uint8_t *record, struct ipfix_template *templ, int field, int *data_length)
+{
+	int offset = data_record_field_offset_at(record, templ, field, data_length);
+	if (offset < 0) {
+		return NULL;
+	}
+
+	return record + offset;
+}
+
 /**
  * \brief Get offset of next field instance in data record. For variable-length
  * fields, the returned offset does not include the field's length indicators (i.e.,
@@ -495,6 +589,23 @@ int data_record_field_next_offset(uint8_t *data_record, struct ipfix_template *t
 	int count, offset = 0, index, length, prev_offset;
 	struct ipfix_template_row *row = NULL;
 
+	if (templ->index) {
+		/* Walk the occurrences of the field */
+		int field = template_get_field_index(templ, enterprise, id);
+		while (field >= 0 && field != TEMPLATE_FIELD_NONE) {
+			offset = data_record_field_offset_at(data_record, templ, field, &length);
+			if (offset > from_offset) {
+				if (data_length) {
+					*data_length = length;
+				}
+				return offset;
+			}
+			field = templ->index->fields[field].next;
+		}
+
+		return -1;
+	}
+
 	if (!(templ->data_length & 0x80000000)) {
 		/* Data record with no variable length field */
 		row = template_get_field(templ, enterprise, id, &offset);
@@ -583,37 +694,11 @@ int data_record_field_offset(uint8_t *data_record, struct ipfix_template *templ,
  */
 uint8_t *data_record_get_field(uint8_t *record, struct ipfix_template *templ, uint32_t enterprise, uint16_t id, int *data_length)
 {
-	int offset_id = OF_COUNT;
-
-	if (enterprise == 0) {
-		/* Check whether we have offset field for this ID */
-		for (offset_id = 0; offset_id < OF_COUNT; ++offset_id) {
-			if (id == offsets[offset_id].id) {
-				break;
-			}
-		}
-
-		/* If offset is already known, use it */
-		if (offset_id != OF_COUNT && templ->offsets[offset_id].offset > 0) {
-			if (data_length) {
-				*data_length = templ->offsets[offset_id].bytes;
-			}
-
-			return (uint8_t *) record + templ->offsets[offset_id].offset;
-		}
-	}
-
 	int offset = data_record_field_offset(record, templ, enterprise, id, data_length);
 	if (offset < 0) {
 		return NULL;
 	}
 
-	/* Store offset for future lookup (safe only for templates without variable length) */
-	if (offset_id != OF_COUNT && data_length != NULL && !(templ->data_length & 0x80000000)) {
-		templ->offsets[offset_id].offset = offset;
-		templ->offsets[offset_id].bytes = *data_length;
-	}
-
 	return (uint8_t *) record + offset;
 }
 
@@ -641,6 +726,22 @@ uint16_t data_record_length(uint8_t *data_record, struct ipfix_template *templat
 		return template->data_length;
 	}
 
+	if (template->index) {
+		/* Fixed part up to the first variable-length field */
+		struct ipfix_template_field *fields = template->index->fields;
+		int var_offset = fields[template->index->first_var].offset;
+
+		for (count = template->index->first_var; count < template->field_count; count++) {
+			if (fields[count].length == VAR_IE_LENGTH) {
+				var_offset += data_record_var_length(data_record, &var_offset);
+			} else {
+				var_offset += fields[count].length;
+			}
+		}
+
+		return var_offset;
+	}
+
 	for (count = index = 0; count < template->field_count; count++, index++) {
 		length = template->fields[index].ie.length;
 
@@ -816,7 +917,7 @@ void message_free_metadata(struct ipfix_message *msg)
 	}
 	
 	/* Free metadata structure */
-	free(msg->metadata);
+	message_pool_free(msg->metadata);
 }
 
 struct metadata *message_copy_metadata(struct ipfix_message *src)
@@ -859,3 +960,135 @@ struct metadata *message_copy_metadata(struct ipfix_message *src)
 
 	return metadata;
 }
+
+struct ipfix_message *message_create_view(struct ipfix_message *src)
+{
+	struct ipfix_message *view;
+
+	view = (struct ipfix_message *) message_pool_alloc(sizeof(*view));
+	if (!view) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+	memset(view, 0, sizeof(*view));
+
+	/* Own header, the rest of the packet is shared */
+	view->pkt_header = (struct ipfix_header *) message_pool_alloc(IPFIX_HEADER_LENGTH);
+	if (!view->pkt_header) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		message_pool_free(view);
+		return NULL;
+	}
+
+	memcpy(view->pkt_header, src->pkt_header, IPFIX_HEADER_LENGTH);
+	view->pkt_header->length = htons(IPFIX_HEADER_LENGTH);
+
+	view->input_info = src->input_info;
+	view->source_status = src->source_status;
+	view->plugin_status = src->plugin_status;
+	view->plugin_id = src->plugin_id;
+	view->live_profile = src->live_profile;
+
+	/* Source message is freed by the last holder */
+	__atomic_add_fetch(&(src->shares), 1, __ATOMIC_ACQ_REL);
+	view->view_source = src;
+
+	return view;
+}
+
+int message_is_view(const struct ipfix_message *msg)
+{
+	return msg->view_source != NULL && msg->data_couple[0].data_set == NULL
+			&& msg->data_records_count > 0;
+}
+
+int message_materialize(struct ipfix_message *msg)
+{
+	struct ipfix_message *src = msg->view_source;
+	uint8_t *packet, *begin, *end, *rec;
+	int i, j, t, length, offset, set_offset, couples = 0;
+
+	if (!message_is_view(msg)) {
+		return 0;
+	}
+
+	/* Upper bound of the packet length */
+	length = IPFIX_HEADER_LENGTH;
+	for (i = 0; i < MSG_MAX_TEMPL_SETS && src->templ_set[i]; ++i) {
+		length += ntohs(src->templ_set[i]->header.length);
+	}
+	for (i = 0; i < MSG_MAX_OTEMPL_SETS && src->opt_templ_set[i]; ++i) {
+		length += ntohs(src->opt_templ_set[i]->header.length);
+	}
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && src->data_couple[i].data_set; ++i) {
+		length += sizeof(struct ipfix_set_header);
+	}
+	for (j = 0; j < msg->data_records_count; ++j) {
+		length += msg->metadata[j].record.length;
+	}
+
+	packet = (uint8_t *) message_pool_alloc(length);
+	if (!packet) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	memcpy(packet, msg->pkt_header, IPFIX_HEADER_LENGTH);
+	offset = IPFIX_HEADER_LENGTH;
+
+	/* Copy (options) template sets */
+	for (t = 0; t < MSG_MAX_TEMPL_SETS && src->templ_set[t]; ++t) {
+		msg->templ_set[t] = (struct ipfix_template_set *) (packet + offset);
+		memcpy(packet + offset, src->templ_set[t], ntohs(src->templ_set[t]->header.length));
+		offset += ntohs(src->templ_set[t]->header.length);
+	}
+	for (t = 0; t < MSG_MAX_OTEMPL_SETS && src->opt_templ_set[t]; ++t) {
+		msg->opt_templ_set[t] = (struct ipfix_options_template_set *) (packet + offset);
+		memcpy(packet + offset, src->opt_templ_set[t], ntohs(src->opt_templ_set[t]->header.length));
+		offset += ntohs(src->opt_templ_set[t]->header.length);
+	}
+
+	/* Copy selected records of each data set */
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && src->data_couple[i].data_set; ++i) {
+		if (!src->data_couple[i].data_template) {
+			continue;
+		}
+
+		begin = (uint8_t *) src->data_couple[i].data_set;
+		end = begin + ntohs(src->data_couple[i].data_set->header.length);
+
+		set_offset = offset;
+		memcpy(packet + offset, begin, sizeof(struct ipfix_set_header));
+		offset += sizeof(struct ipfix_set_header);
+
+		for (j = 0; j < msg->data_records_count; ++j) {
+			rec = msg->metadata[j].record.record;
+			if (rec < begin || rec >= end) {
+				continue;
+			}
+
+			memcpy(packet + offset, rec, msg->metadata[j].record.length);
+			msg->metadata[j].record.record = packet + offset;
+			offset += msg->metadata[j].record.length;
+		}
+
+		if (offset == set_offset + (int) sizeof(struct ipfix_set_header)) {
+			/* No selected record in this set */
+			offset = set_offset;
+			continue;
+		}
+
+		((struct ipfix_set_header *) (packet + set_offset))->length = htons(offset - set_offset);
+		msg->data_couple[couples].data_set = (struct ipfix_data_set *) (packet + set_offset);
+		msg->data_couple[couples].data_template = src->data_couple[i].data_template;
+		tm_template_reference_inc(src->data_couple[i].data_template);
+		couples++;
+	}
+
+	((struct ipfix_header *) packet)->length = htons(offset);
+
+	message_pool_free(msg->pkt_header);
+	msg->pkt_header = (struct ipfix_header *) packet;
+
+	return 0;
+}
@@ -70,6 +70,9 @@
 #include "preprocessor.h"
 #include "output_manager.h"
 #include "configurator.h"
+#include "input_manager.h"
+#include "message_pool.h"
+#include "telemetry.h"
 
 /**
  * \defgroup internalAPIs ipfixcol's Internal APIs
@@ -80,7 +83,7 @@
  */
 
 /** Acceptable command-line parameters (normal) */
-#define OPTSTRING "c:dhv:Vsr:i:S:e:Mp:"
+#define OPTSTRING "c:dhv:Vsr:i:S:e:Mp:t:"
 
 /** Acceptable command-line parameters (long) */
 struct option long_opts[] = {
@@ -138,6 +141,7 @@ void help ()
 	printf ("  -S num    Print statistics every \"num\" seconds\n");
 	printf ("  -M        Enable single data manager (all ODIDs have common storage plugins)\n");
 	printf ("  -p file   Path to the pidfile. Without this option, no pidfile is created.\n");
+	printf ("  -t num    Number of input threads (default: 1, input plugin must support parallel receiving)\n");
 	printf ("\n");
 }
 
@@ -187,20 +191,20 @@ int write_pid(const char *path, int append, pid_t pid)
 
 int main (int argc, char* argv[])
 {
-	int c, i, retval = 0, get_retval, proc_count = 0;
-	int source_status = SOURCE_STATUS_OPENED, stat_interval = 0;
+	int c, i, retval = 0, count, proc_count = 0;
+	int stat_interval = 0;
 	pid_t pid = 0;
 	bool daemonize = false;
 	char *startup_config = NULL, *internal_config = NULL;
 	struct sigaction action;
 	sigset_t set;
-	char *packet = NULL;
-	struct input_info* input_info;
+	struct input_packet batch[INPUT_BATCH_SIZE];
 	void *output_manager_config = NULL;
 	xmlXPathObjectPtr collectors = NULL;
 	int ring_buffer_size = 8192;
 	bool output_odid_merge = false;
 	char *pidfile_path = NULL;
+	int input_threads = 1;
 
 	/* parse command line parameters */
 	while ((c = getopt_long(argc, argv, OPTSTRING, long_opts, NULL)) != -1) {
@@ -261,6 +265,15 @@ int main (int argc, char* argv[])
 		case 'p':
 			pidfile_path = optarg;
 			break;
+		case 't':
+			input_threads = strtoi(optarg, 10);
+			if (input_threads == INT_MAX || input_threads < 1) {
+				MSG_ERROR(msg_module, "No valid number of input threads provided (%s)", optarg);
+				help();
+				exit(EXIT_FAILURE);
+			}
+
+			break;
 
 		default:
 			help();
@@ -330,6 +343,7 @@ int main (int argc, char* argv[])
 		MSG_ERROR(msg_module, "Configurator initialization failed");
 		goto cleanup_err;
 	}
+	config->input_threads = input_threads;
 	
 	/* Get all collectors */
 	collectors = get_collectors(config->act_doc);
@@ -390,8 +404,12 @@ int main (int argc, char* argv[])
 		goto cleanup_err;
 	}
 	
+	/* Pipeline telemetry is reported together with the statistics */
+	telemetry_init(stat_interval > 0);
+
 	/* Create output queue for preprocessor */
 	preprocessor_set_output_queue(rbuffer_init(ring_buffer_size));
+	telemetry_queue_add("preprocessor", get_preprocessor_output_queue());
 	
 	/* Create Output Manager */
 	retval = output_manager_create(config, stat_interval, output_odid_merge, &output_manager_config);
@@ -416,44 +434,41 @@ int main (int argc, char* argv[])
 		goto cleanup;
 	}
 
+	/* start additional input threads (the main loop is the first one) */
+	if (input_manager_start(config) != 0) {
+		MSG_ERROR(msg_module, "[%d] Unable to start input threads", config->proc_id);
+		goto cleanup_err;
+	}
+
 	/* Allow signals in the main thread only */
 	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
 
 	/* main loop */
 	while (!terminating) {
-		/* get data to process */
-		if ((get_retval = config->input.get(config->input.config, &input_info, &packet, &source_status)) < 0) {
-			/* No data received, probably interrupted by a signal */
-			if (packet) {
-				free(packet);
-				packet = NULL;
-			}
-
-			continue;
-		} else if (get_retval == INPUT_CLOSED) {
-			/* ensure that parser gets NULL packet => closed connection */
-			if (packet != NULL) {
-				/* free the memory allocated by xml_conf (if any) right away */
-				free(packet);
-				packet = NULL;
-			}
+		/* get data to process (packet of a closed connection is NULL) */
+		count = input_manager_receive(&(config->input), config->input.config, batch, INPUT_BATCH_SIZE);
 
+		for (i = 0; i < count; ++i) {
 			/* if input plugin is file reader, end collector */
-			if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+			if (batch[i].length == INPUT_CLOSED && batch[i].info->type == SOURCE_TYPE_IPFIX_FILE) {
 				terminating = 1;
 			}
-		}
 
-		/* distribute data to the particular Data Manager for further processing */
-		preprocessor_parse_msg(packet, get_retval, input_info, source_status);
-		source_status = SOURCE_STATUS_OPENED;
-		packet = NULL;
-		input_info = NULL;
+			/* distribute data to the particular Data Manager for further processing */
+			preprocessor_parse_msg(batch[i].packet, batch[i].length, batch[i].info, batch[i].source_status);
+		}
 
 		/* Check whether reconfiguration is needed */
 		if (reconf) {
 			MSG_INFO(msg_module, "[%d] Starting reconfiguration process", config->proc_id);
+
+			/* input plugin may change, restart input threads */
+			input_manager_stop();
 			config_reconf(config);
+			if (input_manager_start(config) != 0) {
+				MSG_ERROR(msg_module, "[%d] Unable to start input threads", config->proc_id);
+			}
+
 			reconf = 0;
 		}
 }
@@ -464,6 +479,9 @@ cleanup_err:
 	retval = EXIT_FAILURE;
 
 cleanup:
+	/* Stop input threads */
+	input_manager_stop();
+
 	/* Close preprocessor */
 	preprocessor_close();
 	
@@ -502,6 +520,11 @@ cleanup:
 		tm_destroy(template_mgr);
 	}
 
+	/* free memory of messages */
+	message_pool_destroy();
+
+	telemetry_destroy();
+
 	xmlCleanupThreads();
 	xmlCleanupParser();
 
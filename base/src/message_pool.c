@@ -0,0 +1,410 @@
+/**
+ * \file message_pool.c
+ * \brief Slab allocator for IPFIX messages, packets and metadata
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <ipfixcol.h>
+
+#include "message_pool.h"
+
+/** Size (and alignment) of one slab */
+#define POOL_SLAB_SIZE (1 << 20)
+/** The smallest size class (256 B) */
+#define POOL_MIN_SHIFT 8
+/** The largest size class (64 KiB, maximal IPFIX message) */
+#define POOL_MAX_SHIFT 16
+/** Number of size classes */
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+/** Slots of the slab registry (at most half of them used) */
+#define POOL_REGISTRY_SIZE 16384
+/** Bytes of free objects of one class kept in a thread cache */
+#define POOL_CACHE_BYTES (512 * 1024)
+
+/** Identifier to MSG_* macros */
+static char *msg_module = "message pool";
+
+/**
+ * \brief Free object, linked in a free list
+ */
+struct pool_object {
+	struct pool_object *next;
+};
+
+/**
+ * \brief Size class with global free list
+ */
+struct pool_class {
+	pthread_mutex_t lock;         /**< lock of the free list */
+	struct pool_object *free;     /**< global free list */
+};
+
+/**
+ * \brief Per-thread cache of free objects
+ */
+struct pool_cache {
+	struct pool_object *head[POOL_CLASSES]; /**< free objects */
+	unsigned int count[POOL_CLASSES];       /**< number of free objects */
+	int registered;                         /**< flushed at thread exit */
+};
+
+static struct pool_class pool_classes[POOL_CLASSES] = {
+	[0 ... POOL_CLASSES - 1] = { PTHREAD_MUTEX_INITIALIZER, NULL }
+};
+
+/**
+ * Registry of slabs - open addressing set of slab addresses. The size class
+ * is stored in the low bits of the (aligned) address. Readers take no lock,
+ * slabs are only added (under slab_lock) until message_pool_destroy().
+ */
+static uintptr_t pool_registry[POOL_REGISTRY_SIZE];
+static unsigned int pool_slabs = 0;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct pool_cache pool_cache;
+static pthread_key_t pool_cache_key;
+static pthread_once_t pool_cache_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief Get size class of an allocation
+ *
+ * \param[in] size Requested size
+ * \return class index or -1 when the size is too big for the pool
+ */
+static inline int pool_class(size_t size)
+{
+	int cls = 0;
+
+	if (size > (1 << POOL_MAX_SHIFT)) {
+		return -1;
+	}
+
+	while (((size_t) 1 << (cls + POOL_MIN_SHIFT)) < size) {
+		cls++;
+	}
+
+	return cls;
+}
+
+/**
+ * \brief Registry slot of a slab address
+ */
+static inline unsigned int pool_registry_hash(uintptr_t slab)
+{
+	return (unsigned int) ((slab / POOL_SLAB_SIZE) * 2654435761U) % POOL_REGISTRY_SIZE;
+}
+
+/**
+ * \brief Find size class of a pool object
+ *
+ * \param[in] ptr Pointer to memory
+ * \return class index or -1 when the memory does not belong to the pool
+ */
+static int pool_lookup(void *ptr)
+{
+	uintptr_t slab = (uintptr_t) ptr & ~((uintptr_t) POOL_SLAB_SIZE - 1);
+	unsigned int i = pool_registry_hash(slab);
+	uintptr_t entry;
+
+	while ((entry = __atomic_load_n(&pool_registry[i], __ATOMIC_ACQUIRE)) != 0) {
+		if ((entry & ~((uintptr_t) POOL_SLAB_SIZE - 1)) == slab) {
+			return (int) (entry & (POOL_SLAB_SIZE - 1));
+		}
+		i = (i + 1) % POOL_REGISTRY_SIZE;
+	}
+
+	return -1;
+}
+
+/**
+ * \brief Allocate a new slab and put its objects into the global free list
+ *
+ * Caller holds the lock of the class.
+ *
+ * \param[in] cls Size class
+ * \return 0 on success, 1 otherwise
+ */
+static int pool_slab_create(int cls)
+{
+	size_t size = (size_t) 1 << (cls + POOL_MIN_SHIFT);
+	void *slab;
+	size_t offset;
+
+	pthread_mutex_lock(&slab_lock);
+
+	if (pool_slabs >= POOL_REGISTRY_SIZE / 2) {
+		pthread_mutex_unlock(&slab_lock);
+		return 1;
+	}
+
+	if (posix_memalign(&slab, POOL_SLAB_SIZE, POOL_SLAB_SIZE) != 0) {
+		pthread_mutex_unlock(&slab_lock);
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	unsigned int i = pool_registry_hash((uintptr_t) slab);
+	while (pool_registry[i] != 0) {
+		i = (i + 1) % POOL_REGISTRY_SIZE;
+	}
+	__atomic_store_n(&pool_registry[i], (uintptr_t) slab | cls, __ATOMIC_RELEASE);
+	pool_slabs++;
+
+	pthread_mutex_unlock(&slab_lock);
+
+	for (offset = 0; offset + size <= POOL_SLAB_SIZE; offset += size) {
+		struct pool_object *obj = (struct pool_object *) ((uint8_t *) slab + offset);
+		obj->next = pool_classes[cls].free;
+		pool_classes[cls].free = obj;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Maximal number of free objects of a class in a thread cache
+ */
+static inline unsigned int pool_cache_max(int cls)
+{
+	unsigned int max = POOL_CACHE_BYTES >> (cls + POOL_MIN_SHIFT);
+	return (max < 4) ? 4 : max;
+}
+
+/**
+ * \brief Move free objects from a thread cache to the global free list
+ *
+ * \param[in] cache Thread cache
+ * \param[in] cls Size class
+ * \param[in] count Number of objects to move
+ */
+static void pool_cache_release(struct pool_cache *cache, int cls, unsigned int count)
+{
+	struct pool_object *first, *last;
+
+	if (count == 0 || cache->head[cls] == NULL) {
+		return;
+	}
+
+	first = last = cache->head[cls];
+	cache->count[cls]--;
+	while (--count > 0 && last->next) {
+		last = last->next;
+		cache->count[cls]--;
+	}
+	cache->head[cls] = last->next;
+
+	pthread_mutex_lock(&pool_classes[cls].lock);
+	last->next = pool_classes[cls].free;
+	pool_classes[cls].free = first;
+	pthread_mutex_unlock(&pool_classes[cls].lock);
+}
+
+/**
+ * \brief Return all objects of a thread cache at thread exit
+ */
+static void pool_cache_flush(void *arg)
+{
+	struct pool_cache *cache = arg;
+	int cls;
+
+	for (cls = 0; cls < POOL_CLASSES; cls++) {
+		pool_cache_release(cache, cls, cache->count[cls]);
+	}
+	cache->registered = 0;
+}
+
+static void pool_cache_key_create(void)
+{
+	pthread_key_create(&pool_cache_key, pool_cache_flush);
+}
+
+/**
+ * \brief Make sure that the cache of the calling thread is flushed at exit
+ */
+static inline void pool_cache_register(void)
+{
+	if (!pool_cache.registered) {
+		pthread_once(&pool_cache_once, pool_cache_key_create);
+		pthread_setspecific(pool_cache_key, &pool_cache);
+		pool_cache.registered = 1;
+	}
+}
+
+/**
+ * \brief Refill a thread cache from the global free list (or a new slab)
+ *
+ * \param[in] cls Size class
+ */
+static void pool_cache_refill(int cls)
+{
+	unsigned int count = pool_cache_max(cls) / 2;
+	struct pool_object *obj;
+
+	pthread_mutex_lock(&pool_classes[cls].lock);
+
+	if (pool_classes[cls].free == NULL && pool_slab_create(cls)) {
+		pthread_mutex_unlock(&pool_classes[cls].lock);
+		return;
+	}
+
+	while (count-- > 0 && (obj = pool_classes[cls].free) != NULL) {
+		pool_classes[cls].free = obj->next;
+		obj->next = pool_cache.head[cls];
+		pool_cache.head[cls] = obj;
+		pool_cache.count[cls]++;
+	}
+
+	pthread_mutex_unlock(&pool_classes[cls].lock);
+}
+
+/**
+ * \brief Allocate memory from the message pool
+ */
+void *message_pool_alloc(size_t size)
+{
+	struct pool_object *obj;
+	int cls = pool_class(size);
+
+	if (cls < 0) {
+		return malloc(size);
+	}
+
+	pool_cache_register();
+
+	if (pool_cache.head[cls] == NULL) {
+		pool_cache_refill(cls);
+		if (pool_cache.head[cls] == NULL) {
+			/* The pool is exhausted */
+			return malloc(size);
+		}
+	}
+
+	obj = pool_cache.head[cls];
+	pool_cache.head[cls] = obj->next;
+	pool_cache.count[cls]--;
+
+	return obj;
+}
+
+/**
+ * \brief Change size of memory from the message pool
+ */
+void *message_pool_realloc(void *ptr, size_t size)
+{
+	void *new_ptr;
+	int cls;
+
+	if (ptr == NULL) {
+		return message_pool_alloc(size);
+	}
+
+	cls = pool_lookup(ptr);
+	if (cls < 0) {
+		return realloc(ptr, size);
+	}
+
+	size_t old_size = (size_t) 1 << (cls + POOL_MIN_SHIFT);
+	if (size <= old_size) {
+		return ptr;
+	}
+
+	if ((new_ptr = message_pool_alloc(size)) == NULL) {
+		return NULL;
+	}
+
+	memcpy(new_ptr, ptr, old_size);
+	message_pool_free(ptr);
+
+	return new_ptr;
+}
+
+/**
+ * \brief Return memory to the message pool
+ */
+void message_pool_free(void *ptr)
+{
+	struct pool_object *obj = ptr;
+	int cls;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	if ((cls = pool_lookup(ptr)) < 0) {
+		free(ptr);
+		return;
+	}
+
+	pool_cache_register();
+
+	obj->next = pool_cache.head[cls];
+	pool_cache.head[cls] = obj;
+	pool_cache.count[cls]++;
+
+	/* Give surplus to other threads */
+	if (pool_cache.count[cls] > pool_cache_max(cls)) {
+		pool_cache_release(&pool_cache, cls, pool_cache_max(cls) / 2);
+	}
+}
+
+/**
+ * \brief Free all slabs of the pool
+ */
+void message_pool_destroy(void)
+{
+	unsigned int i;
+	int cls;
+
+	pthread_mutex_lock(&slab_lock);
+	for (i = 0; i < POOL_REGISTRY_SIZE; i++) {
+		if (pool_registry[i] != 0) {
+			free((void *) (pool_registry[i] & ~((uintptr_t) POOL_SLAB_SIZE - 1)));
+			pool_registry[i] = 0;
+		}
+	}
+	pool_slabs = 0;
+	pthread_mutex_unlock(&slab_lock);
+
+	for (cls = 0; cls < POOL_CLASSES; cls++) {
+		pool_classes[cls].free = NULL;
+		pool_cache.head[cls] = NULL;
+		pool_cache.count[cls] = 0;
+	}
+}
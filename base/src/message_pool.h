@@ -0,0 +1,68 @@
+/**
+ * \file message_pool.h
+ * \brief Slab allocator for IPFIX messages, packets and metadata
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef MESSAGE_POOL_H_
+#define MESSAGE_POOL_H_
+
+#include <ipfixcol.h>
+
+/**
+ * \addtogroup internalAPIs
+ *
+ * Memory of IPFIX messages, packets and metadata arrays is taken from slabs
+ * of fixed-size objects (power of two size classes). Each thread keeps a small
+ * cache of free objects per class, surplus objects are moved to the global
+ * free lists, so objects freed by the output threads are reused by the input
+ * threads. Slabs are never returned to the system until message_pool_destroy().
+ *
+ * The public part of the API (message_pool_alloc(), message_pool_realloc() and
+ * message_pool_free()) is declared in ipfixcol/ipfix_message.h.
+ *
+ * @{
+ */
+
+/**
+ * \brief Free all slabs of the pool
+ *
+ * Called at the end of the collector when no thread uses the pool anymore.
+ */
+void message_pool_destroy(void);
+
+/**@}*/
+
+#endif /* MESSAGE_POOL_H_ */
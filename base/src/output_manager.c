@@ -54,6 +54,7 @@
 #include "configurator.h"
 #include "data_manager.h"
 #include "output_manager.h"
+#include "telemetry.h"
 
 /* MSG_ macros identifiers */
 static const char *msg_module = "output manager";
@@ -145,20 +146,38 @@ void sig_handler(int s)
 	(void) s;
 }
 
+/** Initial number of buckets of the ODID map */
+#define OM_MAP_INIT_SIZE 64
+
 /**
- * \brief Search for Data manager handling specified Observation Domain ID
+ * \brief Get bucket of the ODID map
  *
- * \todo: improve search e.g. by some kind of sorting data_managers
+ * \param[in] id Observation domain ID
+ * \param[in] size Number of buckets (power of 2)
+ * \return bucket index
+ */
+static inline uint32_t om_map_bucket(uint32_t id, uint32_t size)
+{
+	return (id * 2654435761U) >> 7 & (size - 1);
+}
+
+/**
+ * \brief Search for Data manager handling specified Observation Domain ID
  *
  * \param[in] id Observation domain ID of wanted Data manager.
+ * \param[in] manager Output Manager structure
  * \return Desired Data Manager configuration structure if exists, NULL if
  * there is no Data manager for specified Observation domain ID
  */
-static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct data_manager_config *data_mngmts)
+static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct output_manager_config *manager)
 {
-	struct data_manager_config *aux_cfg = data_mngmts;
+	struct data_manager_config *aux_cfg;
+
+	if (!manager->dm_map) {
+		return NULL;
+	}
 
-	for (aux_cfg = data_mngmts; aux_cfg; aux_cfg = aux_cfg->next) {
+	for (aux_cfg = manager->dm_map[om_map_bucket(id, manager->dm_map_size)]; aux_cfg; aux_cfg = aux_cfg->hash_next) {
 		if (aux_cfg->observation_domain_id == id) {
 			break;
 		}
@@ -167,6 +186,50 @@ static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct dat
 	return aux_cfg;
 }
 
+/**
+ * \brief Resize the ODID map
+ *
+ * \param[in] manager Output Manager structure
+ * \param[in] size New number of buckets (power of 2)
+ * \return 0 on success
+ */
+static int om_map_resize(struct output_manager_config *manager, uint32_t size)
+{
+	struct data_manager_config **map, *aux_cfg;
+	uint32_t bucket;
+
+	map = calloc(size, sizeof(struct data_manager_config *));
+	if (!map) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	for (aux_cfg = manager->data_managers; aux_cfg; aux_cfg = aux_cfg->next) {
+		bucket = om_map_bucket(aux_cfg->observation_domain_id, size);
+		aux_cfg->hash_next = map[bucket];
+		map[bucket] = aux_cfg;
+	}
+
+	free(manager->dm_map);
+	manager->dm_map = map;
+	manager->dm_map_size = size;
+
+	return 0;
+}
+
+/**
+ * \brief Remove all Data managers from the ODID map
+ *
+ * \param[in] manager Output Manager structure
+ */
+static void om_map_clear(struct output_manager_config *manager)
+{
+	free(manager->dm_map);
+	manager->dm_map = NULL;
+	manager->dm_map_size = 0;
+	manager->dm_count = 0;
+}
+
 /**
  * \brief Insert new Data manager into list
  *
@@ -175,6 +238,8 @@ static struct data_manager_config *get_data_mngmt_config(uint32_t id, struct dat
  */
 void output_manager_insert(struct output_manager_config *output_manager, struct data_manager_config *new_manager)
 {
+	uint32_t bucket;
+
 	new_manager->next = NULL;
 	if (output_manager->last == NULL) {
 		output_manager->data_managers = new_manager;
@@ -182,6 +247,21 @@ void output_manager_insert(struct output_manager_config *output_manager, struct
 		output_manager->last->next = new_manager;
 	}
 	output_manager->last = new_manager;
+	output_manager->dm_count++;
+
+	/* Insert into ODID map (resize rebuilds it from the list) */
+	if (output_manager->dm_count > output_manager->dm_map_size && om_map_resize(output_manager,
+			output_manager->dm_map_size ? output_manager->dm_map_size * 2 : OM_MAP_INIT_SIZE) == 0) {
+		return;
+	}
+
+	if (!output_manager->dm_map) {
+		return;
+	}
+
+	bucket = om_map_bucket(new_manager->observation_domain_id, output_manager->dm_map_size);
+	new_manager->hash_next = output_manager->dm_map[bucket];
+	output_manager->dm_map[bucket] = new_manager;
 }
 
 /**
@@ -213,6 +293,20 @@ void output_manager_remove(struct output_manager_config *output_manager, struct
 	if (output_manager->data_managers == NULL) {
 		output_manager->last = NULL;
 	}
+
+	/* Remove from ODID map */
+	if (output_manager->dm_map) {
+		struct data_manager_config **aux_ptr;
+		aux_ptr = &(output_manager->dm_map[om_map_bucket(old_manager->observation_domain_id, output_manager->dm_map_size)]);
+		while (*aux_ptr && *aux_ptr != old_manager) {
+			aux_ptr = &((*aux_ptr)->hash_next);
+		}
+		if (*aux_ptr) {
+			*aux_ptr = old_manager->hash_next;
+		}
+	}
+	output_manager->dm_count--;
+
 	uint32_t odid = old_manager->observation_domain_id;
 	data_manager_close(&old_manager);
 
@@ -259,6 +353,46 @@ void output_manager_set_in_queue(struct ring_buffer *in_queue)
 	}
 }
 
+/**
+ * \brief Pause Output Manager thread
+ *
+ * All messages already in the input queue are passed to the Data Managers
+ * first. While paused, Data Managers and their storage plugins can be changed
+ * by another thread.
+ */
+static void output_manager_pause()
+{
+	if (!conf->running) {
+		return;
+	}
+
+	pthread_mutex_lock(&conf->in_q_mutex);
+
+	conf->pause = 1;
+	rbuffer_write(conf->in_queue, NULL, 1);
+
+	while (!conf->paused) {
+		pthread_cond_wait(&conf->in_q_cond, &conf->in_q_mutex);
+	}
+
+	pthread_mutex_unlock(&conf->in_q_mutex);
+}
+
+/**
+ * \brief Resume Output Manager thread paused by output_manager_pause()
+ */
+static void output_manager_resume()
+{
+	if (!conf->running) {
+		return;
+	}
+
+	pthread_mutex_lock(&conf->in_q_mutex);
+	conf->pause = 0;
+	pthread_cond_broadcast(&conf->in_q_cond);
+	pthread_mutex_unlock(&conf->in_q_mutex);
+}
+
 /**
  * \brief Add new storage plugin
  */
@@ -267,13 +401,16 @@ int output_manager_add_plugin(struct storage *plugin)
 	int i;
 	struct data_manager_config *data_mgr = NULL;
 
+	/* Data Managers are used by the Output Manager thread */
+	output_manager_pause();
+
 	/* Find a place for plugin in array */
 	for (i = 0; conf->storage_plugins[i]; ++i) {}
 	conf->storage_plugins[i] = plugin;
 
 	if (plugin->xml_conf->observation_domain_id) {
 		/* Plugin for one specific ODID */
-		data_mgr = get_data_mngmt_config(atol(plugin->xml_conf->observation_domain_id), conf->data_managers);
+		data_mgr = get_data_mngmt_config(atol(plugin->xml_conf->observation_domain_id), conf);
 
 		if (data_mgr) {
 			/* Update existing Data Manager */
@@ -287,6 +424,7 @@ int output_manager_add_plugin(struct storage *plugin)
 		}
 	}
 
+	output_manager_resume();
 	return 0;
 }
 
@@ -299,6 +437,9 @@ int output_manager_remove_plugin(int id)
 	struct data_manager_config *data_mgr = NULL;
 	struct storage *plugin = NULL;
 
+	/* Data Managers are used by the Output Manager thread */
+	output_manager_pause();
+
 	/* Find plugin with given id */
 	for (i = 0; conf->storage_plugins[i]; ++i) {
 		if (conf->storage_plugins[i]->id == id) {
@@ -311,13 +452,14 @@ int output_manager_remove_plugin(int id)
 
 	if (!plugin) {
 		/* Plugin not found */
+		output_manager_resume();
 		return 0;
 	}
 
 	/* Kill all its instances */
 	if (plugin->xml_conf->observation_domain_id) {
 		/* Has ODID - max. 1 instance */
-		data_mgr = get_data_mngmt_config(atol(plugin->xml_conf->observation_domain_id), conf->data_managers);
+		data_mgr = get_data_mngmt_config(atol(plugin->xml_conf->observation_domain_id), conf);
 
 		if (data_mgr) {
 			/* Kill plugin */
@@ -331,6 +473,7 @@ int output_manager_remove_plugin(int id)
 		}
 	}
 
+	output_manager_resume();
 	return 0;
 }
 
@@ -369,6 +512,19 @@ static void *output_manager_plugin_thread(void* config)
 				continue;
 			}
 
+			if (conf->pause) {
+				/* Wait until storage plugins are changed */
+				pthread_mutex_lock(&conf->in_q_mutex);
+				conf->paused = 1;
+				pthread_cond_broadcast(&conf->in_q_cond);
+				while (conf->pause) {
+					pthread_cond_wait(&conf->in_q_cond, &conf->in_q_mutex);
+				}
+				conf->paused = 0;
+				pthread_mutex_unlock(&conf->in_q_mutex);
+				continue;
+			}
+
 			/* Stop manager */
 			break;
 		}
@@ -377,7 +533,7 @@ static void *output_manager_plugin_thread(void* config)
 				? 0 : msg->input_info->odid;
 
 		/* Get appropriate data Manager config according to ODID */
-		data_config = get_data_mngmt_config(odid, conf->data_managers);
+		data_config = get_data_mngmt_config(odid, conf);
 		if (data_config == NULL) {
 			/*
 			 * No data manager config for this observation domain ID found -
@@ -429,16 +585,11 @@ static void *output_manager_plugin_thread(void* config)
 			continue;
 		}
 
-		/* Write data into input queue of Storage Plugins */
-		if (rbuffer_write(data_config->store_queue, msg, data_config->plugins_count) != 0) {
-			MSG_WARNING(msg_module, "[%u] Unable to write into Data Manager input queue; skipping data...", data_config->observation_domain_id);
-			rbuffer_remove_reference(conf->in_queue, index, 1);
-			free(msg);
-			continue;
-		}
-
 		/* Remove data from queue (without memory deallocation) */
 		rbuffer_remove_reference(conf->in_queue, index, 0);
+
+		/* Write data into input queues of Storage Plugins */
+		data_manager_store(data_config, msg);
 	}
 
 	MSG_INFO(msg_module, "Closing Output Manager thread");
@@ -607,19 +758,23 @@ void statistics_print_buffers(struct output_manager_config *conf, FILE *stat_out
 		MSG_ALWAYS(" | Queue utilization:", NULL);
 
 		struct ring_buffer *prep_buffer = get_preprocessor_output_queue();
-		MSG_ALWAYS(" |     Preprocessor output queue: %u / %u", prep_buffer->count, prep_buffer->size);
+		MSG_ALWAYS(" |     Preprocessor output queue: %u / %u", rbuffer_count(prep_buffer), prep_buffer->size);
 
 		/* Print info about Output Manager queues */
+		/* (the fullest queue of storage plugins of each Data Manager) */
 		struct data_manager_config *dm = conf->data_managers;
+		unsigned int count, size;
 		if (dm) {
 			if (conf->manager_mode == OM_SINGLE) {
-				MSG_ALWAYS(" |     Output Manager output queue: %u / %u", dm->store_queue->count, dm->store_queue->size);
+				data_manager_queue_usage(dm, &count, &size);
+				MSG_ALWAYS(" |     Output Manager output queue: %u / %u", count, size);
 			} else {
 				MSG_ALWAYS(" |     Output Manager output queues:", NULL);
 				MSG_ALWAYS(" |         %.4s | %.10s / %.10s", "ODID", "waiting", "total size");
 
 				while (dm) {
-					MSG_ALWAYS(" |   %10u %9u / %u", dm->observation_domain_id, dm->store_queue->count, dm->store_queue->size);
+					data_manager_queue_usage(dm, &count, &size);
+					MSG_ALWAYS(" |   %10u %9u / %u", dm->observation_domain_id, count, size);
 					dm = dm->next;
 				}
 			}
@@ -845,6 +1000,9 @@ static void *statistics_thread(void* config)
 		/* Print buffer usage */
 		statistics_print_buffers(conf, stat_out_file);
 
+		/* Print load of the pipeline stages, queues and exporters */
+		telemetry_report(stat_out_file, conf->stat_interval);
+
 		/* Flush input stream and close file */
 		if (print_stat_to_file) {
 			fflush(stat_out_file);
@@ -937,6 +1095,7 @@ void output_manager_close(void *config)
 	if (manager->running) {
 		rbuffer_write(manager->in_queue, NULL, 1);
 		pthread_join(manager->thread_id, NULL);
+		telemetry_queue_remove(manager->in_queue);
 		rbuffer_free(manager->in_queue);
 
 		/* Close statistics thread */
@@ -954,6 +1113,7 @@ void output_manager_close(void *config)
 			aux_config = aux_config->next;
 			data_manager_close(&tmp);
 		}
+		om_map_clear(manager);
 
 		/* Free input_info_list */
 		if (input_info_list) {
@@ -1019,6 +1179,7 @@ int output_manager_set_mode(enum om_mode mode)
 
 	conf->data_managers = NULL;
 	conf->last = NULL;
+	om_map_clear(conf);
 	conf->manager_mode = mode;
 
 	if (mode == OM_SINGLE) {
@@ -84,10 +84,15 @@ enum om_mode {
 struct output_manager_config {
 	struct data_manager_config *data_managers;  /**< output managers */
 	struct data_manager_config *last;           /**< last Output Manager in list */
+	struct data_manager_config **dm_map;        /**< Data managers hashed by ODID */
+	uint32_t dm_map_size;                       /**< Number of buckets in dm_map */
+	uint32_t dm_count;                          /**< Number of data managers */
 	struct storage *storage_plugins[32];        /**< Storage plugins */
 	struct ring_buffer *in_queue;               /**< Input queue */
 	struct ring_buffer *new_in;                 /**< New input queue */
 	int running;                                /**< Status of manager */
+	int pause;                                  /**< Request to pause the manager's thread */
+	int paused;                                 /**< Manager's thread is paused */
 	bool perman_odid_merge;                     /**< Enable permanently single data manager */
 	enum om_mode manager_mode;                       /**< Manager mode */
 	pthread_t thread_id;                        /**< Manager's thread ID */
@@ -41,11 +41,13 @@
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <sys/prctl.h>
 
 #include "configurator.h"
 #include "preprocessor.h"
 #include "data_manager.h"
 #include "queues.h"
+#include "telemetry.h"
 #include <ipfixcol.h>
 #include <ipfixcol/ipfix_message.h>
 #include "crc.h"
@@ -56,36 +58,216 @@ static char *msg_module = "preprocessor";
 static struct ring_buffer *preprocessor_out_queue = NULL;
 static configurator *global_config = NULL;
 
-/* Sequence number counter for each flow data source */
+/** Initial number of buckets of the per-thread hash tables */
+#define PREPROCESSOR_HASH_SIZE 64
+
+/**
+ * \brief Item of a per-thread hash table
+ *
+ * Must be the first member of the stored structures.
+ */
+struct preprocessor_hash_item {
+	uint64_t key;
+	struct preprocessor_hash_item *next;
+};
+
+/**
+ * \brief Per-thread hash table with chaining
+ */
+struct preprocessor_hash {
+	struct preprocessor_hash_item **buckets;
+	uint32_t size;
+	uint32_t count;
+};
+
+/*
+ * Sequence number counter for each flow data source
+ *
+ * Each input thread keeps its own table (preprocessing shard). Sources are
+ * identified by exporter address, port and ODID and a parallel input plugin
+ * always delivers one source to the same thread, so the shards are disjoint.
+ */
 struct data_source_info {
+	struct preprocessor_hash_item item; /**< Key is ODID and CRC of the exporter */
 	uint32_t exporter_ip_addr, odid, sequence_number;
 	uint32_t free_tid;
-	struct data_source_info *next;
+	struct telemetry_source *telemetry;
+};
+
+/*
+ * Exporter identification cached for an input information structure
+ *
+ * Saves computing of the CRC and the lookup of the data source for every
+ * message. Identification of the exporter is stored with the CRC, so a
+ * reused structure of another exporter is recognized.
+ */
+struct input_source {
+	struct preprocessor_hash_item item; /**< Key is the input_info pointer */
+	uint32_t crc;
+	uint8_t l3_proto;
+	uint16_t src_port;
+	struct in6_addr src_addr;
+	char *name;
+	struct data_source_info *last;      /**< Data source of the last message */
 };
 
-struct data_source_info *data_source_info = NULL;
+static __thread struct preprocessor_hash data_source_info = {NULL, 0, 0};
+static __thread struct preprocessor_hash input_sources = {NULL, 0, 0};
+
+/** Telemetry of the preprocessing in the current input thread */
+static __thread struct telemetry_stage *preprocessor_stage = NULL;
 
 /**
- * \brief Get sequence number counter for given flow data source
+ * \brief Hash function of the per-thread hash tables (MurmurHash3 finalizer)
  *
- * \param[in] exporter_ip_addr CRC32 of exporter IP address
- * \param[in] odid Observation Domain ID
- * \return Pointer to sequence number counter
+ * \param[in] key Key
+ * \return Hash
  */
-struct data_source_info *data_source_info_get(uint32_t exporter_ip_addr, uint32_t odid)
+static inline uint32_t preprocessor_hash_key(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= UINT64_C(0xff51afd7ed558ccd);
+	key ^= key >> 33;
+	key *= UINT64_C(0xc4ceb9fe1a85ec53);
+	key ^= key >> 33;
+	return (uint32_t) key;
+}
+
+/**
+ * \brief Find item in the hash table
+ *
+ * \param[in] hash Hash table
+ * \param[in] key Key
+ * \return Item or NULL
+ */
+static inline struct preprocessor_hash_item *preprocessor_hash_get(struct preprocessor_hash *hash, uint64_t key)
 {
-	struct data_source_info *aux_info = data_source_info;
-	while (aux_info) {
-		if (aux_info->exporter_ip_addr == exporter_ip_addr && aux_info->odid == odid) {
-			return aux_info;
+	struct preprocessor_hash_item *item;
+
+	if (!hash->buckets) {
+		return NULL;
+	}
+
+	item = hash->buckets[preprocessor_hash_key(key) & (hash->size - 1)];
+	while (item && item->key != key) {
+		item = item->next;
+	}
+
+	return item;
+}
+
+/**
+ * \brief Insert item into the hash table
+ *
+ * The table is doubled when it holds more items than buckets.
+ *
+ * \param[in] hash Hash table
+ * \param[in] new Item with the key set
+ * \return 0 on success
+ */
+static int preprocessor_hash_put(struct preprocessor_hash *hash, struct preprocessor_hash_item *new)
+{
+	struct preprocessor_hash_item **buckets, *item;
+	uint32_t size, i, pos;
+
+	if (!hash->buckets || hash->count >= hash->size) {
+		size = hash->buckets ? hash->size * 2 : PREPROCESSOR_HASH_SIZE;
+		buckets = calloc(size, sizeof(struct preprocessor_hash_item *));
+		if (!buckets) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		/* Move items to the new buckets */
+		for (i = 0; i < hash->size; ++i) {
+			while ((item = hash->buckets[i])) {
+				hash->buckets[i] = item->next;
+				pos = preprocessor_hash_key(item->key) & (size - 1);
+				item->next = buckets[pos];
+				buckets[pos] = item;
+			}
 		}
 
-		aux_info = aux_info->next;
+		free(hash->buckets);
+		hash->buckets = buckets;
+		hash->size = size;
+	}
+
+	pos = preprocessor_hash_key(new->key) & (hash->size - 1);
+	new->next = hash->buckets[pos];
+	hash->buckets[pos] = new;
+	hash->count++;
+
+	return 0;
+}
+
+/**
+ * \brief Remove item from the hash table
+ *
+ * \param[in] hash Hash table
+ * \param[in] key Key
+ * \return Removed item or NULL
+ */
+static struct preprocessor_hash_item *preprocessor_hash_remove(struct preprocessor_hash *hash, uint64_t key)
+{
+	struct preprocessor_hash_item **prev, *item;
+
+	if (!hash->buckets) {
+		return NULL;
+	}
+
+	for (prev = &hash->buckets[preprocessor_hash_key(key) & (hash->size - 1)]; (item = *prev); prev = &item->next) {
+		if (item->key == key) {
+			*prev = item->next;
+			hash->count--;
+			return item;
+		}
 	}
 
 	return NULL;
 }
 
+/**
+ * \brief Remove and free all items of the hash table
+ *
+ * \param[in] hash Hash table
+ * \param[in] item_free Function called for each item (frees the item)
+ */
+static void preprocessor_hash_destroy(struct preprocessor_hash *hash, void (*item_free)(struct preprocessor_hash_item *))
+{
+	struct preprocessor_hash_item *item;
+	uint32_t i;
+
+	for (i = 0; i < hash->size; ++i) {
+		while ((item = hash->buckets[i])) {
+			hash->buckets[i] = item->next;
+			item_free(item);
+		}
+	}
+
+	free(hash->buckets);
+	hash->buckets = NULL;
+	hash->size = 0;
+	hash->count = 0;
+}
+
+/**
+ * \brief Key of the data source in the hash table
+ */
+#define DATA_SOURCE_KEY(exporter_ip_addr, odid) (((uint64_t) (odid) << 32) | (exporter_ip_addr))
+
+/**
+ * \brief Get sequence number counter for given flow data source
+ *
+ * \param[in] exporter_ip_addr CRC32 of exporter IP address
+ * \param[in] odid Observation Domain ID
+ * \return Pointer to sequence number counter
+ */
+struct data_source_info *data_source_info_get(uint32_t exporter_ip_addr, uint32_t odid)
+{
+	return (struct data_source_info *) preprocessor_hash_get(&data_source_info, DATA_SOURCE_KEY(exporter_ip_addr, odid));
+}
+
 /**
  * \brief Add new flow data source info
  *
@@ -103,15 +285,14 @@ struct data_source_info *data_source_info_add(uint32_t exporter_ip_addr, uint32_
 		return NULL;
 	}
 
+	aux_info->item.key = DATA_SOURCE_KEY(exporter_ip_addr, odid);
 	aux_info->exporter_ip_addr = exporter_ip_addr;
 	aux_info->odid = odid;
 	aux_info->free_tid = 256;
 
-	if (!data_source_info) {
-		data_source_info = aux_info;
-	} else {
-		aux_info->next = data_source_info->next;
-		data_source_info->next = aux_info;
+	if (preprocessor_hash_put(&data_source_info, &aux_info->item) != 0) {
+		free(aux_info);
+		return NULL;
 	}
 
 	return aux_info;
@@ -147,6 +328,9 @@ void data_source_info_remove_source(uint32_t exporter_ip_addr, uint32_t odid)
 	if (!aux_info) {
 		return;
 	}
+
+	telemetry_source_release(aux_info->telemetry);
+	aux_info->telemetry = NULL;
 }
 
 /**
@@ -167,20 +351,160 @@ struct data_source_info *data_source_info_get_or_add(uint32_t exporter_ip_addr,
 }
 
 /**
- * \brief Get sequence number for given data source
+ * \brief Create telemetry counters of the data source
+ *
+ * \param[in] aux_info Data source info
+ * \param[in] input_info Input information of the source
+ */
+static void data_source_info_telemetry(struct data_source_info *aux_info, struct input_info *input_info)
+{
+	struct input_info_network *input = (struct input_info_network *) input_info;
+	char name[INET6_ADDRSTRLEN + 6 + 1]; // 6: colon and port; 1: null
+	size_t len;
+
+	if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+		aux_info->telemetry = telemetry_source_create(((struct input_info_file *) input_info)->name, aux_info->odid);
+		return;
+	}
+
+	if (input->l3_proto == 6) { /* IPv6 */
+		inet_ntop(AF_INET6, &(input->src_addr.ipv6.s6_addr), name, INET6_ADDRSTRLEN);
+	} else { /* IPv4 */
+		inet_ntop(AF_INET, &(input->src_addr.ipv4.s_addr), name, INET_ADDRSTRLEN);
+	}
+
+	len = strlen(name);
+	snprintf(name + len, sizeof(name) - len, ":%u", input->src_port);
+
+	aux_info->telemetry = telemetry_source_create(name, aux_info->odid);
+}
+
+/**
+ * \brief Get data source info for given message
  *
  * \param[in] exporter_ip_addr CRC32 of exporter IP address
  * \param[in] odid Observation Domain ID
- * \return Pointer to sequence number value
+ * \param[in] input_info Input information of the source
+ * \return data_source_info
  */
-uint32_t *data_source_info_get_sequence_number(uint32_t exporter_ip_addr, uint32_t odid)
+static struct data_source_info *data_source_info_get_for_msg(uint32_t exporter_ip_addr, uint32_t odid, struct input_info *input_info)
 {
 	struct data_source_info *aux_info = data_source_info_get_or_add(exporter_ip_addr, odid);
 	if (!aux_info) {
 		return NULL;
 	}
 
-	return &(aux_info->sequence_number);
+	if (telemetry_enabled && !aux_info->telemetry) {
+		data_source_info_telemetry(aux_info, input_info);
+	}
+
+	return aux_info;
+}
+
+/**
+ * \brief Check whether cached exporter identification belongs to the input info
+ *
+ * \param[in] source Cached exporter identification
+ * \param[in] input_info Input information
+ * \return Nonzero when it matches
+ */
+static inline int input_source_match(struct input_source *source, struct input_info *input_info)
+{
+	struct input_info_network *input = (struct input_info_network *) input_info;
+
+	if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+		return source->name == ((struct input_info_file *) input_info)->name;
+	}
+
+	return source->l3_proto == input->l3_proto && source->src_port == input->src_port
+			&& memcmp(&source->src_addr, &input->src_addr, sizeof(source->src_addr)) == 0;
+}
+
+/**
+ * \brief Get exporter identification of the input info
+ *
+ * The CRC is computed only for the first message of the source.
+ *
+ * \param[in] input_info Input information
+ * \return Exporter identification or NULL on error
+ */
+static struct input_source *input_source_get(struct input_info *input_info)
+{
+	struct input_info_network *input = (struct input_info_network *) input_info;
+	struct input_source *source;
+
+	source = (struct input_source *) preprocessor_hash_get(&input_sources, (uintptr_t) input_info);
+	if (source && input_source_match(source, input_info)) {
+		return source;
+	}
+
+	if (!source) {
+		source = calloc(1, sizeof(struct input_source));
+		if (!source) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+			return NULL;
+		}
+
+		source->item.key = (uintptr_t) input_info;
+		if (preprocessor_hash_put(&input_sources, &source->item) != 0) {
+			free(source);
+			return NULL;
+		}
+	}
+
+	/* New source or the structure has been reused for another one */
+	source->crc = preprocessor_compute_crc(input_info);
+	source->last = NULL;
+	if (input_info->type == SOURCE_TYPE_IPFIX_FILE) {
+		source->name = ((struct input_info_file *) input_info)->name;
+	} else {
+		source->l3_proto = input->l3_proto;
+		source->src_port = input->src_port;
+		memcpy(&source->src_addr, &input->src_addr, sizeof(source->src_addr));
+	}
+
+	return source;
+}
+
+/**
+ * \brief Get data source info of the exporter for given ODID
+ *
+ * \param[in] source Exporter identification
+ * \param[in] odid Observation Domain ID
+ * \param[in] input_info Input information
+ * \return data_source_info
+ */
+static inline struct data_source_info *input_source_data_source(struct input_source *source, uint32_t odid, struct input_info *input_info)
+{
+	/* Exporters usually send a single ODID */
+	if (!source->last || source->last->odid != odid) {
+		source->last = data_source_info_get_for_msg(source->crc, odid, input_info);
+	}
+
+	return source->last;
+}
+
+/**
+ * \brief Free data source info
+ *
+ * \param[in] item Item of the hash table
+ */
+static void data_source_info_free(struct preprocessor_hash_item *item)
+{
+	struct data_source_info *aux_info = (struct data_source_info *) item;
+
+	telemetry_source_release(aux_info->telemetry);
+	free(aux_info);
+}
+
+/**
+ * \brief Free cached exporter identification
+ *
+ * \param[in] item Item of the hash table
+ */
+static void input_source_free(struct preprocessor_hash_item *item)
+{
+	free(item);
 }
 
 /**
@@ -188,12 +512,8 @@ uint32_t *data_source_info_get_sequence_number(uint32_t exporter_ip_addr, uint32
  */
 void data_source_info_destroy()
 {
-	struct data_source_info *aux_info = data_source_info;
-	while (aux_info) {
-		data_source_info = data_source_info->next;
-		free(aux_info);
-		aux_info = data_source_info;
-	}
+	preprocessor_hash_destroy(&data_source_info, data_source_info_free);
+	preprocessor_hash_destroy(&input_sources, input_source_free);
 }
 
 /**
@@ -364,45 +684,113 @@ static int preprocessor_process_one_template(void *tmpl, int max_len, int type,
 	return template->template_length - sizeof(struct ipfix_template) + sizeof(struct ipfix_options_template_record);
 }
 
-static int mdata_max = 0;
+/* Lengths of variable-length data records of the message being processed by this thread */
+static __thread uint16_t *var_lengths = NULL;
+static __thread uint32_t var_lengths_max = 0;
 
-void fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void *data)
+/**
+ * \brief Count data records of one data set
+ *
+ * Records of fixed-length templates are counted arithmetically, lengths of
+ * variable-length records are parsed and stored in the var_lengths array.
+ *
+ * \param[in] data_set Data set
+ * \param[in] templ Template of the data set
+ * \param[in,out] var_count Number of lengths in the var_lengths array
+ * \return Number of data records
+ */
+static uint32_t preprocessor_count_records(struct ipfix_data_set *data_set, struct ipfix_template *templ, uint32_t *var_count)
 {
-	struct ipfix_message *msg = (struct ipfix_message *) data;
+	int set_len = ntohs(data_set->header.length);
+	int offset, min_len;
+	uint32_t count = 0;
+	uint16_t rec_len, *new_lengths;
+
+	if (!(templ->data_length & 0x80000000)) {
+		/* Fixed-length records, the rest of the set is padding */
+		if (templ->data_length == 0 || set_len < 4) {
+			return 0;
+		}
+		return (set_len - 4) / templ->data_length;
+	}
 
-	/* Allocate space for metadata */
-	if (mdata_max == 0) {
-		mdata_max = 75;
-		msg->metadata = calloc(mdata_max, sizeof(struct metadata));
-		if (!msg->metadata) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			mdata_max = 0;
-			return;
+	/* Size of the fields, variable-length fields count as 1 byte */
+	min_len = templ->data_length & 0x7fff;
+
+	for (offset = 4; set_len - offset - min_len >= 0; offset += rec_len) {
+		if (*var_count == var_lengths_max) {
+			new_lengths = realloc(var_lengths, (var_lengths_max ? var_lengths_max * 2 : 1024) * sizeof(uint16_t));
+			if (!new_lengths) {
+				MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+				break;
+			}
+
+			var_lengths = new_lengths;
+			var_lengths_max = var_lengths_max ? var_lengths_max * 2 : 1024;
 		}
+
+		rec_len = data_record_length((uint8_t *) data_set + offset, templ);
+		var_lengths[(*var_count)++] = rec_len;
+		count++;
 	}
 
-	/* Need more space */
-	if (msg->data_records_count == mdata_max) {
-		void *new_mdata = realloc(msg->metadata, mdata_max * 2 * sizeof(struct metadata));
+	return count;
+}
 
-		if (!new_mdata) {
-			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-			return;
+/**
+ * \brief Fill metadata of data records of the message
+ *
+ * Records are counted first, so the metadata array is allocated at once
+ * with the exact size. Each record is parsed at most once.
+ *
+ * \param[in] msg IPFIX message with templates coupled to the data sets
+ */
+static void preprocessor_fill_metadata(struct ipfix_message *msg)
+{
+	struct ipfix_template *templ;
+	struct metadata *mdata;
+	uint32_t count = 0, var_count = 0, var_index = 0, set_count[MSG_MAX_DATA_COUPLES];
+	uint32_t i, j, offset;
+
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; i++) {
+		set_count[i] = 0;
+		if (msg->data_couple[i].data_template) {
+			set_count[i] = preprocessor_count_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template, &var_count);
+			count += set_count[i];
 		}
+	}
+
+	if (count == 0) {
+		return;
+	}
 
-		msg->metadata = new_mdata;
-		memset(&(msg->metadata[mdata_max]), 0, mdata_max * sizeof(struct metadata));
+	msg->metadata = message_pool_alloc(count * sizeof(struct metadata));
+	if (!msg->metadata) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return;
+	}
+	memset(msg->metadata, 0, count * sizeof(struct metadata));
 
-		mdata_max *= 2;
+	mdata = msg->metadata;
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; i++) {
+		templ = msg->data_couple[i].data_template;
+		offset = 0;
+
+		for (j = 0; j < set_count[i]; ++j, ++mdata) {
+			mdata->record.record = msg->data_couple[i].data_set->records + offset;
+			mdata->record.templ = templ;
+			if (templ->data_length & 0x80000000) {
+				mdata->record.length = var_lengths[var_index++];
+			} else {
+				mdata->record.length = templ->data_length;
+			}
+			offset += mdata->record.length;
+		}
 	}
 
-	/* Fill metadata */
+	/* The same profiles are used for all records of the message */
 	msg->live_profile = (global_config) ? config_get_current_profiles(global_config) : NULL;
-	msg->metadata[msg->data_records_count].record.record = rec;
-	msg->metadata[msg->data_records_count].record.length = rec_len;
-	msg->metadata[msg->data_records_count].record.templ = templ;
-
-	msg->data_records_count++;
+	msg->data_records_count = count;
 }
 
 /**
@@ -419,12 +807,12 @@ void fill_metadata(uint8_t *rec, int rec_len, struct ipfix_template *templ, void
  *   determined)
  *
  * @param[in] msg IPFIX			message
+ * @param[in] crc CRC of the exporter identification
  * @return uint32_t Number of received data records
  */
-static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
+static uint32_t preprocessor_process_templates(struct ipfix_message *msg, uint32_t crc)
 {
 	uint8_t *ptr;
-	uint32_t records_count = 0;
 	int i, ret;
 	uint16_t max_len; /* length to the end of the set = max length of the template */
 	uint16_t set_len;
@@ -436,7 +824,7 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 	msg->data_records_count = msg->templ_records_count = msg->opt_templ_records_count = 0;
 
 	key.odid = ntohl(msg->pkt_header->observation_domain_id);
-	key.crc = preprocessor_compute_crc(msg->input_info);
+	key.crc = crc;
 
 	preprocessor_udp_init((struct input_info_network *) msg->input_info, &udp_conf);
 
@@ -482,8 +870,6 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 		}
 	}
 
-	mdata_max = 0;
-
 	/* add template to message data_couples */
 	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; i++) {
 		key.tid = ntohs(msg->data_couple[i].data_set->header.flowset_id);
@@ -504,22 +890,11 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 				MSG_WARNING(msg_module, "[%u] Data template with ID %i has expired; using old template...", key.odid,
 						msg->data_couple[i].data_template->template_id);
 			}
-
-			/* compute sequence number and fill metadata */
-			records_count += data_set_process_records(msg->data_couple[i].data_set, msg->data_couple[i].data_template, fill_metadata, msg);
 		}
 	}
 
-	/*
-	 * FILL METADATA, two options:
-	 * a) fill metadata AFTER counting data records
-	 *		+ allocate whole array at once
-	 *		- data sets and data records are accesed twice (data_set_records_count and data_set_process_records)
-	 *
-	 * b) fill metadata WHILE counting data records (using now) (replace data_set_records_count with data_set_process_records and add callback)
-	 *		+ one acces to data sets
-	 *		- needs reallocation
-	 */
+	/* Count data records (for sequence numbers) and fill metadata */
+	preprocessor_fill_metadata(msg);
 
 	/* return number of data records */
 	return msg->data_records_count;
@@ -536,35 +911,55 @@ static uint32_t preprocessor_process_templates(struct ipfix_message *msg)
 void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info, int source_status)
 {
 	struct ipfix_message* msg;
+	struct input_source *exporter;
+	struct data_source_info *source;
 	uint32_t exporter_ip_addr;
 	uint32_t *seqn;
+	uint64_t start = 0;
+	char thread_name[16];
 
 	/* Check input info */
 	if (input_info == NULL) {
 		MSG_WARNING(msg_module, "Invalid parameters in preprocessor_parse_msg");
 
 		if (packet) {
-			free(packet);
+			message_pool_free(packet);
 		}
 
 		packet = NULL;
 		return;
 	}
 
+	if (telemetry_enabled) {
+		if (!preprocessor_stage) {
+			/* Each input thread is a stage of its own */
+			prctl(PR_GET_NAME, thread_name, 0, 0, 0);
+			thread_name[15] = '\0';
+			preprocessor_stage = telemetry_stage_create(thread_name);
+		}
+
+		start = telemetry_now();
+	}
+
 	/* CRC of exporter identification is used to differentiate sources */
-	exporter_ip_addr = preprocessor_compute_crc(input_info);
+	exporter = input_source_get(input_info);
+	exporter_ip_addr = exporter ? exporter->crc : preprocessor_compute_crc(input_info);
 
 	if (source_status == SOURCE_STATUS_CLOSED) {
 		/* Inform intermediate plugins and output manager about closed input */
-		msg = calloc(1, sizeof(struct ipfix_message));
+		msg = message_pool_alloc(sizeof(struct ipfix_message));
 		if (!msg) {
 			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 			return;
 		}
+		memset(msg, 0, sizeof(struct ipfix_message));
 
 		msg->input_info = input_info;
 		msg->source_status = source_status;
 		data_source_info_remove_source(exporter_ip_addr, input_info->odid);
+
+		/* Input info may be freed after the message is processed */
+		free(preprocessor_hash_remove(&input_sources, (uintptr_t) input_info));
 	} else {
 		if (packet == NULL) {
 			MSG_WARNING(msg_module, "[%u] Received empty IPFIX message", input_info->odid);
@@ -574,7 +969,7 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 		/* Process IPFIX packet and fill up the ipfix_message structure */
 		msg = message_create_from_mem(packet, len, input_info, source_status);
 		if (!msg) {
-			free(packet);
+			message_pool_free(packet);
 			packet = NULL;
 			return;
 		}
@@ -588,12 +983,23 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 		}
 
 		/* Process templates and correct sequence number */
-		preprocessor_process_templates(msg);
+		preprocessor_process_templates(msg, exporter_ip_addr);
 
 		/* Get sequence number for current ODID. More inputs can have the same ODID, so we
 		 * need to keep that separately.
 		 */
-		seqn = data_source_info_get_sequence_number(exporter_ip_addr, ntohl(msg->pkt_header->observation_domain_id));
+		if (exporter) {
+			source = input_source_data_source(exporter, ntohl(msg->pkt_header->observation_domain_id), input_info);
+		} else {
+			source = data_source_info_get_for_msg(exporter_ip_addr, ntohl(msg->pkt_header->observation_domain_id), input_info);
+		}
+
+		if (!source) {
+			message_free(msg);
+			return;
+		}
+
+		seqn = &(source->sequence_number);
 
 		/* If we have a message with data records (the only one that updates sequence number), check
 		 * the sequence numbers.
@@ -608,6 +1014,10 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 						input_info->odid, msg->input_info->sequence_number, pkt_header_seq_number);
 			}
 
+			if (msg->input_info->packets > 0) {
+				telemetry_source_gap(source->telemetry, msg->input_info->sequence_number, pkt_header_seq_number);
+			}
+
 			/* Add number of seen data records to ODID sequence number to maintain consistency */
 			*seqn += pkt_header_seq_number - msg->input_info->sequence_number;
 
@@ -625,6 +1035,9 @@ void preprocessor_parse_msg(void* packet, int len, struct input_info* input_info
 		/* Update other input_info variables */
 		++msg->input_info->packets;
 		msg->input_info->data_records += msg->data_records_count;
+
+		telemetry_source_add(source->telemetry, msg->data_records_count);
+		telemetry_stage_add(preprocessor_stage, start, 1, msg->data_records_count);
 	}
 
 	/* Send data to the first intermediate plugin */
@@ -640,5 +1053,12 @@ void preprocessor_close()
 {
 	/* output queue will be closed by intermediate process or output manager */
 	data_source_info_destroy();
+
+	telemetry_stage_release(preprocessor_stage);
+	preprocessor_stage = NULL;
+
+	free(var_lengths);
+	var_lengths = NULL;
+	var_lengths_max = 0;
 	return;
 }
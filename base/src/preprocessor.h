@@ -99,6 +99,9 @@ void preprocessor_set_configurator(configurator *config);
 
 /**
  * \brief Close all data managers and their storage plugins
+ *
+ * Frees the preprocessing state (sequence number counters) of the calling
+ * thread. Each input thread has to call this function before it exits.
  */
 void preprocessor_close ();
 
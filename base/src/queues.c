@@ -40,12 +40,199 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
 
 #include "queues.h"
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "queue";
 
+/**
+ * Sequence number of the slot: odd value 2 * position + 1 means that the slot
+ * contains data written at the position, even value means that the slot is
+ * free (or just being released). Position never wraps, so the sequence number
+ * identifies also the round of the ring buffer.
+ */
+#define RBUFFER_SEQ_READY(pos)    (((pos) << 1) | 1)
+#define RBUFFER_SEQ_RELEASED(pos) (((pos) + 1) << 1)
+
+/** Number of busy-wait rounds before the thread starts to yield */
+#define RBUFFER_SPIN_COUNT  1024
+/** Number of sched_yield() rounds before the thread parks */
+#define RBUFFER_YIELD_COUNT 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define rbuffer_cpu_relax() __builtin_ia32_pause()
+#else
+#define rbuffer_cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/** Condition checked by waiting thread */
+typedef int (*rbuffer_cond_f)(struct ring_buffer *rbuffer, uint64_t arg);
+
+/**
+ * \brief Check whether writer can claim \p arg new slots
+ */
+static int rbuffer_cond_space(struct ring_buffer *rbuffer, uint64_t arg)
+{
+	uint64_t write_offset = __atomic_load_n(&rbuffer->write_offset, __ATOMIC_SEQ_CST);
+	uint64_t read_offset = __atomic_load_n(&rbuffer->read_offset, __ATOMIC_SEQ_CST);
+
+	/* leave one position in buffer free, so that faster thread cannot read
+	 * data yet not processed by slower one */
+	return write_offset - read_offset + arg < rbuffer->size;
+}
+
+/**
+ * \brief Check whether slot \p arg contains data
+ */
+static int rbuffer_cond_ready(struct ring_buffer *rbuffer, uint64_t arg)
+{
+	return __atomic_load_n(&rbuffer->slots[arg].seq, __ATOMIC_SEQ_CST) & 1;
+}
+
+/**
+ * \brief Check whether all data were released
+ */
+static int rbuffer_cond_empty(struct ring_buffer *rbuffer, uint64_t arg)
+{
+	(void) arg;
+	return __atomic_load_n(&rbuffer->read_offset, __ATOMIC_SEQ_CST)
+			== __atomic_load_n(&rbuffer->write_offset, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Wait until condition is met
+ *
+ * Spin first, then yield the CPU and finally park on the condition variable.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] cond Condition to wait for.
+ * @param[in] arg Argument of the condition.
+ * @return 0 on success, nonzero on error.
+ */
+static int rbuffer_wait(struct ring_buffer *rbuffer, rbuffer_cond_f cond, uint64_t arg)
+{
+	int i, ret = EXIT_SUCCESS;
+
+	for (i = 0; i < RBUFFER_SPIN_COUNT; ++i) {
+		if (cond(rbuffer, arg)) {
+			return EXIT_SUCCESS;
+		}
+		rbuffer_cpu_relax();
+	}
+
+	for (i = 0; i < RBUFFER_YIELD_COUNT; ++i) {
+		if (cond(rbuffer, arg)) {
+			return EXIT_SUCCESS;
+		}
+		sched_yield();
+	}
+
+	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
+	}
+
+	/* announce the waiter before the last check, see rbuffer_wake() */
+	__atomic_add_fetch(&rbuffer->waiters, 1, __ATOMIC_SEQ_CST);
+	while (!cond(rbuffer, arg)) {
+		if (pthread_cond_wait(&(rbuffer->cond), &(rbuffer->mutex)) != 0) {
+			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
+			ret = EXIT_FAILURE;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&rbuffer->waiters, 1, __ATOMIC_SEQ_CST);
+
+	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Wake up parked threads (if any)
+ *
+ * Must be called after the change that parked threads may wait for is
+ * visible. Waiters counter is incremented before the condition is checked
+ * for the last time, so either waker sees the waiter, or waiter sees the
+ * change.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return 0 on success, nonzero on error.
+ */
+static int rbuffer_wake(struct ring_buffer *rbuffer)
+{
+	int ret = EXIT_SUCCESS;
+
+	if (__atomic_load_n(&rbuffer->waiters, __ATOMIC_SEQ_CST) == 0) {
+		return EXIT_SUCCESS;
+	}
+
+	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
+	}
+
+	if (pthread_cond_broadcast(&(rbuffer->cond)) != 0) {
+		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
+		/* Do not return yet, we need to unlock first */
+		ret = EXIT_FAILURE;
+	}
+
+	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
+		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
+		return EXIT_FAILURE;
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Free IPFIX message together with its metadata and decrement
+ * references on its templates
+ *
+ * A message shared by views is freed by the last holder, a view releases
+ * its source message.
+ *
+ * @param[in] msg IPFIX message
+ */
+void rbuffer_free_message(struct ipfix_message *msg)
+{
+	struct ipfix_message *source = msg->view_source;
+	int i;
+
+	if (__atomic_fetch_sub(&(msg->shares), 1, __ATOMIC_ACQ_REL) > 0) {
+		/* Still used by a view */
+		return;
+	}
+
+	if (msg->pkt_header) {
+		message_pool_free(msg->pkt_header);
+	}
+
+	/* Decrement reference on templates */
+	for (i = 0; i < MSG_MAX_DATA_COUPLES && msg->data_couple[i].data_set; ++i) {
+		if (msg->data_couple[i].data_template) {
+			tm_template_reference_dec(msg->data_couple[i].data_template);
+		}
+	}
+
+	if (msg->metadata) {
+		message_free_metadata(msg);
+	}
+
+	message_pool_free(msg);
+
+	if (source) {
+		rbuffer_free_message(source);
+	}
+}
+
 /**
  * \brief Initiate ring buffer structure with specified size.
  *
@@ -56,40 +243,29 @@ struct ring_buffer* rbuffer_init(uint16_t size)
 {
 	struct ring_buffer* retval = NULL;
 
-	if (size == 0) {
-		MSG_ERROR(msg_module, "Size of the ring buffer set to zero");
+	if (size < 2) {
+		MSG_ERROR(msg_module, "Size of the ring buffer set to %u", size);
 		return NULL;
 	}
 
-	retval = (struct ring_buffer*) malloc(sizeof(struct ring_buffer));
-	if (retval == NULL) {
+	/* malloc is used because of the alignment; structure is cleared right away */
+	if (posix_memalign((void **) &retval, RBUFFER_CACHE_LINE, sizeof(struct ring_buffer)) != 0) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
+	memset(retval, 0, sizeof(struct ring_buffer));
 
-	retval->read_offset = 0;
-	retval->write_offset = 0;
-	retval->count = 0;
 	retval->size = size;
-	retval->data = (struct ipfix_message **) malloc(size * sizeof(struct ipfix_message*));
-	if (retval->data == NULL) {
-		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		free(retval);
-		return NULL;
-	}
-
-	retval->data_references = (unsigned int *) calloc(size, sizeof(unsigned int));
-	if (retval->data_references == NULL) {
+	retval->slots = (struct rbuffer_slot *) calloc(size, sizeof(struct rbuffer_slot));
+	if (retval->slots == NULL) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
-		free(retval->data);
 		free(retval);
 		return NULL;
 	}
 
 	if (pthread_mutex_init(&(retval->mutex), NULL) != 0) {
 		MSG_ERROR(msg_module, "Initialization of condition variable failed (%s:%d)", __FILE__, __LINE__);
-		free(retval->data_references);
-		free(retval->data);
+		free(retval->slots);
 		free(retval);
 		return NULL;
 	}
@@ -97,17 +273,7 @@ struct ring_buffer* rbuffer_init(uint16_t size)
 	if (pthread_cond_init(&(retval->cond), NULL) != 0) {
 		MSG_ERROR(msg_module, "Initialization of condition variable failed (%s:%d)", __FILE__, __LINE__);
 		pthread_mutex_destroy(&(retval->mutex));
-		free(retval->data_references);
-		free(retval->data);
-		free(retval);
-		return NULL;
-	}
-
-	if (pthread_cond_init(&(retval->cond_empty), NULL) != 0) {
-		MSG_ERROR(msg_module, "Initialization of condition variable failed (%s:%d)", __FILE__, __LINE__);
-		pthread_mutex_destroy(&(retval->mutex));
-		free(retval->data_references);
-		free(retval->data);
+		free(retval->slots);
 		free(retval);
 		return NULL;
 	}
@@ -116,60 +282,108 @@ struct ring_buffer* rbuffer_init(uint16_t size)
 }
 
 /**
- * \brief Add new record into the ring buffer.
+ * \brief Raise the high water mark of the ring buffer
  *
  * @param[in] rbuffer Ring buffer.
- * @param[in] record IPFIX message structure to be added into the ring buffer.
+ * @param[in] write_offset Write offset after the last claim.
+ */
+static inline void rbuffer_mark_high_water(struct ring_buffer* rbuffer, uint64_t write_offset)
+{
+	unsigned int used, mark;
+
+	used = write_offset - __atomic_load_n(&rbuffer->read_offset, __ATOMIC_RELAXED);
+	mark = __atomic_load_n(&rbuffer->high_water, __ATOMIC_RELAXED);
+	while (used > mark && !__atomic_compare_exchange_n(&rbuffer->high_water, &mark,
+			used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * \brief Claim \p count consecutive positions for writing.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] count Number of positions (must be smaller than size - 1).
+ * @param[out] first First claimed position.
+ * @return 0 on success, nonzero on error.
+ */
+static int rbuffer_claim(struct ring_buffer* rbuffer, unsigned int count, uint64_t *first)
+{
+	uint64_t write_offset;
+
+	write_offset = __atomic_load_n(&rbuffer->write_offset, __ATOMIC_SEQ_CST);
+	do {
+		if (!rbuffer_cond_space(rbuffer, count)) {
+			if (rbuffer_wait(rbuffer, rbuffer_cond_space, count) != 0) {
+				return EXIT_FAILURE;
+			}
+			write_offset = __atomic_load_n(&rbuffer->write_offset, __ATOMIC_SEQ_CST);
+		}
+	} while (!__atomic_compare_exchange_n(&rbuffer->write_offset, &write_offset,
+			write_offset + count, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	rbuffer_mark_high_water(rbuffer, write_offset + count);
+
+	*first = write_offset;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * \brief Add several records into the ring buffer at once.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] records Array of IPFIX messages to be added into the ring buffer.
+ * @param[in] count Number of messages in the array.
  * @param[in] ref_count Initial reference count - number of reading threads.
  * @return 0 on success, nonzero on error.
  */
-int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count)
+int rbuffer_write_batch(struct ring_buffer* rbuffer, struct ipfix_message** records, unsigned int count, uint16_t ref_count)
 {
+	struct rbuffer_slot *slot;
+	unsigned int i, chunk;
+	uint64_t first;
+
 	if (rbuffer == NULL || ref_count == 0) {
 		MSG_ERROR(msg_module, "Invalid ring buffer write parameters");
 		return EXIT_FAILURE;
 	}
 
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
-	}
-	/* it will be never more than ring buffer size, but just to be sure I'm checking it 
-	 * leave one position in buffer free, so that faster thread cannot read 
-	 * data yet not processed by slower one */
-	while (rbuffer->count + 1 >= rbuffer->size) {
-		if (pthread_cond_wait(&(rbuffer->cond), &(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
+	while (count > 0) {
+		/* one position is always free, never claim more than the rest */
+		chunk = (count < (unsigned int) rbuffer->size - 1) ? count : (unsigned int) rbuffer->size - 1;
 
-			if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-				MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			}
-			
+		if (rbuffer_claim(rbuffer, chunk, &first) != 0) {
 			return EXIT_FAILURE;
 		}
-	}
 
-	rbuffer->data[rbuffer->write_offset] = record;
-	rbuffer->data_references[rbuffer->write_offset] = ref_count;
-	rbuffer->write_offset = (rbuffer->write_offset + 1) % rbuffer->size;
-	rbuffer->count++;
+		for (i = 0; i < chunk; ++i) {
+			slot = &rbuffer->slots[(first + i) % rbuffer->size];
+			slot->data = records[i];
+			__atomic_store_n(&slot->references, ref_count, __ATOMIC_RELAXED);
+			__atomic_store_n(&slot->seq, RBUFFER_SEQ_READY(first + i), __ATOMIC_SEQ_CST);
+		}
 
-	/* Set exit code to variable */
-	int ret = EXIT_SUCCESS;
+		/* inform readers once for the whole chunk */
+		if (rbuffer_wake(rbuffer) != 0) {
+			return EXIT_FAILURE;
+		}
 
-	/* I did change of rbuffer->count so inform about it other threads (read threads) */
-	if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
-		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-		/* Do not return yet, we need to unlock first */
-		ret = EXIT_FAILURE;
+		records += chunk;
+		count -= chunk;
 	}
 
-	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
-	}
+	return EXIT_SUCCESS;
+}
 
-	return ret;
+/**
+ * \brief Add new record into the ring buffer.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] record IPFIX message structure to be added into the ring buffer.
+ * @param[in] ref_count Initial reference count - number of reading threads.
+ * @return 0 on success, nonzero on error.
+ */
+int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count)
+{
+	return rbuffer_write_batch(rbuffer, &record, 1, ref_count);
 }
 
 /**
@@ -185,41 +399,59 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
 {
 	if (*index == (unsigned int) -1) {
 		/* if no index specified -> read from read_offset, so just 1 record in ring buffer required */
-		*index = rbuffer->read_offset;
-	}
-
-	/* check if the ring buffer is full enough, if not wait (and block) for it */
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
+		*index = __atomic_load_n(&rbuffer->read_offset, __ATOMIC_SEQ_CST) % rbuffer->size;
 	}
-	/* wait when trying to read from write_offset - no data here yer
-	 * otherwise it's ok, reading tread connot outrun the writing one,
-	 * unles it demands indexes nonlinearly */
-	while (rbuffer->write_offset == *index) {
-		if (pthread_cond_wait(&(rbuffer->cond), &(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
-
-			if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-				MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			}
 
+	/* wait when trying to read from the slot that was not written yet;
+	 * reading thread cannot outrun the writing one, because one position
+	 * is always left free */
+	if (!rbuffer_cond_ready(rbuffer, *index)) {
+		if (rbuffer_wait(rbuffer, rbuffer_cond_ready, *index) != 0) {
 			return NULL;
 		}
 	}
-	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
+
+	/* get data */
+	return rbuffer->slots[*index].data;
+}
+
+/**
+ * \brief Get pointers to all records that are ready to be read from the
+ * specified index.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in,out] index Index of the first record, see rbuffer_read().
+ * @param[out] records Array for the read records.
+ * @param[in] max Size of the \p records array.
+ * @return Number of read records, 0 on error.
+ */
+unsigned int rbuffer_read_batch(struct ring_buffer* rbuffer, unsigned int *index, struct ipfix_message** records, unsigned int max)
+{
+	unsigned int count, avail, pos;
+
+	if (max == 0) {
+		return 0;
 	}
 
-	/* Wake up other threads waiting for read */
-	if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
-		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-		return NULL;
+	records[0] = rbuffer_read(rbuffer, index);
+	count = 1;
+
+	/* only positions between index and write offset can be used, the rest
+	 * of slots may still hold older (unreleased) data */
+	avail = (__atomic_load_n(&rbuffer->write_offset, __ATOMIC_SEQ_CST) % rbuffer->size
+			+ rbuffer->size - *index) % rbuffer->size;
+
+	/* stop at terminating NULL message, caller has to handle it separately */
+	while (records[count - 1] != NULL && count < max && count < avail) {
+		pos = (*index + count) % rbuffer->size;
+		if (!rbuffer_cond_ready(rbuffer, pos)) {
+			break;
+		}
+
+		records[count++] = rbuffer->slots[pos].data;
 	}
 
-	/* get data */
-	return rbuffer->data[*index];
+	return count;
 }
 
 /**
@@ -242,78 +474,55 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
  */
 int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, uint8_t do_free)
 {
-	int i;
+	struct rbuffer_slot *slot;
+	uint64_t read_offset, seq;
+	int released = 0;
 
 	/* atomic rbuffer->data_references[index]--; and check <= 0 */
-	if (__sync_fetch_and_sub(&(rbuffer->data_references[index]), 1) <= 0) {
+	if (__atomic_fetch_sub(&(rbuffer->slots[index].references), 1, __ATOMIC_SEQ_CST) <= 0) {
 		return EXIT_FAILURE;
 	}
 
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
-	}
-
-	/* it will be never less than zero, but just to be sure I'm checking it */
-	if (rbuffer->data_references[rbuffer->read_offset] <= 0) {
-		while ((rbuffer->data_references[rbuffer->read_offset] == 0) && (rbuffer->count > 0)) {
-			if (do_free) {
-				/* free the data */
-				if (rbuffer->data[rbuffer->read_offset]) {
-					if (rbuffer->data[rbuffer->read_offset]->pkt_header) {
-						free(rbuffer->data[rbuffer->read_offset]->pkt_header);
-					}
-
-					/* Decrement reference on templates */
-					for (i = 0; i < MSG_MAX_DATA_COUPLES && rbuffer->data[rbuffer->read_offset]->data_couple[i].data_set; ++i) {
-						if (rbuffer->data[rbuffer->read_offset]->data_couple[i].data_template) {
-							tm_template_reference_dec(rbuffer->data[rbuffer->read_offset]->data_couple[i].data_template);
-						}
-					}
-					
-					if (rbuffer->data[rbuffer->read_offset]->metadata) {
-						message_free_metadata(rbuffer->data[rbuffer->read_offset]);
-					}
-					
-					free(rbuffer->data[rbuffer->read_offset]);
-				}
-			}
-
-			/* move offset pointer in ring buffer */
-			rbuffer->read_offset = (rbuffer->read_offset + 1) % rbuffer->size;
-			rbuffer->count--;
-
-			/* signal to write thread waiting for empty queue */
-			if (rbuffer->count == 0) {
-				if (pthread_cond_signal(&(rbuffer->cond_empty)) != 0) {
-					MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-
-					if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-						MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-					}
+	/*
+	 * Release all unreferenced slots at read offset. Only the thread that
+	 * switches sequence number of the slot at read offset moves the offset,
+	 * so the offset is never moved by two threads at once. Whoever loses the
+	 * race stops; the winner checks the following slot after moving the offset.
+	 */
+	while (1) {
+		read_offset = __atomic_load_n(&rbuffer->read_offset, __ATOMIC_SEQ_CST);
+		slot = &rbuffer->slots[read_offset % rbuffer->size];
+
+		/* check sequence number before references - they are valid only
+		 * when the slot has been written at read offset */
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST);
+		if (seq != RBUFFER_SEQ_READY(read_offset)) {
+			/* not written yet or released by another thread */
+			break;
+		}
 
-					return EXIT_FAILURE;
-				}
-			}
+		if (__atomic_load_n(&slot->references, __ATOMIC_SEQ_CST) != 0) {
+			break;
 		}
-		if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			return EXIT_FAILURE;
+
+		if (!__atomic_compare_exchange_n(&slot->seq, &seq, RBUFFER_SEQ_RELEASED(read_offset),
+				0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			break;
 		}
-	} else {
-		if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			return EXIT_FAILURE;
+
+		if (do_free && slot->data) {
+			/* free the data */
+			rbuffer_free_message(slot->data);
 		}
+		slot->data = NULL;
 
-		/* only reference decrease was done, moving rbuffer->read_offset not */
-		return EXIT_SUCCESS;
+		__atomic_store_n(&rbuffer->read_offset, read_offset + 1, __ATOMIC_SEQ_CST);
+		released = 1;
 	}
 
-	/* I did change of rbuffer->count so inform about it other threads (mainly write thread) */
-	if (pthread_cond_signal(&(rbuffer->cond)) != 0) {
-		MSG_ERROR(msg_module, "Condition signal failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
+	/* I did change of read offset so inform about it other threads (mainly write thread) */
+	if (released) {
+		return rbuffer_wake(rbuffer);
 	}
 
 	return EXIT_SUCCESS;
@@ -325,24 +534,41 @@ int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, ui
  * @param[in] rbuffer Ring buffer.
  * @return 0 on success, nonzero on error
  */
-int rbuffer_wait_empty(struct ring_buffer* rbuffer) {
-	if (pthread_mutex_lock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
+int rbuffer_wait_empty(struct ring_buffer* rbuffer)
+{
+	if (rbuffer_cond_empty(rbuffer, 0)) {
+		return EXIT_SUCCESS;
 	}
 
-	while (rbuffer->count > 0) {
-		if (pthread_cond_wait(&(rbuffer->cond_empty), &(rbuffer->mutex)) != 0) {
-			MSG_ERROR(msg_module, "Condition wait failed (%s:%d)", __FILE__, __LINE__);
-			return EXIT_FAILURE;
-		}
-	}
+	return rbuffer_wait(rbuffer, rbuffer_cond_empty, 0);
+}
 
-	if (pthread_mutex_unlock(&(rbuffer->mutex)) != 0) {
-		MSG_ERROR(msg_module, "Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-		return EXIT_FAILURE;
+/**
+ * \brief Get number of records in the ring buffer that have not been released yet
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return Number of records
+ */
+unsigned int rbuffer_count(struct ring_buffer* rbuffer)
+{
+	return __atomic_load_n(&rbuffer->write_offset, __ATOMIC_SEQ_CST)
+			- __atomic_load_n(&rbuffer->read_offset, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Get the highest number of records held by the ring buffer
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] reset Restart the measurement from the current number of records.
+ * @return Highest number of records since the last reset
+ */
+unsigned int rbuffer_high_water(struct ring_buffer* rbuffer, int reset)
+{
+	if (!reset) {
+		return __atomic_load_n(&rbuffer->high_water, __ATOMIC_RELAXED);
 	}
-	return EXIT_SUCCESS;
+
+	return __atomic_exchange_n(&rbuffer->high_water, rbuffer_count(rbuffer), __ATOMIC_RELAXED);
 }
 
 /**
@@ -354,15 +580,11 @@ int rbuffer_wait_empty(struct ring_buffer* rbuffer) {
 int rbuffer_free(struct ring_buffer* rbuffer)
 {
 	if (rbuffer) {
-		if (rbuffer->data_references) {
-			free(rbuffer->data_references);
-		}
-		if (rbuffer->data) {
-			free(rbuffer->data);
+		if (rbuffer->slots) {
+			free(rbuffer->slots);
 		}
 
 		pthread_cond_destroy(&(rbuffer->cond));
-		pthread_cond_destroy(&(rbuffer->cond_empty));
 		pthread_mutex_destroy(&(rbuffer->mutex));
 		free(rbuffer);
 	}
@@ -45,8 +45,8 @@
 #include "ipfixcol.h"
 
 /**
- * \brief Simple ring buffer for passing data between one write thread and one
- * or more read threads.
+ * \brief Simple ring buffer for passing data between one or more write threads
+ * and one or more read threads.
  *
  * Write thread needs to know the count of reading threads. The scheme of
  * reading the data is usually as follows:
@@ -61,18 +61,56 @@
  * Thread calling rbuffer_read() must specify which index it wants to read and
  * the index must be incremented continuously.
  *
+ * The default implementation is lock-free: writers claim slots by moving
+ * the write counter, readers wait for the sequence number of the slot and
+ * the thread that removes the last reference advances the read counter.
+ * Threads that have to wait spin for a while and then park on the condition
+ * variable, which is signalled only when somebody is actually parked. The
+ * original mutex based implementation is built instead when RBUFFER_MUTEX is
+ * defined (configure --enable-mutex-queues).
  */
+#ifdef RBUFFER_MUTEX
 struct ring_buffer {
 	uint16_t read_offset;
 	uint16_t write_offset;
 	uint16_t size;
 	uint16_t count;
+	uint16_t high_water;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	pthread_cond_t cond_empty;
 	struct ipfix_message** data;
 	unsigned int* data_references;
 };
+#else
+
+/** Size of the cache line used to separate counters of readers and writers */
+#define RBUFFER_CACHE_LINE 64
+
+/**
+ * \brief One item of the lock-free ring buffer
+ */
+struct rbuffer_slot {
+	struct ipfix_message *data;   /**< Stored message */
+	unsigned int references;      /**< Number of readers still using the message */
+	uint64_t seq;                 /**< Sequence number (state) of the slot */
+};
+
+struct ring_buffer {
+	/** Next position to be claimed by a writer (never wraps) */
+	uint64_t write_offset __attribute__((aligned(RBUFFER_CACHE_LINE)));
+	/** Oldest position that has not been released yet (never wraps) */
+	uint64_t read_offset __attribute__((aligned(RBUFFER_CACHE_LINE)));
+	/** Number of threads parked on the condition variable */
+	unsigned int waiters __attribute__((aligned(RBUFFER_CACHE_LINE)));
+	uint16_t size;
+	/** Highest number of claimed positions (see rbuffer_high_water()) */
+	unsigned int high_water;
+	struct rbuffer_slot *slots;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+#endif
 
 /**
  * \brief Initiate ring buffer structure with specified size.
@@ -82,8 +120,30 @@ struct ring_buffer {
  */
 struct ring_buffer* rbuffer_init(uint16_t size);
 
+/**
+ * \brief Add new record into the ring buffer.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] record IPFIX message structure to be added into the ring buffer.
+ * @param[in] ref_count Initial reference count - number of reading threads.
+ * @return 0 on success, nonzero on error.
+ */
 int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uint16_t ref_count);
 
+/**
+ * \brief Add several records into the ring buffer at once.
+ *
+ * Records are published in the given order and waiting readers are woken
+ * up only once for the whole batch.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] records Array of IPFIX messages to be added into the ring buffer.
+ * @param[in] count Number of messages in the array.
+ * @param[in] ref_count Initial reference count - number of reading threads.
+ * @return 0 on success, nonzero on error.
+ */
+int rbuffer_write_batch(struct ring_buffer* rbuffer, struct ipfix_message** records, unsigned int count, uint16_t ref_count);
+
 /**
  * \brief Get pointer to data in ring buffer - its position is specified by
  * index or by ring buffer's current read offset.
@@ -95,6 +155,23 @@ int rbuffer_write(struct ring_buffer* rbuffer, struct ipfix_message* record, uin
  */
 struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *index);
 
+/**
+ * \brief Get pointers to all records that are ready to be read from the
+ * specified index.
+ *
+ * Blocks until at least one record is available. Records are returned in the
+ * order of the ring buffer, i.e. the first record is at \p index, the second
+ * at (\p index + 1) % size and so on. Each of them has to be released by
+ * rbuffer_remove_reference() as if it was obtained by rbuffer_read().
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in,out] index Index of the first record, see rbuffer_read().
+ * @param[out] records Array for the read records.
+ * @param[in] max Size of the \p records array.
+ * @return Number of read records, 0 on error.
+ */
+unsigned int rbuffer_read_batch(struct ring_buffer* rbuffer, unsigned int *index, struct ipfix_message** records, unsigned int max);
+
 /**
  * \brief Decrease reference counter on specified record in ring buffer.
  *
@@ -115,6 +192,16 @@ struct ipfix_message* rbuffer_read(struct ring_buffer* rbuffer, unsigned int *in
  */
 int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, uint8_t do_free);
 
+/**
+ * \brief Free IPFIX message together with its metadata and decrement
+ * references on its templates
+ *
+ * Used for messages that are not stored in any ring buffer.
+ *
+ * @param[in] msg IPFIX message
+ */
+void rbuffer_free_message(struct ipfix_message *msg);
+
 /**
  * \brief Wait for queue to became empty
  *
@@ -123,6 +210,26 @@ int rbuffer_remove_reference(struct ring_buffer* rbuffer, unsigned int index, ui
  */
 int rbuffer_wait_empty(struct ring_buffer* rbuffer);
 
+/**
+ * \brief Get number of records in the ring buffer that have not been released yet
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @return Number of records
+ */
+unsigned int rbuffer_count(struct ring_buffer* rbuffer);
+
+/**
+ * \brief Get the highest number of records held by the ring buffer
+ *
+ * The mark is updated by writers, so a queue that is full for a while shows
+ * the full size even if it has been drained since the last call.
+ *
+ * @param[in] rbuffer Ring buffer.
+ * @param[in] reset Restart the measurement from the current number of records.
+ * @return Highest number of records since the last reset
+ */
+unsigned int rbuffer_high_water(struct ring_buffer* rbuffer, int reset);
+
 /**
  * \brief Destroy ring buffer structures.
  *
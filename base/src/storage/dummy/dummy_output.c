@@ -54,6 +54,7 @@
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+IPFIXCOL_STORAGE_WORKERS;
 
 /** Identifier to MSG_* macros */
 static char *msg_module = "dummy storage";
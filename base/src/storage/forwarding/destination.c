@@ -936,6 +936,28 @@ static enum SEND_STATUS dest_packet_sender(struct dst_client *dst,
 		return STATUS_INVALID;
 	}
 
+	if (sender_get_proto(dst->sender) == IPPROTO_UDP) {
+		// Send all datagrams at once (references are shared by destinations)
+		struct mmsghdr *msgs;
+		const unsigned int *pkt_recs;
+		size_t sent;
+
+		if (bldr_pkts_mmsg(bldr, *seq_num, &msgs, &pkt_recs)) {
+			// Internal Error
+			return STATUS_INVALID;
+		}
+
+		stat = sender_send_mmsg(dst->sender, msgs, pkt_cnt,
+			MODE_NON_BLOCKING, req_flg, &sent);
+
+		// Skip records of sent packets (even if the rest failed)
+		for (size_t i = 0; i < sent; ++i) {
+			*seq_num += pkt_recs[i];
+		}
+
+		return stat;
+	}
+
 	// Send packets
 	for (int i = 0; i < pkt_cnt; ++i) {
 		// Prepare the packet
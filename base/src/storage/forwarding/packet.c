@@ -37,6 +37,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <ipfixcol.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -136,6 +138,31 @@ struct packet_parts {
 	struct ipfix_set_header *last_set_header;
 };
 
+/**
+ * \brief Copies of prepared packets for sendmmsg()
+ *
+ * Parts of the packets are only references (i.e. struct iovec), but every
+ * packet has its own IPFIX header, so all packets can be sent at once.
+ */
+struct packet_batch {
+	/** Messages (one per packet)                                     */
+	struct mmsghdr *msgs;
+	/** IPFIX headers of the packets                                  */
+	struct ipfix_header *hdrs;
+	/** Numbers of data records per packet                            */
+	unsigned int *rec_cnt;
+	/** Max number of packets                                         */
+	size_t pkt_max;
+
+	/** Parts of all packets                                          */
+	struct iovec *io;
+	/** Max number of parts                                           */
+	size_t io_max;
+
+	/** Copies correspond to the current packets                      */
+	bool valid;
+};
+
 /**
  * \brief Main structure of the packet builder
  */
@@ -147,6 +174,8 @@ struct _fwd_bldr {
 
 	/** IPFIX packet header                                           */
 	struct ipfix_header packet_header;
+	/** Copies of the packets for sendmmsg()                          */
+	struct packet_batch batch;
 
 	/** Packet is closed (adding another parts is not permitted)      */
 	bool is_complete;
@@ -700,6 +729,10 @@ void bldr_destroy(fwd_bldr_t *pkt)
 
 	arr_destroy(pkt->headers);
 	parts_destroy(pkt->part_all);
+	free(pkt->batch.msgs);
+	free(pkt->batch.hdrs);
+	free(pkt->batch.rec_cnt);
+	free(pkt->batch.io);
 	free(pkt);
 }
 
@@ -710,6 +743,7 @@ void bldr_start(fwd_bldr_t *pkt, uint32_t odid,	uint32_t exp_time)
 	pkt->packet_header.observation_domain_id = htonl(odid);
 
 	pkt->is_complete = false;
+	pkt->batch.valid = false;
 
 	parts_clear(pkt->part_all);
 	arr_clear(pkt->headers);
@@ -719,6 +753,7 @@ void bldr_start(fwd_bldr_t *pkt, uint32_t odid,	uint32_t exp_time)
 int bldr_end(fwd_bldr_t *pkt, uint16_t len)
 {
 	pkt->is_complete = true;
+	pkt->batch.valid = false;
 	if (parts_packets_prepare(pkt->part_all, len)) {
 		return -1;
 	}
@@ -865,6 +900,125 @@ int bldr_pkts_iovec(fwd_bldr_t *pkt, uint32_t seq_num,
 	return 0;
 }
 
+/**
+ * \brief Prepare copies of all packets for sendmmsg() (auxiliary function)
+ * \param[in,out] pkt Structure for packet builder
+ * \return On success return 0. Otherwise returns non-zero value.
+ */
+static int bldr_batch_prepare(fwd_bldr_t *pkt)
+{
+	struct packet_parts *parts = pkt->part_all;
+	struct packet_batch *batch = &pkt->batch;
+
+	// Resize arrays (if necessary)
+	if (parts->pkt_size > batch->pkt_max) {
+		size_t new_max = parts->pkt_size;
+		struct mmsghdr *new_msgs;
+		struct ipfix_header *new_hdrs;
+		unsigned int *new_cnt;
+
+		new_msgs = (struct mmsghdr *) realloc(batch->msgs,
+			new_max * sizeof(struct mmsghdr));
+		if (new_msgs) {
+			batch->msgs = new_msgs;
+		}
+
+		new_hdrs = (struct ipfix_header *) realloc(batch->hdrs,
+			new_max * sizeof(struct ipfix_header));
+		if (new_hdrs) {
+			batch->hdrs = new_hdrs;
+		}
+
+		new_cnt = (unsigned int *) realloc(batch->rec_cnt,
+			new_max * sizeof(unsigned int));
+		if (new_cnt) {
+			batch->rec_cnt = new_cnt;
+		}
+
+		if (!new_msgs || !new_hdrs || !new_cnt) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)",
+				__FILE__, __LINE__);
+			return 1;
+		}
+
+		batch->pkt_max = new_max;
+	}
+
+	size_t io_total = 0;
+	for (size_t i = 0; i < parts->pkt_size; ++i) {
+		io_total += parts->pkt_arr[i]->size;
+	}
+
+	if (io_total > batch->io_max) {
+		struct iovec *new_io;
+		new_io = (struct iovec *) realloc(batch->io,
+			io_total * sizeof(struct iovec));
+		if (!new_io) {
+			MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)",
+				__FILE__, __LINE__);
+			return 1;
+		}
+
+		batch->io = new_io;
+		batch->io_max = io_total;
+	}
+
+	// Copy references to parts and create headers
+	struct iovec *io = batch->io;
+	for (size_t i = 0; i < parts->pkt_size; ++i) {
+		struct packet_range *range = parts->pkt_arr[i];
+		// Recover the last value from a backup
+		range->start[range->size - 1] = range->backup;
+		memcpy(io, range->start, range->size * sizeof(struct iovec));
+
+		size_t total_len = IPFIX_HEADER_LENGTH;
+		for (size_t j = 1; j < range->size; ++j) {
+			total_len += io[j].iov_len;
+		}
+
+		batch->hdrs[i] = pkt->packet_header;
+		batch->hdrs[i].length = htons(total_len);
+		io[0].iov_base = &batch->hdrs[i];
+		io[0].iov_len = IPFIX_HEADER_LENGTH;
+
+		memset(&batch->msgs[i], 0, sizeof(struct mmsghdr));
+		batch->msgs[i].msg_hdr.msg_iov = io;
+		batch->msgs[i].msg_hdr.msg_iovlen = range->size;
+		batch->rec_cnt[i] = range->rec_cnt;
+
+		io += range->size;
+	}
+
+	batch->valid = true;
+	return 0;
+}
+
+/* Get all packets in the format suitable for sendmmsg() */
+int bldr_pkts_mmsg(fwd_bldr_t *pkt, uint32_t seq_num, struct mmsghdr **msgs,
+	const unsigned int **rec_cnt)
+{
+	if (!pkt->is_complete) {
+		// Internal structure not prepared
+		return 1;
+	}
+
+	// References are prepared only once for all destinations
+	struct packet_batch *batch = &pkt->batch;
+	if (!batch->valid && bldr_batch_prepare(pkt)) {
+		return 1;
+	}
+
+	// Only sequence numbers differ
+	for (size_t i = 0; i < pkt->part_all->pkt_size; ++i) {
+		batch->hdrs[i].sequence_number = htonl(seq_num);
+		seq_num += batch->rec_cnt[i];
+	}
+
+	*msgs = batch->msgs;
+	*rec_cnt = batch->rec_cnt;
+	return 0;
+}
+
 /* Add a Data set */
 int bldr_add_dataset(fwd_bldr_t *pkt, const struct ipfix_data_set *data,
 	uint16_t new_id, unsigned int rec)
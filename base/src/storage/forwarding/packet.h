@@ -82,6 +82,7 @@
  *     - bldr_pkts_cnt()
  *     - bldr_pkts_raw()
  *     - bldr_pkts_iovec()
+ *     - bldr_pkts_mmsg()
  *     - bldr_pkts_get_odid()
  *   -# New message? Go to the 2. step
  *   -# bldr_destroy()
@@ -89,6 +90,7 @@
 
 /** Prototype */
 typedef struct _fwd_bldr fwd_bldr_t;
+struct mmsghdr;
 
 /**
  * \brief Create a packet builder
@@ -210,6 +212,23 @@ int bldr_pkts_raw(fwd_bldr_t *pkt, uint32_t seq_num, size_t idx, size_t offset,
 int bldr_pkts_iovec(fwd_bldr_t *pkt, uint32_t seq_num, size_t idx,
 	struct iovec **io, size_t *size, size_t *rec_cnt);
 
+/**
+ * \brief Get all packets in the format suitable for sendmmsg()
+ *
+ * Packets still point to the parts of the original message, only IPFIX
+ * headers are private. References are prepared only once per message, so
+ * the same packets can be cheaply sent to multiple destinations.
+ * \param[in,out] pkt  Packet builder
+ * \param[in]  seq_num Sequence number of the first packet
+ * \param[out] msgs    Array of messages (bldr_pkts_cnt() elements)
+ * \param[out] rec_cnt Array of numbers of data records per packet
+ * \return On success returns 0. Otherwise returns non-zero value.
+ * \warning The arrays point to internal structures that are valid until
+ *   next call of this function or bldr_start().
+ */
+int bldr_pkts_mmsg(fwd_bldr_t *pkt, uint32_t seq_num, struct mmsghdr **msgs,
+	const unsigned int **rec_cnt);
+
 #endif // PACKET_H
 
 /**@}*/
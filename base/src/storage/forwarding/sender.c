@@ -37,6 +37,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -616,3 +618,55 @@ before_sendmsg:
 
 	return STATUS_OK;
 }
+
+/** Send multiple messages to the destination */
+enum SEND_STATUS sender_send_mmsg(fwd_sender_t *s, struct mmsghdr *msgs,
+	size_t cnt, enum SEND_MODE mode, bool required, size_t *sent)
+{
+	size_t done = 0;
+	*sent = 0;
+
+	// Only datagrams without buffered data can be sent at once
+	if (s->proto == IPPROTO_UDP && s->buffer_valid == 0) {
+		int flags = MSG_NOSIGNAL; // Never use signals
+		flags |= (mode == MODE_NON_BLOCKING) ? MSG_DONTWAIT : 0;
+
+		while (done < cnt) {
+			int ret = sendmmsg(s->socket_fd, msgs + done, cnt - done, flags);
+			if (ret > 0) {
+				// Skip successfully sent datagrams
+				done += ret;
+				*sent = done;
+				continue;
+			}
+
+			if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+				// Unexpected type of error
+				MSG_WARNING(msg_module, "Connection to \"%s:%s\" closed (%s).",
+					s->dst_addr, s->dst_port, strerror(errno));
+				sender_socket_close(s);
+				return STATUS_CLOSED;
+			}
+
+			// Operation would block, the rest is handled one by one
+			break;
+		}
+	}
+
+	// Send remaining messages
+	for (; done < cnt; ++done) {
+		enum SEND_STATUS stat;
+		struct msghdr *hdr = &msgs[done].msg_hdr;
+
+		// When a part of the messages is sent, the rest is always required
+		stat = sender_send_parts(s, hdr->msg_iov, hdr->msg_iovlen, mode,
+			required || done > 0);
+		if (stat != STATUS_OK) {
+			return stat;
+		}
+
+		*sent = done + 1;
+	}
+
+	return STATUS_OK;
+}
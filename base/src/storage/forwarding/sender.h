@@ -67,6 +67,7 @@ enum SEND_STATUS {
 
 /* Prototypes */
 typedef struct _fwd_sender fwd_sender_t;
+struct mmsghdr;
 
 /**
  * \brief Create a new sender
@@ -159,6 +160,24 @@ enum SEND_STATUS sender_send(fwd_sender_t *s, const void *buf, size_t len,
 enum SEND_STATUS sender_send_parts(fwd_sender_t *s, struct iovec *io,
 	size_t parts, enum SEND_MODE mode, bool required);
 
+/**
+ * \brief Send multiple messages to the destination
+ *
+ * UDP datagrams are sent by a single sendmmsg() call. Other protocols (or
+ * datagrams that cannot be sent immediately) fall back to sender_send_parts().
+ * When at least one message is sent, the remaining messages are required.
+ * \param[in,out] s Sender structure
+ * \param[in] msgs Array of messages
+ * \param[in] cnt Number of messages
+ * \param[in] mode Mode of sending operation
+ * \param[in] required Required delivery
+ * \param[out] sent Number of messages sent (or stored for later delivery),
+ *   valid for every return status
+ * \return Status of the operation
+ */
+enum SEND_STATUS sender_send_mmsg(fwd_sender_t *s, struct mmsghdr *msgs,
+	size_t cnt, enum SEND_MODE mode, bool required, size_t *sent);
+
 #endif // SENDER_H
 
 /**@}*/
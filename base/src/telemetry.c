@@ -0,0 +1,470 @@
+/**
+ * \file telemetry.c
+ * \brief Counters of the processing pipeline for the statistics thread
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <ipfixcol.h>
+
+#include "telemetry.h"
+
+/** Identifier to MSG_* macros */
+static const char *msg_module = "telemetry";
+
+/**
+ * \brief Watched ring buffer
+ */
+struct telemetry_queue {
+	struct ring_buffer *queue;
+	char name[TELEMETRY_NAME_LEN];
+	struct telemetry_queue *next;
+};
+
+int telemetry_enabled = 0;
+
+/* Registry of all counters, the lists are modified only under the mutex */
+static pthread_mutex_t telemetry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct telemetry_stage *telemetry_stages = NULL;
+static struct telemetry_source *telemetry_sources = NULL;
+static struct telemetry_queue *telemetry_queues = NULL;
+
+/**
+ * \brief Enable or disable collecting of the telemetry
+ */
+void telemetry_init(int enable)
+{
+	telemetry_enabled = enable;
+}
+
+/**
+ * \brief Free all stages, sources and queues
+ */
+void telemetry_destroy()
+{
+	struct telemetry_stage *stage;
+	struct telemetry_source *source;
+	struct telemetry_queue *queue;
+
+	pthread_mutex_lock(&telemetry_mutex);
+
+	while ((stage = telemetry_stages)) {
+		telemetry_stages = stage->next;
+		free(stage);
+	}
+
+	while ((source = telemetry_sources)) {
+		telemetry_sources = source->next;
+		free(source);
+	}
+
+	while ((queue = telemetry_queues)) {
+		telemetry_queues = queue->next;
+		free(queue);
+	}
+
+	pthread_mutex_unlock(&telemetry_mutex);
+}
+
+/**
+ * \brief Allocate zeroed structure aligned to the cache line
+ *
+ * \param[in] size Size of the structure
+ * \return Structure or NULL
+ */
+static void *telemetry_alloc(size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, TELEMETRY_CACHE_LINE, size) != 0) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/**
+ * \brief Create new processing stage
+ */
+struct telemetry_stage *telemetry_stage_create(const char *name)
+{
+	struct telemetry_stage *stage;
+
+	if (!telemetry_enabled) {
+		return NULL;
+	}
+
+	stage = telemetry_alloc(sizeof(struct telemetry_stage));
+	if (!stage) {
+		return NULL;
+	}
+
+	strncpy_safe(stage->name, name, TELEMETRY_NAME_LEN);
+
+	pthread_mutex_lock(&telemetry_mutex);
+	stage->next = telemetry_stages;
+	telemetry_stages = stage;
+	pthread_mutex_unlock(&telemetry_mutex);
+
+	return stage;
+}
+
+/**
+ * \brief Release processing stage
+ */
+void telemetry_stage_release(struct telemetry_stage *stage)
+{
+	if (stage) {
+		__atomic_store_n(&stage->released, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * \brief Create new flow data source
+ */
+struct telemetry_source *telemetry_source_create(const char *name, uint32_t odid)
+{
+	struct telemetry_source *source;
+
+	if (!telemetry_enabled) {
+		return NULL;
+	}
+
+	source = telemetry_alloc(sizeof(struct telemetry_source));
+	if (!source) {
+		return NULL;
+	}
+
+	strncpy_safe(source->name, name, TELEMETRY_NAME_LEN);
+	source->odid = odid;
+
+	pthread_mutex_lock(&telemetry_mutex);
+	source->next = telemetry_sources;
+	telemetry_sources = source;
+	pthread_mutex_unlock(&telemetry_mutex);
+
+	return source;
+}
+
+/**
+ * \brief Release flow data source
+ */
+void telemetry_source_release(struct telemetry_source *source)
+{
+	if (source) {
+		__atomic_store_n(&source->released, 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * \brief Watch occupancy of a ring buffer
+ */
+int telemetry_queue_add(const char *name, struct ring_buffer *queue)
+{
+	struct telemetry_queue *item;
+
+	if (!telemetry_enabled || !queue) {
+		return 0;
+	}
+
+	item = calloc(1, sizeof(struct telemetry_queue));
+	if (!item) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return 1;
+	}
+
+	item->queue = queue;
+	strncpy_safe(item->name, name, TELEMETRY_NAME_LEN);
+	rbuffer_high_water(queue, 1);
+
+	pthread_mutex_lock(&telemetry_mutex);
+	item->next = telemetry_queues;
+	telemetry_queues = item;
+	pthread_mutex_unlock(&telemetry_mutex);
+
+	return 0;
+}
+
+/**
+ * \brief Stop watching a ring buffer
+ */
+void telemetry_queue_remove(struct ring_buffer *queue)
+{
+	struct telemetry_queue **item, *aux;
+
+	if (!telemetry_enabled || !queue) {
+		return;
+	}
+
+	pthread_mutex_lock(&telemetry_mutex);
+	for (item = &telemetry_queues; *item; ) {
+		if ((*item)->queue == queue) {
+			aux = *item;
+			*item = aux->next;
+			free(aux);
+		} else {
+			item = &(*item)->next;
+		}
+	}
+	pthread_mutex_unlock(&telemetry_mutex);
+}
+
+/**
+ * \brief Convert name to a key usable in the statistics file
+ *
+ * \param[out] key Key
+ * \param[in] name Name
+ */
+static void telemetry_key(char *key, const char *name)
+{
+	for (; *name; ++name, ++key) {
+		*key = isalnum((unsigned char) *name) ? *name : '_';
+	}
+
+	*key = '\0';
+}
+
+/**
+ * \brief Upper bound of a histogram bucket in microseconds
+ *
+ * \param[in] bucket Bucket index
+ * \return Bound
+ */
+static inline uint64_t telemetry_bucket_us(unsigned int bucket)
+{
+	return (UINT64_C(1024) << bucket) / 1000;
+}
+
+/**
+ * \brief Get percentile of latencies from the histogram
+ *
+ * \param[in] hist Histogram
+ * \param[in] total Number of messages in the histogram
+ * \param[in] percent Percentile
+ * \param[in] max Maximal latency (ns), used for the last bucket
+ * \return Upper bound of the latency in microseconds
+ */
+static uint64_t telemetry_percentile(const uint64_t *hist, uint64_t total, unsigned int percent, uint64_t max)
+{
+	uint64_t sum = 0, rank = (total * percent + 99) / 100;
+	unsigned int i;
+
+	if (total == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < TELEMETRY_BUCKETS - 1; ++i) {
+		sum += hist[i];
+		if (sum >= rank) {
+			return telemetry_bucket_us(i);
+		}
+	}
+
+	return max / 1000;
+}
+
+/**
+ * \brief Report processing stages
+ *
+ * \param[in] out Statistics file or NULL
+ * \param[in] interval Length of the interval in seconds
+ */
+static void telemetry_report_stages(FILE *out, int interval)
+{
+	struct telemetry_stage **item, *stage;
+	uint64_t messages, records, busy, max, hist[TELEMETRY_BUCKETS], cumulative;
+	char key[TELEMETRY_NAME_LEN];
+	int released;
+	unsigned int i;
+
+	if (!out) {
+		MSG_ALWAYS(" | Stages:", NULL);
+		MSG_ALWAYS(" |     %-16s %10s %12s %7s %9s %9s %9s", "name", "msgs/s", "records/s", "busy",
+				"p50 [us]", "p99 [us]", "max [us]");
+	}
+
+	for (item = &telemetry_stages; *item; ) {
+		stage = *item;
+
+		/* Counters of a released stage do not change anymore */
+		released = __atomic_load_n(&stage->released, __ATOMIC_ACQUIRE);
+		messages = __atomic_load_n(&stage->messages, __ATOMIC_RELAXED) - stage->last_messages;
+		records = __atomic_load_n(&stage->records, __ATOMIC_RELAXED) - stage->last_records;
+		busy = __atomic_load_n(&stage->busy, __ATOMIC_RELAXED) - stage->last_busy;
+		max = __atomic_exchange_n(&stage->max, 0, __ATOMIC_RELAXED);
+		for (i = 0; i < TELEMETRY_BUCKETS; ++i) {
+			hist[i] = __atomic_load_n(&stage->hist[i], __ATOMIC_RELAXED) - stage->last_hist[i];
+			stage->last_hist[i] += hist[i];
+		}
+
+		stage->last_messages += messages;
+		stage->last_records += records;
+		stage->last_busy += busy;
+
+		if (out) {
+			telemetry_key(key, stage->name);
+			fprintf(out, "STAGE_%s_MSG_SEC=%" PRIu64 "\n", key, messages / interval);
+			fprintf(out, "STAGE_%s_DATA_REC_SEC=%" PRIu64 "\n", key, records / interval);
+			fprintf(out, "STAGE_%s_BUSY_PCT=%.2f\n", key, busy / (interval * 1e7));
+			fprintf(out, "STAGE_%s_P50_US=%" PRIu64 "\n", key, telemetry_percentile(hist, messages, 50, max));
+			fprintf(out, "STAGE_%s_P99_US=%" PRIu64 "\n", key, telemetry_percentile(hist, messages, 99, max));
+			fprintf(out, "STAGE_%s_MAX_US=%" PRIu64 "\n", key, max / 1000);
+
+			/* Cumulative histogram since the start of the stage */
+			cumulative = 0;
+			for (i = 0; i < TELEMETRY_BUCKETS - 1; ++i) {
+				cumulative += stage->last_hist[i];
+				fprintf(out, "STAGE_%s_LAT_LE_%" PRIu64 "_US=%" PRIu64 "\n", key, telemetry_bucket_us(i), cumulative);
+			}
+			fprintf(out, "STAGE_%s_LAT_LE_INF_US=%" PRIu64 "\n", key, stage->last_messages);
+		} else {
+			MSG_ALWAYS(" |     %-16s %10" PRIu64 " %12" PRIu64 " %6.2f%% %9" PRIu64 " %9" PRIu64 " %9" PRIu64,
+					stage->name, messages / interval, records / interval, busy / (interval * 1e7),
+					telemetry_percentile(hist, messages, 50, max),
+					telemetry_percentile(hist, messages, 99, max), max / 1000);
+		}
+
+		if (released) {
+			*item = stage->next;
+			free(stage);
+		} else {
+			item = &stage->next;
+		}
+	}
+}
+
+/**
+ * \brief Report ring buffers
+ *
+ * \param[in] out Statistics file or NULL
+ */
+static void telemetry_report_queues(FILE *out)
+{
+	struct telemetry_queue *item;
+	unsigned int count, mark;
+	char key[TELEMETRY_NAME_LEN];
+
+	if (!out) {
+		MSG_ALWAYS(" | Queues:", NULL);
+		MSG_ALWAYS(" |     %-16s %10s %10s %10s", "name", "used", "high water", "size");
+	}
+
+	for (item = telemetry_queues; item; item = item->next) {
+		count = rbuffer_count(item->queue);
+		mark = rbuffer_high_water(item->queue, 1);
+
+		if (out) {
+			telemetry_key(key, item->name);
+			fprintf(out, "QUEUE_%s_USED=%u\n", key, count);
+			fprintf(out, "QUEUE_%s_HIGH_WATER=%u\n", key, mark);
+			fprintf(out, "QUEUE_%s_SIZE=%u\n", key, item->queue->size);
+		} else {
+			MSG_ALWAYS(" |     %-16s %10u %10u %10u", item->name, count, mark, item->queue->size);
+		}
+	}
+}
+
+/**
+ * \brief Report flow data sources
+ *
+ * \param[in] out Statistics file or NULL
+ * \param[in] interval Length of the interval in seconds
+ */
+static void telemetry_report_sources(FILE *out, int interval)
+{
+	struct telemetry_source **item, *source;
+	uint64_t packets, records, gaps, lost;
+	char key[TELEMETRY_NAME_LEN];
+	int released;
+
+	if (!out) {
+		MSG_ALWAYS(" | Exporters:", NULL);
+		MSG_ALWAYS(" |     %-24s %10s %10s %12s %10s %12s", "source", "ODID", "packets/s", "records/s",
+				"seq. gaps", "lost rec.");
+	}
+
+	for (item = &telemetry_sources; *item; ) {
+		source = *item;
+
+		released = __atomic_load_n(&source->released, __ATOMIC_ACQUIRE);
+		packets = __atomic_load_n(&source->packets, __ATOMIC_RELAXED);
+		records = __atomic_load_n(&source->records, __ATOMIC_RELAXED);
+		gaps = __atomic_load_n(&source->gaps, __ATOMIC_RELAXED);
+		lost = __atomic_load_n(&source->lost, __ATOMIC_RELAXED);
+
+		if (out) {
+			telemetry_key(key, source->name);
+			fprintf(out, "EXPORTER_%s_%u_PACKETS_SEC=%" PRIu64 "\n", key, source->odid, (packets - source->last_packets) / interval);
+			fprintf(out, "EXPORTER_%s_%u_DATA_REC_SEC=%" PRIu64 "\n", key, source->odid, (records - source->last_records) / interval);
+			fprintf(out, "EXPORTER_%s_%u_SEQ_GAPS=%" PRIu64 "\n", key, source->odid, gaps);
+			fprintf(out, "EXPORTER_%s_%u_LOST_DATA_REC=%" PRIu64 "\n", key, source->odid, lost);
+		} else {
+			MSG_ALWAYS(" |     %-24s %10u %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64, source->name, source->odid,
+					(packets - source->last_packets) / interval, (records - source->last_records) / interval, gaps, lost);
+		}
+
+		source->last_packets = packets;
+		source->last_records = records;
+
+		if (released) {
+			*item = source->next;
+			free(source);
+		} else {
+			item = &source->next;
+		}
+	}
+}
+
+/**
+ * \brief Report telemetry collected since the previous report
+ */
+void telemetry_report(FILE *out, int interval)
+{
+	if (!telemetry_enabled || interval <= 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&telemetry_mutex);
+	telemetry_report_stages(out, interval);
+	telemetry_report_queues(out);
+	telemetry_report_sources(out, interval);
+	pthread_mutex_unlock(&telemetry_mutex);
+}
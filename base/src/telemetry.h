@@ -0,0 +1,272 @@
+/**
+ * \file telemetry.h
+ * \brief Counters of the processing pipeline for the statistics thread
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "queues.h"
+
+/** Maximal length of the stage, queue and source names */
+#define TELEMETRY_NAME_LEN 32
+
+/**
+ * Number of buckets of the latency histograms. Bucket i counts latencies
+ * shorter than 2^(i + 10) ns (about 2^i us), the last one all the rest.
+ */
+#define TELEMETRY_BUCKETS 20
+
+/** Size of the cache line separating counters of different threads */
+#define TELEMETRY_CACHE_LINE 64
+
+/**
+ * \brief Counters of one processing stage
+ *
+ * A stage belongs to a single thread, which is the only writer of the
+ * counters, so they are updated without any locking. The statistics thread
+ * reads them with relaxed atomic loads.
+ */
+struct telemetry_stage {
+	uint64_t messages;                     /**< Processed messages */
+	uint64_t records;                      /**< Processed data records */
+	uint64_t busy;                         /**< Processing time (ns) */
+	uint64_t max;                          /**< Longest processing of a message since the last report (ns) */
+	uint64_t hist[TELEMETRY_BUCKETS];      /**< Latency histogram (messages) */
+	int released;                          /**< The owner does not use the stage anymore */
+
+	/* Values reported last time, used only by the statistics thread */
+	uint64_t last_messages __attribute__((aligned(TELEMETRY_CACHE_LINE)));
+	uint64_t last_records;
+	uint64_t last_busy;
+	uint64_t last_hist[TELEMETRY_BUCKETS];
+	char name[TELEMETRY_NAME_LEN];
+	struct telemetry_stage *next;
+} __attribute__((aligned(TELEMETRY_CACHE_LINE)));
+
+/**
+ * \brief Counters of one flow data source (exporter)
+ *
+ * Updated by the input thread that preprocesses messages of the source.
+ */
+struct telemetry_source {
+	uint64_t packets;                      /**< Received packets */
+	uint64_t records;                      /**< Received data records */
+	uint64_t gaps;                         /**< Sequence number errors */
+	uint64_t lost;                         /**< Data records missing in the gaps */
+	int released;                          /**< The source has been closed */
+
+	/* Values reported last time, used only by the statistics thread */
+	uint64_t last_packets __attribute__((aligned(TELEMETRY_CACHE_LINE)));
+	uint64_t last_records;
+	uint32_t odid;
+	char name[TELEMETRY_NAME_LEN];
+	struct telemetry_source *next;
+} __attribute__((aligned(TELEMETRY_CACHE_LINE)));
+
+/** Telemetry is collected only when the statistics are enabled */
+extern int telemetry_enabled;
+
+/**
+ * \brief Enable or disable collecting of the telemetry
+ *
+ * Must be called before any processing thread is started.
+ *
+ * @param[in] enable Nonzero to collect the telemetry
+ */
+void telemetry_init(int enable);
+
+/**
+ * \brief Free all stages, sources and queues
+ */
+void telemetry_destroy();
+
+/**
+ * \brief Get monotonic time for measuring of a stage
+ *
+ * @return Time in nanoseconds
+ */
+static inline uint64_t telemetry_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * \brief Create new processing stage
+ *
+ * @param[in] name Name of the stage (e.g. thread name)
+ * @return Stage or NULL when telemetry is disabled or on error
+ */
+struct telemetry_stage *telemetry_stage_create(const char *name);
+
+/**
+ * \brief Release processing stage
+ *
+ * The stage is freed by the statistics thread after its last report.
+ * The caller must not use it anymore.
+ *
+ * @param[in] stage Stage (may be NULL)
+ */
+void telemetry_stage_release(struct telemetry_stage *stage);
+
+/**
+ * \brief Account processing of messages by the stage
+ *
+ * The time since \p start is split evenly among the messages.
+ *
+ * @param[in] stage Stage (may be NULL)
+ * @param[in] start Time when processing started, see telemetry_now()
+ * @param[in] messages Number of processed messages
+ * @param[in] records Number of processed data records
+ */
+static inline void telemetry_stage_add(struct telemetry_stage *stage, uint64_t start, unsigned int messages, uint64_t records)
+{
+	uint64_t elapsed, each;
+	unsigned int bucket;
+
+	if (!stage || messages == 0) {
+		return;
+	}
+
+	elapsed = telemetry_now() - start;
+	each = elapsed / messages;
+	bucket = (each >> 10) ? 64 - __builtin_clzll(each >> 10) : 0;
+	if (bucket >= TELEMETRY_BUCKETS) {
+		bucket = TELEMETRY_BUCKETS - 1;
+	}
+
+	/* Single writer, only the stores have to be atomic */
+	__atomic_store_n(&stage->messages, stage->messages + messages, __ATOMIC_RELAXED);
+	__atomic_store_n(&stage->records, stage->records + records, __ATOMIC_RELAXED);
+	__atomic_store_n(&stage->busy, stage->busy + elapsed, __ATOMIC_RELAXED);
+	__atomic_store_n(&stage->hist[bucket], stage->hist[bucket] + messages, __ATOMIC_RELAXED);
+	if (each > __atomic_load_n(&stage->max, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&stage->max, each, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * \brief Create new flow data source
+ *
+ * @param[in] name Name of the source (exporter address and port, file name)
+ * @param[in] odid Observation Domain ID
+ * @return Source or NULL when telemetry is disabled or on error
+ */
+struct telemetry_source *telemetry_source_create(const char *name, uint32_t odid);
+
+/**
+ * \brief Release flow data source
+ *
+ * The source is freed by the statistics thread after its last report.
+ * The caller must not use it anymore.
+ *
+ * @param[in] source Source (may be NULL)
+ */
+void telemetry_source_release(struct telemetry_source *source);
+
+/**
+ * \brief Account received message of the source
+ *
+ * @param[in] source Source (may be NULL)
+ * @param[in] records Number of data records in the message
+ */
+static inline void telemetry_source_add(struct telemetry_source *source, uint64_t records)
+{
+	if (!source) {
+		return;
+	}
+
+	__atomic_fetch_add(&source->packets, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&source->records, records, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Account sequence number error of the source
+ *
+ * @param[in] source Source (may be NULL)
+ * @param[in] expected Expected sequence number
+ * @param[in] received Sequence number in the message
+ */
+static inline void telemetry_source_gap(struct telemetry_source *source, uint32_t expected, uint32_t received)
+{
+	int32_t diff = (int32_t) (received - expected);
+
+	if (!source) {
+		return;
+	}
+
+	__atomic_fetch_add(&source->gaps, 1, __ATOMIC_RELAXED);
+	if (diff > 0) {
+		__atomic_fetch_add(&source->lost, diff, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * \brief Watch occupancy of a ring buffer
+ *
+ * @param[in] name Name of the queue
+ * @param[in] queue Ring buffer
+ * @return 0 on success (or when telemetry is disabled)
+ */
+int telemetry_queue_add(const char *name, struct ring_buffer *queue);
+
+/**
+ * \brief Stop watching a ring buffer
+ *
+ * Must be called before the ring buffer is freed. Unknown queues are ignored.
+ *
+ * @param[in] queue Ring buffer
+ */
+void telemetry_queue_remove(struct ring_buffer *queue);
+
+/**
+ * \brief Report telemetry collected since the previous report
+ *
+ * Released stages and sources are freed after being reported.
+ *
+ * @param[in] out Statistics file (KEY=VALUE lines) or NULL for console
+ * @param[in] interval Length of the interval in seconds
+ */
+void telemetry_report(FILE *out, int interval);
+
+#endif /* TELEMETRY_H_ */
@@ -49,6 +49,53 @@
 /** TEMPLATE_ENT_FIELD_LEN length of template enterprise number */
 #define TEMPLATE_ENT_NUM_LEN 4
 
+/** Initial number of slots in the hash table of records (power of two) */
+#define TM_TABLE_INIT_SIZE 64
+/** Marker of a slot with removed record */
+#define TM_SLOT_DELETED ((struct ipfix_template_mgr_record *) 1)
+/** Number of reader slots, further reading threads share one counter */
+#define TM_READERS_MAX 64
+/** Reader slot of a thread that has not claimed one yet */
+#define TM_READER_NONE UINT32_MAX
+
+/**
+ * \brief Hash table of Template Manager's records
+ *
+ * Open addressing with linear probing on the (odid << 32 | crc) key. Data path
+ * lookups take no lock: the table pointer and the slots are loaded atomically.
+ * Changes are serialized by tmr_lock; a new record is published by a single
+ * store into its slot and the table is grown by building a new copy and
+ * swapping the pointer. Removed records and replaced tables are retired with
+ * the current epoch and freed only when no reader that might have found them
+ * is still inside its critical section (see tm_read_enter()).
+ */
+struct ipfix_template_mgr_table {
+	uint32_t size;                             /**< number of slots, power of two */
+	uint64_t retired;                          /**< epoch of replacement */
+	struct ipfix_template_mgr_table *next;     /**< next retired table */
+	struct ipfix_template_mgr_record *slots[]; /**< records */
+};
+
+/**
+ * \brief Reader slot (one cache line per reading thread)
+ */
+struct ipfix_template_mgr_reader {
+	uint64_t epoch;         /**< epoch seen on entry, 0 outside of critical section */
+	uint8_t pad[56];        /**< padding to the size of a cache line */
+};
+
+/** Reader slot of the calling thread */
+static __thread struct {
+	uint64_t tm_id;         /**< identifier of the Template Manager */
+	uint32_t slot;          /**< index of the slot, TM_READERS_MAX for shared counter */
+} tm_reader = {0, TM_READER_NONE};
+
+/** Identifiers of Template Managers (reader slots are not valid across instances) */
+static uint64_t tm_instances = 0;
+
+void tm_record_remove_all_templates(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr, int type);
+void tm_record_destroy(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_record *tmr);
+
 /** Identifier to MSG_* macros */
 static char *msg_module = "template manager";
 
@@ -77,22 +124,295 @@ struct ipfix_template_mgr_record *tm_record_create()
 	return tmr;
 }
 
+/**
+ * \brief Get slot index of the key in the hash table
+ *
+ * Finalizer of MurmurHash3, the odid and crc parts of the key are mixed so
+ * that sources with consecutive ODIDs spread over the whole table.
+ *
+ * \param[in] key Key of Template Manager's record
+ * \return hash of the key
+ */
+static inline uint32_t tm_key_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+
+	return (uint32_t) key;
+}
+
+/**
+ * \brief Create an empty hash table of Template Manager's records
+ *
+ * \param[in] size Number of slots (power of two)
+ * \return pointer to the table or NULL
+ */
+static struct ipfix_template_mgr_table *tm_table_create(uint32_t size)
+{
+	struct ipfix_template_mgr_table *table;
+
+	table = calloc(1, sizeof(struct ipfix_template_mgr_table)
+			+ size * sizeof(struct ipfix_template_mgr_record *));
+	if (!table) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	table->size = size;
+	return table;
+}
+
+/**
+ * \brief Put record into the first free slot of its probe sequence
+ *
+ * Caller holds tmr_lock (or the table is not published yet). The record is
+ * published by a single atomic store, so readers see either the old state
+ * of the slot or the complete record.
+ *
+ * \param[in] table Hash table
+ * \param[in] tmr Template Manager's record
+ * \return 1 when an empty slot was used, 0 when a deleted slot was reused
+ */
+static int tm_table_put(struct ipfix_template_mgr_table *table, struct ipfix_template_mgr_record *tmr)
+{
+	uint32_t mask = table->size - 1;
+	uint32_t i = tm_key_hash(tmr->key) & mask;
+
+	while (table->slots[i] != NULL && table->slots[i] != TM_SLOT_DELETED) {
+		i = (i + 1) & mask;
+	}
+
+	int empty = (table->slots[i] == NULL);
+	__atomic_store_n(&table->slots[i], tmr, __ATOMIC_RELEASE);
+
+	return empty;
+}
+
+/**
+ * \brief Enter reader's critical section
+ *
+ * The table and records found inside of the section are not freed until
+ * the thread leaves it by tm_read_leave(). The thread publishes the current
+ * epoch in its own slot, threads without a slot (more than TM_READERS_MAX)
+ * share a counter that blocks reclamation while it is nonzero.
+ * Sections must not be nested.
+ *
+ * \param[in] tm Template Manager
+ */
+static void tm_read_enter(struct ipfix_template_mgr *tm)
+{
+	if (tm_reader.tm_id != tm->id) {
+		uint32_t slot = __atomic_fetch_add(&tm->reader_cnt, 1, __ATOMIC_RELAXED);
+		tm_reader.tm_id = tm->id;
+		tm_reader.slot = (slot < TM_READERS_MAX) ? slot : TM_READERS_MAX;
+	}
+
+	if (tm_reader.slot == TM_READERS_MAX) {
+		__atomic_add_fetch(&tm->shared_readers, 1, __ATOMIC_RELAXED);
+	} else {
+		uint64_t epoch = __atomic_load_n(&tm->epoch, __ATOMIC_RELAXED);
+		__atomic_store_n(&tm->readers[tm_reader.slot].epoch, epoch, __ATOMIC_RELAXED);
+	}
+
+	/*
+	 * Pairs with the fence in tm_read_min_epoch(): either the reclaiming
+	 * thread sees the announcement or this thread sees the new table.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Leave reader's critical section
+ *
+ * \param[in] tm Template Manager
+ */
+static void tm_read_leave(struct ipfix_template_mgr *tm)
+{
+	if (tm_reader.slot == TM_READERS_MAX) {
+		__atomic_sub_fetch(&tm->shared_readers, 1, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&tm->readers[tm_reader.slot].epoch, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * \brief Retire an item removed from the table
+ *
+ * Caller holds tmr_lock and has already unpublished the item.
+ *
+ * \param[in] tm Template Manager
+ * \return epoch of retirement
+ */
+static uint64_t tm_retire_epoch(struct ipfix_template_mgr *tm)
+{
+	return __atomic_add_fetch(&tm->epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Get the oldest epoch seen by readers inside of critical sections
+ *
+ * Items retired in this or a later epoch may still be used by the readers.
+ *
+ * \param[in] tm Template Manager
+ * \return epoch, 0 when nothing may be freed, UINT64_MAX when there are no readers
+ */
+static uint64_t tm_read_min_epoch(struct ipfix_template_mgr *tm)
+{
+	uint32_t cnt = __atomic_load_n(&tm->reader_cnt, __ATOMIC_RELAXED);
+	uint64_t min = UINT64_MAX, epoch;
+	uint32_t i;
+
+	/* Items are already unpublished, see tm_read_enter() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&tm->shared_readers, __ATOMIC_RELAXED) > 0) {
+		return 0;
+	}
+
+	if (cnt > TM_READERS_MAX) {
+		cnt = TM_READERS_MAX;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		epoch = __atomic_load_n(&tm->readers[i].epoch, __ATOMIC_RELAXED);
+		if (epoch != 0 && epoch < min) {
+			min = epoch;
+		}
+	}
+
+	return min;
+}
+
+/**
+ * \brief Free tables and records that no reader can use any more
+ *
+ * Caller holds tmr_lock. Lists of retired items are sorted from the newest.
+ * An item retired in epoch E is freed when all readers inside of their
+ * critical sections entered in a later epoch.
+ *
+ * \param[in] tm Template Manager
+ * \param[in] force Free everything (no readers left)
+ */
+static void tm_reclaim(struct ipfix_template_mgr *tm, int force)
+{
+	uint64_t limit = force ? UINT64_MAX : tm_read_min_epoch(tm);
+	struct ipfix_template_mgr_table **table = &tm->retired_tables;
+	struct ipfix_template_mgr_record **tmr = &tm->retired_records;
+
+	if (limit == 0 && !force) {
+		return;
+	}
+
+	while (*table && !force && (*table)->retired >= limit) {
+		table = &(*table)->next;
+	}
+	while (*table) {
+		struct ipfix_template_mgr_table *next = (*table)->next;
+		free(*table);
+		*table = next;
+	}
+
+	while (*tmr && !force && (*tmr)->retired >= limit) {
+		tmr = &(*tmr)->next;
+	}
+	while (*tmr) {
+		struct ipfix_template_mgr_record *next = (*tmr)->next;
+		tm_record_destroy(tm, *tmr);
+		*tmr = next;
+	}
+}
+
+/**
+ * \brief Replace the hash table with a new one without deleted slots
+ *
+ * Caller holds tmr_lock. The new table has load factor at most 1/2 after
+ * insertion of one more record. The old table is kept for readers that may
+ * still walk it.
+ *
+ * \param[in] tm Template Manager
+ * \return 0 on success, 1 otherwise
+ */
+static int tm_table_rebuild(struct ipfix_template_mgr *tm)
+{
+	struct ipfix_template_mgr_table *old = tm->table, *table;
+	uint32_t size = TM_TABLE_INIT_SIZE;
+	uint32_t i;
+
+	while (size < (tm->records + 1) * 2) {
+		size *= 2;
+	}
+
+	if ((table = tm_table_create(size)) == NULL) {
+		return 1;
+	}
+
+	for (i = 0; i < old->size; i++) {
+		if (old->slots[i] != NULL && old->slots[i] != TM_SLOT_DELETED) {
+			tm_table_put(table, old->slots[i]);
+		}
+	}
+
+	__atomic_store_n(&tm->table, table, __ATOMIC_RELEASE);
+	tm->used = tm->records;
+
+	old->retired = tm_retire_epoch(tm);
+	old->next = tm->retired_tables;
+	tm->retired_tables = old;
+
+	return 0;
+}
+
+/**
+ * \brief Remove record from the hash table
+ *
+ * Caller holds tmr_lock. Templates of the record are freed, the record itself
+ * is retired and freed by tm_reclaim() when no reader can use it.
+ *
+ * \param[in] tm Template Manager
+ * \param[in] slot Index of the record's slot
+ */
+static void tm_table_remove(struct ipfix_template_mgr *tm, uint32_t slot)
+{
+	struct ipfix_template_mgr_record *tmr = tm->table->slots[slot];
+
+	__atomic_store_n(&tm->table->slots[slot], TM_SLOT_DELETED, __ATOMIC_RELEASE);
+	tm->records--;
+
+	tm_record_remove_all_templates(tm, tmr, TM_TEMPLATE);
+	tm_record_remove_all_templates(tm, tmr, TM_OPTIONS_TEMPLATE);
+
+	tmr->retired = tm_retire_epoch(tm);
+	tmr->next = tm->retired_records;
+	tm->retired_records = tmr;
+}
+
 /**
  * \brief Find template managers record in template manager
  *
+ * Lock-free, the table and its slots are loaded atomically. The table always
+ * contains an empty slot, so the probing terminates. Without tmr_lock, the
+ * caller must be inside of tm_read_enter()/tm_read_leave() as long as it
+ * uses the record.
+ *
  * \param[in] tm Template Manager
  * \param[in] key Unique identifier of template in Template Manager
  * \return pointer to Template Manager's record
  */
 struct ipfix_template_mgr_record *tm_record_lookup(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
+	struct ipfix_template_mgr_table *table = __atomic_load_n(&tm->table, __ATOMIC_ACQUIRE);
 	struct ipfix_template_mgr_record *tmp_rec;
 	uint64_t table_key = ((uint64_t) key->odid << 32) | key->crc;
+	uint32_t mask = table->size - 1;
+	uint32_t i = tm_key_hash(table_key) & mask;
 
-	for (tmp_rec = tm->first; tmp_rec != NULL; tmp_rec = tmp_rec->next) {
-		if (tmp_rec->key == table_key) {
+	while ((tmp_rec = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE)) != NULL) {
+		if (tmp_rec != TM_SLOT_DELETED && tmp_rec->key == table_key) {
 			return tmp_rec;
 		}
+		i = (i + 1) & mask;
 	}
 
 	return NULL;
@@ -107,11 +427,23 @@ struct ipfix_template_mgr_record *tm_record_lookup(struct ipfix_template_mgr *tm
  */
 struct ipfix_template_mgr_record *tm_record_lookup_insert(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
-	pthread_mutex_lock(&tm->tmr_lock);
+	/* Fast path, the record usually exists */
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup(tm, key);
+	if (tmr != NULL) {
+		return tmr;
+	}
+
+	pthread_mutex_lock(&tm->tmr_lock);
+	tmr = tm_record_lookup(tm, key);
 
 	/* Template Manager's record not found - create a new one */
 	if (tmr == NULL) {
+		/* Keep at least a quarter of slots empty */
+		if ((tm->used + 1) * 4 > tm->table->size * 3 && tm_table_rebuild(tm)) {
+			pthread_mutex_unlock(&tm->tmr_lock);
+			return NULL;
+		}
+
 		if ((tmr = tm_record_create()) == NULL) {
 			pthread_mutex_unlock(&tm->tmr_lock);
 			return NULL;
@@ -120,14 +452,9 @@ struct ipfix_template_mgr_record *tm_record_lookup_insert(struct ipfix_template_
 		tmr->key = table_key;
 		tmr->next = NULL;
 
-		/* Insert new record at the end of list */
-		if (tm->first == NULL) {
-			tm->first = tmr;
-		} else {
-			tm->last->next = tmr;
-		}
-
-		tm->last = tmr;
+		tm->used += tm_table_put(tm->table, tmr);
+		tm->records++;
+		tm_reclaim(tm, 0);
 	}
 
 	pthread_mutex_unlock(&tm->tmr_lock);
@@ -200,6 +527,7 @@ static int tm_fill_template(struct ipfix_template *template, void *template_reco
 
 	template->references = 0;
 	template->next = NULL;
+	template->index = NULL;
 	template->first_transmission = time(NULL);
 
 	int i;
@@ -296,7 +624,10 @@ int tm_source_register(struct ipfix_template_mgr *tm, uint32_t odid, uint32_t cr
 	key.tid = 0; // This field is not used by lookup up function, so it is OK
 
 	struct ipfix_template_mgr_record *rec;
-	if ((rec = tm_record_lookup_insert(tm, &key)) == NULL) {
+	tm_read_enter(tm);
+	rec = tm_record_lookup_insert(tm, &key);
+	tm_read_leave(tm);
+	if (rec == NULL) {
 		// Failed
 		return 1;
 	}
@@ -346,6 +677,113 @@ int tm_source_unregister(struct ipfix_template_mgr *tm, uint32_t odid, uint32_t
 	return 0;
 }
 
+/**
+ * \brief Hash of a field ID for the field index
+ *
+ * \param[in] enterprise Enterprise number
+ * \param[in] id Field ID
+ * \return hash value
+ */
+static inline uint32_t tm_field_hash(uint32_t enterprise, uint16_t id)
+{
+	return (id * 0x9E3779B1U) ^ (enterprise * 0x85EBCA6BU) ^ (enterprise >> 16);
+}
+
+/**
+ * \brief Number of slots of the field index hash table
+ *
+ * \param[in] field_count Number of template fields
+ * \return power of two at least twice the number of fields
+ */
+static uint32_t tm_index_hash_size(uint16_t field_count)
+{
+	uint32_t size = 8;
+
+	while (size < (uint32_t) field_count * 2) {
+		size *= 2;
+	}
+
+	return size;
+}
+
+/**
+ * \brief Size of the field index of a template
+ *
+ * \param[in] field_count Number of template fields
+ * \return size of the index including the hash table
+ */
+static size_t tm_index_size(uint16_t field_count)
+{
+	return sizeof(struct ipfix_template_index)
+			+ field_count * sizeof(struct ipfix_template_field)
+			+ tm_index_hash_size(field_count) * sizeof(uint16_t);
+}
+
+/**
+ * \brief Compile field index of a template
+ *
+ * \param[in,out] templ Template (fields in host byte order)
+ * \param[in] index Memory for the index of tm_index_size() bytes
+ */
+static void tm_index_compile(struct ipfix_template *templ, struct ipfix_template_index *index)
+{
+	static uint32_t serial = 0;
+	uint32_t hash_size = tm_index_hash_size(templ->field_count);
+	int32_t offset = 0;
+	uint16_t i, row;
+
+	index->count = templ->field_count;
+	index->first_var = templ->field_count;
+	index->hash_mask = hash_size - 1;
+	index->serial = __atomic_add_fetch(&serial, 1, __ATOMIC_RELAXED);
+	index->hash = (uint16_t *) &index->fields[templ->field_count];
+	memset(index->hash, 0xFF, hash_size * sizeof(uint16_t));
+
+	for (i = 0, row = 0; i < templ->field_count; i++, row++) {
+		struct ipfix_template_field *field = &index->fields[i];
+
+		field->id = templ->fields[row].ie.id & 0x7FFF;
+		field->length = templ->fields[row].ie.length;
+		field->row = row;
+		field->enterprise = 0;
+		field->next = TEMPLATE_FIELD_NONE;
+		field->offset = offset;
+
+		if (templ->fields[row].ie.id >> 15) {
+			field->enterprise = templ->fields[++row].enterprise_number;
+		}
+
+		if (offset >= 0) {
+			if (field->length == VAR_IE_LENGTH) {
+				index->first_var = i;
+				offset = -1;
+			} else {
+				offset += field->length;
+			}
+		}
+
+		/* Link to the previous occurrence or insert into the hash table */
+		uint32_t slot = tm_field_hash(field->enterprise, field->id) & index->hash_mask;
+		while (index->hash[slot] != TEMPLATE_FIELD_NONE) {
+			struct ipfix_template_field *first = &index->fields[index->hash[slot]];
+			if (first->id == field->id && first->enterprise == field->enterprise) {
+				while (first->next != TEMPLATE_FIELD_NONE) {
+					first = &index->fields[first->next];
+				}
+				first->next = i;
+				break;
+			}
+			slot = (slot + 1) & index->hash_mask;
+		}
+
+		if (index->hash[slot] == TEMPLATE_FIELD_NONE) {
+			index->hash[slot] = i;
+		}
+	}
+
+	templ->index = index;
+}
+
 /**
  * \brief Create new IPFIX template
  *
@@ -369,8 +807,10 @@ struct ipfix_template *tm_create_template(void *template, int max_len, int type,
 		return NULL;
 	}
 
-	/* allocate memory for new template */
-	if ((new_tmpl = malloc(tmpl_length)) == NULL) {
+	/* allocate memory for new template and its field index */
+	size_t index_offset = (tmpl_length + 7) & ~((size_t) 7);
+	uint16_t field_count = ntohs(((struct ipfix_template_record *) template)->count);
+	if ((new_tmpl = malloc(index_offset + tm_index_size(field_count))) == NULL) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
@@ -380,6 +820,8 @@ struct ipfix_template *tm_create_template(void *template, int max_len, int type,
 		return NULL;
 	}
 
+	tm_index_compile(new_tmpl, (struct ipfix_template_index *) ((uint8_t *) new_tmpl + index_offset));
+
 	return new_tmpl;
 }
 
@@ -669,22 +1111,38 @@ void tm_record_destroy(struct ipfix_template_mgr *tm, struct ipfix_template_mgr_
 struct ipfix_template_mgr *tm_create() {
 	struct ipfix_template_mgr *tm;
 
-	if ((tm = malloc(sizeof(struct ipfix_template_mgr))) == NULL) {
+	if ((tm = calloc(1, sizeof(struct ipfix_template_mgr))) == NULL) {
 		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
 		return NULL;
 	}
 
 	/* Allocate space for Template Manager's records */
-	tm->first = NULL;
-	tm->last = NULL;
+	if ((tm->table = tm_table_create(TM_TABLE_INIT_SIZE)) == NULL) {
+		free(tm);
+		return NULL;
+	}
+
+	/* Reader slots */
+	tm->readers = calloc(TM_READERS_MAX, sizeof(struct ipfix_template_mgr_reader));
+	if (tm->readers == NULL) {
+		MSG_ERROR(msg_module, "Memory allocation failed (%s:%d)", __FILE__, __LINE__);
+		free(tm->table);
+		free(tm);
+		return NULL;
+	}
 
 	/* Initialize mutex */
 	if (pthread_mutex_init(&tm->tmr_lock, NULL) != 0) {
 		MSG_ERROR(msg_module, "Failed to initialize a mutex.");
+		free(tm->readers);
+		free(tm->table);
 		free(tm);
 		return NULL;
 	}
 
+	/* Readers publish nonzero epochs */
+	tm->epoch = 1;
+	tm->id = __atomic_add_fetch(&tm_instances, 1, __ATOMIC_RELAXED);
 	return tm;
 }
 
@@ -698,14 +1156,18 @@ void tm_destroy(struct ipfix_template_mgr *tm)
 	if (tm == NULL) {
 		return;
 	}
-	struct ipfix_template_mgr_record *tmp_rec = tm->first;
 
-	while (tmp_rec) {
-		tmp_rec = tmp_rec->next;
-		tm_record_destroy(tm, tm->first);
-		tm->first = tmp_rec;
+	uint32_t i;
+	for (i = 0; i < tm->table->size; i++) {
+		if (tm->table->slots[i] != NULL && tm->table->slots[i] != TM_SLOT_DELETED) {
+			tm_record_destroy(tm, tm->table->slots[i]);
+		}
 	}
 
+	tm_reclaim(tm, 1);
+	free(tm->table);
+	free(tm->readers);
+
 	pthread_mutex_destroy(&tm->tmr_lock);
 
 	free(tm);
@@ -717,14 +1179,18 @@ void tm_destroy(struct ipfix_template_mgr *tm)
  */
 struct ipfix_template *tm_add_template(struct ipfix_template_mgr *tm, void *template, int max_len, int type, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	tm_read_enter(tm);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup_insert(tm, key);
 
-	if (tmr == NULL) {
-		return NULL;
+	if (tmr != NULL) {
+		/* Add template to Template Manager */
+		templ = tm_record_add_template(tmr, template, max_len, type, key->odid);
 	}
 
-	/* Add template to Template Manager */
-	return tm_record_add_template(tmr, template, max_len, type, key->odid);
+	tm_read_leave(tm);
+	return templ;
 }
 
 /**
@@ -732,12 +1198,17 @@ struct ipfix_template *tm_add_template(struct ipfix_template_mgr *tm, void *temp
  */
 struct ipfix_template *tm_insert_template(struct ipfix_template_mgr *tm, struct ipfix_template *tmpl, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	tm_read_enter(tm);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup_insert(tm, key);
 
-	if (tmr == NULL) {
-			return NULL;
+	if (tmr != NULL) {
+		templ = tm_record_insert_template(tmr, tmpl);
 	}
-	return tm_record_insert_template(tmr, tmpl);
+
+	tm_read_leave(tm);
+	return templ;
 }
 
 /**
@@ -745,14 +1216,16 @@ struct ipfix_template *tm_insert_template(struct ipfix_template_mgr *tm, struct
  */
 struct ipfix_template *tm_update_template(struct ipfix_template_mgr *tm, void *template, int max_len, int type, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	tm_read_enter(tm);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup_insert(tm, key);
 
-	if (tmr == NULL) {
-		return NULL;
+	if (tmr != NULL) {
+		templ = tm_record_update_template(tmr, template, max_len, type, key->odid);
 	}
 
-	struct ipfix_template *templ = tm_record_update_template(tmr, template, max_len, type, key->odid);
-
+	tm_read_leave(tm);
 	return templ;
 
 }
@@ -762,54 +1235,48 @@ struct ipfix_template *tm_update_template(struct ipfix_template_mgr *tm, void *t
  */
 int tm_remove_template(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
+	int ret = 1;
+
+	tm_read_enter(tm);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup(tm, key);
 
-	if (tmr == NULL) {
-		return 1;
+	if (tmr != NULL) {
+		ret = tm_record_remove_template(tmr, key->tid);
 	}
 
-	return tm_record_remove_template(tmr, key->tid);
+	tm_read_leave(tm);
+	return ret;
 }
 
 void tm_remove_all_templates(struct ipfix_template_mgr *tm)
 {
-	// Lock the list of sources
+	// Lock the table of sources
 	pthread_mutex_lock(&tm->tmr_lock);
 
-	struct ipfix_template_mgr_record *prev_rec = tm->first;
-	struct ipfix_template_mgr_record *aux_rec = tm->first;
+	struct ipfix_template_mgr_record *aux_rec;
+	uint32_t i;
 	MSG_INFO(msg_module, "Removing all templates in the collector!");
 
-	while (aux_rec) {
+	for (i = 0; i < tm->table->size; i++) {
+		aux_rec = tm->table->slots[i];
+		if (aux_rec == NULL || aux_rec == TM_SLOT_DELETED) {
+			continue;
+		}
+
 		// Only template records without registration can be removed
 		if (aux_rec->registrations != 0) {
-			prev_rec = aux_rec;
-			aux_rec = aux_rec->next;
 			MSG_INFO(msg_module, "Unable to remove templates of one of "
 				"sources. The source is probably already reconnected.");
 			continue;
 		}
 
 		// Remove the record
-		if (aux_rec == tm->first) {
-			if (aux_rec == tm->last) {
-				tm->last = NULL;
-			}
-			tm->first = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			prev_rec = tm->first;
-			aux_rec = tm->first;
-		} else {
-			if (aux_rec == tm->last) {
-				tm->last = prev_rec;
-			}
-			prev_rec->next = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			aux_rec = prev_rec->next;
-		}
+		tm_table_remove(tm, i);
 	}
 
-	// Unlock list of sources
+	tm_reclaim(tm, 0);
+
+	// Unlock table of sources
 	pthread_mutex_unlock(&tm->tmr_lock);
 }
 
@@ -818,50 +1285,38 @@ void tm_remove_all_templates(struct ipfix_template_mgr *tm)
  */
 void tm_remove_all_odid_templates(struct ipfix_template_mgr *tm, uint32_t odid)
 {
-	// Lock the list of sources
+	// Lock the table of sources
 	pthread_mutex_lock(&tm->tmr_lock);
 
-	struct ipfix_template_mgr_record *prev_rec = tm->first;
-	struct ipfix_template_mgr_record *aux_rec = tm->first;
+	struct ipfix_template_mgr_record *aux_rec;
+	uint32_t i;
 	MSG_INFO(msg_module, "[%u] Removing all templates", odid);
 
-	while (aux_rec) {
+	for (i = 0; i < tm->table->size; i++) {
+		aux_rec = tm->table->slots[i];
+		if (aux_rec == NULL || aux_rec == TM_SLOT_DELETED) {
+			continue;
+		}
+
 		if (aux_rec->key >> 32 != odid) {
 			// Different ODID source
-			prev_rec = aux_rec;
-			aux_rec = aux_rec->next;
 			continue;
 		}
 
 		// Only template records without registration can be removed
 		if (aux_rec->registrations != 0) {
-			prev_rec = aux_rec;
-			aux_rec = aux_rec->next;
 			MSG_INFO(msg_module, "[%u] Unable to remove templates of one of "
 				"sources. The source is probably already reconnected.", odid);
 			continue;
 		}
 
 		// Remove the record
-		if (aux_rec == tm->first) {
-			if (aux_rec == tm->last) {
-				tm->last = NULL;
-			}
-			tm->first = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			prev_rec = tm->first;
-			aux_rec = tm->first;
-		} else {
-			if (aux_rec == tm->last) {
-				tm->last = prev_rec;
-			}
-			prev_rec->next = aux_rec->next;
-			tm_record_destroy(tm, aux_rec);
-			aux_rec = prev_rec->next;
-		}
+		tm_table_remove(tm, i);
 	}
 
-	// Unlock list of sources
+	tm_reclaim(tm, 0);
+
+	// Unlock table of sources
 	pthread_mutex_unlock(&tm->tmr_lock);
 }
 
@@ -870,11 +1325,16 @@ void tm_remove_all_odid_templates(struct ipfix_template_mgr *tm, uint32_t odid)
  */
 struct ipfix_template *tm_get_template(struct ipfix_template_mgr *tm, struct ipfix_template_key *key)
 {
+	struct ipfix_template *templ = NULL;
+
+	tm_read_enter(tm);
 	struct ipfix_template_mgr_record *tmr = tm_record_lookup(tm, key);
-	if (tmr == NULL) {
-		return NULL;
+	if (tmr != NULL) {
+		templ = tm_record_get_template(tmr, key->tid);
 	}
-	return tm_record_get_template(tmr, key->tid);
+
+	tm_read_leave(tm);
+	return templ;
 }
 
 /**
@@ -899,6 +1359,48 @@ void tm_template_reference_dec(struct ipfix_template *templ)
 	}
 }
 
+/**
+ * \brief Get index of the first field with given ID in template
+ */
+int template_get_field_index(struct ipfix_template *templ, uint32_t enterprise, uint16_t id)
+{
+	if (!templ) {
+		return -1;
+	}
+
+	struct ipfix_template_index *index = templ->index;
+	if (index) {
+		uint32_t slot = tm_field_hash(enterprise, id) & index->hash_mask;
+		uint16_t field;
+
+		while ((field = index->hash[slot]) != TEMPLATE_FIELD_NONE) {
+			if (index->fields[field].id == id && index->fields[field].enterprise == enterprise) {
+				return field;
+			}
+			slot = (slot + 1) & index->hash_mask;
+		}
+
+		return -1;
+	}
+
+	/* Template without index, walk the fields */
+	uint16_t i, row;
+	for (i = 0, row = 0; i < templ->field_count; i++, row++) {
+		uint16_t ie_id = templ->fields[row].ie.id;
+		uint32_t ie_enterprise = 0;
+
+		if (ie_id >> 15) {
+			ie_enterprise = templ->fields[++row].enterprise_number;
+		}
+
+		if ((ie_id & 0x7FFF) == id && ie_enterprise == enterprise) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
 /**
  * \brief Determines whether specific template contains given field and returns
  * the field's offset.
@@ -919,6 +1421,15 @@ int template_contains_field(struct ipfix_template *templ, uint16_t field)
 		return -1;
 	}
 
+	if (templ->index && !(field & 0x8000)) {
+		int i = template_get_field_index(templ, 0, field);
+		if (i < 0) {
+			return -1;
+		}
+
+		return (templ->index->fields[i].offset < 0) ? 0 : templ->index->fields[i].offset;
+	}
+
 	if (templ->template_type == TM_OPTIONS_TEMPLATE) {
 		p = (uint8_t *) ((struct ipfix_options_template_record*) templ)->fields;
 	} else {
@@ -985,6 +1496,15 @@ int template_get_field_offset(struct ipfix_template *templ, uint16_t eid, uint16
 		return -1;
 	}
 
+	if (templ->index) {
+		int i = template_get_field_index(templ, eid, fid & 0x7FFF);
+		if (i < 0) {
+			return -1;
+		}
+
+		return (templ->index->fields[i].offset < 0) ? 0 : templ->index->fields[i].offset;
+	}
+
 	if (templ->template_type == TM_OPTIONS_TEMPLATE) {
 		p = (uint8_t *) ((struct ipfix_options_template_record*) templ)->fields;
 	} else {
@@ -1065,6 +1585,11 @@ int template_get_field_length(struct ipfix_template *templ, uint16_t eid, uint16
 		return -1;
 	}
 
+	if (templ->index) {
+		int i = template_get_field_index(templ, eid, fid & 0x7FFF);
+		return (i < 0) ? -1 : templ->index->fields[i].length;
+	}
+
 	/* Set most specific bit to 1, to indicate enterprise field */
 	if (eid > 0) {
 		fid = fid | 0x8000;
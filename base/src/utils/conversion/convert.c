@@ -44,6 +44,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "convert.h"
 #ifdef ENABLE_SFLOW
@@ -130,16 +131,21 @@ static uint16_t netflow_v5_data_header[2] = {\
 		IPFIX_MIN_RECORD_FLOWSET_ID, NETFLOW_V5_DATA_SET_LEN + sizeof(struct ipfix_set_header)
 };
 
+/*
+ * Conversion state is thread-local so that several instances of an input
+ * plugin can convert packets in parallel (one instance per receiver thread)
+ */
+
 /* (New) IPFIX sequence numbers for NFv5, NFv9 and sFlow traffic streams */
-static uint32_t ipfix_seq_no[3] = {0, 0, 0};
+static __thread uint32_t ipfix_seq_no[3] = {0, 0, 0};
 
 #define NF5_SEQ_NO  0
 #define NF9_SEQ_NO  1
 #define SF_SEQ_NO   2
 
-static uint8_t inserted = 0;
-static uint8_t plugin = UDP_PLUGIN;
-static uint32_t buff_len = 0;
+static __thread uint8_t inserted = 0;
+static __thread uint8_t plugin = UDP_PLUGIN;
+static __thread uint32_t buff_len = 0;
 
 /**
  * \struct input_info_list
@@ -158,14 +164,17 @@ struct templates_s {
 	int *templ;
 };
 
-static struct templates_s templates;
-static struct input_info_list *info_list;
+static __thread struct templates_s templates;
+static __thread struct input_info_list *info_list;
+
+/* Byte order of the static template arrays is converted only once */
+static pthread_once_t modify_once = PTHREAD_ONCE_INIT;
 
 /**
  * \brief Convers static arrays from host to network byte order
  *
  */
-static inline void modify()
+static void modify(void)
 {
 	int i;
 	for (i = 0; i < NETFLOW_V5_TEMPLATE_LEN / 2; i++) {
@@ -209,7 +218,7 @@ int convert_init(int in_plugin, int len)
 	plugin = in_plugin;
 
 	/* Modify static variables for template & data set insertion */
-	modify();
+	pthread_once(&modify_once, modify);
 
 	return 0;
 }
@@ -60,7 +60,7 @@ extern "C" {
 #define YES 1
 #define NO 0
 
-static uint16_t numOfFlowSamples;
+static __thread uint16_t numOfFlowSamples;
 
 /* define my own IP header struct - to ease portability */
 struct myiphdr
@@ -176,7 +176,7 @@ typedef struct _SFCommonLogFormat {
   char http_log[SFLFMT_CLF_MAX_LINE];
 } SFCommonLogFormat;
 
-static SFCommonLogFormat sfCLF;
+static __thread SFCommonLogFormat sfCLF;
 static const char *SFHTTP_method_names[] = { "-", "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE", "CONNECT" };
 
 typedef struct _SFSample {
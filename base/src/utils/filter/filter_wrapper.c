@@ -47,6 +47,7 @@
 
 #include <ipfixcol.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "filter_wrapper.h"
 #include "ffilter.h"
@@ -105,11 +106,55 @@ const char constants[10][CONST_END] = {
     [CONST_INET6] = {"6"},
 };
 
+/** Number of cached template programs of one thread (power of two) */
+#define NFF_PROGRAM_CACHE 64
+/** Maximal number of resolved fields in one template program */
+#define NFF_PROGRAM_STEPS 16
+
+/**
+ * \brief Field of a filter resolved for one template
+ */
+struct nff_step_s {
+    uint64_t id;        /**< External ID of the field (see toGenEnId()) */
+    int field;          /**< Index of the field in template, -1 if missing */
+};
+
+/**
+ * \brief Filter specialized for one template
+ *
+ * Fields used by the filter are resolved to indexes in the template's field
+ * index when they are accessed for the first time, following records of the
+ * same template read them without any search. The program belongs to the
+ * filter with the same ID and to the template with the same address and
+ * serial number, so a template allocated at the address of a withdrawn one
+ * replaces the program.
+ *
+ * Programs are cached per thread, one filter can be evaluated by more
+ * threads at once.
+ */
+struct nff_program_s {
+    uint64_t filter;                /**< ID of the filter, 0 for an empty slot */
+    struct ipfix_template *templ;   /**< Template */
+    uint32_t serial;                /**< Serial number of the template's index */
+    uint16_t count;                 /**< Number of resolved fields */
+    struct nff_step_s steps[NFF_PROGRAM_STEPS]; /**< Resolved fields */
+};
+
 struct ipx_filter {
     ff_t *filter;	//internal filter representation
     void* buffer;	//buffer
+    uint64_t id;	//ID of the parsed expression in program caches
 };
 
+/** Last assigned filter ID */
+static uint64_t nff_filter_ids = 0;
+
+/** Program cache of the thread (direct mapped), allocated on first use */
+static __thread struct nff_program_s *nff_programs = NULL;
+/** Releases program caches of finished threads */
+static pthread_key_t nff_programs_key;
+static pthread_once_t nff_programs_once = PTHREAD_ONCE_INIT;
+
 /**
  * \brief Structure of ipfix message and record pointers
  *
@@ -119,6 +164,7 @@ struct ipx_filter {
 typedef struct nff_msg_rec_s {
     struct ipfix_message* msg;
     struct ipfix_record* rec;
+    struct nff_program_s* prog; // program of the record's template or NULL
 } nff_msg_rec_t;
 
 /**
@@ -798,6 +844,46 @@ ff_error_t ipf_lookup_func(ff_t *filter, const char *fieldstr, ff_lvalue_t *lval
     return FF_OK;
 }
 
+/**
+ * \brief Get index of a field in the record's template using the template program
+ *
+ * The field is resolved once per template (including the IPv4/IPv6 switch of
+ * CTL_V4V6IP fields), then it is only looked up in the program.
+ *
+ * \param[in,out] prog Program of the record's template
+ * \param[in] id External ID of the field
+ * \return Index of the field, -1 if the template does not contain it,
+ *  -2 if the program is full
+ */
+static inline int nff_program_field(struct nff_program_s *prog, uint64_t id)
+{
+    uint16_t gen, ie_id;
+    uint32_t en;
+    int field;
+
+    for (int i = 0; i < prog->count; i++) {
+        if (prog->steps[i].id == id) {
+            return prog->steps[i].field;
+        }
+    }
+
+    if (prog->count == NFF_PROGRAM_STEPS) {
+        return -2;
+    }
+
+    unpackEnId(id, &gen, &en, &ie_id);
+    field = template_get_field_index(prog->templ, en, ie_id);
+    if (field < 0 && (gen & CTL_V4V6IP) && specify_ipv(&ie_id)) {
+        field = template_get_field_index(prog->templ, en, ie_id);
+    }
+
+    prog->steps[prog->count].id = id;
+    prog->steps[prog->count].field = field;
+    prog->count++;
+
+    return field;
+}
+
 /* getting data callback */
 ff_error_t ipf_data_func(ff_t *filter, void *rec, ff_extern_id_t id, char **data, size_t *size)
 {
@@ -987,7 +1073,28 @@ ff_error_t ipf_data_func(ff_t *filter, void *rec, ff_extern_id_t id, char **data
             return FF_ERR_OTHER;
         }
 
-    } */else {
+    } */else if (msg_pair->prog) {
+
+        int field = nff_program_field(msg_pair->prog, id.index);
+        if (field == -1) {
+            return FF_ERR_OTHER;
+        }
+
+        if (field >= 0) {
+            ipf_field = (char *) data_record_get_field_at((msg_pair->rec)->record, (msg_pair->rec)->templ, field, &len);
+        } else {
+            ipf_field = (char *) data_record_get_field((msg_pair->rec)->record, (msg_pair->rec)->templ, en, ie_id, &len);
+            if (generic_set & CTL_V4V6IP && ipf_field == NULL) {
+                if (specify_ipv(&ie_id)) {
+                    ipf_field = (char *) data_record_get_field((msg_pair->rec)->record, (msg_pair->rec)->templ, en, ie_id, &len);
+                }
+            }
+        }
+        if (ipf_field == NULL) {
+            return FF_ERR_OTHER;
+        }
+
+    } else {
 
         ipf_field = data_record_get_field((msg_pair->rec)->record, (msg_pair->rec)->templ, en, ie_id, &len);
         if (generic_set & CTL_V4V6IP && ipf_field == NULL) {
@@ -1126,16 +1233,69 @@ int ipx_filter_parse(ipx_filter_t *filter, char* filter_str)
         retval = 1;
     }
 
+    /* Programs of the previous filter expression are not valid anymore */
+    filter->id = __atomic_add_fetch(&nff_filter_ids, 1, __ATOMIC_RELAXED);
+
     ff_options_free(opts);
     return retval;
 }
 
+/**
+ * \brief Create key that releases program caches of finished threads
+ */
+static void nff_programs_key_create()
+{
+    pthread_key_create(&nff_programs_key, free);
+}
+
+/**
+ * \brief Get program of a template from the thread's cache
+ *
+ * The cache is direct mapped by filter ID and template address. The slot is
+ * (re)initialized when it holds a program of another filter or template or of
+ * a withdrawn template that had the same address.
+ *
+ * \param[in] filter Filter
+ * \param[in] templ Template of the evaluated record
+ * \return Program or NULL when the template has no field index or the cache
+ *  cannot be allocated
+ */
+static inline struct nff_program_s *nff_program_get(ipx_filter_t *filter, struct ipfix_template *templ)
+{
+    if (templ == NULL || templ->index == NULL) {
+        return NULL;
+    }
+
+    if (nff_programs == NULL) {
+        pthread_once(&nff_programs_once, nff_programs_key_create);
+        nff_programs = calloc(NFF_PROGRAM_CACHE, sizeof(struct nff_program_s));
+        if (nff_programs == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(nff_programs_key, nff_programs);
+    }
+
+    uintptr_t hash = (uintptr_t) templ ^ (uintptr_t) (filter->id * 0x9E3779B97F4A7C15ULL);
+    hash ^= hash >> 12;
+    struct nff_program_s *prog = &nff_programs[(hash >> 4) & (NFF_PROGRAM_CACHE - 1)];
+
+    if (prog->filter != filter->id || prog->templ != templ || prog->serial != templ->index->serial) {
+        prog->filter = filter->id;
+        prog->templ = templ;
+        prog->serial = templ->index->serial;
+        prog->count = 0;
+    }
+
+    return prog;
+}
+
 /* Evaulate expresion tree */
 int ipx_filter_eval(ipx_filter_t *filter, struct ipfix_message *msg, struct ipfix_record *record)
 {
     struct nff_msg_rec_s pack;
     pack.msg = msg;
     pack.rec = record;
+    pack.prog = nff_program_get(filter, record->templ);
     /* Necesarry to pass both msg and record to ff_eval, passed structure that contains both */
     return ff_eval(filter->filter, &pack);
 }
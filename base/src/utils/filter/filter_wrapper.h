@@ -78,6 +78,9 @@ int ipx_filter_parse(ipx_filter_t *filter, char* filter_str);
 /**
  * \brief Match filter with IPFIX record
  *
+ * Fields of the record are resolved once per template and cached in
+ * a per-thread cache, the filter object itself is not modified.
+ *
  * \param[in] filter filter object
  * \param[in] msg    IPFIX message (filter may contain field from message header)
  * \param[in] record IPFIX data record
@@ -196,9 +196,10 @@ void Channel::setProfile(Profile* profile)
 /**
  * Set channel filter
  */
-void Channel::setFilter(ipx_filter_t* filter)
+void Channel::setFilter(ipx_filter_t* filter, std::string expr)
 {
 	m_filter = filter;
+	m_filterExpr = expr;
 }
 
 /**
@@ -79,8 +79,24 @@ public:
 	 * \brief Set channel's filter
 	 * 
      * \param[in] filter filter
+     * \param[in] expr filter expression (channels with the same expression
+     * share the evaluation)
      */
-	void setFilter(ipx_filter_t *filter);
+	void setFilter(ipx_filter_t *filter, std::string expr = "");
+
+	/**
+	 * \brief Get channel's filter
+	 *
+	 * \return filter or NULL
+	 */
+	ipx_filter_t *getFilter() { return m_filter; }
+
+	/**
+	 * \brief Get channel's filter expression
+	 *
+	 * \return filter expression
+	 */
+	const std::string& getFilterExpr() const { return m_filterExpr; }
 
 	/**
 	 * \brief Get channel's ID
@@ -168,6 +184,7 @@ private:
 	std::string m_pathName;		/**< path name */
 
 	ipx_filter_t *m_filter{};	/**< Filter */
+	std::string m_filterExpr{};	/**< Filter expression */
 	Profile *m_profile{};		/**< Profile */
 
 	channelsSet m_listeners{};	/**< Listening channels */
@@ -0,0 +1,222 @@
+/**
+ * \file Matcher.cpp
+ * \brief Matcher of data records with the whole profile tree
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <map>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+
+#include "Matcher.h"
+
+/* Identifier for verbose macros */
+static const char *msg_module = "profiles";
+
+/**
+ * \brief Normalize filter expression (collapse white spaces)
+ */
+static std::string normalize_expr(const std::string &expr)
+{
+	std::istringstream iss(expr);
+	std::string word, result;
+
+	while (iss >> word) {
+		if (!result.empty()) {
+			result += ' ';
+		}
+		result += word;
+	}
+
+	return result;
+}
+
+/**
+ * Constructor
+ */
+Matcher::Matcher(Profile *root)
+{
+	std::map<Channel *, uint32_t> indexes;
+	std::queue<Profile *> profiles;
+
+	/* Profiles breadth first, so sources (in parent profiles) are added first */
+	profiles.push(root);
+	while (!profiles.empty()) {
+		Profile *profile = profiles.front();
+		profiles.pop();
+
+		for (auto &channel: profile->getChannels()) {
+			struct node item;
+			item.channel = channel;
+			item.predicate = addPredicate(channel);
+			item.top = (profile == root);
+
+			if (!item.top) {
+				for (auto &src: channel->getSources()) {
+					auto it = indexes.find(src);
+					if (it != indexes.end()) {
+						item.sources.push_back(it->second);
+					}
+				}
+			}
+
+			indexes[channel] = m_nodes.size();
+			m_nodes.push_back(item);
+		}
+
+		for (auto &child: profile->getChildren()) {
+			profiles.push(child);
+		}
+	}
+
+	m_matched = bitset_create(m_nodes.size() ? m_nodes.size() : 1);
+	if (!m_matched) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		throw std::bad_alloc();
+	}
+
+	MSG_DEBUG(msg_module, "Profile tree compiled: %zu channels, %zu distinct filters",
+		m_nodes.size(), m_predicates.size());
+}
+
+/**
+ * Destructor
+ */
+Matcher::~Matcher()
+{
+	/* Filters are owned by channels */
+	bitset_destroy(m_matched);
+}
+
+/**
+ * \brief Find or add predicate of a channel
+ *
+ * \param[in] channel Channel
+ * \return index of the predicate, -1 when the channel has no filter
+ */
+int Matcher::addPredicate(Channel *channel)
+{
+	if (!channel->getFilter()) {
+		return -1;
+	}
+
+	std::string expr = normalize_expr(channel->getFilterExpr());
+	for (size_t i = 0; !expr.empty() && i < m_predicates.size(); ++i) {
+		if (m_predicates[i].expr == expr) {
+			return i;
+		}
+	}
+
+	m_predicates.push_back({expr, channel->getFilter(), 0, false});
+	return m_predicates.size() - 1;
+}
+
+/**
+ * \brief Evaluate predicate for the current record (at most once)
+ */
+bool Matcher::evaluate(struct predicate &pred, struct ipfix_message *msg, struct metadata *mdata)
+{
+	if (pred.round != m_round) {
+		pred.round = m_round;
+		pred.result = ipx_filter_eval(pred.filter, msg, &(mdata->record)) > 0;
+	}
+
+	return pred.result;
+}
+
+/**
+ * Match data record
+ */
+void **Matcher::match(struct ipfix_message *msg, struct metadata *mdata)
+{
+	size_t count = 0;
+
+	if (++m_round == 0) {
+		/* Wrap around, forget all results */
+		for (auto &pred: m_predicates) {
+			pred.round = 0;
+		}
+		m_round = 1;
+	}
+
+	bitset_clear(m_matched);
+
+	for (size_t i = 0; i < m_nodes.size(); ++i) {
+		struct node &item = m_nodes[i];
+
+		/* Channels outside the root profile need a matching source */
+		if (!item.top) {
+			bool source = false;
+			for (auto idx: item.sources) {
+				if (bitset_get_fast(m_matched, idx)) {
+					source = true;
+					break;
+				}
+			}
+
+			if (!source) {
+				continue;
+			}
+		}
+
+		if (item.predicate >= 0 && !evaluate(m_predicates[item.predicate], msg, mdata)) {
+			continue;
+		}
+
+		bitset_set_fast(m_matched, i, true);
+		count++;
+	}
+
+	if (count == 0) {
+		return NULL;
+	}
+
+	void **channels = (void **) malloc((count + 1) * sizeof(void *));
+	if (!channels) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	size_t pos = 0;
+	for (size_t i = 0; pos < count; ++i) {
+		if (bitset_get_fast(m_matched, i)) {
+			channels[pos++] = (void *) m_nodes[i].channel;
+		}
+	}
+
+	channels[count] = NULL;
+	return channels;
+}
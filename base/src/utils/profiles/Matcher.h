@@ -0,0 +1,128 @@
+/**
+ * \file Matcher.h
+ * \brief Matcher of data records with the whole profile tree
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef MATCHER_H
+#define	MATCHER_H
+
+#include <string>
+#include <vector>
+
+#include "profiles_internal.h"
+
+extern "C" {
+#include "bitset.h"
+}
+
+/**
+ * \brief Matcher compiled from the whole profile tree
+ *
+ * All channels of the tree are stored in one array ordered so that sources
+ * of a channel always precede the channel (profiles are visited breadth
+ * first). Channels with the same filter expression share one predicate,
+ * which is evaluated at most once per data record and only when some
+ * channel using it can still match. Matched channels are marked in a
+ * preallocated bitmap.
+ *
+ * The matcher is not thread safe, it belongs to the thread that matches
+ * the records (the profiler plugin).
+ */
+class Matcher {
+public:
+	/**
+	 * \brief Compile the matcher
+	 *
+	 * \param[in] root Profile to match, root of the compiled subtree
+	 */
+	Matcher(Profile *root);
+
+	/**
+	 * \brief Destructor
+	 */
+	~Matcher();
+
+	/**
+	 * \brief Match data record with all channels of the tree
+	 *
+	 * \param[in] msg IPFIX message
+	 * \param[in] mdata Data record's metadata
+	 * \return NULL terminated array of matching channels (must be freed by
+	 * caller), NULL when no channel matches
+	 */
+	void **match(struct ipfix_message *msg, struct metadata *mdata);
+
+	/**
+	 * \brief Get number of channels
+	 *
+	 * \return number of channels in the tree
+	 */
+	size_t getChannels() const { return m_nodes.size(); }
+
+	/**
+	 * \brief Get number of distinct predicates
+	 *
+	 * \return number of filters evaluated for the tree
+	 */
+	size_t getPredicates() const { return m_predicates.size(); }
+
+private:
+	/** Channel in the compiled tree */
+	struct node {
+		Channel *channel;               /**< Channel */
+		int predicate;                  /**< Index of the predicate, -1 for no filter */
+		bool top;                       /**< Channel of the profile the matcher was compiled for (no sources) */
+		std::vector<uint32_t> sources;  /**< Indexes of source channels */
+	};
+
+	/** Filter shared by channels with the same expression */
+	struct predicate {
+		std::string expr;               /**< Normalized filter expression */
+		ipx_filter_t *filter;           /**< Filter (owned by a channel) */
+		uint32_t round;                 /**< Number of the record of the last evaluation */
+		bool result;                    /**< Result of the last evaluation */
+	};
+
+	int addPredicate(Channel *channel);
+	bool evaluate(struct predicate &pred, struct ipfix_message *msg, struct metadata *mdata);
+
+	std::vector<node> m_nodes{};            /**< Channels (sources first) */
+	std::vector<predicate> m_predicates{};  /**< Distinct predicates */
+	bitset_t *m_matched{};                  /**< Matched channels of the current record */
+	uint32_t m_round{};                     /**< Number of the current record */
+};
+
+#endif	/* MATCHER_H */
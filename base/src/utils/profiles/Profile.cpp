@@ -41,6 +41,7 @@
 
 #include "Profile.h"
 #include "Channel.h"
+#include "Matcher.h"
 
 /* Numer of profiles (ID for new profiles) */
 profile_id_t Profile::profiles_cnt = 1;
@@ -58,6 +59,8 @@ Profile::Profile(std::string name, PROFILE_TYPE type)
  */
 Profile::~Profile()
 {
+	delete m_matcher;
+
 	/* Remove channels */
 	for (auto& ch: m_channels) {
 		delete ch;
@@ -75,6 +78,7 @@ Profile::~Profile()
 void Profile::addChannel(Channel* channel)
 {
 	m_channels.push_back(channel);
+	invalidateMatcher();
 }
 
 /**
@@ -83,6 +87,7 @@ void Profile::addChannel(Channel* channel)
 void Profile::addProfile(Profile* child)
 {
 	m_children.push_back(child);
+	invalidateMatcher();
 }
 
 /**
@@ -97,6 +102,7 @@ void Profile::removeProfile(profile_id_t id)
 	/* Remove it */
 	if (it != m_children.end()) {
 		m_children.erase(it);
+		invalidateMatcher();
 	}
 }
 
@@ -122,6 +128,7 @@ void Profile::removeChannel(channel_id_t id)
 
 	// TODO: clear source list and unsubscribe listeners?
 	m_channels.erase(it);
+	invalidateMatcher();
 }
 
 /**
@@ -162,3 +169,26 @@ void Profile::match(struct match_data *data)
 		channel->match(data);
 	}
 }
+
+/**
+ * Get compiled matcher
+ */
+Matcher *Profile::getMatcher()
+{
+	if (!m_matcher) {
+		m_matcher = new Matcher(this);
+	}
+
+	return m_matcher;
+}
+
+/**
+ * Drop compiled matchers
+ */
+void Profile::invalidateMatcher()
+{
+	for (Profile *p = this; p; p = p->getParent()) {
+		delete p->m_matcher;
+		p->m_matcher = NULL;
+	}
+}
@@ -47,6 +47,7 @@
 #include "profiles_internal.h"
 
 class Channel;
+class Matcher;
 
 /**
  * \brief Class representing profile
@@ -117,14 +118,14 @@ public:
 	 *
 	 * \return vector of channels
 	 */
-	channelsVec getChannels() { return m_channels; }
+	const channelsVec& getChannels() const { return m_channels; }
 	
 	/**
 	 * \brief Get vector of all profile's child profiles
 	 *
 	 * \return vector of profiles
 	 */
-	profilesVec getChildren() { return m_children; }
+	const profilesVec& getChildren() const { return m_children; }
 	
 	/**
 	 * \brief Get parent profile
@@ -183,6 +184,21 @@ public:
 	void match(struct ipfix_message *msg, struct metadata *mdata, std::vector<Channel *>& channels);
 
 	void match(struct match_data *data);
+
+	/**
+	 * \brief Get matcher compiled from this profile and its subprofiles
+	 *
+	 * The matcher is compiled on the first call and dropped whenever
+	 * the tree changes.
+	 *
+	 * \return matcher
+	 */
+	Matcher *getMatcher();
+
+	/**
+	 * \brief Drop compiled matchers of this profile and its ancestors
+	 */
+	void invalidateMatcher();
 private:
 
 	Profile *m_parent{NULL};	/**< Parent profile */
@@ -196,6 +212,7 @@ private:
 
 	profilesVec m_children{};	/**< Children */
 	channelsVec m_channels{};	/**< Channels */
+	Matcher *m_matcher{};		/**< Compiled matcher (see getMatcher()) */
 	
 	static profile_id_t profiles_cnt;	/**< Total number of profiles */
 };
@@ -51,6 +51,7 @@ extern "C" {
 
 #include "Profile.h"
 #include "Channel.h"
+#include "Matcher.h"
 
 
 #include "profiles_internal.h"
@@ -100,10 +101,10 @@ int xml_find_uniq_element(xmlNodePtr root, const char *name, xmlNodePtr *result)
 /**
  * \brief Find and parse flow filter in the channel specification
  * \param[in] root Channel element
- * \param[in,out] pdata Filter parse aux. structure
+ * \param[out] expr Filter expression
  * \return Pointer to new filter or NULL
  */
-static ipx_filter_t *channel_parse_filter(xmlNodePtr root)
+static ipx_filter_t *channel_parse_filter(xmlNodePtr root, std::string &expr)
 {
 	ipx_filter_t *pdata = NULL;
 	xmlNodePtr filter_node = NULL;
@@ -152,6 +153,7 @@ static ipx_filter_t *channel_parse_filter(xmlNodePtr root)
 		xmlFree(aux_char);
 		throw_empty;
 	}
+	expr = (const char *) aux_char;
 	xmlFree(aux_char);
 	return pdata;
 }
@@ -239,8 +241,9 @@ Channel *process_channel(Profile *profile, xmlNode *root)
 	/*Create filter*/
 	try {
 		/* Find and parse filter */
-		ipx_filter_t *filter = channel_parse_filter(root);
-		channel->setFilter(filter);
+		std::string expr;
+		ipx_filter_t *filter = channel_parse_filter(root, expr);
+		channel->setFilter(filter, expr);
 
 		/* Find and process the list of source channels */
 		std::string list = channel_parse_source_list(root);
@@ -661,34 +664,11 @@ void *profile_get_channel(void *profile, uint16_t index)
  */
 void **profile_match_data(void *profile, struct ipfix_message *msg, struct metadata *mdata)
 {
-	Profile *p = (Profile *) profile;
-
-	/* Fill data structure */
-	struct match_data data;
-	data.msg = msg;
-	data.mdata = mdata;
-	data.channels = NULL;
-	data.channelsCounter = 0;
-	data.channelsMax = 0;
-
-	/* Find matching channels */
-	p->match(&data);
-	if (data.channels == NULL || data.channelsCounter == 0) {
+	try {
+		return ((Profile *) profile)->getMatcher()->match(msg, mdata);
+	} catch (std::exception &e) {
 		return NULL;
 	}
-
-	/* Add terminating NULL pointer */
-	if (data.channelsCounter == data.channelsMax) {
-		data.channels = (void**) realloc(data.channels, sizeof(void*) * (data.channelsCounter + 1));
-		if (data.channels == NULL) {
-			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
-			return NULL;
-		}
-	}
-
-	data.channels[data.channelsCounter] = NULL;
-
-	return data.channels;
 }
 
 /**
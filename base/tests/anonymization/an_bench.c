@@ -0,0 +1,258 @@
+/**
+ * \file an_bench.c
+ * \brief Benchmark of Crypto-PAn anonymization in the anonymization plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cryptopan.h"
+#include "Crypto-PAn/panonymizer.h"
+
+int address_count = 1000000; // Number of anonymized addresses
+int prefix_count = 1000; // Number of distinct prefixes the addresses come from
+uint32_t cache_size = CRYPTOPAN_CACHE_DEFAULT; // Number of cached prefixes
+int errors = 0; // Number of addresses that differ from the Crypto-PAn library
+
+uint8_t key[32] = "ipfixcol anonymization bench key";
+
+uint32_t *v4_addrs;
+uint8_t (*v6_addrs)[16];
+
+uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Addresses from a limited number of /24 (IPv4) and /64 (IPv6) prefixes */
+void generate_addresses()
+{
+	int i, j;
+	uint32_t *prefixes = malloc(prefix_count * sizeof(uint32_t));
+
+	v4_addrs = malloc(address_count * sizeof(uint32_t));
+	v6_addrs = malloc(address_count * sizeof(*v6_addrs));
+
+	for (i = 0; i < prefix_count; i++) {
+		prefixes[i] = (uint32_t) rand() << 8;
+	}
+
+	for (i = 0; i < address_count; i++) {
+		uint32_t prefix = prefixes[rand() % prefix_count];
+
+		v4_addrs[i] = prefix | (rand() & 0xFF);
+
+		memset(v6_addrs[i], 0, 16);
+		v6_addrs[i][0] = 0x20;
+		v6_addrs[i][1] = 0x01;
+		memcpy(v6_addrs[i] + 4, &prefix, 4);
+		for (j = 8; j < 16; j++) {
+			v6_addrs[i][j] = rand();
+		}
+	}
+
+	free(prefixes);
+}
+
+/* Compare results with anonymize() and anonymize_v6() */
+void check(struct cryptopan *cp, const char *name)
+{
+	int i;
+	uint64_t ref[2], in[2];
+	uint8_t anon[16];
+
+	for (i = 0; i < address_count && i < 10000; i++) {
+		if (cryptopan_anonymize_v4(cp, v4_addrs[i]) != anonymize(v4_addrs[i])) {
+			errors++;
+		}
+
+		memcpy(in, v6_addrs[i], 16);
+		anonymize_v6(in, ref);
+		cryptopan_anonymize_v6(cp, v6_addrs[i], anon);
+		if (memcmp(ref, anon, 16)) {
+			errors++;
+		}
+	}
+
+	if (errors) {
+		fprintf(stderr, "%s: %d addresses differ from Crypto-PAn library\n", name, errors);
+	}
+}
+
+void report(const char *name, int count, uint64_t start)
+{
+	double sec = (now_ns() - start) / 1e9;
+
+	printf("%-24s %10.0f addresses/s\n", name, count / sec);
+}
+
+/* Anonymize all addresses with given configuration */
+void bench(const char *name, uint32_t cache, int aesni)
+{
+	struct cryptopan cp;
+	char label[64];
+	uint64_t start;
+	uint32_t sum = 0;
+	uint8_t anon[16];
+	int i;
+
+	if (cryptopan_init(&cp, key, cache, aesni)) {
+		fprintf(stderr, "Cannot initialize anonymizer\n");
+		exit(1);
+	}
+
+	if (aesni && !cp.aesni) {
+		printf("%-24s CPU does not support AES-NI\n", name);
+		cryptopan_free(&cp);
+		return;
+	}
+
+	check(&cp, name);
+
+	start = now_ns();
+	for (i = 0; i < address_count; i++) {
+		sum += cryptopan_anonymize_v4(&cp, v4_addrs[i]);
+	}
+	snprintf(label, sizeof(label), "%s IPv4", name);
+	report(label, address_count, start);
+
+	start = now_ns();
+	for (i = 0; i < address_count; i++) {
+		cryptopan_anonymize_v6(&cp, v6_addrs[i], anon);
+		sum += anon[15];
+	}
+	snprintf(label, sizeof(label), "%s IPv6", name);
+	report(label, address_count, start);
+
+	if (cache) {
+		printf("%-24s %.1f %% hits\n", "", 100.0 * cp.hits / (cp.hits + cp.misses));
+	}
+
+	cryptopan_free(&cp);
+	if (sum == 0) {
+		printf("\n");
+	}
+}
+
+/* Crypto-PAn library */
+void bench_library(int count)
+{
+	uint64_t start, in[2], out[2];
+	uint32_t sum = 0;
+	int i;
+
+	PAnonymizer_Init(key);
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		sum += anonymize(v4_addrs[i]);
+	}
+	report("library IPv4", count, start);
+
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		memcpy(in, v6_addrs[i], 16);
+		anonymize_v6(in, out);
+		sum += out[1];
+	}
+	report("library IPv6", count, start);
+
+	if (sum == 0) {
+		printf("\n");
+	}
+}
+
+void usage(char *name)
+{
+	printf("Usage: %s [-n addresses] [-p prefixes] [-c cache size]\n", name);
+	printf("  -n  Number of anonymized addresses (default %d)\n", address_count);
+	printf("  -p  Number of distinct prefixes (default %d)\n", prefix_count);
+	printf("  -c  Number of cached prefixes (default %u)\n", cache_size);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:p:c:h")) != -1) {
+		switch (c) {
+		case 'n':
+			address_count = atoi(optarg);
+			break;
+		case 'p':
+			prefix_count = atoi(optarg);
+			break;
+		case 'c':
+			cache_size = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (address_count <= 0 || prefix_count <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	generate_addresses();
+
+	/* The library is slow, keep its run short */
+	bench_library(address_count < 100000 ? address_count : 100000);
+	bench("software", 0, 0);
+	bench("software cached", cache_size, 0);
+	bench("AES-NI", 0, 1);
+	bench("AES-NI cached", cache_size, 1);
+
+	free(v4_addrs);
+	free(v6_addrs);
+
+	if (errors) {
+		return 1;
+	}
+
+	printf("All anonymized addresses match the Crypto-PAn library\n");
+	return 0;
+}
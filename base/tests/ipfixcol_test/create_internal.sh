@@ -72,12 +72,19 @@ paths["ipfixcol-ipfixviewer-output"]="$PWD/ipfixviewer/.libs"
 
 cd ../../plugins/storage/
 paths["ipfixcol-fastbit-output"]="$PWD/fastbit/.libs"
+paths["ipfixcol-json-output"]="$PWD/json/.libs"
 paths["ipfixcol-nfdump-output"]="$PWD/nfdump/.libs"
 paths["ipfixcol-postgres-output"]="$PWD/postgres/.libs"
 paths["ipfixcol-statistics-output"]="$PWD/statistics/.libs"
 paths["ipfixcol-unirec-output"]="$PWD/unirec/.libs"
 
 cd "$CREATE_BASE"
+
+# External plugins are registered on installation, add the json plugin for tests
+if ! grep -q "ipfixcol-json-output.so" $INTERNAL; then
+	sed -i 's,^\(\s*\)<!-- Intermediate plugins -->,\1<storagePlugin>\n\1\t<fileFormat>json</fileFormat>\n\1\t<file>ipfixcol-json-output.so</file>\n\1\t<threadName>json</threadName>\n\1</storagePlugin>\n&,' $INTERNAL
+fi
+
 for plugin in ${!paths[@]}; do
 	sed -i 's,\(<file>\).*\('"$plugin"'\.so\)\(<\/file>\),\1'"${paths[$plugin]}"'\/\2\3,g' $INTERNAL
 done
\ No newline at end of file
@@ -0,0 +1,9 @@
+# decompressed files must be identical to the plain ones
+cat out-plain/json.* > out-plain.json && zcat out-gzip/json.*.gz > out-gzip.json
+status=$?
+
+diff out-plain.json out-gzip.json > output
+# make the test fail when a file is missing, empty or corrupted
+[ $status -ne 0 -o ! -s out-plain.json ] && echo "fail" > output
+
+rm -rf out-*
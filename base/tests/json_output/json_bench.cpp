@@ -0,0 +1,378 @@
+/**
+ * \file json_bench.cpp
+ * \brief Benchmark and differential test of the json storage plugin formatters
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "Translator.h"
+#include "json.h"
+
+int value_count = 1000000; // Number of formatted values of each kind
+int errors = 0; // Number of values that differ from the reference
+
+std::vector<std::array<uint8_t, 16>> ipv6_addrs;
+std::vector<std::array<uint8_t, 6>> mac_addrs;
+std::vector<uint64_t> timestamps;
+std::vector<std::string> strings;
+
+char ref_buffer[65536 * 6];
+
+uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Previous implementations of the formatters */
+const char *ref_ipv6(const uint8_t *addr)
+{
+	inet_ntop(AF_INET6, (struct in6_addr *) addr, ref_buffer, INET6_ADDRSTRLEN);
+	return ref_buffer;
+}
+
+const char *ref_mac(const uint8_t *addr)
+{
+	snprintf(ref_buffer, sizeof(ref_buffer), "%02x:%02x:%02x:%02x:%02x:%02x",
+		addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+	return ref_buffer;
+}
+
+const char *ref_timestamp(uint64_t tstamp)
+{
+	time_t timesec = tstamp / 1000;
+	uint64_t msec = tstamp % 1000;
+	struct tm *tm = localtime(&timesec);
+
+	strftime(ref_buffer, 21, "\"%FT%T", tm);
+	sprintf(&(ref_buffer[20]), ".%03u\"", (const unsigned int) msec);
+	return ref_buffer;
+}
+
+const char *ref_escape(const std::string &str, bool white_spaces)
+{
+	uint32_t idx_output = 0;
+
+	ref_buffer[idx_output++] = '"';
+	for (unsigned char c: str) {
+		if (c > 0x7F) {
+			snprintf(&ref_buffer[idx_output], 7, "\\u00%02x", c);
+			idx_output += 6;
+			continue;
+		}
+
+		if (c > 0x1F && c != '"' && c != '\\') {
+			ref_buffer[idx_output++] = c;
+			continue;
+		}
+
+		if (c == '\\' || c == '"') {
+			ref_buffer[idx_output++] = '\\';
+			ref_buffer[idx_output++] = c;
+			continue;
+		}
+
+		if (!white_spaces) {
+			continue;
+		}
+
+		switch (c) {
+		case '\t': ref_buffer[idx_output++] = '\\'; ref_buffer[idx_output++] = 't'; break;
+		case '\n': ref_buffer[idx_output++] = '\\'; ref_buffer[idx_output++] = 'n'; break;
+		case '\b': ref_buffer[idx_output++] = '\\'; ref_buffer[idx_output++] = 'b'; break;
+		case '\f': ref_buffer[idx_output++] = '\\'; ref_buffer[idx_output++] = 'f'; break;
+		case '\r': ref_buffer[idx_output++] = '\\'; ref_buffer[idx_output++] = 'r'; break;
+		default:
+			snprintf(&ref_buffer[idx_output], 7, "\\u00%02x", c);
+			idx_output += 6;
+			break;
+		}
+	}
+
+	ref_buffer[idx_output++] = '"';
+	ref_buffer[idx_output] = '\0';
+	return ref_buffer;
+}
+
+/* Random values with the corner cases of each formatter */
+void generate_values()
+{
+	static const char host_chars[] = "abcdefghijklmnopqrstuvwxyz0123456789-./?=&_";
+
+	ipv6_addrs.resize(value_count);
+	mac_addrs.resize(value_count);
+	timestamps.resize(value_count);
+	strings.resize(value_count);
+
+	uint64_t tstamp = 1500000000000ULL;
+	for (int i = 0; i < value_count; i++) {
+		std::array<uint8_t, 16> &addr = ipv6_addrs[i];
+
+		/* Groups are zero with 50% probability to create runs of zeros */
+		for (int j = 0; j < 8; j++) {
+			uint16_t word = 0;
+			switch (rand() % 4) {
+			case 0: word = rand() & 0x000f; break;
+			case 1: word = rand(); break;
+			}
+			addr[2 * j] = word >> 8;
+			addr[2 * j + 1] = word;
+		}
+
+		/* IPv4-mapped, IPv4-compatible and similar addresses */
+		switch (rand() % 16) {
+		case 0:
+			memset(addr.data(), 0, 10);
+			addr[10] = addr[11] = 0xff;
+			break;
+		case 1:
+			memset(addr.data(), 0, 12);
+			break;
+		case 2:
+			memset(addr.data(), 0, 14);
+			break;
+		case 3:
+			memset(addr.data(), 0, 16);
+			addr[15] = rand() % 3;
+			break;
+		}
+
+		for (int j = 0; j < 6; j++) {
+			mac_addrs[i][j] = rand();
+		}
+
+		/* Flows start in the same second in bursts */
+		tstamp += rand() % 8 == 0 ? rand() % 5000 : rand() % 3;
+		timestamps[i] = tstamp;
+
+		/* Host names and URLs, sometimes with characters to escape */
+		std::string &str = strings[i];
+		int len = rand() % 4 == 0 ? rand() % 300 : rand() % 40;
+		str.resize(len);
+		for (int j = 0; j < len; j++) {
+			str[j] = rand() % 64 ? host_chars[rand() % (sizeof(host_chars) - 1)] : rand() % 256;
+		}
+	}
+}
+
+void report(const char *name, uint64_t start)
+{
+	double sec = (now_ns() - start) / 1e9;
+
+	printf("%-28s %10.0f values/s\n", name, value_count / sec);
+}
+
+/* Compare formatters with the reference implementation */
+void check(Translator &tr, struct json_conf *conf, const char *name)
+{
+	uint16_t len;
+	uint32_t str_len;
+	int failed = 0;
+
+	for (int i = 0; i < value_count; i++) {
+		const char *out = tr.formatIPv6(ipv6_addrs[i].data(), &len);
+		if (strcmp(out, ref_ipv6(ipv6_addrs[i].data())) || len != strlen(out)) {
+			if (failed++ < 5) {
+				fprintf(stderr, "%s: IPv6 %s != %s\n", name, out, ref_buffer);
+			}
+		}
+
+		out = tr.formatMac(mac_addrs[i].data(), &len);
+		if (strcmp(out, ref_mac(mac_addrs[i].data())) || len != strlen(out)) {
+			if (failed++ < 5) {
+				fprintf(stderr, "%s: MAC %s != %s\n", name, out, ref_buffer);
+			}
+		}
+
+		out = tr.formatTimestamp(htobe64(timestamps[i]), t_units::MILLISEC, &len, conf);
+		if (strcmp(out, ref_timestamp(timestamps[i])) || len != strlen(out)) {
+			if (failed++ < 5) {
+				fprintf(stderr, "%s: timestamp %s != %s\n", name, out, ref_buffer);
+			}
+		}
+
+		conf->whiteSpaces = i % 2;
+		out = tr.escapeString(strings[i].size(), (const uint8_t *) strings[i].data(), &str_len, conf);
+		if (strcmp(out, ref_escape(strings[i], conf->whiteSpaces)) || str_len != strlen(out)) {
+			if (failed++ < 5) {
+				fprintf(stderr, "%s: string %s != %s\n", name, out, ref_buffer);
+			}
+		}
+	}
+	conf->whiteSpaces = true;
+
+	if (failed) {
+		fprintf(stderr, "%s: %d values differ from the reference\n", name, failed);
+		errors += failed;
+	}
+}
+
+/* Reference implementation */
+void bench_reference(struct json_conf *conf)
+{
+	uint64_t start;
+	uint32_t sum = 0;
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += ref_ipv6(ipv6_addrs[i].data())[0];
+	}
+	report("reference IPv6", start);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += ref_mac(mac_addrs[i].data())[0];
+	}
+	report("reference MAC", start);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += ref_timestamp(timestamps[i])[1];
+	}
+	report("reference timestamp", start);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += ref_escape(strings[i], conf->whiteSpaces)[0];
+	}
+	report("reference string", start);
+
+	if (sum == 0) {
+		printf("\n");
+	}
+}
+
+/* Formatters of the plugin */
+void bench(const char *name, bool simd, struct json_conf *conf)
+{
+	Translator tr(simd);
+	char label[64];
+	uint64_t start;
+	uint32_t sum = 0;
+	uint16_t len;
+	uint32_t str_len;
+
+	check(tr, conf, name);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += tr.formatIPv6(ipv6_addrs[i].data(), &len)[0] + len;
+	}
+	snprintf(label, sizeof(label), "%s IPv6", name);
+	report(label, start);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += tr.formatMac(mac_addrs[i].data(), &len)[0] + len;
+	}
+	snprintf(label, sizeof(label), "%s MAC", name);
+	report(label, start);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += tr.formatTimestamp(htobe64(timestamps[i]), t_units::MILLISEC, &len, conf)[1] + len;
+	}
+	snprintf(label, sizeof(label), "%s timestamp", name);
+	report(label, start);
+
+	start = now_ns();
+	for (int i = 0; i < value_count; i++) {
+		sum += tr.escapeString(strings[i].size(), (const uint8_t *) strings[i].data(), &str_len, conf)[0] + str_len;
+	}
+	snprintf(label, sizeof(label), "%s string", name);
+	report(label, start);
+
+	if (sum == 0) {
+		printf("\n");
+	}
+}
+
+void usage(char *name)
+{
+	printf("Usage: %s [-n values]\n", name);
+	printf("  -n  Number of formatted values of each kind (default %d)\n", value_count);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			value_count = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (value_count <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct json_conf conf{};
+	conf.timestamp = true;
+	conf.whiteSpaces = true;
+
+	srand(1);
+	generate_values();
+
+	bench_reference(&conf);
+	bench("scalar", false, &conf);
+	bench("SIMD", true, &conf);
+
+	if (errors) {
+		return 1;
+	}
+
+	printf("All formatted values match the reference\n");
+	return 0;
+}
@@ -1,7 +1,7 @@
 /**
  * \file rbuffer_test.c
  * \author Petr Velan <petr.velan@cesnet.cz>
- * \brief Test for ipfixcol's ring buffer queue
+ * \brief Test and benchmark for ipfixcol's ring buffer queue
  *
  * Copyright (C) 2015 CESNET, z.s.p.o.
  *
@@ -37,19 +37,59 @@
  *
  */
 
-#include "../../../src/queues.h" // We expect that ring buffer API does not change
+#include "../../src/queues.h" // We expect that ring buffer API does not change
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 
-#define THREAD_NUM 2 // Number of threads to use
-#define BUFFER_SIZE 128 // Size of the ring buffer
-#define WRITE_COUNT 100000 // How many items should be written
-#define READ_COUNT WRITE_COUNT // How many items should each thread dread
+#ifdef RBUFFER_MUTEX
+#define IMPL_NAME "mutex"
+#else
+#define IMPL_NAME "lock-free"
+#endif
+
+#define MAX_THREADS 64 // Maximal number of reading threads
+
+int thread_num = 2; // Number of threads to use
+int buffer_size = 128; // Size of the ring buffer
+int write_count = 100000; // How many items should be written (and each thread read)
+int batch_size = 1; // Number of items written at once
+int delay = 0; // Delay of each reading thread (microseconds)
+int errors = 0; // Number of detected errors
 
 struct ring_buffer *rb;
-int delays[THREAD_NUM] = {50, 50}; // Delays for each thread
+uint64_t *write_times; // Time of write of each item
+uint64_t *latencies; // Latencies measured by the first thread
+
+/* The queue frees messages itself, templates and metadata are not used here */
+void tm_template_reference_dec(struct ipfix_template *templ)
+{
+	(void) templ;
+}
+
+void message_free_metadata(struct ipfix_message *msg)
+{
+	(void) msg;
+}
+
+uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
 
 void *reader_thread(void *arg)
 {
@@ -57,65 +97,123 @@ void *reader_thread(void *arg)
 	int num = *((int*) arg);
 	struct ipfix_message *msg;
 
-	printf("Starting thread %i with delay %i\n", num, delays[num]);
-
-	for (int i=0; i<READ_COUNT; i++) {
+	for (int i=0; i<write_count; i++) {
 		msg = rbuffer_read(rb, &index);
 
-		/* give the data a chance to disappear */
-		usleep(delays[num]);
-
-		/* lock the rbuffer so that the error output is consistent */
-		if (pthread_mutex_lock (&(rb->mutex)) != 0) {
-			printf("Mutex lock failed (%s:%d)", __FILE__, __LINE__);
-			return (NULL);
+		if (num == 0) {
+			latencies[i] = now_ns() - write_times[i];
 		}
 
-		if ( msg->pkt_header->observation_domain_id != i) {
-            printf("Error: ODID does not match\n");
-			printf("Thread num: %i iteration: %i read from index: %i\n", num, i, index);
-			printf("buffer size: %i buffer count: %i read offset: %i write offset: %i\n\n",
-                rb->size, rb->count, rb->read_offset, rb->write_offset);
+		/* give the data a chance to disappear */
+		if (delay) {
+			usleep(delay);
 		}
 
-		if (pthread_mutex_unlock(&(rb->mutex)) != 0) {
-			printf("Mutex unlock failed (%s:%d)", __FILE__, __LINE__);
-			return (NULL);
+		if (msg == NULL || msg->pkt_header->observation_domain_id != (uint32_t) i) {
+			printf("Error: ODID does not match\n");
+			printf("Thread num: %i iteration: %i read from index: %i\n\n", num, i, index);
+			__sync_fetch_and_add(&errors, 1);
 		}
 
 		rbuffer_remove_reference(rb, index, 1);
 
-		index = (index+1) % BUFFER_SIZE;
+		index = (index+1) % buffer_size;
 	}
 
 	return NULL;
 }
 
-int main()
+void usage(const char *name)
+{
+	printf("Usage: %s [-t threads] [-n count] [-s size] [-b batch] [-d delay]\n", name);
+	printf("  -t threads  Number of reading threads (default: %d)\n", thread_num);
+	printf("  -n count    Number of written messages (default: %d)\n", write_count);
+	printf("  -s size     Size of the ring buffer (default: %d)\n", buffer_size);
+	printf("  -b batch    Number of messages written at once (default: %d)\n", batch_size);
+	printf("  -d delay    Delay of reading threads in microseconds (default: %d)\n", delay);
+}
+
+int main(int argc, char *argv[])
 {
-	rb = rbuffer_init(BUFFER_SIZE);
+	int c;
+
+	while ((c = getopt(argc, argv, "t:n:s:b:d:h")) != -1) {
+		switch (c) {
+		case 't': thread_num = atoi(optarg); break;
+		case 'n': write_count = atoi(optarg); break;
+		case 's': buffer_size = atoi(optarg); break;
+		case 'b': batch_size = atoi(optarg); break;
+		case 'd': delay = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (thread_num < 1 || thread_num > MAX_THREADS || write_count < 1
+			|| buffer_size < 2 || buffer_size > UINT16_MAX || batch_size < 1) {
+		usage(argv[0]);
+		return 1;
+	}
 
-	pthread_t threads[THREAD_NUM];
-	int idarray[THREAD_NUM];
+	rb = rbuffer_init(buffer_size);
+	write_times = calloc(write_count, sizeof(uint64_t));
+	latencies = calloc(write_count, sizeof(uint64_t));
+	struct ipfix_message **batch = calloc(batch_size, sizeof(struct ipfix_message *));
+	if (!rb || !write_times || !latencies || !batch) {
+		printf("Initialization failed\n");
+		return 1;
+	}
+
+	pthread_t threads[MAX_THREADS];
+	int idarray[MAX_THREADS];
 
-	for (int i = 0; i < THREAD_NUM; i++) {
+	for (int i = 0; i < thread_num; i++) {
 		idarray[i] = i;
 		pthread_create(&threads[i], NULL, reader_thread, &idarray[i]);
 	}
 
-	for (int i=0; i<WRITE_COUNT; i++) {
+	uint64_t start = now_ns();
+	int count = 0;
 
-		struct ipfix_message *record = malloc(sizeof(struct ipfix_message));
-		record->pkt_header = malloc(sizeof(struct ipfix_header));
+	for (int i=0; i<write_count; i++) {
+		struct ipfix_message *record = calloc(1, sizeof(struct ipfix_message));
+		record->pkt_header = calloc(1, sizeof(struct ipfix_header));
 		record->pkt_header->observation_domain_id = i;
-		rbuffer_write(rb, record, THREAD_NUM);
+		batch[count++] = record;
+
+		if (count == batch_size || i == write_count - 1) {
+			uint64_t t = now_ns();
+			for (int j = i - count + 1; j <= i; j++) {
+				write_times[j] = t;
+			}
+
+			rbuffer_write_batch(rb, batch, count, thread_num);
+			count = 0;
+		}
 	}
 
-	for (int i = 0; i < THREAD_NUM; i++) {
+	for (int i = 0; i < thread_num; i++) {
 		pthread_join(threads[i], NULL);
 	}
 
+	double elapsed = (now_ns() - start) / 1e9;
+
+	qsort(latencies, write_count, sizeof(uint64_t), cmp_u64);
+	uint64_t sum = 0;
+	for (int i = 0; i < write_count; i++) {
+		sum += latencies[i];
+	}
+
+	printf("%-9s threads: %2d size: %5d batch: %3d  %10.0f msg/s  latency [us] avg: %8.2f p50: %8.2f p99: %8.2f max: %9.2f  errors: %d\n",
+		IMPL_NAME, thread_num, buffer_size, batch_size, write_count / elapsed,
+		sum / 1e3 / write_count, latencies[write_count / 2] / 1e3,
+		latencies[(int) (write_count * 0.99)] / 1e3, latencies[write_count - 1] / 1e3, errors);
+
 	rbuffer_free(rb);
+	free(write_times);
+	free(latencies);
+	free(batch);
 
-	return 0;
+	return errors ? 1 : 0;
 }
@@ -0,0 +1,225 @@
+/**
+ * \file tm_bench.c
+ * \brief Benchmark of template lookups in ipfixcol's template manager
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <ipfixcol.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#define MAX_THREADS 64 // Maximal number of reading threads
+#define CHURN_ODID 0x80000000 // First ODID used by the churning writer
+
+int thread_num = 4; // Number of reading threads
+int source_count = 10000; // Number of sources (ODID and exporter pairs)
+int template_count = 8; // Number of templates of each source
+int lookup_count = 10000000; // Number of lookups done by each thread
+int churn = 0; // Add and remove sources while the readers run
+int errors = 0; // Number of lookups that returned a wrong template
+int readers_done = 0;
+
+struct ipfix_template_mgr *tm;
+struct ipfix_template_key *keys; // Keys of all sources
+
+uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Template with only the attributes the template manager looks at */
+struct ipfix_template *bench_template(uint16_t id)
+{
+	struct ipfix_template *tmpl = calloc(1, sizeof(struct ipfix_template));
+
+	tmpl->original_id = id;
+	tmpl->template_id = id;
+	tmpl->template_type = TM_TEMPLATE;
+
+	return tmpl;
+}
+
+int add_source(uint32_t odid, uint32_t crc)
+{
+	struct ipfix_template_key key = {odid, crc, 0};
+
+	for (int i = 0; i < template_count; i++) {
+		key.tid = 256 + i;
+		if (tm_insert_template(tm, bench_template(key.tid), &key) == NULL) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void *reader_thread(void *arg)
+{
+	uint64_t x = 88172645463325252ULL + *((int*) arg);
+	struct ipfix_template_key key;
+
+	for (int i = 0; i < lookup_count; i++) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+
+		key = keys[x % source_count];
+		key.tid = 256 + (x >> 32) % template_count;
+
+		struct ipfix_template *tmpl = tm_get_template(tm, &key);
+		if (tmpl == NULL || tmpl->original_id != key.tid) {
+			__sync_fetch_and_add(&errors, 1);
+		}
+	}
+
+	return NULL;
+}
+
+/* Sources of exporters that connect and disconnect */
+void *churn_thread(void *arg)
+{
+	uint32_t odid = CHURN_ODID;
+	int *changes = arg;
+
+	while (!__atomic_load_n(&readers_done, __ATOMIC_ACQUIRE)) {
+		add_source(odid, odid * 2654435761U);
+		if (odid - CHURN_ODID >= 16) {
+			tm_remove_all_odid_templates(tm, odid - 16);
+		}
+		odid++;
+		(*changes)++;
+	}
+
+	return NULL;
+}
+
+void usage(const char *name)
+{
+	printf("Usage: %s [-t threads] [-s sources] [-T templates] [-n count] [-c]\n", name);
+	printf("  -t threads    Number of reading threads (default: %d)\n", thread_num);
+	printf("  -s sources    Number of sources (default: %d)\n", source_count);
+	printf("  -T templates  Number of templates per source (default: %d)\n", template_count);
+	printf("  -n count      Number of lookups per thread (default: %d)\n", lookup_count);
+	printf("  -c            Add and remove other sources during the lookups\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "t:s:T:n:ch")) != -1) {
+		switch (c) {
+		case 't': thread_num = atoi(optarg); break;
+		case 's': source_count = atoi(optarg); break;
+		case 'T': template_count = atoi(optarg); break;
+		case 'n': lookup_count = atoi(optarg); break;
+		case 'c': churn = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (thread_num < 1 || thread_num > MAX_THREADS || source_count < 1
+			|| source_count >= CHURN_ODID || template_count < 1
+			|| template_count > 1024 || lookup_count < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Only errors are interesting */
+	verbose = ICMSG_ERROR;
+
+	tm = tm_create();
+	keys = calloc(source_count, sizeof(struct ipfix_template_key));
+	if (!tm || !keys) {
+		printf("Initialization failed\n");
+		return 1;
+	}
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < source_count; i++) {
+		/* A few ODIDs, many exporters */
+		keys[i].odid = i % 16;
+		keys[i].crc = (i + 1) * 2654435761U;
+		if (add_source(keys[i].odid, keys[i].crc)) {
+			printf("Failed to add source %d\n", i);
+			return 1;
+		}
+	}
+	double fill = (now_ns() - start) / 1e9;
+
+	pthread_t threads[MAX_THREADS], writer;
+	int idarray[MAX_THREADS];
+	int changes = 0;
+
+	start = now_ns();
+	for (int i = 0; i < thread_num; i++) {
+		idarray[i] = i;
+		pthread_create(&threads[i], NULL, reader_thread, &idarray[i]);
+	}
+	if (churn) {
+		pthread_create(&writer, NULL, churn_thread, &changes);
+	}
+
+	for (int i = 0; i < thread_num; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+
+	__atomic_store_n(&readers_done, 1, __ATOMIC_RELEASE);
+	if (churn) {
+		pthread_join(writer, NULL);
+	}
+
+	uint64_t lookups = (uint64_t) lookup_count * thread_num;
+	printf("sources: %6d templates: %4d threads: %2d  insert: %8.3f s  %12.0f lookups/s  %7.1f ns/lookup  source changes: %d  errors: %d\n",
+		source_count, template_count, thread_num, fill, lookups / elapsed,
+		elapsed * 1e9 * thread_num / lookups, changes, errors);
+
+	tm_destroy(tm);
+	free(keys);
+
+	return errors ? 1 : 0;
+}
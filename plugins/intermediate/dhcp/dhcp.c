@@ -42,13 +42,19 @@
 #include <libxml/parser.h>
 #include <libxml2/libxml/tree.h>
 
-#include <sqlite3.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "dhcp_map.h"
+
 #define IP_MAC_PAIRS_MAX 16
 
+/** Default interval of checking the database for changes in seconds */
+#define REFRESH_DEFAULT 1
+
 /* API version constant */
 IPFIXCOL_API_VERSION;
+/* No IPFIXCOL_MESSAGE_VIEWS, MAC addresses are rewritten inside the records */
 
 /* Identifier for verbose macros */
 static const char *msg_module = "dhcp";
@@ -73,9 +79,9 @@ typedef struct {
  * \brief Plugin's configuration structure
  */
 struct plugin_conf {
-	char mac[18];		/**< MAC field from DB */
-	sqlite3 *db;		/**< DB config */
+	struct dhcp_map *map;	/**< In-memory copy of the dhcp table */
 	char *db_path;		/**< Path to database file */
+	int refresh;		/**< Interval of checking the database in seconds, 0 to disable */
 	void *ip_config;	/**< Intermediate process config */
 	dhcp_ip_mac_t ip_mac_pairs[IP_MAC_PAIRS_MAX]; /**< IP-MAC pairs */
 	uint8_t ip_mac_pairs_count; /**< IP-MAC pairs count*/
@@ -94,10 +100,8 @@ void dhcp_free_config(struct plugin_conf *conf)
 			free(conf->db_path);
 		}
 		
-		/* Close database */
-		if (conf->db) {
-			sqlite3_close(conf->db);
-		}
+		/* Stop refreshing, close database and free map */
+		dhcp_map_destroy(conf->map);
 		
 		free(conf);
 	}
@@ -135,6 +139,19 @@ int process_startup_xml(struct plugin_conf *conf, char *params)
 		/* Path to database file */
 		if (!xmlStrcasecmp(node->name, (const xmlChar *) "path")) {
 			conf->db_path = (char *) xmlNodeListGetString(doc, node->children, 1);
+		} else if (!xmlStrcasecmp(node->name, (const xmlChar *) "refresh")) {
+			/* Interval of checking the database for changes */
+			char *refresh = (char *) xmlNodeListGetString(doc, node->children, 1);
+			char *end = NULL;
+
+			conf->refresh = refresh ? strtol(refresh, &end, 10) : -1;
+			if (!refresh || *end != '\0' || conf->refresh < 0) {
+				MSG_ERROR(msg_module, "Invalid refresh interval '%s'!", refresh ? refresh : "");
+				xmlFree(refresh);
+				xmlFreeDoc(doc);
+				return 1;
+			}
+			xmlFree(refresh);
 		} else if (!xmlStrcasecmp(node->name, (const xmlChar *) "pair")) { /* IP-MAC pairs */
 
 			if (conf->ip_mac_pairs_count >= IP_MAC_PAIRS_MAX) {
@@ -203,20 +220,23 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 	}
 	
 	/* Process configuration */
+	conf->refresh = REFRESH_DEFAULT;
 	if (process_startup_xml(conf, params) != 0) {
 		dhcp_free_config(conf);
 		return 1;
 	}
 	
-	/* Open database */
-	if (sqlite3_open(conf->db_path, &(conf->db))) {
-		MSG_ERROR(msg_module, "Cannot open DHCP database: %s", sqlite3_errmsg(conf->db));
+	/* Open database and load the dhcp table */
+	conf->map = dhcp_map_create(conf->db_path);
+	if (!conf->map) {
 		dhcp_free_config(conf);
 		return 1;
 	}
 
-	/* Set a 10ms busy timeout */
-	sqlite3_busy_timeout(conf->db, 10);
+	if (conf->refresh > 0 && dhcp_map_start(conf->map, conf->refresh)) {
+		dhcp_free_config(conf);
+		return 1;
+	}
 	
 	/* Save configuration */
 	conf->ip_config = ip_config;
@@ -226,23 +246,6 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 	return 0;
 }
 
-/**
- * \brief Callback for each select
- * 
- * \param[in] data Plugin configuration
- * \param[in] argc
- * \param[in] argv DB fields
- * \param[in] azColName
- * \return 0 on success
- */
-static int dhcp_callback(void *data, int argc, char **argv, char **azColName){
-	struct plugin_conf *conf = (struct plugin_conf *) data;
-
-	strncpy(conf->mac, argv[0], 17);
-
-	return 0;
-}
-
 /**
  * \brief Replace existing MAC address with MAC from database
  * 
@@ -253,57 +256,29 @@ static int dhcp_callback(void *data, int argc, char **argv, char **azColName){
  */
 void dhcp_replace_mac(struct plugin_conf *conf, struct metadata *mdata, dhcp_ip_mac_t *ip_mac_pair)
 {
-	void *ip_data = NULL, *mac_data = NULL;
-	conf->mac[0] = '\0';
+	uint8_t *ip_data = NULL, *mac_data = NULL;
+	const uint8_t *mac;
+	int ip_length, mac_length;
 	
 	/* Get IP address */
-	ip_data = data_record_get_field(mdata->record.record, mdata->record.templ, ip_mac_pair->ip.en, ip_mac_pair->ip.id, NULL);
-	if (!ip_data) {
+	ip_data = data_record_get_field(mdata->record.record, mdata->record.templ, ip_mac_pair->ip.en, ip_mac_pair->ip.id, &ip_length);
+	if (!ip_data || ip_length != 4) {
 		return;
 	}
 
 	/* Get MAC address pointer */
-	mac_data = data_record_get_field(mdata->record.record, mdata->record.templ, ip_mac_pair->mac.en, ip_mac_pair->mac.id, NULL);
-	if (!mac_data) {
+	mac_data = data_record_get_field(mdata->record.record, mdata->record.templ, ip_mac_pair->mac.en, ip_mac_pair->mac.id, &mac_length);
+	if (!mac_data || mac_length != 6) {
 		return;
 	}
 
-	/** Get the MAC from database **/
-
-	char ipStr[INET_ADDRSTRLEN];
-	
-	/* Get IPv4 string */
-	inet_ntop(AF_INET, ip_data, ipStr, INET_ADDRSTRLEN);
-	
-	char sqlQuery[150];
-	snprintf(sqlQuery, 150, "SELECT mac FROM dhcp WHERE ip == '%s'", ipStr);
-
-	/* Execute query */
-	char *err = NULL;
-	int rc = sqlite3_exec(conf->db, sqlQuery, dhcp_callback, (void *) conf, &err);
-	
-	if (rc != SQLITE_OK) {
-		MSG_ERROR(msg_module, "SQL error: %s", err);
-		sqlite3_free(err);
-		return;
+	/* Fill the MAC from database back to the record, zeroes when not found */
+	mac = dhcp_map_lookup(conf->map, ip_data);
+	if (mac) {
+		memcpy(mac_data, mac, 6);
+	} else {
+		memset(mac_data, 0, 6);
 	}
-
-	/* Check that we got a result */
-	if (conf->mac[0] == '\0') {
-		/* Write zeroes */
-		uint64_t zero = 0;
-		memcpy(mac_data, &zero, 6);
-		return;
-	}
-
-	/* Convert MAC to number */
-	unsigned char mac[6];
-	sscanf(conf->mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
-
-	/* Fill the result back to the record */
-	memcpy(mac_data, mac, 6);
-
-	return;
 }
 
 /**
@@ -318,6 +293,8 @@ int intermediate_process_message(void* config, void* message)
 	struct plugin_conf *conf = (struct plugin_conf *) config;
 	struct ipfix_message *msg = (struct ipfix_message *) message;
 	struct metadata *mdata;
+
+	dhcp_map_enter(conf->map);
 	
 	/* Process each data record */
 	for (int i = 0; i < msg->data_records_count; ++i) {
@@ -328,6 +305,8 @@ int intermediate_process_message(void* config, void* message)
 			dhcp_replace_mac(conf, mdata, &conf->ip_mac_pairs[j]);
 		}
 	}
+
+	dhcp_map_leave(conf->map);
 	
 	/* Pass message to the next plugin/Output Manager */
 	pass_message(conf->ip_config, msg);
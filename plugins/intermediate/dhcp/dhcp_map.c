@@ -0,0 +1,449 @@
+/**
+ * \file dhcp_map.c
+ * \brief In-memory IPv4 to MAC map for the dhcp plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <ipfixcol.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "dhcp_map.h"
+
+/* Identifier for verbose macros */
+static const char *msg_module = "dhcp";
+
+/** Minimal number of hash table slots */
+#define DHCP_TABLE_MIN 1024
+
+/**
+ * \brief Hash table slot
+ */
+struct dhcp_entry {
+	uint32_t ip;            /**< IPv4 address in network byte order */
+	uint8_t mac[6];         /**< MAC address */
+	uint8_t used;           /**< Slot is used */
+};
+
+/**
+ * \brief Open addressing hash table
+ */
+struct dhcp_table {
+	uint32_t size;          /**< Number of slots (power of two) */
+	uint32_t count;         /**< Number of used slots */
+	struct dhcp_entry *entries;
+};
+
+struct dhcp_map {
+	char *path;                     /**< Path to database file */
+	sqlite3 *db;
+	int data_version;               /**< data_version of the loaded table */
+	struct stat st;                 /**< File status of the loaded table */
+
+	struct dhcp_table tables[2];    /**< Current and spare table */
+	struct dhcp_table *current;     /**< Table used for lookups */
+	uint32_t reader_gen;            /**< Odd while the reader is in critical section */
+
+	pthread_t thread;               /**< Refreshing thread */
+	int running;                    /**< Refreshing thread was started */
+	int interval;                   /**< Refresh interval in seconds */
+	int stop;                       /**< Stop refreshing thread */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/**
+ * \brief Hash of IPv4 address
+ */
+static inline uint32_t dhcp_hash(uint32_t ip)
+{
+	ip ^= ip >> 16;
+	ip *= 0x85EBCA6B;
+	ip ^= ip >> 13;
+	ip *= 0xC2B2AE35;
+	ip ^= ip >> 16;
+	return ip;
+}
+
+/**
+ * \brief Add address to table being built
+ *
+ * The table is doubled when it is half full.
+ *
+ * \return 0 on success
+ */
+static int dhcp_table_insert(struct dhcp_table *table, uint32_t ip, const uint8_t *mac)
+{
+	uint32_t slot, i;
+
+	if ((table->count + 1) * 2 > table->size) {
+		struct dhcp_table bigger;
+
+		bigger.size = table->size ? table->size * 2 : DHCP_TABLE_MIN;
+		bigger.count = 0;
+		bigger.entries = calloc(bigger.size, sizeof(struct dhcp_entry));
+		if (!bigger.entries) {
+			return 1;
+		}
+
+		for (i = 0; i < table->size; i++) {
+			if (table->entries[i].used) {
+				dhcp_table_insert(&bigger, table->entries[i].ip, table->entries[i].mac);
+			}
+		}
+
+		free(table->entries);
+		*table = bigger;
+	}
+
+	slot = dhcp_hash(ip) & (table->size - 1);
+	while (table->entries[slot].used && table->entries[slot].ip != ip) {
+		slot = (slot + 1) & (table->size - 1);
+	}
+
+	if (!table->entries[slot].used) {
+		table->entries[slot].used = 1;
+		table->entries[slot].ip = ip;
+		table->count++;
+	}
+
+	memcpy(table->entries[slot].mac, mac, 6);
+	return 0;
+}
+
+/**
+ * \brief Open database, reopen it when the file was replaced
+ *
+ * \return 0 on success
+ */
+static int dhcp_map_open(struct dhcp_map *map, struct stat *st)
+{
+	if (map->db && st->st_ino == map->st.st_ino && st->st_dev == map->st.st_dev) {
+		return 0;
+	}
+
+	if (map->db) {
+		sqlite3_close(map->db);
+		map->db = NULL;
+	}
+
+	if (sqlite3_open_v2(map->path, &map->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "Cannot open DHCP database: %s", sqlite3_errmsg(map->db));
+		sqlite3_close(map->db);
+		map->db = NULL;
+		return 1;
+	}
+
+	/* Set a 10ms busy timeout */
+	sqlite3_busy_timeout(map->db, 10);
+	map->data_version = -1;
+	return 0;
+}
+
+/**
+ * \brief Get data_version of the database
+ */
+static int dhcp_map_data_version(struct dhcp_map *map)
+{
+	sqlite3_stmt *stmt;
+	int version = -1;
+
+	if (sqlite3_prepare_v2(map->db, "PRAGMA data_version", -1, &stmt, NULL) != SQLITE_OK) {
+		return -1;
+	}
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+
+	sqlite3_finalize(stmt);
+	return version;
+}
+
+/**
+ * \brief Load the dhcp table into a table
+ *
+ * \return 0 on success
+ */
+static int dhcp_map_load(struct dhcp_map *map, struct dhcp_table *table)
+{
+	sqlite3_stmt *stmt;
+	unsigned char mac[6];
+	uint32_t ip;
+	int rc, ret = 0;
+
+	if (sqlite3_prepare_v2(map->db, "SELECT ip, mac FROM dhcp", -1, &stmt, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(map->db));
+		return 1;
+	}
+
+	if (table->entries) {
+		memset(table->entries, 0, table->size * sizeof(struct dhcp_entry));
+	}
+	table->count = 0;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *ip_str = (const char *) sqlite3_column_text(stmt, 0);
+		const char *mac_str = (const char *) sqlite3_column_text(stmt, 1);
+
+		if (!ip_str || inet_pton(AF_INET, ip_str, &ip) != 1) {
+			continue;
+		}
+
+		if (!mac_str || sscanf(mac_str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+				&mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 6) {
+			continue;
+		}
+
+		if (dhcp_table_insert(table, ip, mac)) {
+			MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+			ret = 1;
+			break;
+		}
+	}
+
+	if (ret == 0 && rc != SQLITE_DONE) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(map->db));
+		ret = 1;
+	}
+
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+/**
+ * \brief Wait until the reader does not use the spare table
+ */
+static void dhcp_map_synchronize(struct dhcp_map *map)
+{
+	uint32_t gen;
+
+	/* New table must be visible before the reader's state is checked */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	gen = __atomic_load_n(&map->reader_gen, __ATOMIC_SEQ_CST);
+	if (gen & 1) {
+		while (__atomic_load_n(&map->reader_gen, __ATOMIC_SEQ_CST) == gen) {
+			sched_yield();
+		}
+	}
+}
+
+/**
+ * \brief Reload the dhcp table if the database has changed
+ */
+int dhcp_map_refresh(struct dhcp_map *map)
+{
+	struct dhcp_table *spare;
+	struct stat st;
+	int version;
+
+	if (stat(map->path, &st) != 0) {
+		MSG_ERROR(msg_module, "Cannot access DHCP database '%s'", map->path);
+		return 1;
+	}
+
+	if (dhcp_map_open(map, &st)) {
+		return 1;
+	}
+
+	version = dhcp_map_data_version(map);
+	if (map->current && version == map->data_version && version != -1
+			&& st.st_mtime == map->st.st_mtime && st.st_size == map->st.st_size) {
+		/* Not changed */
+		return 0;
+	}
+
+	spare = (map->current == &map->tables[0]) ? &map->tables[1] : &map->tables[0];
+	if (dhcp_map_load(map, spare)) {
+		return 1;
+	}
+
+	__atomic_store_n(&map->current, spare, __ATOMIC_RELEASE);
+	dhcp_map_synchronize(map);
+
+	map->data_version = version;
+	map->st = st;
+
+	MSG_DEBUG(msg_module, "Loaded %u addresses from DHCP database", spare->count);
+	return 0;
+}
+
+/**
+ * \brief Open database and load the dhcp table
+ */
+struct dhcp_map *dhcp_map_create(const char *path)
+{
+	struct dhcp_map *map = calloc(1, sizeof(struct dhcp_map));
+	if (!map) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	map->path = strdup(path);
+	if (!map->path) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		free(map);
+		return NULL;
+	}
+
+	pthread_mutex_init(&map->mutex, NULL);
+	pthread_cond_init(&map->cond, NULL);
+
+	if (dhcp_map_refresh(map)) {
+		dhcp_map_destroy(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+/**
+ * \brief Refreshing thread
+ */
+static void *dhcp_map_thread(void *arg)
+{
+	struct dhcp_map *map = (struct dhcp_map *) arg;
+	struct timespec ts;
+
+	pthread_mutex_lock(&map->mutex);
+	while (!map->stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += map->interval;
+		pthread_cond_timedwait(&map->cond, &map->mutex, &ts);
+		if (map->stop) {
+			break;
+		}
+
+		pthread_mutex_unlock(&map->mutex);
+		dhcp_map_refresh(map);
+		pthread_mutex_lock(&map->mutex);
+	}
+	pthread_mutex_unlock(&map->mutex);
+
+	return NULL;
+}
+
+/**
+ * \brief Start thread refreshing the map periodically
+ */
+int dhcp_map_start(struct dhcp_map *map, int interval)
+{
+	map->interval = interval;
+	if (pthread_create(&map->thread, NULL, dhcp_map_thread, map) != 0) {
+		MSG_ERROR(msg_module, "Unable to create refreshing thread");
+		return 1;
+	}
+
+	map->running = 1;
+	return 0;
+}
+
+/**
+ * \brief Stop refreshing thread, close database and free the map
+ */
+void dhcp_map_destroy(struct dhcp_map *map)
+{
+	if (!map) {
+		return;
+	}
+
+	if (map->running) {
+		pthread_mutex_lock(&map->mutex);
+		map->stop = 1;
+		pthread_cond_signal(&map->cond);
+		pthread_mutex_unlock(&map->mutex);
+		pthread_join(map->thread, NULL);
+	}
+
+	if (map->db) {
+		sqlite3_close(map->db);
+	}
+
+	pthread_mutex_destroy(&map->mutex);
+	pthread_cond_destroy(&map->cond);
+	free(map->tables[0].entries);
+	free(map->tables[1].entries);
+	free(map->path);
+	free(map);
+}
+
+/**
+ * \brief Enter reader's critical section
+ */
+void dhcp_map_enter(struct dhcp_map *map)
+{
+	__atomic_add_fetch(&map->reader_gen, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Leave reader's critical section
+ */
+void dhcp_map_leave(struct dhcp_map *map)
+{
+	__atomic_add_fetch(&map->reader_gen, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Find MAC address of IPv4 address
+ */
+const uint8_t *dhcp_map_lookup(struct dhcp_map *map, const uint8_t *ip)
+{
+	struct dhcp_table *table = __atomic_load_n(&map->current, __ATOMIC_ACQUIRE);
+	struct dhcp_entry *entry;
+	uint32_t addr, slot;
+
+	if (!table->entries) {
+		return NULL;
+	}
+
+	memcpy(&addr, ip, 4);
+	slot = dhcp_hash(addr) & (table->size - 1);
+	while ((entry = &table->entries[slot])->used) {
+		if (entry->ip == addr) {
+			return entry->mac;
+		}
+		slot = (slot + 1) & (table->size - 1);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,113 @@
+/**
+ * \file dhcp_map.h
+ * \brief In-memory IPv4 to MAC map for the dhcp plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef DHCP_MAP_H_
+#define DHCP_MAP_H_
+
+#include <stdint.h>
+
+/**
+ * \brief Copy of the dhcp table
+ *
+ * Two hash tables are kept: the one used for lookups and a spare one. When
+ * the database changes (its data_version or the file's modification time
+ * or inode), the refreshing thread rebuilds the spare table, swaps the
+ * tables and waits until the reader leaves its critical section before the
+ * old one may be rebuilt. Lookups do not take any locks, only one thread
+ * may read the map.
+ */
+struct dhcp_map;
+
+/**
+ * \brief Open database and load the dhcp table
+ *
+ * \param[in] path Path to database file
+ * \return Map or NULL on error
+ */
+struct dhcp_map *dhcp_map_create(const char *path);
+
+/**
+ * \brief Reload the dhcp table if the database has changed
+ *
+ * \param[in] map Map
+ * \return 0 on success
+ */
+int dhcp_map_refresh(struct dhcp_map *map);
+
+/**
+ * \brief Start thread refreshing the map periodically
+ *
+ * \param[in] map Map
+ * \param[in] interval Interval of checking the database in seconds
+ * \return 0 on success
+ */
+int dhcp_map_start(struct dhcp_map *map, int interval);
+
+/**
+ * \brief Stop refreshing thread, close database and free the map
+ *
+ * \param[in] map Map
+ */
+void dhcp_map_destroy(struct dhcp_map *map);
+
+/**
+ * \brief Enter reader's critical section
+ *
+ * MAC addresses returned by dhcp_map_lookup() are valid until dhcp_map_leave().
+ *
+ * \param[in] map Map
+ */
+void dhcp_map_enter(struct dhcp_map *map);
+
+/**
+ * \brief Leave reader's critical section
+ *
+ * \param[in] map Map
+ */
+void dhcp_map_leave(struct dhcp_map *map);
+
+/**
+ * \brief Find MAC address of IPv4 address
+ *
+ * \param[in] map Map
+ * \param[in] ip IPv4 address in network byte order
+ * \return 6 bytes of MAC address or NULL
+ */
+const uint8_t *dhcp_map_lookup(struct dhcp_map *map, const uint8_t *ip);
+
+#endif /* DHCP_MAP_H_ */
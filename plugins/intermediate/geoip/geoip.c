@@ -42,12 +42,17 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
 #include <GeoIP.h>
 #include <geoip.h>
 #include "countrycode.h"
-
-#define IPv4 4
-#define IPv6 6
+#include "lpm.h"
 
 #define FIELD_IPV4_SRC 8
 #define FIELD_IPV4_DST 12
@@ -55,12 +60,31 @@
 #define FIELD_IPV6_SRC 27
 #define FIELD_IPV6_DST 28
 
+/** Number of records looked up together */
+#define GEOIP_BATCH 16
+
+/** Default interval of checking the databases for changes in seconds */
+#define REFRESH_DEFAULT 60
+
+/** Number of GeoIP country IDs */
+#define GEOIP_COUNTRIES (sizeof(iso3166_GeoIP_country_codes) / sizeof(iso3166_GeoIP_country_codes[0]))
+
 /* API version constant */
 IPFIXCOL_API_VERSION;
+IPFIXCOL_MESSAGE_VIEWS;
 
 /* Identifier for verbose macros */
 static const char *msg_module = "geoip";
 
+/**
+ * \brief Address fields of a template
+ */
+struct geoip_fields {
+	struct ipfix_template *templ;   /**< Template */
+	uint32_t serial;                /**< Serial number of the template index */
+	int src4, dst4, src6, dst6;     /**< Field indexes, -1 when missing */
+};
+
 /**
  * \brief Plugin's configuration structure
  */
@@ -68,8 +92,19 @@ struct geoip_conf {
 	void *ip_config;	/**< intermediate process config */
 	char *path;			/**< path to database file */
 	char *path6;		/**< path to IPv6 database file */
-	GeoIP *country_db;	/**< MaxMind GeoIP DB */
-	GeoIP *country_db6;	/**< IPv6 version */
+	struct stat st;		/**< status of database file */
+	struct stat st6;	/**< status of IPv6 database file */
+	int refresh;		/**< interval of checking the databases in seconds, 0 to disable */
+
+	struct lpm *lpm;	/**< compiled databases used for lookups */
+	uint32_t reader_gen;	/**< odd while a message is processed */
+	struct geoip_fields fields; /**< fields of the last template */
+
+	pthread_t thread;	/**< refreshing thread */
+	int running;		/**< refreshing thread was started */
+	int stop;			/**< stop refreshing thread */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 };
 
 /**
@@ -80,14 +115,20 @@ struct geoip_conf {
 void geoip_free_config(struct geoip_conf *conf)
 {
 	if (conf) {
-		/* Close databases */
-		if (conf->country_db) {
-			GeoIP_delete(conf->country_db);
-		}
-		
-		if (conf->country_db6) {
-			GeoIP_delete(conf->country_db6);
+		/* Stop refreshing thread */
+		if (conf->running) {
+			pthread_mutex_lock(&conf->mutex);
+			conf->stop = 1;
+			pthread_cond_signal(&conf->cond);
+			pthread_mutex_unlock(&conf->mutex);
+			pthread_join(conf->thread, NULL);
 		}
+
+		pthread_mutex_destroy(&conf->mutex);
+		pthread_cond_destroy(&conf->cond);
+
+		/* Free compiled databases */
+		lpm_free(conf->lpm);
 		
 		/* Free paths */
 		if (conf->path) {
@@ -137,6 +178,19 @@ int process_startup_xml(struct geoip_conf *conf, char *params)
 			conf->path = (char *) xmlNodeListGetString(doc, node->children, 1);
 		} else if (!xmlStrcmp(node->name, (const xmlChar *) "path6")) {
 			conf->path6 = (char *) xmlNodeListGetString(doc, node->children, 1);
+		} else if (!xmlStrcmp(node->name, (const xmlChar *) "refresh")) {
+			/* Interval of checking the databases for changes */
+			char *refresh = (char *) xmlNodeListGetString(doc, node->children, 1);
+			char *end = NULL;
+
+			conf->refresh = refresh ? strtol(refresh, &end, 10) : -1;
+			if (!refresh || *end != '\0' || conf->refresh < 0) {
+				MSG_ERROR(msg_module, "Invalid refresh interval '%s'", refresh ? refresh : "");
+				xmlFree(refresh);
+				xmlFreeDoc(doc);
+				return 1;
+			}
+			xmlFree(refresh);
 		} else {
 			MSG_WARNING(msg_module, "Unknown element %s", (char *) node->name);
 		}
@@ -146,6 +200,235 @@ int process_startup_xml(struct geoip_conf *conf, char *params)
 	return 0;
 }
 
+/**
+ * \brief Add all IPv4 networks of GeoIP database to tables
+ *
+ * The tree of the database is walked network by network, the length of each
+ * one is returned by GeoIP_last_netmask().
+ *
+ * \param[in] lpm Tables
+ * \param[in] db GeoIP database
+ * \return 0 on success
+ */
+static int geoip_compile4(struct lpm *lpm, GeoIP *db)
+{
+	uint64_t ip = 0;
+	int id, netmask;
+
+	while (ip <= 0xFFFFFFFFULL) {
+		id = GeoIP_id_by_ipnum(db, (unsigned long) ip);
+		netmask = GeoIP_last_netmask(db);
+		if (netmask < 0 || netmask > 32) {
+			MSG_ERROR(msg_module, "Invalid network length %d in GeoIP database", netmask);
+			return 1;
+		}
+
+		if (id > 0 && (size_t) id < GEOIP_COUNTRIES && lpm_add4(lpm, (uint32_t) ip, netmask, id)) {
+			MSG_ERROR(msg_module, "Unable to compile GeoIP database (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		ip += 1ULL << (32 - netmask);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Add all IPv6 networks of GeoIP database to tables
+ *
+ * \param[in] lpm Tables
+ * \param[in] db GeoIPv6 database
+ * \return 0 on success
+ */
+static int geoip_compile6(struct lpm *lpm, GeoIP *db)
+{
+	geoipv6_t ipnum;
+	uint8_t addr[16];
+	int id, netmask, byte;
+	uint8_t carry;
+
+	memset(addr, 0, sizeof(addr));
+
+	for (;;) {
+		memcpy(&ipnum, addr, sizeof(addr));
+		id = GeoIP_id_by_ipnum_v6(db, ipnum);
+		netmask = GeoIP_last_netmask(db);
+		if (netmask < 0 || netmask > 128) {
+			MSG_ERROR(msg_module, "Invalid network length %d in GeoIPv6 database", netmask);
+			return 1;
+		}
+
+		if (id > 0 && (size_t) id < GEOIP_COUNTRIES && lpm_add6(lpm, addr, netmask, id)) {
+			MSG_ERROR(msg_module, "Unable to compile GeoIPv6 database (%s:%d)", __FILE__, __LINE__);
+			return 1;
+		}
+
+		if (netmask == 0) {
+			return 0;
+		}
+
+		/* Move to the next network, stop on overflow */
+		byte = (netmask - 1) / 8;
+		carry = 1 << (7 - (netmask - 1) % 8);
+		for (; byte >= 0 && carry; byte--) {
+			addr[byte] += carry;
+			carry = (addr[byte] < carry) ? 1 : 0;
+		}
+
+		if (carry) {
+			return 0;
+		}
+	}
+}
+
+/**
+ * \brief Open GeoIP databases and compile them into lookup tables
+ *
+ * \param[in] conf plugin's configuration
+ * \param[out] st Status of IPv4 database file
+ * \param[out] st6 Status of IPv6 database file
+ * \return Tables or NULL on error
+ */
+static struct lpm *geoip_compile(struct geoip_conf *conf, struct stat *st, struct stat *st6)
+{
+	const char *path = conf->path, *path6 = conf->path6 ? conf->path6 : GEOIPV6_DAT;
+	GeoIP *db, *db6;
+	struct lpm *lpm;
+
+	/* Initialize IPv4 GeoIP database */
+	if (path) {
+		db = GeoIP_open(path, GEOIP_MEMORY_CACHE);
+	} else {
+		db = GeoIP_new(GEOIP_MEMORY_CACHE);
+		path = GeoIPDBFileName[GEOIP_COUNTRY_EDITION];
+	}
+	
+	if (!db) {
+		MSG_ERROR(msg_module, "Error while opening GeoIP database");
+		return NULL;
+	}
+	
+	/* Initialize IPv6 GeoIP database */
+	db6 = GeoIP_open(path6, GEOIP_MEMORY_CACHE);
+	if (!db6) {
+		MSG_ERROR(msg_module, "Error while opening GeoIPv6 database");
+		GeoIP_delete(db);
+		return NULL;
+	}
+
+	memset(st, 0, sizeof(*st));
+	memset(st6, 0, sizeof(*st6));
+	if (path) {
+		stat(path, st);
+	}
+	stat(path6, st6);
+
+	lpm = lpm_create();
+	if (!lpm) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+	} else if (geoip_compile4(lpm, db) || geoip_compile6(lpm, db6)) {
+		lpm_free(lpm);
+		lpm = NULL;
+	} else {
+		MSG_DEBUG(msg_module, "Compiled GeoIP databases (%u IPv4 groups, %u IPv6 groups)",
+				lpm->tbl8_groups, lpm->nodes6_count);
+	}
+
+	GeoIP_delete(db);
+	GeoIP_delete(db6);
+	return lpm;
+}
+
+/**
+ * \brief Check whether database file has changed
+ */
+static int geoip_file_changed(const char *path, const struct stat *old)
+{
+	struct stat st;
+
+	if (!path || stat(path, &st) != 0) {
+		return 0;
+	}
+
+	return st.st_mtime != old->st_mtime || st.st_size != old->st_size
+			|| st.st_ino != old->st_ino || st.st_dev != old->st_dev;
+}
+
+/**
+ * \brief Recompile databases if they have changed
+ *
+ * New tables are swapped in atomically. The old ones are freed when the
+ * processing thread has left the message it was working on, so the
+ * pipeline is never stopped.
+ *
+ * \param[in] conf plugin's configuration
+ */
+static void geoip_refresh(struct geoip_conf *conf)
+{
+	const char *path = conf->path ? conf->path : GeoIPDBFileName[GEOIP_COUNTRY_EDITION];
+	const char *path6 = conf->path6 ? conf->path6 : GEOIPV6_DAT;
+	struct stat st, st6;
+	struct lpm *lpm, *old;
+	uint32_t gen;
+
+	if (!geoip_file_changed(path, &conf->st) && !geoip_file_changed(path6, &conf->st6)) {
+		return;
+	}
+
+	lpm = geoip_compile(conf, &st, &st6);
+	if (!lpm) {
+		MSG_WARNING(msg_module, "Keeping previous GeoIP databases");
+		/* Do not try again until the files change again */
+		stat(path, &conf->st);
+		stat(path6, &conf->st6);
+		return;
+	}
+
+	old = conf->lpm;
+	__atomic_store_n(&conf->lpm, lpm, __ATOMIC_RELEASE);
+	conf->st = st;
+	conf->st6 = st6;
+
+	/* Wait until the processing thread leaves the current message */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	gen = __atomic_load_n(&conf->reader_gen, __ATOMIC_SEQ_CST);
+	if (gen & 1) {
+		while (__atomic_load_n(&conf->reader_gen, __ATOMIC_SEQ_CST) == gen) {
+			sched_yield();
+		}
+	}
+
+	lpm_free(old);
+	MSG_INFO(msg_module, "GeoIP databases reloaded");
+}
+
+/**
+ * \brief Thread checking the databases for changes
+ */
+static void *geoip_refresh_thread(void *arg)
+{
+	struct geoip_conf *conf = (struct geoip_conf *) arg;
+	struct timespec ts;
+
+	pthread_mutex_lock(&conf->mutex);
+	while (!conf->stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += conf->refresh;
+		pthread_cond_timedwait(&conf->cond, &conf->mutex, &ts);
+		if (conf->stop) {
+			break;
+		}
+
+		pthread_mutex_unlock(&conf->mutex);
+		geoip_refresh(conf);
+		pthread_mutex_lock(&conf->mutex);
+	}
+	pthread_mutex_unlock(&conf->mutex);
+
+	return NULL;
+}
+
 /**
  * \brief Plugin initialization
  * 
@@ -172,38 +455,32 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
 		return 1;
 	}
+
+	pthread_mutex_init(&conf->mutex, NULL);
+	pthread_cond_init(&conf->cond, NULL);
 	
 	/* Process configuration */
+	conf->refresh = REFRESH_DEFAULT;
 	if (process_startup_xml(conf, params) != 0) {
 		geoip_free_config(conf);
 		return 1;
 	}
 	
-	/* Initialize IPv4 GeoIP database */
-	if (conf->path) {
-		conf->country_db = GeoIP_open(conf->path, GEOIP_MEMORY_CACHE);
-	} else {
-		conf->country_db = GeoIP_new(GEOIP_MEMORY_CACHE);
-	}
-	
-	if (!conf->country_db) {
-		MSG_ERROR(msg_module, "Error while opening GeoIP database");
+	/* Compile GeoIP databases */
+	conf->lpm = geoip_compile(conf, &conf->st, &conf->st6);
+	if (!conf->lpm) {
 		geoip_free_config(conf);
 		return 1;
 	}
-	
-	/* Initialize IPv6 GeoIP database */
-	if (conf->path6) {
-		conf->country_db6 = GeoIP_open(conf->path6, GEOIP_MEMORY_CACHE);
-	} else {
-		conf->country_db6 = GeoIP_open(GEOIPV6_DAT, GEOIP_MEMORY_CACHE);
-//		conf->country_db6 = GeoIP_open_type(GEOIP_COUNTRY_EDITION_V6, GEOIP_MEMORY_CACHE);
-	}
-	
-	if (!conf->country_db6) {
-		MSG_ERROR(msg_module, "Error while opening GeoIPv6 database");
-		geoip_free_config(conf);
-		return 1;
+
+	/* Start checking the databases for changes */
+	if (conf->refresh > 0) {
+		if (pthread_create(&conf->thread, NULL, geoip_refresh_thread, conf) != 0) {
+			MSG_ERROR(msg_module, "Unable to create refreshing thread");
+			geoip_free_config(conf);
+			return 1;
+		}
+		conf->running = 1;
 	}
 	
 	/* Save configuration */
@@ -215,55 +492,105 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 }
 
 /**
- * \brief Get country code for given data record and given address (source or destination)
- * 
+ * \brief Get address fields of a template
+ *
+ * Field indexes of the last template are kept, records of a message usually
+ * share few templates.
+ *
  * \param[in] conf plugin's configuration
- * \param[in] mdata data record's metadata
- * \param[in] ipv4_field IPv4 field
+ * \param[in] templ template
+ * \return Field indexes
+ */
+static inline struct geoip_fields *geoip_get_fields(struct geoip_conf *conf, struct ipfix_template *templ)
+{
+	struct geoip_fields *fields = &conf->fields;
+	uint32_t serial = templ->index ? templ->index->serial : 0;
+
+	if (fields->templ != templ || fields->serial != serial || serial == 0) {
+		fields->templ = templ;
+		fields->serial = serial;
+		fields->src4 = template_get_field_index(templ, 0, FIELD_IPV4_SRC);
+		fields->dst4 = template_get_field_index(templ, 0, FIELD_IPV4_DST);
+		fields->src6 = template_get_field_index(templ, 0, FIELD_IPV6_SRC);
+		fields->dst6 = template_get_field_index(templ, 0, FIELD_IPV6_DST);
+	}
+
+	return fields;
+}
+
+/**
+ * \brief Get address from data record
+ *
+ * \param[in] record data record
+ * \param[in] templ data record's template
+ * \param[in] ipv4_field IPv4 field index
  * \param[in] ipv6_field IPv6 alternative
- * \return country code
+ * \param[out] length address length (4 or 16), 0 when there is no address
+ * \return address
  */
-uint16_t geoip_get_country_code(struct geoip_conf *conf, struct metadata *mdata, int ipv4_field, int ipv6_field)
+static inline uint8_t *geoip_get_address(uint8_t *record, struct ipfix_template *templ, int ipv4_field, int ipv6_field, int *length)
 {
-	void *data;
-	
-	/* Get address */
-	int ipv = IPv4;
-	data = data_record_get_field(mdata->record.record, mdata->record.templ, 0, ipv4_field, NULL);
-	if (!data) {
-		data = data_record_get_field(mdata->record.record, mdata->record.templ, 0, ipv6_field, NULL);
-		ipv = IPv6;
+	uint8_t *data = NULL;
+
+	if (ipv4_field >= 0) {
+		data = data_record_get_field_at(record, templ, ipv4_field, length);
 	}
-	
-	if (!data) {
-		return 0;
+
+	if (!data && ipv6_field >= 0) {
+		data = data_record_get_field_at(record, templ, ipv6_field, length);
 	}
-	
-	/* Country ID */
-	uint16_t id = 0;
-	
-	/* Get country ID */
-	if (ipv == IPv4) {
-		id = GeoIP_id_by_ipnum(conf->country_db, *((uint32_t *) data));
-	} else {
-		/* IPv6 address */
-		uint32_t *addr = (uint32_t *) data;
-		
-		geoipv6_t ipnum;
-		ipnum.s6_addr32[0] = htonl(addr[3]);
-		ipnum.s6_addr32[1] = htonl(addr[2]);
-		ipnum.s6_addr32[2] = htonl(addr[1]);
-		ipnum.s6_addr32[3] = htonl(addr[0]);
-		
-		id = GeoIP_id_by_ipnum_v6(conf->country_db6, ipnum);
+
+	if (!data || (*length != 4 && *length != 16)) {
+		*length = 0;
 	}
-	
-	/* Return numeric code */
-	return iso3166_GeoIP_country_codes[id].num_code;
+
+	return data;
+}
+
+/**
+ * \brief Prefetch the first table entry of an address
+ */
+static inline void geoip_prefetch(const struct lpm *lpm, const uint8_t *addr, int length)
+{
+	uint32_t ip;
+
+	if (length == 4) {
+		memcpy(&ip, addr, 4);
+		lpm_prefetch4(lpm, ntohl(ip));
+	} else if (length == 16) {
+		lpm_prefetch6(lpm, addr);
+	}
+}
+
+/**
+ * \brief Get country code of an address
+ *
+ * \param[in] lpm compiled databases
+ * \param[in] addr address
+ * \param[in] length address length, 0 when there is no address
+ * \return numeric country code
+ */
+static inline uint16_t geoip_country_code(const struct lpm *lpm, const uint8_t *addr, int length)
+{
+	uint32_t ip;
+
+	if (length == 4) {
+		memcpy(&ip, addr, 4);
+		return iso3166_GeoIP_country_codes[lpm_lookup4(lpm, ntohl(ip))].num_code;
+	}
+
+	if (length == 16) {
+		return iso3166_GeoIP_country_codes[lpm_lookup6(lpm, addr)].num_code;
+	}
+
+	return 0;
 }
 
 /**
  * \brief Process IPFIX message
+ *
+ * Records are processed in batches: addresses of all records in a batch
+ * are found and their table entries prefetched first, then looked up.
  * 
  * \param[in] config plugin configuration
  * \param[in] message IPFIX message
@@ -273,17 +600,44 @@ int intermediate_process_message(void* config, void* message)
 {
 	struct geoip_conf *conf = (struct geoip_conf *) config;
 	struct ipfix_message *msg = (struct ipfix_message *) message;
-	
 	struct metadata *mdata;
+	struct geoip_fields *fields;
+	const struct lpm *lpm;
+	uint8_t *src[GEOIP_BATCH], *dst[GEOIP_BATCH];
+	int src_len[GEOIP_BATCH], dst_len[GEOIP_BATCH];
+	int start, count, i;
+
+	/* Enter critical section, tables are not freed while in it */
+	__atomic_add_fetch(&conf->reader_gen, 1, __ATOMIC_SEQ_CST);
+	lpm = __atomic_load_n(&conf->lpm, __ATOMIC_ACQUIRE);
 	
-	/* Process each data record */
-	for (int i = 0; i < msg->data_records_count; ++i) {
-		mdata = &(msg->metadata[i]);
-		
+	/* Process data records in batches */
+	for (start = 0; start < msg->data_records_count; start += GEOIP_BATCH) {
+		count = msg->data_records_count - start;
+		if (count > GEOIP_BATCH) {
+			count = GEOIP_BATCH;
+		}
+
+		for (i = 0; i < count; i++) {
+			mdata = &(msg->metadata[start + i]);
+			fields = geoip_get_fields(conf, mdata->record.templ);
+
+			src[i] = geoip_get_address(mdata->record.record, mdata->record.templ, fields->src4, fields->src6, &src_len[i]);
+			dst[i] = geoip_get_address(mdata->record.record, mdata->record.templ, fields->dst4, fields->dst6, &dst_len[i]);
+			geoip_prefetch(lpm, src[i], src_len[i]);
+			geoip_prefetch(lpm, dst[i], dst_len[i]);
+		}
+
 		/* Fill country codes */
-		mdata->srcCountry = geoip_get_country_code(conf, mdata, FIELD_IPV4_SRC, FIELD_IPV6_SRC);
-		mdata->dstCountry = geoip_get_country_code(conf, mdata, FIELD_IPV4_DST, FIELD_IPV6_DST);
+		for (i = 0; i < count; i++) {
+			mdata = &(msg->metadata[start + i]);
+			mdata->srcCountry = geoip_country_code(lpm, src[i], src_len[i]);
+			mdata->dstCountry = geoip_country_code(lpm, dst[i], dst_len[i]);
+		}
 	}
+
+	/* Leave critical section */
+	__atomic_add_fetch(&conf->reader_gen, 1, __ATOMIC_RELEASE);
 	
 	/* Pass message to the next plugin/Output Manager */
 	pass_message(conf->ip_config, msg);
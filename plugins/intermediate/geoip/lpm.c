@@ -0,0 +1,258 @@
+/**
+ * \file lpm.c
+ * \brief Longest prefix match tables of the geoip plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lpm.h"
+
+/** Number of IPv4 /24 prefixes */
+#define LPM_TBL24_SIZE (1 << 24)
+
+/** Number of IPv6 root entries */
+#define LPM_ROOT6_SIZE (1 << 16)
+
+/** Maximal number of groups addressable by 16 bit IPv4 entries */
+#define LPM_TBL8_MAX (65536 - LPM_EXT)
+
+/**
+ * \brief Create empty tables, all addresses have value 0
+ */
+struct lpm *lpm_create(void)
+{
+	struct lpm *lpm = calloc(1, sizeof(struct lpm));
+	if (!lpm) {
+		return NULL;
+	}
+
+	lpm->tbl24 = calloc(LPM_TBL24_SIZE, sizeof(uint16_t));
+	lpm->root6 = calloc(LPM_ROOT6_SIZE, sizeof(uint32_t));
+	if (!lpm->tbl24 || !lpm->root6) {
+		lpm_free(lpm);
+		return NULL;
+	}
+
+	return lpm;
+}
+
+/**
+ * \brief Free tables
+ */
+void lpm_free(struct lpm *lpm)
+{
+	if (!lpm) {
+		return;
+	}
+
+	free(lpm->tbl24);
+	free(lpm->tbl8);
+	free(lpm->root6);
+	free(lpm->nodes6);
+	free(lpm);
+}
+
+/**
+ * \brief Get IPv4 group for /24 prefix, create it when missing
+ *
+ * \return Group or NULL when out of memory
+ */
+static uint8_t *lpm_group4(struct lpm *lpm, uint32_t index)
+{
+	uint16_t entry = lpm->tbl24[index];
+
+	if (entry >= LPM_EXT) {
+		return lpm->tbl8 + ((uint32_t) (entry - LPM_EXT) << 8);
+	}
+
+	if (lpm->tbl8_groups == lpm->tbl8_size) {
+		uint32_t size = lpm->tbl8_size ? lpm->tbl8_size * 2 : 256;
+		uint8_t *tbl8;
+
+		if (lpm->tbl8_size == LPM_TBL8_MAX) {
+			return NULL;
+		}
+
+		if (size > LPM_TBL8_MAX) {
+			size = LPM_TBL8_MAX;
+		}
+
+		tbl8 = realloc(lpm->tbl8, (size_t) size << 8);
+		if (!tbl8) {
+			return NULL;
+		}
+
+		lpm->tbl8 = tbl8;
+		lpm->tbl8_size = size;
+	}
+
+	/* New group inherits value of the /24 prefix */
+	memset(lpm->tbl8 + ((size_t) lpm->tbl8_groups << 8), entry, 256);
+	lpm->tbl24[index] = lpm->tbl8_groups + LPM_EXT;
+
+	return lpm->tbl8 + ((size_t) lpm->tbl8_groups++ << 8);
+}
+
+/**
+ * \brief Set value of IPv4 prefix
+ */
+int lpm_add4(struct lpm *lpm, uint32_t ip, int length, uint8_t value)
+{
+	uint32_t first, count, i;
+	uint8_t *group;
+
+	if (length <= 24) {
+		first = length ? (ip >> 8) & ~((1U << (24 - length)) - 1) : 0;
+		count = 1U << (24 - length);
+
+		for (i = first; i < first + count; i++) {
+			if (lpm->tbl24[i] >= LPM_EXT) {
+				/* The prefix covers the whole group */
+				memset(lpm->tbl8 + ((uint32_t) (lpm->tbl24[i] - LPM_EXT) << 8), value, 256);
+			} else {
+				lpm->tbl24[i] = value;
+			}
+		}
+
+		return 0;
+	}
+
+	group = lpm_group4(lpm, ip >> 8);
+	if (!group) {
+		return 1;
+	}
+
+	first = ip & 0xFF & ~((1U << (32 - length)) - 1);
+	memset(group + first, value, 1U << (32 - length));
+	return 0;
+}
+
+/**
+ * \brief Create IPv6 group inheriting value of an entry
+ *
+ * \return Group number + LPM_EXT or 0 when out of memory
+ */
+static uint32_t lpm_node6(struct lpm *lpm, uint32_t value)
+{
+	uint32_t i, *node;
+
+	if (lpm->nodes6_count == lpm->nodes6_size) {
+		uint32_t size = lpm->nodes6_size ? lpm->nodes6_size * 2 : 256;
+		uint32_t *nodes = realloc(lpm->nodes6, ((size_t) size << 8) * sizeof(uint32_t));
+		if (!nodes) {
+			return 0;
+		}
+
+		lpm->nodes6 = nodes;
+		lpm->nodes6_size = size;
+	}
+
+	node = lpm->nodes6 + ((size_t) lpm->nodes6_count << 8);
+	for (i = 0; i < 256; i++) {
+		node[i] = value;
+	}
+
+	return lpm->nodes6_count++ + LPM_EXT;
+}
+
+/**
+ * \brief Set value of all entries in IPv6 subtree
+ */
+static void lpm_fill6(struct lpm *lpm, uint32_t *entry, uint8_t value)
+{
+	uint32_t i, *node;
+
+	if (*entry < LPM_EXT) {
+		*entry = value;
+		return;
+	}
+
+	node = lpm->nodes6 + ((size_t) (*entry - LPM_EXT) << 8);
+	for (i = 0; i < 256; i++) {
+		lpm_fill6(lpm, &node[i], value);
+	}
+}
+
+/**
+ * \brief Get entry of IPv6 group (0 for root)
+ */
+static inline uint32_t *lpm_entry6(struct lpm *lpm, uint32_t node, uint32_t index)
+{
+	if (node == 0) {
+		return &lpm->root6[index];
+	}
+
+	return &lpm->nodes6[((size_t) (node - LPM_EXT) << 8) | index];
+}
+
+/**
+ * \brief Set value of IPv6 prefix
+ */
+int lpm_add6(struct lpm *lpm, const uint8_t *addr, int length, uint8_t value)
+{
+	uint32_t *entry, node = 0, child, first, count, i;
+	uint32_t index = (addr[0] << 8) | addr[1];
+	int level_end = 16, byte = 2;
+
+	/* Descend to the level where the prefix ends */
+	while (length > level_end) {
+		entry = lpm_entry6(lpm, node, index);
+		if (*entry < LPM_EXT) {
+			child = lpm_node6(lpm, *entry);
+			if (!child) {
+				return 1;
+			}
+
+			/* Groups may have been reallocated */
+			entry = lpm_entry6(lpm, node, index);
+			*entry = child;
+		}
+
+		node = *entry;
+		index = addr[byte++];
+		level_end += 8;
+	}
+
+	/* Expand the prefix within the level */
+	count = 1U << (level_end - length);
+	first = index & ~(count - 1);
+	for (i = first; i < first + count; i++) {
+		lpm_fill6(lpm, lpm_entry6(lpm, node, i), value);
+	}
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+/**
+ * \file lpm.h
+ * \brief Longest prefix match tables of the geoip plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef LPM_H_
+#define LPM_H_
+
+#include <stdint.h>
+
+/** Table entries not smaller than this refer to a next level group */
+#define LPM_EXT 256
+
+/**
+ * \brief Compiled country database
+ *
+ * IPv4 uses DIR-24-8: the first table is indexed by the upper 24 bits of
+ * the address, prefixes longer than /24 are expanded into groups of 256
+ * entries indexed by the last byte. IPv6 uses a multibit trie with the root
+ * indexed by the first 16 bits and 8 bits in each following level.
+ *
+ * Entries smaller than LPM_EXT are values (GeoIP country IDs), the others
+ * are group numbers + LPM_EXT. The tables are not modified after they are
+ * built.
+ */
+struct lpm {
+	uint16_t *tbl24;        /**< 2^24 IPv4 entries */
+	uint8_t *tbl8;          /**< IPv4 groups of 256 values */
+	uint32_t tbl8_groups;   /**< Number of used IPv4 groups */
+	uint32_t tbl8_size;     /**< Number of allocated IPv4 groups */
+
+	uint32_t *root6;        /**< 2^16 IPv6 entries */
+	uint32_t *nodes6;       /**< IPv6 groups of 256 entries */
+	uint32_t nodes6_count;  /**< Number of used IPv6 groups */
+	uint32_t nodes6_size;   /**< Number of allocated IPv6 groups */
+};
+
+/**
+ * \brief Create empty tables, all addresses have value 0
+ *
+ * \return Tables or NULL when out of memory
+ */
+struct lpm *lpm_create(void);
+
+/**
+ * \brief Free tables
+ *
+ * \param[in] lpm Tables
+ */
+void lpm_free(struct lpm *lpm);
+
+/**
+ * \brief Set value of IPv4 prefix
+ *
+ * Prefixes must be added from the shortest ones, a longer prefix overrides
+ * the part of a shorter one it covers.
+ *
+ * \param[in] lpm Tables
+ * \param[in] ip Prefix in host byte order
+ * \param[in] length Prefix length
+ * \param[in] value Value smaller than LPM_EXT
+ * \return 0 on success, 1 when out of memory
+ */
+int lpm_add4(struct lpm *lpm, uint32_t ip, int length, uint8_t value);
+
+/**
+ * \brief Set value of IPv6 prefix
+ *
+ * Same rules as for lpm_add4().
+ *
+ * \param[in] lpm Tables
+ * \param[in] addr Prefix in network byte order (16 bytes)
+ * \param[in] length Prefix length
+ * \param[in] value Value smaller than LPM_EXT
+ * \return 0 on success, 1 when out of memory
+ */
+int lpm_add6(struct lpm *lpm, const uint8_t *addr, int length, uint8_t value);
+
+/**
+ * \brief Prefetch the first level entry of IPv4 address
+ */
+static inline void lpm_prefetch4(const struct lpm *lpm, uint32_t ip)
+{
+	__builtin_prefetch(&lpm->tbl24[ip >> 8]);
+}
+
+/**
+ * \brief Prefetch the first level entry of IPv6 address
+ */
+static inline void lpm_prefetch6(const struct lpm *lpm, const uint8_t *addr)
+{
+	__builtin_prefetch(&lpm->root6[(addr[0] << 8) | addr[1]]);
+}
+
+/**
+ * \brief Look up IPv4 address
+ *
+ * \param[in] lpm Tables
+ * \param[in] ip Address in host byte order
+ * \return Value of the longest matching prefix
+ */
+static inline uint8_t lpm_lookup4(const struct lpm *lpm, uint32_t ip)
+{
+	uint16_t entry = lpm->tbl24[ip >> 8];
+
+	if (entry < LPM_EXT) {
+		return entry;
+	}
+
+	return lpm->tbl8[((uint32_t) (entry - LPM_EXT) << 8) | (ip & 0xFF)];
+}
+
+/**
+ * \brief Look up IPv6 address
+ *
+ * \param[in] lpm Tables
+ * \param[in] addr Address in network byte order (16 bytes)
+ * \return Value of the longest matching prefix
+ */
+static inline uint8_t lpm_lookup6(const struct lpm *lpm, const uint8_t *addr)
+{
+	uint32_t entry = lpm->root6[(addr[0] << 8) | addr[1]];
+	int i = 2;
+
+	/* A trie has at most 15 levels, so i never exceeds 15 */
+	while (entry >= LPM_EXT) {
+		entry = lpm->nodes6[((entry - LPM_EXT) << 8) | addr[i++]];
+	}
+
+	return entry;
+}
+
+#endif /* LPM_H_ */
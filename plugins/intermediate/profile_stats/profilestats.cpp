@@ -55,6 +55,7 @@ extern "C" {
 
 // API version constant
 IPFIXCOL_API_VERSION
+IPFIXCOL_MESSAGE_VIEWS
 }
 
 #define PROFILE_PATH_FIX(var) \
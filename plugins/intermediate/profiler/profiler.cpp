@@ -43,6 +43,7 @@ extern "C" {
 
 /* API version constant */
 IPFIXCOL_API_VERSION;
+IPFIXCOL_MESSAGE_VIEWS;
 }
 
 #include <libxml/parser.h>
@@ -43,10 +43,10 @@
 #include <libxml2/libxml/tree.h>
 
 #include <sqlite3.h>
+#include <stdlib.h>
 #include <string.h>
 
-#define IPv4 4
-#define IPv6 6
+#include "uid_index.h"
 
 #define FIELD_IPV4_SRC 8
 #define FIELD_IPV4_DST 12
@@ -57,8 +57,12 @@
 #define FLOW_START_SECONDS 150
 #define FLOW_START_MILLISECONDS 152
 
+/** Default refresh interval of the index in seconds */
+#define REFRESH_DEFAULT 1
+
 /* API version constant */
 IPFIXCOL_API_VERSION;
+IPFIXCOL_MESSAGE_VIEWS;
 
 /* Identifier for verbose macros */
 static const char *msg_module = "uid";
@@ -67,9 +71,10 @@ static const char *msg_module = "uid";
  * \brief Plugin's configuration structure
  */
 struct plugin_conf {
-	char name[32];		/**< Name field from DB */
 	sqlite3 *db;		/**< DB config */
 	char *db_path;		/**< Path to database file */
+	int refresh;		/**< Refresh interval of the index in seconds, 0 to disable */
+	struct uid_index *index; /**< In-memory index of the logs table */
 	void *ip_config;	/**< intermediate process config */
 };
 
@@ -85,6 +90,9 @@ void uid_free_config(struct plugin_conf *conf)
 		if (conf->db_path) {
 			free(conf->db_path);
 		}
+
+		/* Stop refreshing and free index */
+		uid_index_destroy(conf->index);
 		
 		/* Close database */
 		if (conf->db) {
@@ -127,6 +135,19 @@ int process_startup_xml(struct plugin_conf *conf, char *params)
 		/* Path to database file */
 		if (!xmlStrcasecmp(node->name, (const xmlChar *) "path")) {
 			conf->db_path = (char *) xmlNodeListGetString(doc, node->children, 1);
+		} else if (!xmlStrcasecmp(node->name, (const xmlChar *) "refresh")) {
+			/* Refresh interval of the index */
+			char *refresh = (char *) xmlNodeListGetString(doc, node->children, 1);
+			char *end = NULL;
+
+			conf->refresh = refresh ? strtol(refresh, &end, 10) : -1;
+			if (!refresh || *end != '\0' || conf->refresh < 0) {
+				MSG_ERROR(msg_module, "Invalid refresh interval '%s'!", refresh ? refresh : "");
+				xmlFree(refresh);
+				xmlFreeDoc(doc);
+				return 1;
+			}
+			xmlFree(refresh);
 		}
 	}
 	
@@ -168,6 +189,7 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 	}
 	
 	/* Process configuration */
+	conf->refresh = REFRESH_DEFAULT;
 	if (process_startup_xml(conf, params) != 0) {
 		uid_free_config(conf);
 		return 1;
@@ -179,6 +201,19 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 		uid_free_config(conf);
 		return 1;
 	}
+
+	/* Load logs table */
+	conf->index = uid_index_create(conf->db);
+	if (!conf->index) {
+		MSG_ERROR(msg_module, "Cannot load UID database");
+		uid_free_config(conf);
+		return 1;
+	}
+
+	if (conf->refresh > 0 && uid_index_start(conf->index, conf->refresh)) {
+		uid_free_config(conf);
+		return 1;
+	}
 	
 	/* Save configuration */
 	conf->ip_config = ip_config;
@@ -188,54 +223,6 @@ int intermediate_init(char* params, void* ip_config, uint32_t ip_id, struct ipfi
 	return 0;
 }
 
-/**
- * \brief Callback for each select
- * 
- * \param[in] data Plugin configuration
- * \param[in] argc
- * \param[in] argv DB fields
- * \param[in] azColName
- * \return 0 on success
- */
-static int uid_callback(void *data, int argc, char **argv, char **azColName){
-	/*
-		item                argv[x]:
-		id = 1                  0
-		name = Paul             1
-		ip = 192.168.1.1        2
-		action = 1              3
-		time = 1415204353       4
-	*/
-
-	struct plugin_conf *conf = (struct plugin_conf *) data;
-
-	if (strcmp(argv[3], "1") == 0) {
-		strncpy(conf->name, argv[1], 31);
-	} else {
-		strncpy(conf->name, "", 31);
-	}
-
-	return 0;
-}
-
-/**
- * \brief Convert IPv6 address to expanded form
- * 
- * \param[out] str Expanded address
- * \param[in] addr ipv6 address
- */
-void convertToExpandedIPv6(char *str, const struct in6_addr *addr) {
-	sprintf(str, "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x",
-			(int)addr->s6_addr[0], (int)addr->s6_addr[1],
-			(int)addr->s6_addr[2], (int)addr->s6_addr[3],
-			(int)addr->s6_addr[4], (int)addr->s6_addr[5],
-			(int)addr->s6_addr[6], (int)addr->s6_addr[7],
-			(int)addr->s6_addr[8], (int)addr->s6_addr[9],
-			(int)addr->s6_addr[10], (int)addr->s6_addr[11],
-			(int)addr->s6_addr[12], (int)addr->s6_addr[13],
-			(int)addr->s6_addr[14], (int)addr->s6_addr[15]);
-}
-
 /**
  * \brief Get user informations for given data record and given address (source or destination)
  * 
@@ -244,49 +231,32 @@ void convertToExpandedIPv6(char *str, const struct in6_addr *addr) {
  * \param[in] ipv4_field IPv4 field
  * \param[in] ipv6_field IPv6 alternative
  * \param[in] flow_start Flow start time
- * \return country code
+ * \param[out] name User name, empty when no user is logged in
  */
-uint16_t uid_get_user_info(struct plugin_conf *conf, struct metadata *mdata, int ipv4_field, int ipv6_field, uint32_t flow_start)
+void uid_get_user_info(struct plugin_conf *conf, struct metadata *mdata, int ipv4_field, int ipv6_field, uint32_t flow_start, char *name)
 {
+	const char *user;
 	void *data = NULL;
-	conf->name[0] = '\0';
+	int length;
+
+	name[0] = '\0';
 	
 	/* Get address */
-	int ipv = IPv4;
-	data = data_record_get_field(mdata->record.record, mdata->record.templ, 0, ipv4_field, NULL);
+	data = data_record_get_field(mdata->record.record, mdata->record.templ, 0, ipv4_field, &length);
 	if (!data) {
-		data = data_record_get_field(mdata->record.record, mdata->record.templ, 0, ipv6_field, NULL);
-		ipv = IPv6;
+		data = data_record_get_field(mdata->record.record, mdata->record.templ, 0, ipv6_field, &length);
 	}
 	
 	if (!data) {
-		return 0;
+		return;
 	}
-	
-	char ipStr[INET6_ADDRSTRLEN];
-	
-	/* Get country ID */
-	if (ipv == IPv4) {
-		inet_ntop(AF_INET, data, ipStr, INET_ADDRSTRLEN);
-	} else {
-		convertToExpandedIPv6(ipStr, data);
-	}
-	
-	char sqlQuery[150];
-	snprintf(sqlQuery, 150, "SELECT * from logs WHERE ip == '%s' and time <= %u ORDER BY time DESC LIMIT 1", ipStr, flow_start);
 
-	/* Execute query */
-	char *err = NULL;
-	int rc = sqlite3_exec(conf->db, sqlQuery, uid_callback, (void *) conf, &err);
-	
-	if (rc != SQLITE_OK) {
-		MSG_ERROR(msg_module, "SQL error: %s", err);
-		sqlite3_free(err);
+	/* Find user in index */
+	user = uid_index_lookup(conf->index, data, length, flow_start);
+	if (user) {
+		strncpy(name, user, 31);
+		name[31] = '\0';
 	}
-	
-	conf->name[31] = '\0';
-	
-	return 0;
 }
 
 /**
@@ -326,20 +296,21 @@ int intermediate_process_message(void* config, void* message)
 	struct ipfix_message *msg = (struct ipfix_message *) message;
 	
 	struct metadata *mdata;
+
+	uid_index_enter(conf->index);
 	
 	/* Process each data record */
 	for (int i = 0; i < msg->data_records_count; ++i) {
 		mdata = &(msg->metadata[i]);
 
-		uint32_t flowStart = get_flow_start(&(msg->metadata->record));
+		uint32_t flowStart = get_flow_start(&(mdata->record));
 
 		/* Fill user names */
-		uid_get_user_info(conf, mdata, FIELD_IPV4_SRC, FIELD_IPV6_SRC, flowStart);
-		strncpy(mdata->srcName, conf->name, 31);
-		
-		uid_get_user_info(conf, mdata, FIELD_IPV4_DST, FIELD_IPV6_DST, flowStart);
-		strncpy(mdata->dstName, conf->name, 31);
+		uid_get_user_info(conf, mdata, FIELD_IPV4_SRC, FIELD_IPV6_SRC, flowStart, mdata->srcName);
+		uid_get_user_info(conf, mdata, FIELD_IPV4_DST, FIELD_IPV6_DST, flowStart, mdata->dstName);
 	}
+
+	uid_index_leave(conf->index);
 	
 	/* Pass message to the next plugin/Output Manager */
 	pass_message(conf->ip_config, msg);
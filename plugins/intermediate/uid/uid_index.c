@@ -0,0 +1,647 @@
+/**
+ * \file uid_index.c
+ * \brief In-memory index of user logins for the uid plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include <ipfixcol.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "uid_index.h"
+
+/* Identifier for verbose macros */
+static const char *msg_module = "uid";
+
+/** Initial number of hash table slots */
+#define UID_TABLE_INIT 1024
+
+#define UID_NAME_LENGTH 32
+
+/**
+ * \brief Login or logout
+ */
+struct uid_login {
+	int64_t time;                   /**< Unix timestamp */
+	sqlite3_int64 rowid;            /**< Row in the logs table */
+	int login;                      /**< 1 for login, 0 for logout */
+	char name[UID_NAME_LENGTH];     /**< User name */
+};
+
+/**
+ * \brief Logins and logouts at one address, sorted by time and rowid
+ */
+struct uid_history {
+	uint32_t count;
+	struct uid_login logins[];
+};
+
+/**
+ * \brief Hash table slot
+ *
+ * The address is written before the history is published, a slot without
+ * history is empty.
+ */
+struct uid_entry {
+	uint8_t addr[16];               /**< IPv6 or IPv4-mapped IPv6 address */
+	struct uid_history *history;
+};
+
+/**
+ * \brief Open addressing hash table
+ */
+struct uid_table {
+	uint32_t mask;                  /**< Number of slots - 1 */
+	uint32_t used;                  /**< Number of used slots */
+	struct uid_entry entries[];
+};
+
+/**
+ * \brief Row loaded from the logs table
+ */
+struct uid_row {
+	uint8_t addr[16];
+	struct uid_login login;
+};
+
+struct uid_index {
+	sqlite3 *db;
+	sqlite3_stmt *select;           /**< Rows newer than given rowid */
+	sqlite3_int64 last_rowid;       /**< Last loaded row */
+	struct uid_table *table;        /**< Current hash table */
+	uint32_t reader_gen;            /**< Odd while the reader is in critical section */
+
+	void **garbage;                 /**< Memory replaced by the last refresh */
+	size_t garbage_count;
+	size_t garbage_size;
+
+	pthread_t thread;               /**< Refreshing thread */
+	int running;                    /**< Refreshing thread was started */
+	int interval;                   /**< Refresh interval in seconds */
+	int stop;                       /**< Stop refreshing thread */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+/**
+ * \brief Hash of an address
+ */
+static inline uint32_t uid_hash(const uint8_t *addr)
+{
+	uint64_t a, b;
+
+	memcpy(&a, addr, 8);
+	memcpy(&b, addr + 8, 8);
+
+	a ^= b * 0x9E3779B97F4A7C15ULL;
+	a ^= a >> 33;
+	a *= 0xFF51AFD7ED558CCDULL;
+	a ^= a >> 33;
+	return (uint32_t) a;
+}
+
+/**
+ * \brief Convert address to the IPv6 form used as key
+ *
+ * \param[out] key 16 bytes long key
+ * \param[in] addr Address
+ * \param[in] length Address length (4 or 16)
+ */
+static inline void uid_key(uint8_t *key, const uint8_t *addr, int length)
+{
+	if (length == 4) {
+		memset(key, 0, 10);
+		key[10] = 0xff;
+		key[11] = 0xff;
+		memcpy(key + 12, addr, 4);
+	} else {
+		memcpy(key, addr, 16);
+	}
+}
+
+/**
+ * \brief Parse address from the logs table
+ *
+ * \param[out] key 16 bytes long key
+ * \param[in] str Address in text format
+ * \return 0 on success
+ */
+static int uid_parse_addr(uint8_t *key, const char *str)
+{
+	uint8_t addr[16];
+
+	if (inet_pton(AF_INET, str, addr) == 1) {
+		uid_key(key, addr, 4);
+		return 0;
+	}
+
+	if (inet_pton(AF_INET6, str, addr) == 1) {
+		uid_key(key, addr, 16);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * \brief Compare loaded rows by address, time and rowid
+ */
+static int uid_row_cmp(const void *a, const void *b)
+{
+	const struct uid_row *r1 = a, *r2 = b;
+	int ret = memcmp(r1->addr, r2->addr, 16);
+
+	if (ret) {
+		return ret;
+	}
+
+	if (r1->login.time != r2->login.time) {
+		return r1->login.time < r2->login.time ? -1 : 1;
+	}
+
+	return r1->login.rowid < r2->login.rowid ? -1 : (r1->login.rowid > r2->login.rowid);
+}
+
+/**
+ * \brief Allocate hash table
+ */
+static struct uid_table *uid_table_create(uint32_t size)
+{
+	struct uid_table *table = calloc(1, sizeof(struct uid_table) + size * sizeof(struct uid_entry));
+	if (!table) {
+		return NULL;
+	}
+
+	table->mask = size - 1;
+	return table;
+}
+
+/**
+ * \brief Add memory to be freed after the reader leaves its critical section
+ */
+static int uid_index_retire(struct uid_index *idx, void *ptr)
+{
+	if (idx->garbage_count == idx->garbage_size) {
+		size_t size = idx->garbage_size ? idx->garbage_size * 2 : 64;
+		void **garbage = realloc(idx->garbage, size * sizeof(void *));
+		if (!garbage) {
+			return 1;
+		}
+
+		idx->garbage = garbage;
+		idx->garbage_size = size;
+	}
+
+	idx->garbage[idx->garbage_count++] = ptr;
+	return 0;
+}
+
+/**
+ * \brief Wait until the reader does not use retired memory and free it
+ */
+static void uid_index_synchronize(struct uid_index *idx)
+{
+	uint32_t gen;
+	size_t i;
+
+	if (idx->garbage_count == 0) {
+		return;
+	}
+
+	/* New pointers must be visible before the reader's state is checked */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	gen = __atomic_load_n(&idx->reader_gen, __ATOMIC_SEQ_CST);
+	if (gen & 1) {
+		while (__atomic_load_n(&idx->reader_gen, __ATOMIC_SEQ_CST) == gen) {
+			sched_yield();
+		}
+	}
+
+	for (i = 0; i < idx->garbage_count; i++) {
+		free(idx->garbage[i]);
+	}
+
+	idx->garbage_count = 0;
+}
+
+/**
+ * \brief Find slot of an address in the current table, add it when missing
+ *
+ * The table is doubled when it is half full.
+ *
+ * \return Slot or NULL on error
+ */
+static struct uid_entry *uid_index_slot(struct uid_index *idx, const uint8_t *addr)
+{
+	struct uid_table *table = idx->table;
+	struct uid_entry *entry;
+	uint32_t i, slot;
+
+	if ((table->used + 1) * 2 > table->mask + 1) {
+		struct uid_table *bigger = uid_table_create((table->mask + 1) * 2);
+		if (!bigger || uid_index_retire(idx, table)) {
+			free(bigger);
+			return NULL;
+		}
+
+		for (i = 0; i <= table->mask; i++) {
+			if (!table->entries[i].history) {
+				continue;
+			}
+
+			slot = uid_hash(table->entries[i].addr) & bigger->mask;
+			while (bigger->entries[slot].history) {
+				slot = (slot + 1) & bigger->mask;
+			}
+
+			bigger->entries[slot] = table->entries[i];
+		}
+
+		bigger->used = table->used;
+		__atomic_store_n(&idx->table, bigger, __ATOMIC_RELEASE);
+		table = bigger;
+	}
+
+	slot = uid_hash(addr) & table->mask;
+	while ((entry = &table->entries[slot])->history) {
+		if (!memcmp(entry->addr, addr, 16)) {
+			return entry;
+		}
+		slot = (slot + 1) & table->mask;
+	}
+
+	memcpy(entry->addr, addr, 16);
+	table->used++;
+	return entry;
+}
+
+/**
+ * \brief Merge new rows of one address into its history
+ *
+ * Rows that are already in the history (loaded again after a failed
+ * refresh) are skipped.
+ *
+ * \param[in] idx Index
+ * \param[in,out] rows Rows of the same address sorted by time and rowid
+ * \param[in] count Number of rows
+ * \return 0 on success
+ */
+static int uid_index_merge(struct uid_index *idx, struct uid_row *rows, size_t count)
+{
+	struct uid_entry *entry = uid_index_slot(idx, rows[0].addr);
+	struct uid_history *old, *history;
+	uint32_t i = 0, j = 0, k = 0, old_count;
+	sqlite3_int64 merged = 0;
+
+	if (!entry) {
+		return 1;
+	}
+
+	old = entry->history;
+	old_count = old ? old->count : 0;
+
+	/* Rows of one address are always merged together, up to the newest one */
+	for (i = 0; i < old_count; i++) {
+		if (old->logins[i].rowid > merged) {
+			merged = old->logins[i].rowid;
+		}
+	}
+
+	for (i = 0, j = 0; i < count; i++) {
+		if (rows[i].login.rowid > merged) {
+			rows[j++] = rows[i];
+		}
+	}
+
+	count = j;
+	if (count == 0) {
+		return 0;
+	}
+	i = j = 0;
+
+	history = malloc(sizeof(struct uid_history) + (old_count + count) * sizeof(struct uid_login));
+	if (!history) {
+		return 1;
+	}
+
+	/* Rows already in the history are older, keep them first on equal time */
+	while (i < old_count || j < count) {
+		if (j == count || (i < old_count && old->logins[i].time <= rows[j].login.time)) {
+			history->logins[k++] = old->logins[i++];
+		} else {
+			history->logins[k++] = rows[j++].login;
+		}
+	}
+	history->count = k;
+
+	if (old && uid_index_retire(idx, old)) {
+		free(history);
+		return 1;
+	}
+
+	__atomic_store_n(&entry->history, history, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * \brief Load rows added to the logs table since the last refresh
+ */
+int uid_index_refresh(struct uid_index *idx)
+{
+	struct uid_row *rows = NULL, *tmp;
+	size_t count = 0, size = 0, i, first;
+	sqlite3_int64 rowid;
+	int rc, ret = 0;
+
+	sqlite3_bind_int64(idx->select, 1, idx->last_rowid);
+
+	while ((rc = sqlite3_step(idx->select)) == SQLITE_ROW) {
+		const char *name = (const char *) sqlite3_column_text(idx->select, 1);
+		const char *ip = (const char *) sqlite3_column_text(idx->select, 2);
+
+		rowid = sqlite3_column_int64(idx->select, 0);
+
+		/* The row is loaded again by the next refresh */
+		if (count == size) {
+			size = size ? size * 2 : 1024;
+			tmp = realloc(rows, size * sizeof(struct uid_row));
+			if (!tmp) {
+				MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+				ret = 1;
+				break;
+			}
+			rows = tmp;
+		}
+
+		if (!ip || uid_parse_addr(rows[count].addr, ip)) {
+			MSG_WARNING(msg_module, "Invalid address '%s' in row %lld", ip ? ip : "", (long long) rowid);
+			idx->last_rowid = rowid;
+			continue;
+		}
+
+		rows[count].login.rowid = rowid;
+		rows[count].login.time = sqlite3_column_int64(idx->select, 4);
+		rows[count].login.login = (sqlite3_column_int(idx->select, 3) == 1);
+		strncpy(rows[count].login.name, name ? name : "", UID_NAME_LENGTH - 1);
+		rows[count].login.name[UID_NAME_LENGTH - 1] = '\0';
+		count++;
+		idx->last_rowid = rowid;
+	}
+
+	if (ret == 0 && rc != SQLITE_DONE) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(idx->db));
+		ret = 1;
+	}
+
+	sqlite3_reset(idx->select);
+
+	if (count > 0) {
+		qsort(rows, count, sizeof(struct uid_row), uid_row_cmp);
+
+		for (first = 0, i = 1; i <= count; i++) {
+			if (i < count && !memcmp(rows[i].addr, rows[first].addr, 16)) {
+				continue;
+			}
+
+			if (uid_index_merge(idx, rows + first, i - first)) {
+				MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+
+				/* Load rows of the addresses that were not merged again */
+				for (i = first; i < count; i++) {
+					if (rows[i].login.rowid <= idx->last_rowid) {
+						idx->last_rowid = rows[i].login.rowid - 1;
+					}
+				}
+				ret = 1;
+				break;
+			}
+			first = i;
+		}
+
+		MSG_DEBUG(msg_module, "Loaded %zu rows, %u addresses in index", count, idx->table->used);
+	}
+
+	free(rows);
+	uid_index_synchronize(idx);
+	return ret;
+}
+
+/**
+ * \brief Create index and load the whole logs table
+ */
+struct uid_index *uid_index_create(sqlite3 *db)
+{
+	struct uid_index *idx = calloc(1, sizeof(struct uid_index));
+	if (!idx) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		return NULL;
+	}
+
+	idx->db = db;
+	idx->table = uid_table_create(UID_TABLE_INIT);
+	if (!idx->table) {
+		MSG_ERROR(msg_module, "Unable to allocate memory (%s:%d)", __FILE__, __LINE__);
+		free(idx);
+		return NULL;
+	}
+
+	if (sqlite3_prepare_v2(db, "SELECT rowid, name, ip, action, time FROM logs WHERE rowid > ?1 ORDER BY rowid",
+			-1, &idx->select, NULL) != SQLITE_OK) {
+		MSG_ERROR(msg_module, "SQL error: %s", sqlite3_errmsg(db));
+		uid_index_destroy(idx);
+		return NULL;
+	}
+
+	pthread_mutex_init(&idx->mutex, NULL);
+	pthread_cond_init(&idx->cond, NULL);
+
+	if (uid_index_refresh(idx)) {
+		uid_index_destroy(idx);
+		return NULL;
+	}
+
+	return idx;
+}
+
+/**
+ * \brief Refreshing thread
+ */
+static void *uid_index_thread(void *arg)
+{
+	struct uid_index *idx = (struct uid_index *) arg;
+	struct timespec ts;
+
+	pthread_mutex_lock(&idx->mutex);
+	while (!idx->stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += idx->interval;
+		pthread_cond_timedwait(&idx->cond, &idx->mutex, &ts);
+		if (idx->stop) {
+			break;
+		}
+
+		pthread_mutex_unlock(&idx->mutex);
+		uid_index_refresh(idx);
+		pthread_mutex_lock(&idx->mutex);
+	}
+	pthread_mutex_unlock(&idx->mutex);
+
+	return NULL;
+}
+
+/**
+ * \brief Start thread refreshing the index periodically
+ */
+int uid_index_start(struct uid_index *idx, int interval)
+{
+	idx->interval = interval;
+	if (pthread_create(&idx->thread, NULL, uid_index_thread, idx) != 0) {
+		MSG_ERROR(msg_module, "Unable to create refreshing thread");
+		return 1;
+	}
+
+	idx->running = 1;
+	return 0;
+}
+
+/**
+ * \brief Stop refreshing thread and free the index
+ */
+void uid_index_destroy(struct uid_index *idx)
+{
+	uint32_t i;
+
+	if (!idx) {
+		return;
+	}
+
+	if (idx->running) {
+		pthread_mutex_lock(&idx->mutex);
+		idx->stop = 1;
+		pthread_cond_signal(&idx->cond);
+		pthread_mutex_unlock(&idx->mutex);
+		pthread_join(idx->thread, NULL);
+	}
+
+	if (idx->select) {
+		pthread_mutex_destroy(&idx->mutex);
+		pthread_cond_destroy(&idx->cond);
+		sqlite3_finalize(idx->select);
+	}
+
+	for (i = 0; i <= idx->table->mask; i++) {
+		free(idx->table->entries[i].history);
+	}
+
+	for (i = 0; i < idx->garbage_count; i++) {
+		free(idx->garbage[i]);
+	}
+
+	free(idx->garbage);
+	free(idx->table);
+	free(idx);
+}
+
+/**
+ * \brief Enter reader's critical section
+ */
+void uid_index_enter(struct uid_index *idx)
+{
+	__atomic_add_fetch(&idx->reader_gen, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * \brief Leave reader's critical section
+ */
+void uid_index_leave(struct uid_index *idx)
+{
+	__atomic_add_fetch(&idx->reader_gen, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Find user logged in at given address and time
+ */
+const char *uid_index_lookup(struct uid_index *idx, const uint8_t *addr, int length, int64_t time)
+{
+	struct uid_table *table = __atomic_load_n(&idx->table, __ATOMIC_ACQUIRE);
+	struct uid_history *history;
+	struct uid_entry *entry;
+	uint8_t key[16];
+	uint32_t slot, low, high, mid;
+
+	if (length != 4 && length != 16) {
+		return NULL;
+	}
+
+	uid_key(key, addr, length);
+
+	/* Hash probe */
+	slot = uid_hash(key) & table->mask;
+	for (;;) {
+		entry = &table->entries[slot];
+		history = __atomic_load_n(&entry->history, __ATOMIC_ACQUIRE);
+		if (!history) {
+			return NULL;
+		}
+
+		if (!memcmp(entry->addr, key, 16)) {
+			break;
+		}
+		slot = (slot + 1) & table->mask;
+	}
+
+	/* Binary search of the last record not later than time */
+	low = 0;
+	high = history->count;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (history->logins[mid].time <= time) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	if (low == 0 || !history->logins[low - 1].login) {
+		return NULL;
+	}
+
+	return history->logins[low - 1].name;
+}
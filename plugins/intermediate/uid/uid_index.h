@@ -0,0 +1,121 @@
+/**
+ * \file uid_index.h
+ * \brief In-memory index of user logins for the uid plugin
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef UID_INDEX_H_
+#define UID_INDEX_H_
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+/**
+ * \brief Index of the logs table
+ *
+ * Logins and logouts are kept per IP address sorted by time, addresses are
+ * looked up in an open addressing hash table. The index is refreshed by
+ * loading rows with rowid greater than the last loaded one, rows are expected
+ * to be only appended to the table.
+ *
+ * Lookups do not take any locks. Replaced parts of the index are released
+ * by the refreshing thread once the reader has left its critical section
+ * (uid_index_enter(), uid_index_leave()). Only one thread may read the index.
+ */
+struct uid_index;
+
+/**
+ * \brief Create index and load the whole logs table
+ *
+ * \param[in] db Database, used by the refreshing thread from now on
+ * \return Index or NULL on error
+ */
+struct uid_index *uid_index_create(sqlite3 *db);
+
+/**
+ * \brief Load rows added to the logs table since the last refresh
+ *
+ * \param[in] idx Index
+ * \return 0 on success
+ */
+int uid_index_refresh(struct uid_index *idx);
+
+/**
+ * \brief Start thread refreshing the index periodically
+ *
+ * \param[in] idx Index
+ * \param[in] interval Refresh interval in seconds
+ * \return 0 on success
+ */
+int uid_index_start(struct uid_index *idx, int interval);
+
+/**
+ * \brief Stop refreshing thread and free the index
+ *
+ * \param[in] idx Index
+ */
+void uid_index_destroy(struct uid_index *idx);
+
+/**
+ * \brief Enter reader's critical section
+ *
+ * Names returned by uid_index_lookup() are valid until uid_index_leave().
+ *
+ * \param[in] idx Index
+ */
+void uid_index_enter(struct uid_index *idx);
+
+/**
+ * \brief Leave reader's critical section
+ *
+ * \param[in] idx Index
+ */
+void uid_index_leave(struct uid_index *idx);
+
+/**
+ * \brief Find user logged in at given address and time
+ *
+ * Returns the name of the last login at the address not later than the given
+ * time, unless it was followed by a logout.
+ *
+ * \param[in] idx Index
+ * \param[in] addr IPv4 (4 bytes) or IPv6 (16 bytes) address in network byte order
+ * \param[in] length Length of the address
+ * \param[in] time Unix timestamp in seconds
+ * \return User name or NULL
+ */
+const char *uid_index_lookup(struct uid_index *idx, const uint8_t *addr, int length, int64_t time);
+
+#endif /* UID_INDEX_H_ */
@@ -82,6 +82,9 @@ File::File(const pugi::xpath_node &config)
 	// File prefix
 	prefix = config.node().child_value("prefix");
 
+	// Compression (throws on unknown or unsupported types)
+	compression_t compression = WindowFile::parse(config.node().child_value("compression"));
+
 	// Windows size & interval
 	pugi::xml_node ie = config.node().child("dumpInterval");
 	if (!ie) {
@@ -131,6 +134,7 @@ File::File(const pugi::xpath_node &config)
 
 	_thread->storage_path = path;
 	_thread->file_prefix = prefix;
+	_thread->compression = compression;
 	_thread->window_size = w_size;
 	time(&_thread->window_time);
 
@@ -141,8 +145,8 @@ File::File(const pugi::xpath_node &config)
 	}
 
 	// Create directory & first file
-	FILE *new_file = file_create(_thread->storage_path, _thread->file_prefix,
-		_thread->window_time);
+	WindowFile *new_file = file_create(_thread->storage_path, _thread->file_prefix,
+		_thread->window_time, _thread->compression);
 	if (!new_file) {
 		delete _thread;
 		throw std::runtime_error("Failed to create a time window file.");
@@ -151,14 +155,14 @@ File::File(const pugi::xpath_node &config)
 	_file = new_file;
 
 	if (pthread_mutex_init(&_thread->mutex, NULL) != 0) {
-		fclose(_file);
+		delete _file;
 		delete _thread;
 		throw std::runtime_error("Mutex initialization failed");
 	}
 
 	if (pthread_create(&_thread->thread, NULL, &File::thread_window,
 			_thread) != 0) {
-		fclose(_file);
+		delete _file;
 		pthread_mutex_destroy(&_thread->mutex);
 		delete _thread;
 		throw std::runtime_error("Failed to start a thread for changing time "
@@ -173,21 +177,46 @@ File::File(const pugi::xpath_node &config)
  */
 File::~File()
 {
-	if (_file) {
-		fclose(_file);
-	}
-
 	if (_thread) {
 		_thread->stop = true;
 		pthread_join(_thread->thread, NULL);
-		pthread_mutex_destroy(&_thread->mutex);
 
+		close_old_files(_thread);
 		if (_thread->new_file) {
-			fclose(_thread->new_file);
+			_thread->new_file->close();
+			delete _thread->new_file;
 		}
 
+		pthread_mutex_destroy(&_thread->mutex);
+
 		delete _thread;
 	}
+
+	if (_file) {
+		_file->close();
+		delete _file;
+	}
+}
+
+/**
+ * \brief Close files of previous time windows
+ *
+ * Finishing a compressed stream and writing the rest of the buffer may take
+ * a while, so the files are closed outside of the writer thread.
+ * \param[in,out] ctx Thread configuration
+ */
+void File::close_old_files(thread_ctx_t *ctx)
+{
+	std::vector<WindowFile *> files;
+
+	pthread_mutex_lock(&ctx->mutex);
+	files.swap(ctx->old_files);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	for (WindowFile *file : files) {
+		file->close();
+		delete file;
+	}
 }
 
 /**
@@ -207,6 +236,9 @@ void *File::thread_window(void *context)
 		tim.tv_nsec = 100000000L; // 0.1 sec
 		nanosleep(&tim, NULL);
 
+		// Finalize previous time windows
+		close_old_files(ctx);
+
 		// Get current time
 		time_t now;
 		time(&now);
@@ -215,20 +247,20 @@ void *File::thread_window(void *context)
 			continue;
 		}
 
-		// New time window
-		pthread_mutex_lock(&ctx->mutex);
-		if (ctx->new_file) {
-			fclose(ctx->new_file);
-			ctx->new_file = NULL;
-		}
-
+		// New time window (the file is created without holding the mutex)
 		ctx->window_time += ctx->window_size;
-		FILE *file = file_create(ctx->storage_path, ctx->file_prefix,
-			ctx->window_time);
+		WindowFile *file = file_create(ctx->storage_path, ctx->file_prefix,
+			ctx->window_time, ctx->compression);
 		if (!file) {
 			MSG_ERROR(msg_module, "Failed to create a time window file.");
 		}
 
+		pthread_mutex_lock(&ctx->mutex);
+		if (ctx->new_file) {
+			// The previous window has not been used at all
+			ctx->old_files.push_back(ctx->new_file);
+		}
+
 		// Null pointer is also valid...
 		ctx->new_file = file;
 		ctx->new_file_ready = true;
@@ -240,20 +272,19 @@ void *File::thread_window(void *context)
 }
 
 /**
- * \brief Store a record to a file
- * \param[in] record JSON record
+ * \brief Store records to a file
+ * \param[in] batch JSON records
  */
-void File::ProcessDataRecord(const std::string &record)
+void File::ProcessDataBatch(const std::string &batch)
 {
 	// Should we change a time window
 	if (_thread->new_file_ready) {
-		// Close old time window
+		// Get new time window, the old one is closed by the window thread
+		pthread_mutex_lock(&_thread->mutex);
 		if (_file) {
-			fclose(_file);
+			_thread->old_files.push_back(_file);
 		}
 
-		// Get new time window
-		pthread_mutex_lock(&_thread->mutex);
 		_file = _thread->new_file;
 		_thread->new_file = NULL;
 		_thread->new_file_ready = false;
@@ -264,8 +295,8 @@ void File::ProcessDataRecord(const std::string &record)
 		return;
 	}
 
-	// Store the record
-	fwrite(record.c_str(), record.size(), 1, _file);
+	// Store the records
+	_file->write(batch.data(), batch.size());
 }
 
 /**
@@ -374,10 +405,11 @@ int File::dir_create(const std::string &path)
  *
  * Check/create a directory hierarchy and create a new file for time window.
  * \param[in] tm Time window
+ * \param[in] compression Compression of the file
  * \return On success returns pointer to the file, Otherwise returns NULL.
  */
-FILE *File::file_create(const std::string &tmplt, const std::string &prefix,
-	const time_t &tm)
+WindowFile *File::file_create(const std::string &tmplt, const std::string &prefix,
+	const time_t &tm, compression_t compression)
 {
 	char file_fmt[20];
 
@@ -405,13 +437,5 @@ FILE *File::file_create(const std::string &tmplt, const std::string &prefix,
 	}
 
 	std::string file_name = directory + prefix + file_fmt;
-	FILE *file = fopen(file_name.c_str(), "w");
-	if (!file) {
-		// Failed to create a flow file
-		MSG_ERROR(msg_module, "Failed to create a flow file '%s' (%s).",
-			file_name.c_str(), strerror(errno));
-		return NULL;
-	}
-
-	return file;
+	return WindowFile::create(file_name, compression);
 }
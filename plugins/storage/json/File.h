@@ -41,10 +41,13 @@
 #define FILE_H
 
 #include "json.h"
+#include "WindowFile.h"
 
 #include <string>
 #include <ctime>
 #include <cstdio>
+#include <vector>
+#include <atomic>
 
 #include <pthread.h>
 
@@ -57,8 +60,8 @@ public:
 	File(const pugi::xpath_node &config);
 	~File();
 
-	// Store a record to the file
-	void ProcessDataRecord(const std::string &record);
+	// Store records to the file
+	void ProcessDataBatch(const std::string &batch);
 
 	// Get a directory path for a time window
 	static int dir_name(const time_t &tm, const std::string &tmplt,
@@ -66,8 +69,8 @@ public:
 	// Create a directory for a time window
 	static int dir_create(const std::string &path);
 	// Create a file for a time window
-	static FILE *file_create(const std::string &tmplt, const std::string &prefix,
-				const time_t &tm);
+	static WindowFile *file_create(const std::string &tmplt, const std::string &prefix,
+				const time_t &tm, compression_t compression);
 private:
 	/** Minimal window size */
 	const unsigned int _WINDOW_MIN_SIZE = 60; // seconds
@@ -76,24 +79,28 @@ private:
 	typedef struct thread_ctx_s {
 		pthread_t thread;            /**< Thread                     */
 		pthread_mutex_t mutex;       /**< Data mutex                 */
-		bool stop;                   /**< Stop flag for temination   */
+		std::atomic<bool> stop;      /**< Stop flag for temination   */
 
 		unsigned int window_size;    /**< Size of a time window      */
 		time_t window_time;          /**< Current time window        */
 		std::string storage_path;    /**< Storage path (template)    */
 		std::string file_prefix;     /**< File prefix                */
+		compression_t compression;   /**< Compression of files       */
 
-		FILE *new_file;              /**< New file                   */
-		bool new_file_ready;         /**< New file flag              */
+		WindowFile *new_file;        /**< New file                   */
+		std::atomic<bool> new_file_ready; /**< New file flag         */
+		std::vector<WindowFile *> old_files; /**< Files to close     */
 	} thread_ctx_t;
 
-	/** File descritor */
-	FILE *_file;
+	/** Current file */
+	WindowFile *_file;
 	/** Thread for changing time windows */
 	thread_ctx_t *_thread;
 
 	// Window changer
 	static void *thread_window(void *context);
+	// Close files of previous time windows
+	static void close_old_files(thread_ctx_t *ctx);
 };
 
 #endif // FILE_H
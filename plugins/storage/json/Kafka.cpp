@@ -1,6 +1,7 @@
 #include "Kafka.h"
 
 #include <stdexcept>
+#include <cstring>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -90,10 +91,26 @@ Kafka::~Kafka()
     MSG_INFO(msg_module, "Kafka plugin finished");
 }
 
-void Kafka::ProcessDataRecord(const std::string &record)
+void Kafka::ProcessDataBatch(const std::string &batch)
+{
+    /* Each record is one Kafka message */
+    const char *record = batch.c_str();
+    const char *end = record + batch.length();
+    while (record < end) {
+        const char *next = (const char *) memchr(record, '\n', end - record);
+        next = next ? next + 1 : end;
+
+        produce(record, next - record);
+        record = next;
+    }
+
+    rd_kafka_poll(_rk, 0);
+}
+
+void Kafka::produce(const char *record, size_t length)
 {
     while (rd_kafka_produce(_rkt, _current_partition++ % _partitions,
-        RD_KAFKA_MSG_F_COPY, (void *) record.c_str(), record.length(),
+        RD_KAFKA_MSG_F_COPY, (void *) record, length,
         NULL, 0, NULL) != 0) {
 
         switch (errno) {
@@ -102,9 +119,9 @@ void Kafka::ProcessDataRecord(const std::string &record)
                 " (%u) has been reached: 'queue.buffering.max.messages'",
                 rd_kafka_outq_len(_rk));
 
-            // wait a while for the queue to be processed
-            usleep(200000);
-            rd_kafka_poll(_rk, 0);
+            // wait a while for the queue to be processed (only the writer
+            // thread of this output waits)
+            rd_kafka_poll(_rk, 200);
             break;
         case EMSGSIZE:
             MSG_ERROR(msg_module, "Message is larged than configured max size:"
@@ -123,6 +140,4 @@ void Kafka::ProcessDataRecord(const std::string &record)
             break;
         }
     }
-
-    rd_kafka_poll(_rk, 0);
 }
@@ -10,9 +10,12 @@ public:
     Kafka(const pugi::xpath_node &config);
 
     ~Kafka();
-    void ProcessDataRecord(const std::string& record);
+    void ProcessDataBatch(const std::string& batch);
 
 private:
+    // Produce one record, wait while the queue of the producer is full
+    void produce(const char *record, size_t length);
+
     std::string _topic;
     int _partitions = 1;
     int _current_partition = 0;
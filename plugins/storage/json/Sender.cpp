@@ -1,6 +1,7 @@
 #include "Sender.h"
 
 #include <stdexcept>
+#include <cstring>
 #include <sys/time.h>
 
 static const char *msg_module = "json sender";
@@ -47,6 +48,9 @@ Sender::Sender(const pugi::xpath_node &config)
 	}
 
 	gettimeofday(&connection_time, NULL);
+
+	/* Datagrams and SCTP messages keep one record each */
+	stream = (strcasecmp(proto.c_str(), "TCP") == 0);
 }
 
 Sender::~Sender()
@@ -54,7 +58,7 @@ Sender::~Sender()
 	siso_destroy(sender);
 }
 
-void Sender::ProcessDataRecord(const std::string &record)
+void Sender::ProcessDataBatch(const std::string &batch)
 {
 	if (siso_is_connected(sender) == 0) {
 		// Not connected -> try to reconnect
@@ -75,8 +79,26 @@ void Sender::ProcessDataRecord(const std::string &record)
 		}
 	}
 
-	if (siso_send(sender, record.c_str(), record.length()) != SISO_OK) {
-		MSG_ERROR(msg_module, "Failed to send JSON data (%s). Connection closed.",
-			siso_get_last_err(sender));
+	if (stream) {
+		if (siso_send(sender, batch.c_str(), batch.length()) != SISO_OK) {
+			MSG_ERROR(msg_module, "Failed to send JSON data (%s). Connection closed.",
+				siso_get_last_err(sender));
+		}
+		return;
+	}
+
+	/* Send records one by one */
+	const char *record = batch.c_str();
+	const char *end = record + batch.length();
+	while (record < end) {
+		const char *next = (const char *) memchr(record, '\n', end - record);
+		next = next ? next + 1 : end;
+
+		if (siso_send(sender, record, next - record) != SISO_OK) {
+			MSG_ERROR(msg_module, "Failed to send JSON data (%s). Connection closed.",
+				siso_get_last_err(sender));
+			return;
+		}
+		record = next;
 	}
 }
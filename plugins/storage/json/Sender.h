@@ -13,10 +13,11 @@ public:
 	Sender(const pugi::xpath_node &config);
 
 	~Sender();
-	void ProcessDataRecord(const std::string& record);
+	void ProcessDataBatch(const std::string& batch);
 
 private:
 	sisoconf *sender{NULL};
+	bool stream{false};	/**< Records can be sent together (TCP) */
 	struct timeval connection_time;
 };
 
@@ -317,14 +317,14 @@ enum Server::Send_status Server::msg_send(const char *data, ssize_t len,
 }
 
 /**
- * \brief Send record to all connected clients
+ * \brief Send records to all connected clients
  *
- * \param[in] record Record
+ * \param[in] batch Records
  */
-void Server::ProcessDataRecord(const std::string &record)
+void Server::ProcessDataBatch(const std::string &batch)
 {
-	const char *data = record.c_str();
-	ssize_t length = record.size();
+	const char *data = batch.c_str();
+	ssize_t length = batch.size();
 
 	// Are there new clients?
 	if (_acceptor->new_clients_ready) {
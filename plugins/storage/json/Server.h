@@ -56,8 +56,8 @@ public:
 	Server(const pugi::xpath_node &config);
 	~Server();
 
-	// Send a record to connected clients
-	void ProcessDataRecord(const std::string& record);
+	// Send records to connected clients
+	void ProcessDataBatch(const std::string& batch);
 
 private:
 	/** Transmission status */
@@ -60,13 +60,6 @@ extern "C" {
 
 static const char *msg_module = "json_storage";
 
-#define READ_BYTE_ARR(_dst_, _src_, _len_) \
-do {\
-	for (int i = 0; i < (_len_); ++i) { \
-		(_dst_)[i] = read8((_src_) + i); \
-	} \
-} while(0)
-
 #define STR_APPEND(_string_, _addition_) _string_.append(_addition_, sizeof(_addition_) - 1)
 
 /**
@@ -76,23 +69,40 @@ Storage::Storage()
 {
 	/* Allocate space for buffers */
 	record.reserve(4096);
-	buffer.reserve(4096);
+	plans.resize(PLAN_CACHE_SIZE);
 }
 
 Storage::~Storage()
 {
-	for (Output *output: outputs) {
+	for (Writer *writer: writers) {
+		delete writer;
+	}
+}
+
+/**
+ * \brief Add new output processor
+ */
+void Storage::addOutput(Output *output, unsigned int queue_size, bool drop)
+{
+	Writer *writer;
+
+	try {
+		writer = new Writer(output, queue_size, drop);
+	} catch (...) {
 		delete output;
+		throw;
 	}
+
+	writers.push_back(writer);
 }
 
 /**
  * \brief Send data record
  */
-void Storage::sendData() const
+void Storage::sendData()
 {
-	for (Output *output: outputs) {
-		output->ProcessDataRecord(record);
+	for (Writer *writer: writers) {
+		writer->Write(record);
 	}
 }
 
@@ -105,6 +115,11 @@ void Storage::storeDataSets(const ipfix_message* ipfix_msg, struct json_conf * c
 	for (int i = 0; i < ipfix_msg->data_records_count; ++i) {
 		storeDataRecord(&(ipfix_msg->metadata[i]), ipfix_msg, config);
 	}
+
+	/* Records of the message are passed to the outputs together */
+	for (Writer *writer: writers) {
+		writer->Flush();
+	}
 }
 
 /**
@@ -130,46 +145,30 @@ uint16_t Storage::realLength(uint16_t length, uint8_t *data_record, uint16_t &of
 }
 
 /**
- * \brief Read raw data from record
+ * \brief Append raw data in hexadecimal
  */
-void Storage::readRawData(uint16_t &length, uint8_t* data_record, uint16_t &offset)
+void Storage::readRawHex(uint16_t length, const uint8_t *field)
 {
-	/* Read raw value */
-	switch (length) {
-	case 1:
-		sprintf(buffer.data(), "%" PRIu16, static_cast<int>(read8(data_record + offset)));
-		break;
-	case 2:
-		sprintf(buffer.data(), "%" PRIu16, ntohs(read16(data_record + offset)));
-		break;
-	case 4:
-		sprintf(buffer.data(), "%" PRIu32, ntohl(read32(data_record + offset)));
-		break;
-	case 8:
-		sprintf(buffer.data(), "%" PRIu64, be64toh(read64(data_record + offset)));
-		break;
-	default:
-		length = this->realLength(length, data_record, offset);
-
-		if (length == 0) {
-			STR_APPEND(record, "null");
-			return;
-		}
-
-		if (length * 2 > buffer.capacity()) {
-			buffer.reserve(length * 2 + 1);
-		}
+	static const char hex[] = "0123456789abcdef";
 
-		/* Start the string with 0x and print the rest in hexa */
-		strncpy(buffer.data(), "0x", 3);
-		for (int i = 0; i < length; i++) {
-			sprintf(buffer.data() + i * 2 + 2, "%02x", (data_record + offset)[i]);
-		}
+	if (length == 0) {
+		STR_APPEND(record, "null");
+		return;
 	}
 
-	record += '"';
-	record += buffer.data();
-	record += '"';
+	/* Start the string with 0x and print the rest in hexa */
+	size_t pos = record.size();
+	record.resize(pos + 2 * length + 4);
+
+	char *out = &record[pos];
+	*out++ = '"';
+	*out++ = '0';
+	*out++ = 'x';
+	for (uint16_t i = 0; i < length; ++i) {
+		*out++ = hex[field[i] >> 4];
+		*out++ = hex[field[i] & 0x0f];
+	}
+	*out = '"';
 }
 
 /**
@@ -184,132 +183,321 @@ const char* Storage::rawName(uint32_t en, uint16_t id) const
 }
 
 /**
- * \brief Store data record
+ * \brief Select converter of a number with given length
  */
-void Storage::storeDataRecord(struct metadata *mdata, const struct ipfix_message *ipfix_msg, struct json_conf *config)
+static plan_conv numberConv(plan_conv conv, uint16_t length, bool floating)
 {
-	const char *element_name = NULL;
-	ELEMENT_TYPE element_type;
-
-	offset = 0;
-	uint16_t trans_len = 0;
-	const char *trans_str = NULL;
-	record.clear();
-	STR_APPEND(record, "{\"@type\": \"ipfix.entry\", ");
+	if (floating) {
+		return (length == BYTE4 || length == BYTE8) ? conv : plan_conv::UNKNOWN;
+	}
 
-	struct ipfix_template *templ = mdata->record.templ;
-	uint8_t *data_record = (uint8_t*) mdata->record.record;
+	switch (length) {
+	case BYTE1:
+	case BYTE2:
+	case BYTE4:
+	case BYTE8:
+		return conv;
+	default:
+		return plan_conv::UNKNOWN;
+	}
+}
 
-	/* get all fields */
+/**
+ * \brief Compile serialization plan of a template
+ */
+void Storage::compilePlan(struct serial_plan *plan, const struct ipfix_template *templ, struct json_conf *config)
+{
+	int32_t offset = 0;
 	uint16_t added = 0;
+
+	plan->fields.clear();
+
 	for (uint16_t count = 0, index = 0; count < templ->field_count; ++count, ++index) {
 		/* Get Enterprise number and ID */
-		id = templ->fields[index].ie.id;
-		length = templ->fields[index].ie.length;
-		enterprise = 0;
+		uint16_t id = templ->fields[index].ie.id;
+		uint16_t length = templ->fields[index].ie.length;
+		uint32_t enterprise = 0;
 
 		if (id & 0x8000) {
 			id &= 0x7fff;
 			enterprise = templ->fields[++index].enterprise_number;
 		}
 
+		plan_field field;
+		field.length = length;
+		field.offset = offset;
+
+		/* Offsets of fields after a variable-length field are not fixed */
+		if (offset >= 0) {
+			offset = (length == VAR_IE_LENGTH) ? -1 : offset + length;
+		}
+
 		/* Get element informations */
-		const ipfix_element_t * element = get_element_by_id(id, enterprise);
+		const char *element_name;
+		ELEMENT_TYPE element_type;
+		const ipfix_element_t *element = get_element_by_id(id, enterprise);
 		if (element != NULL) {
 			element_name = element->name;
 			element_type = element->type;
 		} else {
 			// Element not found
 			if (config->ignoreUnknown) {
-				offset += realLength(length, data_record, offset);
+				/* Fixed-length fields with fixed offsets are followed by fields with fixed offsets */
+				if (field.offset < 0 || length == VAR_IE_LENGTH) {
+					field.conv = plan_conv::SKIP;
+					plan->fields.push_back(std::move(field));
+				}
 				continue;
 			}
 
 			element_name = rawName(enterprise, id);
 			element_type = ET_UNASSIGNED;
 			MSG_DEBUG(msg_module, "Unknown element (%s)", element_name);
-	}
+		}
 
 		if (added > 0) {
-			STR_APPEND(record, ", ");
+			STR_APPEND(field.key, ", ");
 		}
 
-		STR_APPEND(record, "\"");
-		record += config->prefix;
-		record += element_name;
-		STR_APPEND(record, "\": ");
+		STR_APPEND(field.key, "\"");
+		field.key += config->prefix;
+		field.key += element_name;
+		STR_APPEND(field.key, "\": ");
 
 		switch (element_type) {
 		case ET_UNSIGNED_8:
 		case ET_UNSIGNED_16:
 		case ET_UNSIGNED_32:
-		case ET_UNSIGNED_64:{
-			trans_str = translator.toUnsigned(length, &trans_len, data_record, offset,
-				element, config);
-			record.append(trans_str, trans_len);
-		}
+		case ET_UNSIGNED_64:
+			if (enterprise == 0 && id == 6 && config->tcpFlags && length == BYTE1) {
+				field.conv = plan_conv::TCP_FLAGS8;
+			} else if (enterprise == 0 && id == 6 && config->tcpFlags && length == BYTE2) {
+				field.conv = plan_conv::TCP_FLAGS16;
+			} else if (enterprise == 0 && id == 4 && !config->protocol && length == BYTE1) {
+				field.conv = plan_conv::PROTOCOL;
+			} else {
+				field.conv = numberConv(plan_conv::UNSIGNED, length, false);
+			}
 			break;
 		case ET_SIGNED_8:
 		case ET_SIGNED_16:
 		case ET_SIGNED_32:
 		case ET_SIGNED_64:
-			trans_str = translator.toSigned(length, &trans_len, data_record, offset);
-			record.append(trans_str, trans_len);
+			field.conv = numberConv(plan_conv::SIGNED, length, false);
 			break;
 		case ET_FLOAT_32:
 		case ET_FLOAT_64:
-			trans_str = translator.toFloat(length, &trans_len, data_record, offset);
-			record.append(trans_str, trans_len);
+			field.conv = numberConv(plan_conv::FLOAT, length, true);
 			break;
 		case ET_IPV4_ADDRESS:
-			record += '"';
-			trans_str = translator.formatIPv4(read32(data_record + offset), &trans_len);
-			record.append(trans_str, trans_len);
-			record += '"';
+			field.conv = plan_conv::IPV4;
 			break;
 		case ET_IPV6_ADDRESS:
-			READ_BYTE_ARR(addr6, data_record + offset, IPV6_LEN);
-			record += '"';
-			record += translator.formatIPv6(addr6);
-			record += '"';
+			field.conv = plan_conv::IPV6;
 			break;
 		case ET_MAC_ADDRESS:
-			READ_BYTE_ARR(addrMac, data_record + offset, MAC_LEN);
-			record += '"';
-			record += translator.formatMac(addrMac);
-			record += '"';
+			field.conv = plan_conv::MAC;
 			break;
 		case ET_DATE_TIME_SECONDS:
-			record += translator.formatTimestamp(read32(data_record + offset),
-				t_units::SEC, config);
+			field.conv = plan_conv::TIME_SEC;
 			break;
 		case ET_DATE_TIME_MILLISECONDS:
-			record += translator.formatTimestamp(read64(data_record + offset),
-				t_units::MILLISEC, config);
+			field.conv = plan_conv::TIME_MILLI;
 			break;
 		case ET_DATE_TIME_MICROSECONDS:
-			record += translator.formatTimestamp(read64(data_record + offset),
-				t_units::MICROSEC, config);
+			field.conv = plan_conv::TIME_MICRO;
 			break;
 		case ET_DATE_TIME_NANOSECONDS:
-			record += translator.formatTimestamp(read64(data_record + offset),
-				t_units::NANOSEC, config);
+			field.conv = plan_conv::TIME_NANO;
 			break;
 		case ET_STRING:
-			length = realLength(length, data_record, offset);
-			record += translator.escapeString(length, data_record + offset,
-				config);
+			field.conv = plan_conv::STRING;
 			break;
 		case ET_BOOLEAN:
 		case ET_UNASSIGNED:
 		default:
-			readRawData(length, data_record, offset);
+			field.conv = (length == BYTE1 || length == BYTE2 || length == BYTE4 || length == BYTE8)
+				? plan_conv::RAW_NUMBER : plan_conv::RAW_HEX;
 			break;
 		}
 
-		offset += length;
+		/* Addresses and timestamps with variable length cannot be converted */
+		if (length == VAR_IE_LENGTH && field.conv >= plan_conv::IPV4 && field.conv <= plan_conv::TIME_NANO) {
+			field.conv = plan_conv::RAW_HEX;
+		}
+
+		plan->fields.push_back(std::move(field));
 		added++;
 	}
+}
+
+/**
+ * \brief Get serialization plan of a template
+ */
+const struct serial_plan *Storage::getPlan(const struct ipfix_template *templ, struct json_conf *config)
+{
+	uint32_t serial = templ->index ? templ->index->serial : 0;
+	uintptr_t hash = (uintptr_t) templ;
+	hash ^= hash >> 12;
+	struct serial_plan *plan = &plans[(hash >> 4) & (PLAN_CACHE_SIZE - 1)];
+
+	/* Templates without the field index cannot be told apart, compile them every time */
+	if (plan->templ != templ || plan->serial != serial || serial == 0) {
+		plan->templ = templ;
+		plan->serial = serial;
+		compilePlan(plan, templ, config);
+	}
+
+	return plan;
+}
+
+/**
+ * \brief Store data record
+ */
+void Storage::storeDataRecord(struct metadata *mdata, const struct ipfix_message *ipfix_msg, struct json_conf *config)
+{
+	uint16_t offset = 0, length;
+	uint16_t trans_len = 0;
+	uint32_t str_len = 0;
+	const char *trans_str = NULL;
+	char conv_buf[32], *conv_buf_pos = NULL;
+
+	record.clear();
+	STR_APPEND(record, "{\"@type\": \"ipfix.entry\", ");
+
+	struct ipfix_template *templ = mdata->record.templ;
+	uint8_t *data_record = (uint8_t*) mdata->record.record;
+	const struct serial_plan *plan = getPlan(templ, config);
+
+	for (const plan_field &field: plan->fields) {
+		if (field.offset >= 0) {
+			offset = field.offset;
+		}
+
+		length = realLength(field.length, data_record, offset);
+		const uint8_t *data = data_record + offset;
+		offset += length;
+
+		if (field.conv == plan_conv::SKIP) {
+			continue;
+		}
+
+		record += field.key;
+
+		switch (field.conv) {
+		case plan_conv::UNSIGNED:
+			switch (length) {
+			case BYTE1:
+				conv_buf_pos = u32toa_branchlut2(read8(data), conv_buf);
+				break;
+			case BYTE2:
+				conv_buf_pos = u32toa_branchlut2(ntohs(read16(data)), conv_buf);
+				break;
+			case BYTE4:
+				conv_buf_pos = u32toa_branchlut2(ntohl(read32(data)), conv_buf);
+				break;
+			default:
+				conv_buf_pos = u64toa_branchlut2(be64toh(read64(data)), conv_buf);
+				break;
+			}
+			record.append(conv_buf, conv_buf_pos - conv_buf);
+			break;
+		case plan_conv::SIGNED:
+			switch (length) {
+			case BYTE1:
+				conv_buf_pos = i32toa_branchlut2(read8(data), conv_buf);
+				break;
+			case BYTE2:
+				conv_buf_pos = i32toa_branchlut2(ntohs(read16(data)), conv_buf);
+				break;
+			case BYTE4:
+				conv_buf_pos = i32toa_branchlut2(ntohl(read32(data)), conv_buf);
+				break;
+			default:
+				conv_buf_pos = i64toa_branchlut2(be64toh(read64(data)), conv_buf);
+				break;
+			}
+			record.append(conv_buf, conv_buf_pos - conv_buf);
+			break;
+		case plan_conv::FLOAT:
+			trans_str = translator.toFloat(length, &trans_len, (uint8_t *) data, 0);
+			record.append(trans_str, trans_len);
+			break;
+		case plan_conv::UNKNOWN:
+			STR_APPEND(record, "\"unknown\"");
+			break;
+		case plan_conv::TCP_FLAGS8:
+			record.append(translator.formatFlags8(read8(data)), 8);
+			break;
+		case plan_conv::TCP_FLAGS16:
+			record.append(translator.formatFlags16(read16(data)), 8);
+			break;
+		case plan_conv::PROTOCOL:
+			record += translator.formatProtocol(read8(data));
+			break;
+		case plan_conv::IPV4:
+			record += '"';
+			trans_str = translator.formatIPv4(read32(data), &trans_len);
+			record.append(trans_str, trans_len);
+			record += '"';
+			break;
+		case plan_conv::IPV6:
+			record += '"';
+			trans_str = translator.formatIPv6(data, &trans_len);
+			record.append(trans_str, trans_len);
+			record += '"';
+			break;
+		case plan_conv::MAC:
+			record += '"';
+			trans_str = translator.formatMac(data, &trans_len);
+			record.append(trans_str, trans_len);
+			record += '"';
+			break;
+		case plan_conv::TIME_SEC:
+			trans_str = translator.formatTimestamp(read32(data), t_units::SEC, &trans_len, config);
+			record.append(trans_str, trans_len);
+			break;
+		case plan_conv::TIME_MILLI:
+			trans_str = translator.formatTimestamp(read64(data), t_units::MILLISEC, &trans_len, config);
+			record.append(trans_str, trans_len);
+			break;
+		case plan_conv::TIME_MICRO:
+			trans_str = translator.formatTimestamp(read64(data), t_units::MICROSEC, &trans_len, config);
+			record.append(trans_str, trans_len);
+			break;
+		case plan_conv::TIME_NANO:
+			trans_str = translator.formatTimestamp(read64(data), t_units::NANOSEC, &trans_len, config);
+			record.append(trans_str, trans_len);
+			break;
+		case plan_conv::STRING:
+			trans_str = translator.escapeString(length, data, &str_len, config);
+			record.append(trans_str, str_len);
+			break;
+		case plan_conv::RAW_NUMBER:
+			switch (length) {
+			case BYTE1:
+				conv_buf_pos = u32toa_branchlut2(read8(data), conv_buf);
+				break;
+			case BYTE2:
+				conv_buf_pos = u32toa_branchlut2(ntohs(read16(data)), conv_buf);
+				break;
+			case BYTE4:
+				conv_buf_pos = u32toa_branchlut2(ntohl(read32(data)), conv_buf);
+				break;
+			default:
+				conv_buf_pos = u64toa_branchlut2(be64toh(read64(data)), conv_buf);
+				break;
+			}
+			record += '"';
+			record.append(conv_buf, conv_buf_pos - conv_buf);
+			record += '"';
+			break;
+		case plan_conv::RAW_HEX:
+		default:
+			readRawHex(length, data);
+			break;
+		}
+	}
 
 	/* Store metadata */
 	if (processMetadata) {
@@ -322,21 +510,16 @@ void Storage::storeDataRecord(struct metadata *mdata, const struct ipfix_message
 
 	/* Store ODID */
 	if (config->odid) {
-		/* Temporary buffer for the ODID, must be as big as UINT_MAX converted to string */
-		char odid_buf[sizeof("4294967295")];
-
 		STR_APPEND(record, ", \"");
 		record += config->prefix;
 		STR_APPEND(record, "odid\": ");
 		/* Convert ODID efficiently */
-		char *odid_buf_pos = u32toa_branchlut2(ipfix_msg->input_info->odid, odid_buf);
-		record.append(odid_buf, odid_buf_pos - odid_buf);
+		conv_buf_pos = u32toa_branchlut2(ipfix_msg->input_info->odid, conv_buf);
+		record.append(conv_buf, conv_buf_pos - conv_buf);
 	}
 
 	/* Store Detailed Information */
 	if (config->detailedInfo) {
-		char conv_buf[sizeof("4294967295")], *conv_buf_pos = NULL;
-
 		STR_APPEND(record, ", \"ipfixcol.packet_length\": ");
 		conv_buf_pos = u32toa_branchlut2(ntohs(ipfix_msg->pkt_header->length), conv_buf);
 		record.append(conv_buf, conv_buf_pos - conv_buf);
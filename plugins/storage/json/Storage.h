@@ -47,6 +47,7 @@
 #include "json.h"
 #include "pugixml/pugixml.hpp"
 #include "Translator.h"
+#include "Writer.h"
 
 /* some auxiliary functions for extracting data of exact length */
 #define read8(_ptr_)  (*((uint8_t *)  (_ptr_)))
@@ -57,6 +58,56 @@
 #define IPV6_LEN 16
 #define MAC_LEN  6
 
+/** Number of slots of the serialization plan cache (power of two) */
+#define PLAN_CACHE_SIZE 256
+
+/**
+ * \brief Converters of fields in the serialization plan
+ */
+enum class plan_conv : uint8_t {
+	SKIP,          /**< Unknown element, only moves the offset */
+	UNSIGNED,      /**< Unsigned integer of 1, 2, 4 or 8 bytes */
+	SIGNED,        /**< Signed integer of 1, 2, 4 or 8 bytes */
+	FLOAT,         /**< Float of 4 or 8 bytes */
+	UNKNOWN,       /**< Number with unsupported length */
+	TCP_FLAGS8,    /**< Formatted TCP flags (1 byte) */
+	TCP_FLAGS16,   /**< Formatted TCP flags (2 bytes) */
+	PROTOCOL,      /**< Formatted protocol */
+	IPV4,          /**< IPv4 address */
+	IPV6,          /**< IPv6 address */
+	MAC,           /**< MAC address */
+	TIME_SEC,      /**< Timestamp in seconds */
+	TIME_MILLI,    /**< Timestamp in milliseconds */
+	TIME_MICRO,    /**< Timestamp in microseconds */
+	TIME_NANO,     /**< Timestamp in nanoseconds */
+	STRING,        /**< Escaped string */
+	RAW_NUMBER,    /**< Raw value of 1, 2, 4 or 8 bytes printed as a number */
+	RAW_HEX        /**< Raw value printed in hexadecimal */
+};
+
+/**
+ * \brief One field of the serialization plan
+ */
+struct plan_field {
+	std::string key;     /**< Separator, quoted name with prefix and colon */
+	plan_conv conv;      /**< Converter */
+	uint16_t length;     /**< Length from the template (VAR_IE_LENGTH for variable) */
+	int32_t offset;      /**< Offset in data record, -1 when it follows a variable-length field */
+};
+
+/**
+ * \brief Serialization plan of one template
+ *
+ * Compiled when a record of the template is stored for the first time,
+ * records are then serialized by walking the fields without looking up
+ * the elements.
+ */
+struct serial_plan {
+	const struct ipfix_template *templ{NULL}; /**< Template of the plan */
+	uint32_t serial{0};                       /**< Serial number of the template's index */
+	std::vector<plan_field> fields{};         /**< Fields to serialize */
+};
+
 class Storage {
 public:
     /**
@@ -67,11 +118,15 @@ public:
 
 	/**
 	 * \brief Add new output processor
+	 *
+	 * The output runs in its own writer thread, it is destroyed with the storage
 	 * \param[in] output
+	 * \param[in] queue_size Number of batches waiting for the output
+	 * \param[in] drop Drop batches when the queue is full (otherwise wait)
 	 */
-	void addOutput(Output *output) { outputs.push_back(output); }
+	void addOutput(Output *output, unsigned int queue_size, bool drop);
 
-	bool hasSomeOutput() { return !outputs.empty(); }
+	bool hasSomeOutput() { return !writers.empty(); }
 
     /**
      * \brief Store IPFIX message
@@ -109,22 +164,33 @@ private:
     uint16_t realLength(uint16_t length, uint8_t *data, uint16_t &offset) const;
 
     /**
-     * \brief Read string field
+     * \brief Append raw data in hexadecimal
      *
-     * @param length length from template
-     * @param data data record
-     * @param offset field offset
+     * @param length real length of the field
+     * @param field field data
      */
-	void readString(uint16_t &length, uint8_t *data, uint16_t &offset);
+	void readRawHex(uint16_t length, const uint8_t *field);
 
     /**
-     * \brief Read raw data from record on given offset
+     * \brief Get serialization plan of a template
      *
-     * @param field_len length from template
-     * @param data data record
-     * @param offset field offset (will be changed)
+     * Plans are kept in a direct mapped cache indexed by the template address
+     * and validated by the serial number of the template's field index.
+     *
+     * @param templ template
+     * @param config plugin configuration
+     * @return serialization plan
+     */
+	const struct serial_plan *getPlan(const struct ipfix_template *templ, struct json_conf *config);
+
+    /**
+     * \brief Compile serialization plan of a template
+     *
+     * @param plan plan to fill
+     * @param templ template
+     * @param config plugin configuration
      */
-	void readRawData(uint16_t &length, uint8_t *data, uint16_t &offset);
+	void compilePlan(struct serial_plan *plan, const struct ipfix_template *templ, struct json_conf *config);
 
     /**
      * \brief Store data record
@@ -149,17 +215,13 @@ private:
 	/**
 	 * \brief Send JSON data to output processors
      */
-	void sendData() const;
+	void sendData();
 
 	bool processMetadata{false};	/**< Metadata processing enabled */
 	bool printOnly{false};
-	uint8_t addr6[IPV6_LEN];
-	uint8_t addrMac[MAC_LEN];
-	uint16_t offset{0}, id{0}, length{0};
-	uint32_t enterprise{0};
 
-	std::vector<Output*> outputs{};
-	std::vector<char> buffer;
+	std::vector<Writer*> writers{};	/**< Writer threads of outputs */
+	std::vector<serial_plan> plans;	/**< Cache of serialization plans */
 	std::string record;
 };
 
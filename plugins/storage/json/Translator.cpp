@@ -47,6 +47,18 @@
 // #include "itostr.h"
 #include "branchlut2.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRANSLATOR_SIMD
+#include <tmmintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** Hexadecimal digits */
+static const char hexDigits[] = "0123456789abcdef";
+
 /**
  * \brief Format flags 16bits
  */
@@ -77,9 +89,15 @@ const char *Translator::formatFlags8(uint8_t flags)
 /**
  * \brief Constructor
  */
-Translator::Translator()
+Translator::Translator(bool simd)
 {
 	buffer = new char[Translator::BUFF_SIZE];
+
+#ifdef TRANSLATOR_SIMD
+	ssse3 = simd && __builtin_cpu_supports("ssse3");
+#else
+	(void) simd;
+#endif
 }
 
 Translator::~Translator()
@@ -106,22 +124,149 @@ const char *Translator::formatIPv4(uint32_t addr, uint16_t *ret_len)
 	return buffer;
 }
 
+#ifdef TRANSLATOR_SIMD
+/**
+ * \brief Convert 16 bytes to hexadecimal digits by SSSE3
+ */
+__attribute__((target("ssse3")))
+static void toHexSSSE3(const uint8_t *in, char *out)
+{
+	const __m128i digits = _mm_loadu_si128((const __m128i *) hexDigits);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+
+	__m128i bytes = _mm_loadu_si128((const __m128i *) in);
+	__m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, mask));
+	__m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+
+	_mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(high, low));
+	_mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi8(high, low));
+}
+#endif
+
+/**
+ * \brief Convert bytes to hexadecimal digits
+ */
+void Translator::toHex(const uint8_t *in, int count, char *out) const
+{
+#ifdef TRANSLATOR_SIMD
+	/* Shorter inputs (MAC addresses) are faster without copying them to a block */
+	if (ssse3 && count == 16) {
+		toHexSSSE3(in, out);
+		return;
+	}
+#endif
+
+	for (int i = 0; i < count; ++i) {
+		out[2 * i] = hexDigits[in[i] >> 4];
+		out[2 * i + 1] = hexDigits[in[i] & 0x0f];
+	}
+}
+
 /**
  * \brief Format IPv6
+ *
+ * The longest run of at least two zero groups is compressed (the first one
+ * of equally long runs), IPv4-compatible and IPv4-mapped addresses end with
+ * the dotted IPv4 address, as done by inet_ntop().
  */
-const char *Translator::formatIPv6(uint8_t* addr)
-{	
-	inet_ntop(AF_INET6, (struct in6_addr *) addr, buffer, INET6_ADDRSTRLEN);
+const char *Translator::formatIPv6(const uint8_t *addr, uint16_t *ret_len)
+{
+	char digits[32];
+	uint16_t words[8];
+	int best_base = -1, best_len = 0, cur_base = -1, cur_len = 0;
+
+	for (int i = 0; i < 8; ++i) {
+		words[i] = (addr[2 * i] << 8) | addr[2 * i + 1];
+	}
+
+	/* Find the longest run of zero groups */
+	for (int i = 0; i < 8; ++i) {
+		if (words[i] == 0) {
+			if (cur_base == -1) {
+				cur_base = i;
+				cur_len = 0;
+			}
+			cur_len++;
+			continue;
+		}
+
+		if (cur_base != -1 && (best_base == -1 || cur_len > best_len)) {
+			best_base = cur_base;
+			best_len = cur_len;
+		}
+		cur_base = -1;
+	}
+
+	if (cur_base != -1 && (best_base == -1 || cur_len > best_len)) {
+		best_base = cur_base;
+		best_len = cur_len;
+	}
+
+	if (best_len < 2) {
+		best_base = -1;
+	}
+
+	toHex(addr, 16, digits);
+
+	char *ret = buffer;
+	for (int i = 0; i < 8; ++i) {
+		/* Compressed zeros */
+		if (best_base != -1 && i >= best_base && i < best_base + best_len) {
+			if (i == best_base) {
+				*ret++ = ':';
+			}
+			continue;
+		}
+
+		if (i != 0) {
+			*ret++ = ':';
+		}
+
+		/* IPv4-compatible and IPv4-mapped addresses */
+		if (i == 6 && best_base == 0 && (best_len == 6 || (best_len == 7 && words[7] != 0x0001)
+				|| (best_len == 5 && words[5] == 0xffff))) {
+			ret = u32toa_branchlut2(addr[12], ret);
+			ret++[0] = '.';
+			ret = u32toa_branchlut2(addr[13], ret);
+			ret++[0] = '.';
+			ret = u32toa_branchlut2(addr[14], ret);
+			ret++[0] = '.';
+			ret = u32toa_branchlut2(addr[15], ret);
+			break;
+		}
+
+		/* Group without leading zeros */
+		int skip = words[i] >= 0x1000 ? 0 : words[i] >= 0x100 ? 1 : words[i] >= 0x10 ? 2 : 3;
+		memcpy(ret, digits + 4 * i + skip, 4 - skip);
+		ret += 4 - skip;
+	}
+
+	if (best_base != -1 && best_base + best_len == 8) {
+		*ret++ = ':';
+	}
+
+	*ret = '\0';
+	*ret_len = ret - buffer;
 	return buffer;
 }
 
 /**
- * \brief Format timestamp
+ * \brief Format MAC address
  */
-const char *Translator::formatMac(uint8_t* addr)
-{	
-	snprintf(buffer, BUFF_SIZE, "%02x:%02x:%02x:%02x:%02x:%02x",
-		addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+const char *Translator::formatMac(const uint8_t *addr, uint16_t *ret_len)
+{
+	char digits[12];
+
+	toHex(addr, 6, digits);
+
+	for (int i = 0; i < 6; ++i) {
+		buffer[3 * i] = digits[2 * i];
+		buffer[3 * i + 1] = digits[2 * i + 1];
+		buffer[3 * i + 2] = ':';
+	}
+
+	buffer[17] = '\0';
+	*ret_len = 17;
 	return buffer;
 }
 
@@ -137,7 +282,7 @@ const char *Translator::formatProtocol(uint8_t proto)
 /**
  * \brief Format timestamp
  */
-const char *Translator::formatTimestamp(uint64_t tstamp, t_units units, struct json_conf * config)
+const char *Translator::formatTimestamp(uint64_t tstamp, t_units units, uint16_t *ret_len, struct json_conf * config)
 {
 	/* Convert to host byte order. Seconds are stored in uint32_t */
 	if (units == t_units::SEC) {
@@ -165,98 +310,30 @@ const char *Translator::formatTimestamp(uint64_t tstamp, t_units units, struct j
 	
 		timesec = tstamp / 1000;
 		msec	= tstamp % 1000;
-		tm		= localtime(&timesec);
-	
-		strftime(buffer, 21, "\"%FT%T", tm);
-		/* append miliseconds */
-		sprintf(&(buffer[20]), ".%03u\"", (const unsigned int) msec);
-	} else {
-		sprintf(buffer, "%" PRIu64 , tstamp);
-	}	
-
-	return buffer;
-}
 
-/**
- * \brief Conversion of unsigned int
- */
-const char *Translator::toUnsigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record,
-	uint16_t offset, const ipfix_element_t * element, struct json_conf * config)
-{
-	// Calculate the length of returned string here to avoid unnecessary strlen later
-	const char *ret = NULL;
-	*ret_len = 0;
-
-	if(length == BYTE1) {
-		// 1 byte
-		if(element->en == 0 && element->id == 6 && config->tcpFlags) {
-			// Formated TCP flags
-			ret = formatFlags8(read8(data_record + offset));
-			*ret_len = 8;
-			return ret;
-		} else if (element->en == 0 && element->id == 4 && !config->protocol) {
-			// Formated protocol identification (TCP, UDP, ICMP,...)
-			ret =  (formatProtocol(read8(data_record + offset)));
-			*ret_len = strlen(ret);
-			return ret;
-		} else {
-			// Other elements
-			ret = u32toa_branchlut2(read8(data_record + offset), buffer);
+		/* Records of a message usually start in the same second */
+		if (!cachedValid || timesec != cachedSec) {
+			tm = localtime(&timesec);
+			cachedLen = strftime(cachedTime, 21, "\"%FT%T", tm);
+			cachedSec = timesec;
+			cachedValid = true;
 		}
-	} else if(length == BYTE2) {
-		// 2 bytes
-		if (element->en == 0 && element->id == 6 && config->tcpFlags) {
-			// Formated TCP flags
-			ret = formatFlags16(read16(data_record + offset));
-			*ret_len = 8;
-			return ret;
-		} else {
-			// Other elements
-			ret = u32toa_branchlut2(ntohs(read16(data_record + offset)), buffer);
-		}
-	} else if(length == BYTE4) {
-		// 4 bytes
-		ret = u32toa_branchlut2(ntohl(read32(data_record + offset)), buffer);
-	} else if(length == BYTE8) {
-		// 8 bytes
- 		ret = u64toa_branchlut2(be64toh(read64(data_record + offset)), buffer);
-	} else {
-		// Other sizes
-		*ret_len = snprintf(buffer, BUFF_SIZE, "%s", "\"unknown\"");
-		return buffer;
-	}
 
-	*ret_len = ret - buffer;
-	return buffer;
-}
+		memcpy(buffer, cachedTime, cachedLen);
+		char *ret = buffer + cachedLen;
 
-/**
- * \brief Conversion of signed int
- */
-const char *Translator::toSigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset)
-{
-	// Calculate the length of returned string here to avoid unnecessary strlen later
-	const char *ret = NULL;
-	*ret_len = 0;
-
-	if(length == BYTE1) {
-		// 1 byte
-		ret = i32toa_branchlut2(read8(data_record + offset), buffer);
-	} else if(length == BYTE2) {
-		// 2 bytes
-		ret = i32toa_branchlut2(ntohs(read16(data_record + offset)), buffer);
-	} else if(length == BYTE4) {
-		// 4 bytes
-		ret = i32toa_branchlut2(ntohl(read32(data_record + offset)), buffer);
-	} else if(length == BYTE8) {
-		// 8 bytes
-		ret = i64toa_branchlut2(be64toh(read64(data_record + offset)), buffer);
+		/* append miliseconds */
+		*ret++ = '.';
+		*ret++ = '0' + msec / 100;
+		*ret++ = '0' + (msec / 10) % 10;
+		*ret++ = '0' + msec % 10;
+		*ret++ = '"';
+		*ret = '\0';
+		*ret_len = ret - buffer;
 	} else {
-		*ret_len = snprintf(buffer, BUFF_SIZE, "\"unknown\"");
-		return buffer;
-	}
+		*ret_len = u64toa_branchlut2(tstamp, buffer) - buffer;
+	}	
 
-	*ret_len = ret - buffer;
 	return buffer;
 }
 
@@ -279,23 +356,64 @@ const char *Translator::toFloat(uint16_t length, uint16_t *ret_len, uint8_t *dat
  * \brief Convert string to JSON format
  */
 const char *Translator::escapeString(uint16_t length, const uint8_t *field,
-	const json_conf *config)
+	uint32_t *ret_len, const json_conf *config)
 {
 	uint32_t idx_output = 0;
+	uint32_t i = 0;
 
 	#define ESCAPE_CHAR(ch) { \
 		buffer[idx_output++] = '\\'; \
 		buffer[idx_output++] = ch; \
 	}
+	#define ESCAPE_HEX(ch) { \
+		memcpy(&buffer[idx_output], "\\u00", 4); \
+		buffer[idx_output + 4] = hexDigits[(ch) >> 4]; \
+		buffer[idx_output + 5] = hexDigits[(ch) & 0x0f]; \
+		idx_output += 6; \
+	}
 
 	// Beginning of the string
 	buffer[idx_output++] = '"';
 
-	for (uint32_t i = 0; i < length; ++i) {
+	while (i < length) {
+#ifdef __SSE2__
+		/*
+		 * Copy blocks of 16 characters that need no escaping at once. Signed
+		 * comparison catches both control characters and the extended part
+		 * of ASCII. The block is stored before it is checked, the output
+		 * buffer always has space for it.
+		 */
+		while (i + 16 <= length) {
+			__m128i chars = _mm_loadu_si128((const __m128i *) (field + i));
+			__m128i special = _mm_or_si128(
+				_mm_cmplt_epi8(chars, _mm_set1_epi8(0x20)),
+				_mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('"')),
+					_mm_cmpeq_epi8(chars, _mm_set1_epi8('\\'))));
+			int mask = _mm_movemask_epi8(special);
+
+			_mm_storeu_si128((__m128i *) (buffer + idx_output), chars);
+			if (mask == 0) {
+				idx_output += 16;
+				i += 16;
+				continue;
+			}
+
+			/* Copy up to the first special character */
+			int plain = __builtin_ctz(mask);
+			idx_output += plain;
+			i += plain;
+			break;
+		}
+
+		if (i >= length) {
+			break;
+		}
+#endif
+
 		// All characters from the extended part of ASCII must be escaped
 		if (field[i] > 0x7F) {
-			snprintf(&buffer[idx_output], 7, "\\u00%02x", field[i]);
-			idx_output += 6;
+			ESCAPE_HEX(field[i]);
+			++i;
 			continue;
 		}
 
@@ -306,7 +424,7 @@ const char *Translator::escapeString(uint16_t length, const uint8_t *field,
 		 */
 		if (field[i] > 0x1F && field[i] != '"' && field[i] != '\\') {
 			// Copy to the output buffer
-			buffer[idx_output++] = field[i];
+			buffer[idx_output++] = field[i++];
 			continue;
 		}
 
@@ -314,9 +432,11 @@ const char *Translator::escapeString(uint16_t length, const uint8_t *field,
 		switch(field[i]) {
 		case '\\': // Reverse solidus
 			ESCAPE_CHAR('\\');
+			++i;
 			continue;
 		case '\"': // Quotation
 			ESCAPE_CHAR('\"');
+			++i;
 			continue;
 		default:
 			break;
@@ -324,6 +444,7 @@ const char *Translator::escapeString(uint16_t length, const uint8_t *field,
 
 		if (config->whiteSpaces == false) {
 			// Skip white space characters
+			++i;
 			continue;
 		}
 
@@ -344,16 +465,17 @@ const char *Translator::escapeString(uint16_t length, const uint8_t *field,
 			ESCAPE_CHAR('r');
 			break;
 		default: // "\uXXXX"
-			snprintf(&buffer[idx_output], 7, "\\u00%02x", field[i]);
-			idx_output += 6;
+			ESCAPE_HEX(field[i]);
 			break;
 		}
+		++i;
 	}
 	#undef ESCAPE_CHAR
+	#undef ESCAPE_HEX
 
 	// End of the string
 	buffer[idx_output++] = '"';
 	buffer[idx_output] = '\0';
+	*ret_len = idx_output;
 	return buffer;
 }
-
@@ -68,8 +68,12 @@ enum class t_units {
 
 class Translator {
 public:
-	/** Constructor */
-	Translator();
+	/**
+	 * \brief Constructor
+	 *
+	 * @param simd Use SIMD instructions when the CPU supports them
+	 */
+	Translator(bool simd = true);
 
 	/** Destructor */
 	~Translator();
@@ -85,28 +89,36 @@ public:
 
     /**
      * \brief Format IPv6 address
-     * 
+     *
+     * Produces the same text as inet_ntop() (RFC 5952).
+     *
      * @param addr address
+     * @param ret_len pointer to return length of generated string
      * @return formatted address
      */
-	const char *formatIPv6(uint8_t *addr);
+	const char *formatIPv6(const uint8_t *addr, uint16_t *ret_len);
     
     /**
      * \brief Format MAC address
-     * 
+     *
      * @param addr address
+     * @param ret_len pointer to return length of generated string
      * @return formatted address
      */
-	const char *formatMac(uint8_t *addr);
+	const char *formatMac(const uint8_t *addr, uint16_t *ret_len);
     
     /**
      * \brief Format timestamp
-     * 
+     *
+     * Date and time of the last formatted second are cached, only
+     * milliseconds are converted for timestamps within the same second.
+     *
      * @param tstamp timestamp
      * @param units time units
+     * @param ret_len pointer to return length of generated string
      * @return  formatted timestamp
      */
-	const char *formatTimestamp(uint64_t tstamp, t_units units, struct json_conf * config);
+	const char *formatTimestamp(uint64_t tstamp, t_units units, uint16_t *ret_len, struct json_conf * config);
     
     /**
      * \brief Format protocol
@@ -132,30 +144,6 @@ public:
      */
 	const char *formatFlags8(uint8_t flags);
 
-    /**
-     * \brief Checks, if real length of record is the same as its data type. If not, converts to real length.
-     *
-     * @param length length of record
-     * @param ret_len pointer to return length of generated string
-     * @param data_record pointer to head of data record
-     * @param offset offset since head of data record
-     * @param element pointer to actuall element in record
-     * @param config pointer to configuration structure
-     * @return value of Unsigned int
-     */
-	const char *toUnsigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset, const ipfix_element_t * element, struct json_conf * config);
-
-    /**
-     * \brief Checks, if real length of record is the same as its data type. If not, converts to real length.
-     *
-     * @param length length of record
-     * @param ret_len pointer to return length of generated string
-     * @param data_record pointer to head of data record
-     * @param offset offset since head of data record
-     * @return value of Signed int
-     */
-	const char *toSigned(uint16_t length, uint16_t *ret_len, uint8_t *data_record, uint16_t offset);
-
     /**
      * \brief Checks, if real length of record is the same as its data type. If not, converts to real length.
      *
@@ -170,13 +158,15 @@ public:
 	/**
 	 * \brief Convert string to JSON format
 	 *
-	 * Escape non-printable characters and replace them.
+	 * Escape non-printable characters and replace them. Blocks of characters
+	 * that need no escaping are copied by SSE2 instructions.
 	 * @param length Length of the field
 	 * @param field Pointer to the field
+	 * @param ret_len pointer to return length of generated string
 	 * @param config Plugin configuration
 	 * @return
 	 */
-	const char *escapeString(uint16_t length, const uint8_t *field,
+	const char *escapeString(uint16_t length, const uint8_t *field, uint32_t *ret_len,
 		const struct json_conf *config);
 
 private:
@@ -194,9 +184,25 @@ private:
 	/** Buffer for JSON conversion */
 	char *buffer;
 
+	/**
+	 * \brief Convert bytes to hexadecimal digits
+	 *
+	 * @param in bytes
+	 * @param count number of bytes
+	 * @param out output (2 * count digits)
+	 */
+	void toHex(const uint8_t *in, int count, char *out) const;
+
+	bool ssse3{false};   /**< Convert to hexadecimal by SSSE3 instructions */
+
 	struct tm *tm{};
 	time_t timesec{};
 	uint64_t msec{};
+
+	time_t cachedSec{};     /**< Second of the cached date and time */
+	bool cachedValid{false};/**< Cached date and time are valid */
+	size_t cachedLen{0};    /**< Length of the cached date and time */
+	char cachedTime[24];    /**< Cached "\"YYYY-MM-DDTHH:MM:SS" */
 };
 
 #endif	/* TRANSLATOR_H */
@@ -0,0 +1,501 @@
+/**
+ * \file WindowFile.cpp
+ * \brief File of a time window of the JSON file output
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include "WindowFile.h"
+#include "json.h"
+
+#include <stdexcept>
+#include <new>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <strings.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const char *msg_module = "json_storage(file)";
+
+/** Alignment of the write buffer */
+#define WINDOW_FILE_ALIGN (4096)
+
+/**
+ * \brief Class constructor
+ *
+ * Takes ownership of the file, the file is closed when the constructor fails
+ * \param[in] file Opened file
+ * \param[in] name File name
+ */
+WindowFile::WindowFile(FILE *file, const std::string &name)
+	: _file(file), _name(name), _buffer(NULL), _used(0), _failed(false)
+{
+	void *buffer;
+	if (posix_memalign(&buffer, WINDOW_FILE_ALIGN, WINDOW_FILE_BUFFER) != 0) {
+		fclose(_file);
+		throw std::bad_alloc();
+	}
+	_buffer = (char *) buffer;
+
+	// Data are written by whole buffers
+	setvbuf(_file, NULL, _IONBF, 0);
+}
+
+/**
+ * \brief Class destructor
+ */
+WindowFile::~WindowFile()
+{
+	if (_file) {
+		fclose(_file);
+	}
+
+	free(_buffer);
+}
+
+/**
+ * \brief Write the buffer to the file
+ * \return On success returns 0. Otherwise returns non-zero value.
+ */
+int WindowFile::flush()
+{
+	if (_used > 0 && !_failed && fwrite(_buffer, _used, 1, _file) != 1) {
+		MSG_ERROR(msg_module, "Failed to write to file '%s' (%s).", _name.c_str(),
+			strerror(errno));
+		_failed = true;
+	}
+
+	_used = 0;
+	return _failed ? 1 : 0;
+}
+
+/**
+ * \brief Finish the stream, write the rest of the data and close the file
+ * \return On success returns 0. Otherwise returns non-zero value.
+ */
+int WindowFile::close()
+{
+	int ret = 0;
+
+	if (!_failed) {
+		ret = finish();
+		ret |= flush();
+	}
+
+	if (fclose(_file) != 0) {
+		MSG_ERROR(msg_module, "Failed to close file '%s' (%s).", _name.c_str(),
+			strerror(errno));
+		ret = 1;
+	}
+
+	_file = NULL;
+	return ret;
+}
+
+/**
+ * \brief Plain file
+ */
+class PlainFile : public WindowFile
+{
+public:
+	PlainFile(FILE *file, const std::string &name) : WindowFile(file, name) {}
+
+protected:
+	int append(const char *data, size_t len)
+	{
+		while (len > 0) {
+			size_t now = WINDOW_FILE_BUFFER - _used;
+			if (now > len) {
+				now = len;
+			}
+
+			memcpy(_buffer + _used, data, now);
+			_used += now;
+			data += now;
+			len -= now;
+
+			if (_used == WINDOW_FILE_BUFFER && flush()) {
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+};
+
+#ifdef HAVE_ZLIB
+/**
+ * \brief File compressed by gzip
+ */
+class GzipFile : public WindowFile
+{
+public:
+	GzipFile(FILE *file, const std::string &name) : WindowFile(file, name)
+	{
+		memset(&_stream, 0, sizeof(_stream));
+
+		// Window bits + 16 writes the gzip header
+		if (deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+				Z_DEFAULT_STRATEGY) != Z_OK) {
+			throw std::runtime_error("Failed to initialize gzip compression.");
+		}
+	}
+
+	~GzipFile()
+	{
+		deflateEnd(&_stream);
+	}
+
+protected:
+	int append(const char *data, size_t len)
+	{
+		return compress(data, len, Z_NO_FLUSH);
+	}
+
+	int finish()
+	{
+		return compress(NULL, 0, Z_FINISH);
+	}
+
+private:
+	z_stream _stream;
+
+	int compress(const char *data, size_t len, int mode)
+	{
+		int ret;
+
+		_stream.next_in = (Bytef *) data;
+		_stream.avail_in = len;
+
+		do {
+			_stream.next_out = (Bytef *) _buffer + _used;
+			_stream.avail_out = WINDOW_FILE_BUFFER - _used;
+
+			ret = deflate(&_stream, mode);
+			if (ret == Z_STREAM_ERROR) {
+				MSG_ERROR(msg_module, "Failed to compress data of file '%s'.", _name.c_str());
+				_failed = true;
+				return 1;
+			}
+
+			_used = WINDOW_FILE_BUFFER - _stream.avail_out;
+			if (_used == WINDOW_FILE_BUFFER && flush()) {
+				return 1;
+			}
+		} while (_stream.avail_in > 0 || (mode == Z_FINISH && ret != Z_STREAM_END));
+
+		return 0;
+	}
+};
+#endif
+
+#ifdef HAVE_LZ4
+/**
+ * \brief File compressed by LZ4 (frame format)
+ */
+class Lz4File : public WindowFile
+{
+public:
+	Lz4File(FILE *file, const std::string &name) : WindowFile(file, name)
+	{
+		memset(&_prefs, 0, sizeof(_prefs));
+
+		if (LZ4F_isError(LZ4F_createCompressionContext(&_ctx, LZ4F_VERSION))) {
+			throw std::runtime_error("Failed to initialize LZ4 compression.");
+		}
+
+		size_t ret = LZ4F_compressBegin(_ctx, _buffer, WINDOW_FILE_BUFFER, &_prefs);
+		if (LZ4F_isError(ret)) {
+			LZ4F_freeCompressionContext(_ctx);
+			throw std::runtime_error("Failed to initialize LZ4 compression.");
+		}
+		_used = ret;
+	}
+
+	~Lz4File()
+	{
+		LZ4F_freeCompressionContext(_ctx);
+	}
+
+protected:
+	int append(const char *data, size_t len)
+	{
+		while (len > 0) {
+			size_t now = len > LZ4_CHUNK ? LZ4_CHUNK : len;
+
+			// Make sure the compressed chunk fits into the buffer
+			if (WINDOW_FILE_BUFFER - _used < LZ4F_compressBound(now, &_prefs) && flush()) {
+				return 1;
+			}
+
+			size_t ret = LZ4F_compressUpdate(_ctx, _buffer + _used, WINDOW_FILE_BUFFER - _used,
+				data, now, NULL);
+			if (LZ4F_isError(ret)) {
+				return error(ret);
+			}
+
+			_used += ret;
+			data += now;
+			len -= now;
+		}
+
+		return 0;
+	}
+
+	int finish()
+	{
+		if (WINDOW_FILE_BUFFER - _used < LZ4F_compressBound(0, &_prefs) && flush()) {
+			return 1;
+		}
+
+		size_t ret = LZ4F_compressEnd(_ctx, _buffer + _used, WINDOW_FILE_BUFFER - _used, NULL);
+		if (LZ4F_isError(ret)) {
+			return error(ret);
+		}
+
+		_used += ret;
+		return 0;
+	}
+
+private:
+	/** Size of input passed to the compressor at once */
+	static const size_t LZ4_CHUNK = 64 * 1024;
+
+	LZ4F_compressionContext_t _ctx;
+	LZ4F_preferences_t _prefs;
+
+	int error(size_t code)
+	{
+		MSG_ERROR(msg_module, "Failed to compress data of file '%s' (%s).", _name.c_str(),
+			LZ4F_getErrorName(code));
+		_failed = true;
+		return 1;
+	}
+};
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+ * \brief File compressed by Zstandard
+ */
+class ZstdFile : public WindowFile
+{
+public:
+	ZstdFile(FILE *file, const std::string &name) : WindowFile(file, name)
+	{
+		_stream = ZSTD_createCStream();
+		if (!_stream) {
+			throw std::runtime_error("Failed to initialize Zstandard compression.");
+		}
+
+		if (ZSTD_isError(ZSTD_initCStream(_stream, ZSTD_LEVEL))) {
+			ZSTD_freeCStream(_stream);
+			throw std::runtime_error("Failed to initialize Zstandard compression.");
+		}
+	}
+
+	~ZstdFile()
+	{
+		ZSTD_freeCStream(_stream);
+	}
+
+protected:
+	int append(const char *data, size_t len)
+	{
+		ZSTD_inBuffer in = {data, len, 0};
+
+		while (in.pos < in.size) {
+			// Make sure the compressor can make progress
+			if (WINDOW_FILE_BUFFER - _used < ZSTD_CStreamOutSize() && flush()) {
+				return 1;
+			}
+
+			ZSTD_outBuffer out = {_buffer, WINDOW_FILE_BUFFER, _used};
+			size_t ret = ZSTD_compressStream(_stream, &out, &in);
+			if (ZSTD_isError(ret)) {
+				return error(ret);
+			}
+			_used = out.pos;
+		}
+
+		return 0;
+	}
+
+	int finish()
+	{
+		size_t remaining;
+
+		do {
+			if (WINDOW_FILE_BUFFER - _used < ZSTD_CStreamOutSize() && flush()) {
+				return 1;
+			}
+
+			ZSTD_outBuffer out = {_buffer, WINDOW_FILE_BUFFER, _used};
+			remaining = ZSTD_endStream(_stream, &out);
+			if (ZSTD_isError(remaining)) {
+				return error(remaining);
+			}
+			_used = out.pos;
+		} while (remaining > 0);
+
+		return 0;
+	}
+
+private:
+	/** Compression level */
+	static const int ZSTD_LEVEL = 3;
+
+	ZSTD_CStream *_stream;
+
+	int error(size_t code)
+	{
+		MSG_ERROR(msg_module, "Failed to compress data of file '%s' (%s).", _name.c_str(),
+			ZSTD_getErrorName(code));
+		_failed = true;
+		return 1;
+	}
+};
+#endif
+
+/**
+ * \brief Create a file with given compression
+ *
+ * The suffix of the compression is added to the name.
+ * \param[in] name File name
+ * \param[in] type Compression
+ * \return On success returns pointer to the file, Otherwise returns NULL.
+ */
+WindowFile *WindowFile::create(const std::string &name, compression_t type)
+{
+	std::string file_name = name + suffix(type);
+
+	FILE *file = fopen(file_name.c_str(), "w");
+	if (!file) {
+		// Failed to create a flow file
+		MSG_ERROR(msg_module, "Failed to create a flow file '%s' (%s).",
+			file_name.c_str(), strerror(errno));
+		return NULL;
+	}
+
+	// The file is closed by the constructors on failure
+	try {
+		switch (type) {
+#ifdef HAVE_ZLIB
+		case compression_t::GZIP:
+			return new GzipFile(file, file_name);
+#endif
+#ifdef HAVE_LZ4
+		case compression_t::LZ4:
+			return new Lz4File(file, file_name);
+#endif
+#ifdef HAVE_ZSTD
+		case compression_t::ZSTD:
+			return new ZstdFile(file, file_name);
+#endif
+		default:
+			return new PlainFile(file, file_name);
+		}
+	} catch (std::exception &e) {
+		MSG_ERROR(msg_module, "Failed to create a flow file '%s' (%s).",
+			file_name.c_str(), e.what());
+		return NULL;
+	}
+}
+
+/**
+ * \brief Parse name of a compression
+ *
+ * \param[in] name Name (none, gzip, lz4 or zstd), empty means none
+ * \return Compression
+ * \throw std::invalid_argument for unknown or unsupported compressions
+ */
+compression_t WindowFile::parse(const std::string &name)
+{
+	if (name.empty() || strcasecmp(name.c_str(), "none") == 0) {
+		return compression_t::NONE;
+	}
+
+	if (strcasecmp(name.c_str(), "gzip") == 0) {
+#ifdef HAVE_ZLIB
+		return compression_t::GZIP;
+#else
+		throw std::invalid_argument("gzip compression is not supported (built without zlib).");
+#endif
+	}
+
+	if (strcasecmp(name.c_str(), "lz4") == 0) {
+#ifdef HAVE_LZ4
+		return compression_t::LZ4;
+#else
+		throw std::invalid_argument("LZ4 compression is not supported (built without liblz4).");
+#endif
+	}
+
+	if (strcasecmp(name.c_str(), "zstd") == 0) {
+#ifdef HAVE_ZSTD
+		return compression_t::ZSTD;
+#else
+		throw std::invalid_argument("Zstandard compression is not supported (built without libzstd).");
+#endif
+	}
+
+	throw std::invalid_argument("Unknown compression \"" + name + "\".");
+}
+
+/**
+ * \brief Suffix of file names with given compression
+ */
+const char *WindowFile::suffix(compression_t type)
+{
+	switch (type) {
+	case compression_t::GZIP:
+		return ".gz";
+	case compression_t::LZ4:
+		return ".lz4";
+	case compression_t::ZSTD:
+		return ".zst";
+	default:
+		return "";
+	}
+}
@@ -0,0 +1,105 @@
+/**
+ * \file WindowFile.h
+ * \brief File of a time window of the JSON file output
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef WINDOW_FILE_H
+#define WINDOW_FILE_H
+
+#include <string>
+#include <cstdio>
+
+/** Size of the write buffer (aligned to pages) */
+#define WINDOW_FILE_BUFFER (1024 * 1024)
+
+/** Compression of window files */
+enum class compression_t {
+	NONE,
+	GZIP,    /**< gzip (zlib) */
+	LZ4,     /**< LZ4 frame */
+	ZSTD     /**< Zstandard */
+};
+
+/**
+ * \brief File of a time window
+ *
+ * Data are collected (and compressed) in a large aligned buffer that is
+ * written to the unbuffered file when it is full.
+ */
+class WindowFile
+{
+public:
+	// Create a file with given compression
+	static WindowFile *create(const std::string &name, compression_t type);
+	// Parse name of a compression, throws std::invalid_argument
+	static compression_t parse(const std::string &name);
+	// Suffix of file names with given compression
+	static const char *suffix(compression_t type);
+
+	virtual ~WindowFile();
+
+	/**
+	 * \brief Write data to the file
+	 * \param[in] data Data
+	 * \param[in] len Length of the data
+	 * \return On success returns 0. Otherwise returns non-zero value.
+	 */
+	int write(const char *data, size_t len)
+	{
+		return _failed ? 1 : append(data, len);
+	}
+
+	// Finish the stream, write the rest of the data and close the file
+	int close();
+
+protected:
+	WindowFile(FILE *file, const std::string &name);
+
+	// Add (compressed) data to the buffer
+	virtual int append(const char *data, size_t len) = 0;
+	// Finish the stream (compressed formats)
+	virtual int finish() { return 0; }
+	// Write the buffer to the file
+	int flush();
+
+	FILE *_file;        /**< File */
+	std::string _name;  /**< File name */
+	char *_buffer;      /**< Write buffer */
+	size_t _used;       /**< Used part of the buffer */
+	bool _failed;       /**< Write failed, the rest of the data is discarded */
+};
+
+#endif // WINDOW_FILE_H
@@ -0,0 +1,201 @@
+/**
+ * \file Writer.cpp
+ * \brief Writer thread of a JSON output
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#include "Writer.h"
+#include <stdexcept>
+#include <cstring>
+#include <inttypes.h>
+
+static const char *msg_module = "json_storage(writer)";
+
+/**
+ * \brief Class constructor
+ *
+ * Takes ownership of the output and starts the writer thread
+ * \param[in] output Output processor
+ * \param[in] queue_size Number of batches waiting for the output
+ * \param[in] drop Drop batches when the queue is full
+ */
+Writer::Writer(Output *output, unsigned int queue_size, bool drop)
+	: _output(output), _batches(queue_size), _head(0), _count(0),
+	_current_records(0), _drop(drop), _dropped(0), _dropped_time(0),
+	_stop(false), _failed(false)
+{
+	if (queue_size == 0) {
+		throw std::invalid_argument("Queue size of an output must be positive.");
+	}
+
+	_current.reserve(WRITER_BATCH_SIZE + 4096);
+
+	if (pthread_mutex_init(&_mutex, NULL) != 0) {
+		throw std::runtime_error("Mutex initialization failed");
+	}
+
+	if (pthread_cond_init(&_cond_ready, NULL) != 0) {
+		pthread_mutex_destroy(&_mutex);
+		throw std::runtime_error("Condition variable initialization failed");
+	}
+
+	if (pthread_cond_init(&_cond_free, NULL) != 0) {
+		pthread_cond_destroy(&_cond_ready);
+		pthread_mutex_destroy(&_mutex);
+		throw std::runtime_error("Condition variable initialization failed");
+	}
+
+	if (pthread_create(&_thread, NULL, &Writer::thread_write, this) != 0) {
+		pthread_cond_destroy(&_cond_free);
+		pthread_cond_destroy(&_cond_ready);
+		pthread_mutex_destroy(&_mutex);
+		throw std::runtime_error("Failed to start a writer thread.");
+	}
+}
+
+/**
+ * \brief Class destructor
+ *
+ * Pass the remaining records to the output, stop the thread and destroy
+ * the output.
+ */
+Writer::~Writer()
+{
+	Flush();
+
+	pthread_mutex_lock(&_mutex);
+	_stop = true;
+	pthread_cond_signal(&_cond_ready);
+	pthread_mutex_unlock(&_mutex);
+
+	pthread_join(_thread, NULL);
+	pthread_cond_destroy(&_cond_free);
+	pthread_cond_destroy(&_cond_ready);
+	pthread_mutex_destroy(&_mutex);
+
+	if (_dropped > 0) {
+		MSG_WARNING(msg_module, "%" PRIu64 " records dropped (queue of the output is full).", _dropped);
+	}
+
+	delete _output;
+}
+
+/**
+ * \brief Pass the current batch to the writer thread
+ *
+ * The batch is swapped with a processed one, so the buffers are reused.
+ */
+void Writer::Flush()
+{
+	if (_current.empty()) {
+		return;
+	}
+
+	pthread_mutex_lock(&_mutex);
+	if (_count == _batches.size() && _drop) {
+		pthread_mutex_unlock(&_mutex);
+
+		// Drop the batch, warn at most once per second
+		_dropped += _current_records;
+		_current.clear();
+		_current_records = 0;
+
+		time_t now = time(NULL);
+		if (now != _dropped_time) {
+			MSG_WARNING(msg_module, "%" PRIu64 " records dropped (queue of the output is full).", _dropped);
+			_dropped_time = now;
+			_dropped = 0;
+		}
+		return;
+	}
+
+	while (_count == _batches.size()) {
+		pthread_cond_wait(&_cond_free, &_mutex);
+	}
+
+	_batches[(_head + _count) % _batches.size()].swap(_current);
+	_count++;
+	pthread_cond_signal(&_cond_ready);
+	pthread_mutex_unlock(&_mutex);
+
+	_current.clear();
+	_current_records = 0;
+}
+
+/**
+ * \brief Writer's thread function
+ *
+ * Pass batches from the queue to the output until the writer is stopped
+ * and the queue is empty.
+ * \param[in,out] context Writer
+ * \return Nothing
+ */
+void *Writer::thread_write(void *context)
+{
+	Writer *writer = (Writer *) context;
+
+	pthread_mutex_lock(&writer->_mutex);
+	while (1) {
+		while (writer->_count == 0 && !writer->_stop) {
+			pthread_cond_wait(&writer->_cond_ready, &writer->_mutex);
+		}
+
+		if (writer->_count == 0) {
+			// Stopped and nothing left
+			break;
+		}
+
+		// The batch stays in the queue until it is processed
+		std::string &batch = writer->_batches[writer->_head];
+		pthread_mutex_unlock(&writer->_mutex);
+
+		if (!writer->_failed) {
+			try {
+				writer->_output->ProcessDataBatch(batch);
+			} catch (std::exception &e) {
+				MSG_ERROR(msg_module, "Output failed, its data are discarded (%s)", e.what());
+				writer->_failed = true;
+			}
+		}
+
+		pthread_mutex_lock(&writer->_mutex);
+		writer->_head = (writer->_head + 1) % writer->_batches.size();
+		writer->_count--;
+		pthread_cond_signal(&writer->_cond_free);
+	}
+	pthread_mutex_unlock(&writer->_mutex);
+
+	return NULL;
+}
@@ -0,0 +1,114 @@
+/**
+ * \file Writer.h
+ * \brief Writer thread of a JSON output
+ *
+ * Copyright (C) 2016 CESNET, z.s.p.o.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ * 3. Neither the name of the Company nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * ALTERNATIVELY, provided that this notice is retained in full, this
+ * product may be distributed under the terms of the GNU General Public
+ * License (GPL) version 2 or later, in which case the provisions
+ * of the GPL apply INSTEAD OF those given above.
+ *
+ * This software is provided ``as is, and any express or implied
+ * warranties, including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose are disclaimed.
+ * In no event shall the company or contributors be liable for any
+ * direct, indirect, incidental, special, exemplary, or consequential
+ * damages (including, but not limited to, procurement of substitute
+ * goods or services; loss of use, data, or profits; or business
+ * interruption) however caused and on any theory of liability, whether
+ * in contract, strict liability, or tort (including negligence or
+ * otherwise) arising in any way out of the use of this software, even
+ * if advised of the possibility of such damage.
+ *
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "json.h"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <pthread.h>
+
+/** Default number of batches waiting for an output */
+#define WRITER_QUEUE_SIZE (64)
+/** Size of a batch that is passed to the output even before end of a message */
+#define WRITER_BATCH_SIZE (64 * 1024)
+
+/**
+ * \brief Writer thread of an output
+ *
+ * Records are collected into batches of newline-delimited records. A batch
+ * is passed to the writer thread at the end of each IPFIX message (or when it
+ * reaches WRITER_BATCH_SIZE) through a bounded queue, the thread hands it to
+ * the output. When the queue is full, the storage thread either waits or
+ * drops the batch, depending on the policy.
+ */
+class Writer
+{
+public:
+	Writer(Output *output, unsigned int queue_size, bool drop);
+	~Writer();
+
+	/**
+	 * \brief Add a record to the current batch
+	 * \param[in] record Newline terminated JSON record
+	 */
+	void Write(const std::string &record)
+	{
+		_current.append(record);
+		_current_records++;
+
+		if (_current.size() >= WRITER_BATCH_SIZE) {
+			Flush();
+		}
+	}
+
+	// Pass the current batch to the writer thread
+	void Flush();
+
+private:
+	/** Output processor */
+	Output *_output;
+	/** Ring of batches, filled batches are [_head, _head + _count) */
+	std::vector<std::string> _batches;
+	unsigned int _head;
+	unsigned int _count;
+	/** Batch being filled by the storage thread */
+	std::string _current;
+	unsigned int _current_records;
+
+	/** Drop batches when the queue is full (otherwise wait) */
+	bool _drop;
+	/** Records dropped since the last warning */
+	uint64_t _dropped;
+	/** Time of the last warning about dropped records */
+	time_t _dropped_time;
+
+	pthread_t _thread;
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond_ready;  /**< A batch was added to the queue */
+	pthread_cond_t _cond_free;   /**< A batch was processed */
+	bool _stop;                  /**< Stop flag for terminating */
+	bool _failed;                /**< The output failed, batches are discarded */
+
+	// Writer's thread function
+	static void *thread_write(void *context);
+};
+
+#endif // WRITER_H
@@ -155,7 +155,32 @@ void process_startup_xml(struct json_conf *conf, char *params)
 			throw std::invalid_argument("Unknown output type \"" + type + "\"");
 		}
 
-		conf->storage->addOutput(output);
+		/* Queue of the output's writer thread */
+		unsigned int queue_size = WRITER_QUEUE_SIZE;
+		std::string queue = node.node().child_value("queueSize");
+		if (!queue.empty()) {
+			try {
+				queue_size = std::stoul(queue);
+			} catch (std::exception &e) {
+				queue_size = 0;
+			}
+
+			if (queue_size == 0) {
+				delete output;
+				throw std::invalid_argument("Invalid queue size \"" + queue + "\"");
+			}
+		}
+
+		bool drop = false;
+		std::string policy = node.node().child_value("queuePolicy");
+		if (strcasecmp(policy.c_str(), "drop") == 0) {
+			drop = true;
+		} else if (!policy.empty() && strcasecmp(policy.c_str(), "block") != 0) {
+			delete output;
+			throw std::invalid_argument("Unknown queue policy \"" + policy + "\"");
+		}
+
+		conf->storage->addOutput(output, queue_size, drop);
 	}
 
 	if (!conf->storage->hasSomeOutput()) {
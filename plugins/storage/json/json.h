@@ -74,7 +74,13 @@ public:
 	Output(const pugi::xpath_node& config);
 	virtual ~Output() {}
 
-	virtual void ProcessDataRecord(const std::string& record) = 0;
+	/**
+	 * \brief Process a batch of records
+	 *
+	 * Called from the writer thread of the output (see Writer).
+	 * \param[in] batch Newline-delimited JSON records
+	 */
+	virtual void ProcessDataBatch(const std::string& batch) = 0;
 };
 
 #endif // JSON_H
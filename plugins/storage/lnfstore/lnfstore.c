@@ -45,6 +45,7 @@
 
 // API version constant
 IPFIXCOL_API_VERSION;
+IPFIXCOL_MESSAGE_VIEWS;
 
 // Module identification
 const char* msg_module = "lnfstore";